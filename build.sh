@@ -46,9 +46,10 @@ function main()
         echo "cmake not installed" >&2 && return 1
     fi
 
-    if ! apt list --installed 2>/dev/null | grep -q 'libboost1[.]67[-]'
+    # Asio's C++20 coroutine support (any_io_executor, co_spawn) needs 1.74
+    if ! apt list --installed 2>/dev/null | grep -qE '^libboost1[.](7[4-9]|[89][0-9])[-]'
     then
-        echo "libboost1.67 not installed" >&2 && return 1
+        echo "libboost1.74 or later not installed" >&2 && return 1
     fi
 
     build "$@"
@@ -0,0 +1,552 @@
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <boost/filesystem.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/shared_lock_guard.hpp>
+#include "benchmark/benchmark.h"
+#include "cidr_db.hpp"
+#include "cidr_frozen_db.hpp"
+#include "cidr_gen.hpp"
+#include "cidr_sharded_db.hpp"
+#include "cidr_shm.hpp"
+#include "cidrdb_client.hpp"
+
+namespace fs = boost::filesystem;
+
+
+/*
+ * Count every heap allocation so benchmarks can report allocations/op.
+ */
+static std::atomic<size_t> allocations(0);
+
+void* operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    std::free(p);
+}
+
+
+static std::string to_cidr(uint32_t addr, size_t length)
+{
+    return cidr::gen::to_cidr(cidr::gen::prefix{ addr, length });
+}
+
+/*
+ * A synthetic data set: a BGP-shaped CIDR list with some nesting, plus hit
+ * and miss query traces.
+ */
+struct dataset
+{
+    std::vector<std::string> cidrs;
+    std::vector<std::string> hits;
+    std::vector<std::string> misses;
+
+    explicit dataset(size_t count, unsigned seed = 1)
+    {
+        cidr::gen::options opts;
+        opts.count = count;
+        opts.lengths = cidr::gen::profile("bgp");
+        opts.nested = 0.1;
+        opts.seed = seed;
+
+        std::vector<cidr::gen::prefix> prefixes(cidr::gen::prefixes(opts));
+        cidrs.reserve(count);
+        for (auto &p : prefixes)
+            cidrs.push_back(cidr::gen::to_cidr(p));
+
+        cidr::gen::query_options query_opts;
+        query_opts.count = 4096;
+        query_opts.seed = seed + 1;
+
+        query_opts.hit_rate = 1.0;
+        for (auto addr : cidr::gen::queries(prefixes, query_opts))
+            hits.push_back(cidr::gen::to_ip(addr));
+
+        query_opts.hit_rate = 0.0;
+        for (auto addr : cidr::gen::queries(prefixes, query_opts))
+            misses.push_back(cidr::gen::to_ip(addr));
+    }
+};
+
+/*
+ * Data sets and loaded databases are expensive to build at the larger sizes,
+ * so keep the most recent one around across benchmarks.
+ */
+struct fixture
+{
+    size_t count = 0;
+    std::unique_ptr<dataset> data;
+    std::unique_ptr<cidr::db> db;
+    std::unique_ptr<cidr::frozen_db> frozen;
+};
+
+static fixture& load(size_t count)
+{
+    static fixture f;
+
+    if (f.count != count)
+    {
+        f.db.reset();
+        f.frozen.reset();
+        f.data.reset(new dataset(count));
+        f.db.reset(new cidr::db());
+        for (auto &cidr : f.data->cidrs)
+            f.db->put(cidr);
+        f.count = count;
+    }
+
+    return f;
+}
+
+static double rss_megabytes()
+{
+    long pages = 0, resident = 0;
+    std::ifstream statm("/proc/self/statm");
+    statm >> pages >> resident;
+    return resident * sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0);
+}
+
+static void report(benchmark::State &state, size_t allocations_before)
+{
+    state.counters["allocs/op"] = benchmark::Counter(
+        allocations.load() - allocations_before,
+        benchmark::Counter::kAvgIterations);
+    state.counters["rss_MB"] = rss_megabytes();
+}
+
+static fs::path scratch(const std::string &name)
+{
+    return fs::temp_directory_path() / ("bench_cidrdb_" + name);
+}
+
+
+static void BM_LookupHit(benchmark::State &state)
+{
+    fixture &f = load(state.range(0));
+    std::vector<std::string> results;
+    size_t i = 0;
+    size_t before = allocations.load();
+
+    for (auto _ : state)
+    {
+        results.clear();
+        f.db->lookup(f.data->hits[i++ & 4095], results);
+        benchmark::DoNotOptimize(results.data());
+    }
+
+    report(state, before);
+}
+
+static void BM_LookupMiss(benchmark::State &state)
+{
+    fixture &f = load(state.range(0));
+    std::vector<std::string> results;
+    size_t i = 0;
+    size_t before = allocations.load();
+
+    for (auto _ : state)
+    {
+        results.clear();
+        f.db->lookup(f.data->misses[i++ & 4095], results);
+        benchmark::DoNotOptimize(results.data());
+    }
+
+    report(state, before);
+}
+
+/*
+ * The same lookups against a cidr::frozen_db built from the fixture.
+ */
+static void lookup_frozen(benchmark::State &state, bool hits)
+{
+    fixture &f = load(state.range(0));
+    if (!f.frozen)
+        f.frozen.reset(new cidr::frozen_db(*f.db));
+    const std::vector<std::string> &ips = hits ? f.data->hits : f.data->misses;
+    std::vector<std::string> results;
+    size_t i = 0;
+    size_t before = allocations.load();
+
+    for (auto _ : state)
+    {
+        results.clear();
+        f.frozen->lookup(ips[i++ & 4095], results);
+        benchmark::DoNotOptimize(results.data());
+    }
+
+    report(state, before);
+    state.counters["bytes/cidr"] = double(f.frozen->bytes()) / f.frozen->size();
+}
+
+static void BM_LookupHitFrozen(benchmark::State &state)
+{
+    lookup_frozen(state, true);
+}
+
+static void BM_LookupMissFrozen(benchmark::State &state)
+{
+    lookup_frozen(state, false);
+}
+
+/*
+ * The same lookups with the per prefix length Bloom filters turned on.
+ */
+static void lookup_prefiltered(benchmark::State &state, bool hits)
+{
+    fixture &f = load(state.range(0));
+    f.db->prefilter(true);
+    const std::vector<std::string> &ips = hits ? f.data->hits : f.data->misses;
+    std::vector<std::string> results;
+    size_t i = 0;
+    size_t before = allocations.load();
+
+    for (auto _ : state)
+    {
+        results.clear();
+        f.db->lookup(ips[i++ & 4095], results);
+        benchmark::DoNotOptimize(results.data());
+    }
+
+    report(state, before);
+    f.db->prefilter(false);
+}
+
+static void BM_LookupHitPrefiltered(benchmark::State &state)
+{
+    lookup_prefiltered(state, true);
+}
+
+static void BM_LookupMissPrefiltered(benchmark::State &state)
+{
+    lookup_prefiltered(state, false);
+}
+
+/*
+ * The same lookups through libcidrdb_client against the fixture published
+ * to shared memory, with addresses already in binary as a caller of the
+ * client library would have them.
+ */
+static void lookup_shm(benchmark::State &state, bool hits)
+{
+    fixture &f = load(state.range(0));
+    std::string name = "bench_cidrdb_" + std::to_string(getpid());
+    const std::vector<std::string> &ips = hits ? f.data->hits : f.data->misses;
+    std::vector<in_addr_t> addresses;
+    for (size_t i = 0; i < 4096; i++)
+        addresses.push_back(inet_network(ips[i].c_str()));
+
+    uint64_t generation;
+    {
+        cidr::shm::publisher publisher(name);
+        publisher.publish(*f.db);
+        generation = publisher.generation();
+
+        cidr::shm::client client(name);
+        uint8_t lengths[32];
+        size_t i = 0;
+        size_t before = allocations.load();
+
+        for (auto _ : state)
+        {
+            benchmark::DoNotOptimize(client.lookup(addresses[i++ & 4095], lengths));
+        }
+
+        report(state, before);
+    }
+
+    shm_unlink(cidr::shm::segment_name(name, generation).c_str());
+    shm_unlink(cidr::shm::segment_name(name).c_str());
+}
+
+static void BM_LookupHitShm(benchmark::State &state)
+{
+    lookup_shm(state, true);
+}
+
+static void BM_LookupMissShm(benchmark::State &state)
+{
+    lookup_shm(state, false);
+}
+
+static void BM_LookupManyMatches(benchmark::State &state)
+{
+    fixture &f = load(state.range(0));
+
+    // every prefix from /8 to /32 covering one address; the ones the data
+    // set already has stay when the rest are taken out again, so the
+    // database, and f.frozen built from it, end up as they were
+    uint32_t addr = 0xdf0a0b0c;
+    std::vector<std::string> added;
+    for (size_t length = 8; length <= 32; length++)
+    {
+        uint32_t mask = length == 32 ? 0xffffffff : ~(0xffffffffu >> length);
+        std::string cidr(to_cidr(addr & mask, length));
+        if (!f.db->has(cidr)) added.push_back(cidr);
+        f.db->put(cidr);
+    }
+
+    std::string ip(cidr::gen::to_ip(addr));
+    std::vector<std::string> results;
+    size_t before = allocations.load();
+
+    for (auto _ : state)
+    {
+        results.clear();
+        f.db->lookup(ip, results);
+        benchmark::DoNotOptimize(results.data());
+    }
+
+    report(state, before);
+    state.counters["matches"] = results.size();
+
+    for (auto &cidr : added)
+        f.db->del(cidr);
+}
+
+static void BM_Put(benchmark::State &state)
+{
+    fixture &f = load(state.range(0));
+    dataset extra(4096, 2);
+    std::vector<std::string> added;
+    for (auto &cidr : extra.cidrs)
+        if (!f.db->has(cidr)) added.push_back(cidr);
+    size_t i = 0;
+    size_t before = allocations.load();
+
+    for (auto _ : state)
+        f.db->put(extra.cidrs[i++ & 4095]);
+
+    report(state, before);
+
+    for (auto &cidr : added)
+        f.db->del(cidr);
+}
+
+static void BM_Del(benchmark::State &state)
+{
+    fixture &f = load(state.range(0));
+    const std::vector<std::string> &cidrs = f.data->cidrs;
+    size_t i = 0;
+    size_t before = allocations.load();
+
+    for (auto _ : state)
+    {
+        f.db->del(cidrs[i++]);
+
+        if (i == cidrs.size())
+        {
+            state.PauseTiming();
+            for (auto &cidr : cidrs)
+                f.db->put(cidr);
+            i = 0;
+            state.ResumeTiming();
+        }
+    }
+
+    report(state, before);
+
+    for (size_t j = 0; j < i; j++)
+        f.db->put(cidrs[j]);
+}
+
+static void BM_Has(benchmark::State &state)
+{
+    fixture &f = load(state.range(0));
+    const std::vector<std::string> &cidrs = f.data->cidrs;
+    size_t i = 0;
+    size_t before = allocations.load();
+
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(f.db->has(cidrs[i++]));
+        if (i == cidrs.size()) i = 0;
+    }
+
+    report(state, before);
+}
+
+static void BM_Commit(benchmark::State &state)
+{
+    fixture &f = load(state.range(0));
+    fs::path dbfilename(scratch("commit.cdb"));
+    cidr::db db(dbfilename);
+    for (auto &cidr : f.data->cidrs)
+        db.put(cidr);
+    size_t before = allocations.load();
+
+    for (auto _ : state)
+        db.commit();
+
+    report(state, before);
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    fs::remove(dbfilename);
+}
+
+static void BM_Read(benchmark::State &state)
+{
+    fixture &f = load(state.range(0));
+    fs::path dbfilename(scratch("read.cdb"));
+    {
+        cidr::db db(dbfilename);
+        for (auto &cidr : f.data->cidrs)
+            db.put(cidr);
+        db.commit();
+    }
+    size_t before = allocations.load();
+
+    for (auto _ : state)
+    {
+        cidr::db db(dbfilename);
+        benchmark::DoNotOptimize(&db);
+    }
+
+    report(state, before);
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    fs::remove(dbfilename);
+}
+
+static void BM_Build(benchmark::State &state)
+{
+    fixture &f = load(state.range(0));
+    fs::path infilename(scratch("build.list"));
+    fs::path dbfilename(scratch("build.cdb"));
+    {
+        std::ofstream list(infilename.c_str());
+        for (auto &cidr : f.data->cidrs)
+            list << cidr << "\n";
+    }
+    size_t before = allocations.load();
+
+    for (auto _ : state)
+        cidr::db::build(infilename, dbfilename);
+
+    report(state, before);
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    fs::remove(infilename);
+    fs::remove(dbfilename);
+}
+
+/*
+ * Mixed traffic from several threads: every eighth operation is a PUT or
+ * DELETE, the rest are lookups. Compares one cidr::db behind a single
+ * reader/writer lock with cidr::sharded_db.
+ */
+struct locked_db
+{
+    boost::shared_mutex mutex;
+    cidr::db db;
+
+    void lookup(const std::string &ip, std::vector<std::string> &results)
+    {
+        boost::shared_lock_guard<boost::shared_mutex> lock(mutex);
+        db.lookup(ip, results);
+    }
+
+    void put(const std::string &cidr)
+    {
+        std::lock_guard<boost::shared_mutex> lock(mutex);
+        db.put(cidr);
+    }
+
+    void del(const std::string &cidr)
+    {
+        std::lock_guard<boost::shared_mutex> lock(mutex);
+        db.del(cidr);
+    }
+};
+
+template <typename DB>
+static void mixed(benchmark::State &state, DB &db, const dataset &data)
+{
+    dataset extra(4096, 100 + state.thread_index());
+    std::vector<std::string> results;
+    size_t i = 0;
+
+    for (auto _ : state)
+    {
+        if ((i & 7) == 0)
+        {
+            const std::string &cidr = extra.cidrs[(i >> 3) & 4095];
+            if ((i >> 15) & 1)
+                db.del(cidr);
+            else
+                db.put(cidr);
+        }
+        else
+        {
+            results.clear();
+            db.lookup(data.hits[i & 4095], results);
+            benchmark::DoNotOptimize(results.data());
+        }
+        i++;
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_MixedLocked(benchmark::State &state)
+{
+    static dataset data(state.range(0));
+    static locked_db db;
+
+    if (state.thread_index() == 0 && db.db.has(data.cidrs[0]) == false)
+        for (auto &cidr : data.cidrs)
+            db.put(cidr);
+
+    mixed(state, db, data);
+}
+
+static void BM_MixedSharded(benchmark::State &state)
+{
+    static dataset data(state.range(0));
+    static cidr::sharded_db db;
+
+    if (state.thread_index() == 0 && db.has(data.cidrs[0]) == false)
+        for (auto &cidr : data.cidrs)
+            db.put(cidr);
+
+    mixed(state, db, data);
+}
+
+#define CIDRDB_SIZES RangeMultiplier(10)->Range(1000, 10000000)
+
+BENCHMARK(BM_LookupHit)->CIDRDB_SIZES;
+BENCHMARK(BM_LookupMiss)->CIDRDB_SIZES;
+BENCHMARK(BM_LookupHitFrozen)->CIDRDB_SIZES;
+BENCHMARK(BM_LookupMissFrozen)->CIDRDB_SIZES;
+BENCHMARK(BM_LookupHitPrefiltered)->CIDRDB_SIZES;
+BENCHMARK(BM_LookupMissPrefiltered)->CIDRDB_SIZES;
+BENCHMARK(BM_LookupHitShm)->CIDRDB_SIZES;
+BENCHMARK(BM_LookupMissShm)->CIDRDB_SIZES;
+BENCHMARK(BM_LookupManyMatches)->CIDRDB_SIZES;
+BENCHMARK(BM_Has)->CIDRDB_SIZES;
+BENCHMARK(BM_Put)->CIDRDB_SIZES;
+BENCHMARK(BM_Del)->CIDRDB_SIZES;
+BENCHMARK(BM_Commit)->CIDRDB_SIZES->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Read)->CIDRDB_SIZES->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Build)->CIDRDB_SIZES->Unit(benchmark::kMillisecond);
+
+BENCHMARK(BM_MixedLocked)->Arg(1000000)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_MixedSharded)->Arg(1000000)->ThreadRange(1, 8)->UseRealTime();
+
+BENCHMARK_MAIN();
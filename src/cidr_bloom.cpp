@@ -0,0 +1,34 @@
+#include "cidr_bloom.hpp"
+
+
+namespace cidr
+{
+    /**
+     * Constructor for an empty cidr::bloom.
+     *
+     * @param size_t number of keys to size the filter for
+     */
+    bloom::bloom(size_t capacity)
+        : block_count((capacity * bits_per_key + 511) / 512 + 1),
+          capacity_count(capacity)
+    {
+        words.assign(block_count * words_per_block, 0);
+    }
+
+    /**
+     * Method to add a key to the filter.
+     *
+     * @param in_addr_t key
+     */
+    void bloom::insert(in_addr_t key)
+    {
+        uint64_t h = mph::mix(key);
+        uint64_t *block = &words[block_of(h) * words_per_block];
+        uint64_t bits = mph::mix(h);
+
+        for (size_t i = 0; i < hashes; i++, bits >>= 9)
+            block[(bits >> 6) & 7] |= 1ULL << (bits & 63);
+
+        inserted_count++;
+    }
+}
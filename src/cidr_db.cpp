@@ -1,10 +1,14 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
-#include <bitset>
+#include <queue>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
 #include <boost/lexical_cast.hpp>
 #include <boost/algorithm/string.hpp>
 #include "cidr_db.hpp"
+#include "trace.hpp"
 
 namespace ba = boost::algorithm;
 namespace fs = boost::filesystem;
@@ -32,31 +36,23 @@ namespace cidr
      */
     void db::lookup(const std::string &ip_address, std::vector<std::string> &results) const
     {
-        const char* DEBUG = std::getenv("DEBUG");
-
         in_addr_t ip_bits = ip_to_addr_bits(ip_address);
 
-        for (size_t offset = 0; offset < 32; offset++)
+        for (uint32_t lengths = populated; lengths != 0; lengths &= lengths - 1)
         {
-            if (cidrs[offset] == 0)
-                continue;
+            size_t offset = __builtin_ctz(lengths);
 
             in_addr_t shifted_bits = ip_bits >> offset;
 
+            if (filtering && !filters[offset]->maybe_contains(shifted_bits))
+                continue;
+
             if (cidrs[offset].get()->count(shifted_bits) == 0)
                 continue;
 
             in_addr_t unshifted_bits = shifted_bits << offset;
 
-            if (DEBUG)
-            {
-                std::cerr
-                    << " found: "
-                    << shifted_bits
-                    << "/"
-                    << offset
-                    << std::endl;
-            }
+            CIDR_TRACE(trace::debug, "found", shifted_bits, offset);
 
             std::stringstream cidr;
 
@@ -66,6 +62,37 @@ namespace cidr
         }
     }
 
+    /**
+     * Method to lookup CIDR entries for an address in host byte order
+     * without formatting them, for callers that speak binary.
+     *
+     * @param in_addr_t IP address bits
+     * @param uint8_t* receives up to 32 prefix lengths, longest first
+     * @return size_t number of matches
+     */
+    size_t db::lookup(in_addr_t ip_bits, uint8_t *lengths) const
+    {
+        size_t count = 0;
+
+        for (uint32_t populated_lengths = populated; populated_lengths != 0;
+             populated_lengths &= populated_lengths - 1)
+        {
+            size_t offset = __builtin_ctz(populated_lengths);
+
+            in_addr_t shifted_bits = ip_bits >> offset;
+
+            if (filtering && !filters[offset]->maybe_contains(shifted_bits))
+                continue;
+
+            if (cidrs[offset].get()->count(shifted_bits) == 0)
+                continue;
+
+            lengths[count++] = 32 - offset;
+        }
+
+        return count;
+    }
+
     /**
      * Method to add a new CIDR to the in-memory database.
      *
@@ -86,7 +113,19 @@ namespace cidr
                 new std::set<in_addr_t>
             );
 
-        cidrs[offset].get()->insert(shifted_bits);
+        if (!cidrs[offset].get()->insert(shifted_bits).second)
+            return;
+
+        populated |= 1u << offset;
+        versions[offset]++;
+
+        if (filtering)
+        {
+            if (filters[offset] == 0 || filters[offset]->stale())
+                refilter(offset);
+            else
+                filters[offset]->insert(shifted_bits);
+        }
     }
 
     /**
@@ -107,15 +146,20 @@ namespace cidr
         if (cidrs[offset] == 0)
             return;
 
-        for (auto it = cidrs[offset].get()->begin();
-                  it != cidrs[offset].get()->end();
-                  it++)
+        if (cidrs[offset].get()->erase(shifted_bits) == 0)
+            return;
+
+        versions[offset]++;
+
+        if (cidrs[offset].get()->empty())
+            populated &= ~(1u << offset);
+
+        if (filtering)
         {
-            if ( *it == shifted_bits )
-            {
-                cidrs[offset].get()->erase(it);
-                return;
-            }
+            filters[offset]->removed();
+
+            if (filters[offset]->stale())
+                refilter(offset);
         }
     }
 
@@ -126,8 +170,6 @@ namespace cidr
      */
     bool db::has(const std::string &cidr) const
     {
-        const char* DEBUG = std::getenv("DEBUG");
-
         std::vector<std::string> parts;
         ba::split(parts, cidr, boost::is_any_of("/"));
 
@@ -139,18 +181,258 @@ namespace cidr
         if (cidrs[offset] == 0)
             return false;
 
-        if (DEBUG)
+        if (filtering && filters[offset] != 0 && !filters[offset]->maybe_contains(shifted_bits))
+            return false;
+
+        CIDR_TRACE(trace::debug, "has", shifted_bits, offset);
+
+        return cidrs[offset].get()->count(shifted_bits) > 0;
+    }
+
+    /**
+     * Method to find every stored CIDR contained in a supernet, including
+     * the supernet itself.
+     *
+     * @param std::string CIDR of the supernet
+     * @param vector<string> to store CIDR results
+     */
+    void db::within(const std::string &cidr, std::vector<std::string> &results) const
+    {
+        within(cidr, [&results](const std::string &match)
+        {
+            results.push_back(match);
+        });
+    }
+
+    /**
+     * Method to stream every stored CIDR contained in a supernet to a
+     * visitor, in address order with shorter prefixes first.
+     *
+     * @param std::string CIDR of the supernet
+     * @param cidr_visitor called once per contained CIDR
+     */
+    void db::within(const std::string &cidr, const cidr_visitor &visit) const
+    {
+        walk(cidr, nullptr, &visit);
+    }
+
+    /**
+     * Method to stream every stored CIDR contained in a supernet to a
+     * visitor as network bits and prefix length, without formatting.
+     *
+     * @param in_addr_t address bits of the supernet in host byte order
+     * @param uint8_t prefix length of the supernet, 1 to 32
+     * @param prefix_visitor called once per contained CIDR
+     */
+    void db::within(in_addr_t addr_bits, uint8_t length, const prefix_visitor &visit) const
+    {
+        walk(addr_bits, 32 - length, nullptr, &visit);
+    }
+
+    /**
+     * Method to find every stored CIDR that covers a CIDR, including the
+     * CIDR itself, shortest prefix first.
+     *
+     * @param std::string CIDR
+     * @param vector<string> to store CIDR results
+     */
+    void db::covering(const std::string &cidr, std::vector<std::string> &results) const
+    {
+        covering(cidr, [&results](const std::string &match)
+        {
+            results.push_back(match);
+        });
+    }
+
+    /**
+     * Method to stream every stored CIDR that covers a CIDR to a visitor.
+     *
+     * @param std::string CIDR
+     * @param cidr_visitor called once per covering CIDR
+     */
+    void db::covering(const std::string &cidr, const cidr_visitor &visit) const
+    {
+        walk(cidr, &visit, nullptr);
+    }
+
+    /**
+     * Method to stream every stored CIDR that covers a CIDR to a visitor
+     * as network bits and prefix length, without formatting.
+     *
+     * @param in_addr_t address bits of the CIDR in host byte order
+     * @param uint8_t prefix length of the CIDR, 1 to 32
+     * @param prefix_visitor called once per covering CIDR
+     */
+    void db::covering(in_addr_t addr_bits, uint8_t length, const prefix_visitor &visit) const
+    {
+        walk(addr_bits, 32 - length, &visit, nullptr);
+    }
+
+    /**
+     * Method to find every stored CIDR covered by a CIDR; the same set as
+     * within(), named for symmetry with covering().
+     *
+     * @param std::string CIDR
+     * @param vector<string> to store CIDR results
+     */
+    void db::covered_by(const std::string &cidr, std::vector<std::string> &results) const
+    {
+        within(cidr, results);
+    }
+
+    /**
+     * Method to stream every stored CIDR covered by a CIDR to a visitor.
+     *
+     * @param std::string CIDR
+     * @param cidr_visitor called once per covered CIDR
+     */
+    void db::covered_by(const std::string &cidr, const cidr_visitor &visit) const
+    {
+        within(cidr, visit);
+    }
+
+    /**
+     * Method to find every stored CIDR overlapping a CIDR. Two CIDRs overlap
+     * only if one covers the other, so the result is split into the stored
+     * CIDRs covering it and those it covers; an exact match is in both.
+     *
+     * @param std::string CIDR
+     * @param vector<string> to store covering CIDRs
+     * @param vector<string> to store covered CIDRs
+     */
+    void db::overlaps(const std::string &cidr,
+                      std::vector<std::string> &covering_results,
+                      std::vector<std::string> &covered_results) const
+    {
+        cidr_visitor covering_visit = [&covering_results](const std::string &match)
+        {
+            covering_results.push_back(match);
+        };
+
+        cidr_visitor covered_visit = [&covered_results](const std::string &match)
+        {
+            covered_results.push_back(match);
+        };
+
+        walk(cidr, &covering_visit, &covered_visit);
+    }
+
+    /**
+     * Parse a CIDR and walk it, formatting each match for string visitors.
+     *
+     * @param std::string CIDR
+     * @param cidr_visitor* receives covering CIDRs, or nullptr
+     * @param cidr_visitor* receives covered CIDRs, or nullptr
+     */
+    void db::walk(const std::string &cidr,
+                  const cidr_visitor *covering_visit,
+                  const cidr_visitor *covered_visit) const
+    {
+        std::vector<std::string> parts;
+        ba::split(parts, cidr, boost::is_any_of("/"));
+
+        in_addr_t addr_bits = ip_to_addr_bits(parts[0]);
+        size_t cidr_offset = 32 - boost::lexical_cast<size_t>(parts[1].c_str());
+
+        prefix_visitor covering_format = [covering_visit](in_addr_t network, uint8_t length)
         {
-            std::cerr
-                << "   has: "
-                << shifted_bits
-                << "/"
-                << offset
-                << " [" << std::bitset<32>(shifted_bits) << "]"
-                << std::endl;
+            (*covering_visit)(addr_bits_to_ip(network) + "/" + std::to_string(length));
+        };
+
+        prefix_visitor covered_format = [covered_visit](in_addr_t network, uint8_t length)
+        {
+            (*covered_visit)(addr_bits_to_ip(network) + "/" + std::to_string(length));
+        };
+
+        walk(addr_bits, cidr_offset,
+             covering_visit ? &covering_format : nullptr,
+             covered_visit ? &covered_format : nullptr);
+    }
+
+    /**
+     * One pass over the populated prefix lengths answering both directions.
+     * Lengths at or above the CIDR's take a point probe of the CIDR's
+     * address (covering); lengths at or below it contribute one ordered
+     * range of their set (covered). The ranges are merged through a small
+     * heap, so covered results cost O(log n + k) per length and are never
+     * materialized.
+     *
+     * @param in_addr_t address bits of the CIDR
+     * @param size_t offset (32 - prefix length) of the CIDR, 0 to 31
+     * @param prefix_visitor* receives covering network bits and lengths, or nullptr
+     * @param prefix_visitor* receives covered network bits and lengths, or nullptr
+     */
+    void db::walk(in_addr_t addr_bits, size_t cidr_offset,
+                  const prefix_visitor *covering_visit,
+                  const prefix_visitor *covered_visit) const
+    {
+        in_addr_t first = (addr_bits >> cidr_offset) << cidr_offset;
+        in_addr_t last = first | (in_addr_t)((1ULL << cidr_offset) - 1);
+
+        struct range
+        {
+            std::set<in_addr_t>::const_iterator next;
+            std::set<in_addr_t>::const_iterator end;
+            size_t offset;
+
+            in_addr_t addr_bits() const { return *next << offset; }
+        };
+
+        std::vector<range> ranges;
+
+        // highest offset (shortest prefix) first
+        for (uint32_t lengths = populated; lengths != 0; )
+        {
+            size_t offset = 31 - __builtin_clz(lengths);
+            lengths &= ~(1u << offset);
+
+            const std::set<in_addr_t> &cidr_set = *cidrs[offset];
+
+            if (covering_visit && offset >= cidr_offset
+                && cidr_set.count(first >> offset) > 0)
+            {
+                CIDR_TRACE(trace::debug, "covering", first >> offset, offset);
+
+                (*covering_visit)((first >> offset) << offset, 32 - offset);
+            }
+
+            if (covered_visit && offset <= cidr_offset)
+            {
+                range r{ cidr_set.lower_bound(first >> offset),
+                         cidr_set.upper_bound(last >> offset),
+                         offset };
+
+                if (r.next != r.end)
+                    ranges.push_back(r);
+            }
         }
 
-        return cidrs[offset].get()->count(shifted_bits) > 0;
+        if (!covered_visit)
+            return;
+
+        auto later = [](const range &a, const range &b)
+        {
+            if (a.addr_bits() != b.addr_bits())
+                return a.addr_bits() > b.addr_bits();
+
+            return a.offset < b.offset;
+        };
+
+        std::priority_queue<range, std::vector<range>, decltype(later)>
+            pending(later, std::move(ranges));
+
+        while (!pending.empty())
+        {
+            range r = pending.top();
+            pending.pop();
+
+            CIDR_TRACE(trace::debug, "covered", *r.next, r.offset);
+
+            (*covered_visit)(r.addr_bits(), 32 - r.offset);
+
+            if (++r.next != r.end)
+                pending.push(r);
+        }
     }
 
     /**
@@ -158,8 +440,6 @@ namespace cidr
      */
     void db::commit() const
     {
-        const char* DEBUG = std::getenv("DEBUG");
-
         std::ofstream dbfile(db_filename.c_str(), std::ios::out|std::ios::binary);
 
         for (size_t offset = 0; offset < 32; offset++)
@@ -169,18 +449,9 @@ namespace cidr
 
             std::for_each(cidrs[offset]->begin(),
                           cidrs[offset]->end(),
-            [&dbfile, &offset, &DEBUG](in_addr_t shifted_bits)
+            [&dbfile, &offset](in_addr_t shifted_bits)
             {
-                if (DEBUG)
-                {
-                    std::cerr
-                        << "commit: "
-                        << shifted_bits
-                        << "/"
-                        << offset
-                        << " [" << std::bitset<32>(shifted_bits) << "]"
-                        << std::endl;
-                }
+                CIDR_TRACE(trace::verbose, "commit", shifted_bits, offset);
 
                 dbfile.write(reinterpret_cast<char*>( &offset ), sizeof offset);
                 dbfile.write(reinterpret_cast<char*>( &shifted_bits ), sizeof shifted_bits);
@@ -190,6 +461,305 @@ namespace cidr
         dbfile.close();
     }
 
+    /**
+     * Method to visit every CIDR in the in-memory database, in the same
+     * (prefix length descending, address ascending) order commit() writes.
+     *
+     * @param cidr_visitor called with each CIDR
+     */
+    void db::each(const cidr_visitor &visit) const
+    {
+        for (size_t offset = 0; offset < 32; offset++)
+        {
+            if (cidrs[offset] == 0)
+                continue;
+
+            for (in_addr_t shifted_bits : *cidrs[offset])
+            {
+                std::stringstream cidr;
+                cidr << addr_bits_to_ip(shifted_bits << offset) << "/" << (32 - offset);
+                visit(cidr.str());
+            }
+        }
+    }
+
+    /**
+     * Method to exchange the in-memory contents of two databases. The
+     * datafile each one commits to and whether it is prefiltered stay
+     * where they were.
+     *
+     * @param cidr::db to swap contents with
+     */
+    void db::swap(db &other)
+    {
+        for (size_t offset = 0; offset < 32; offset++)
+            cidrs[offset].swap(other.cidrs[offset]);
+
+        std::swap(populated, other.populated);
+
+        for (size_t offset = 0; offset < 32; offset++)
+        {
+            versions[offset]++;
+            other.versions[offset]++;
+
+            if (filtering)
+                refilter(offset);
+
+            if (other.filtering)
+                other.refilter(offset);
+        }
+    }
+
+    /**
+     * Method to turn the per prefix length Bloom filters on or off. With
+     * them on, lookup() and has() skip the tree search at every length
+     * whose filter rules the address out, which is most of them for most
+     * addresses. Filters are updated on put() and rebuilt from the tree
+     * when they fill up or after enough del() calls leave stale bits.
+     *
+     * @param bool enable
+     */
+    void db::prefilter(bool enable)
+    {
+        filtering = enable;
+
+        for (size_t offset = 0; offset < 32; offset++)
+            refilter(offset);
+    }
+
+    void db::refilter(size_t offset)
+    {
+        if (!filtering || (populated & (1u << offset)) == 0)
+        {
+            filters[offset].reset();
+            return;
+        }
+
+        // room to grow before the next rebuild
+        const std::set<in_addr_t> &cidr_set = *cidrs[offset];
+        filters[offset].reset(new bloom(cidr_set.size() * 2 + 64));
+
+        for (in_addr_t shifted_bits : cidr_set)
+            filters[offset]->insert(shifted_bits);
+
+        CIDR_TRACE(trace::debug, "refilter", cidr_set.size(), offset);
+    }
+
+    namespace
+    {
+        const char snapshot_magic[] = { 'C', 'I', 'D', 'R', 'S', 'N', 'P', '1' };
+        const unsigned char snapshot_end = 0xff;
+
+        void put_varint(std::string &out, uint64_t value)
+        {
+            while (value >= 0x80)
+            {
+                out.push_back(static_cast<char>(value | 0x80));
+                value >>= 7;
+            }
+            out.push_back(static_cast<char>(value));
+        }
+
+        uint64_t get_varint(const std::string &in, size_t &position)
+        {
+            uint64_t value = 0;
+
+            for (int shift = 0; shift < 64; shift += 7)
+            {
+                if (position >= in.size())
+                    throw std::runtime_error("truncated snapshot");
+
+                unsigned char byte = in[position++];
+                value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+
+                if ((byte & 0x80) == 0)
+                    return value;
+            }
+
+            throw std::runtime_error("bad varint in snapshot");
+        }
+    }
+
+    /**
+     * Method to encode a point-in-time image of the in-memory database.
+     * Each populated prefix length is written as its offset, a count and
+     * the ascending shifted addresses as varint deltas, so a /24-heavy table
+     * needs little more than a byte or two per CIDR.
+     *
+     * @param std::string to append the binary image to
+     */
+    void db::snapshot(std::string &image) const
+    {
+        db_copy(*this).snapshot(image, std::numeric_limits<size_t>::max());
+    }
+
+    /**
+     * Method to replace the in-memory database with a snapshot() image.
+     * Addresses arrive sorted, so every set is built by appending rather
+     * than by searching. The database is left untouched if the image is
+     * malformed.
+     *
+     * @param std::string binary image
+     * @return size_t number of CIDRs restored
+     * @throw std::runtime_error on a malformed image
+     */
+    size_t db::restore(const std::string &image)
+    {
+        if (image.size() < sizeof snapshot_magic
+            || image.compare(0, sizeof snapshot_magic,
+                             snapshot_magic, sizeof snapshot_magic) != 0)
+            throw std::runtime_error("not a CIDR-DB snapshot");
+
+        std::shared_ptr<std::set<in_addr_t>> restored[32];
+        uint32_t restored_populated = 0;
+        uint64_t total = 0;
+        size_t position = sizeof snapshot_magic;
+
+        for (;;)
+        {
+            if (position >= image.size())
+                throw std::runtime_error("truncated snapshot");
+
+            unsigned char offset = image[position++];
+
+            if (offset == snapshot_end)
+                break;
+
+            if (31 < offset || restored[offset] != 0)
+                throw std::runtime_error("bad prefix length in snapshot");
+
+            uint64_t count = get_varint(image, position);
+            uint64_t limit = offset == 0 ? 0xffffffffull : (0xffffffffull >> offset);
+            uint64_t shifted_bits = 0;
+
+            restored[offset] = std::make_shared<std::set<in_addr_t>>();
+            std::set<in_addr_t> &entries = *restored[offset];
+
+            for (uint64_t i = 0; i < count; i++)
+            {
+                shifted_bits += get_varint(image, position);
+
+                if (shifted_bits > limit || (i > 0 && shifted_bits == *entries.rbegin()))
+                    throw std::runtime_error("bad address in snapshot");
+
+                entries.emplace_hint(entries.end(), static_cast<in_addr_t>(shifted_bits));
+            }
+
+            if (count > 0)
+                restored_populated |= 1u << offset;
+
+            total += count;
+        }
+
+        if (get_varint(image, position) != total || position != image.size())
+            throw std::runtime_error("snapshot record count mismatch");
+
+        for (size_t offset = 0; offset < 32; offset++)
+            cidrs[offset].swap(restored[offset]);
+
+        populated = restored_populated;
+
+        for (size_t offset = 0; offset < 32; offset++)
+        {
+            versions[offset]++;
+            refilter(offset);
+        }
+
+        CIDR_TRACE(trace::info, "restore", total, image.size());
+
+        return total;
+    }
+
+    /**
+     * Constructor for cidr::db_copy. Copying the keys is far cheaper than
+     * encoding them, so only the copy has to happen while the source can't
+     * change.
+     *
+     * @param cidr::db database to copy
+     */
+    db_copy::db_copy(const db &source)
+    {
+        for (size_t offset = 0; offset < 32; offset++)
+        {
+            if (source.cidrs[offset] == 0)
+                continue;
+
+            keys[offset].assign(source.cidrs[offset]->begin(), source.cidrs[offset]->end());
+            total += keys[offset].size();
+        }
+    }
+
+    /**
+     * Method to visit the next CIDRs of the copy, carrying on where the
+     * previous call stopped, in the same order as db::each().
+     *
+     * @param cidr_visitor called with each CIDR
+     * @param size_t most CIDRs to visit in this call
+     * @return bool whether any CIDRs are left for another call
+     */
+    bool db_copy::each(const db::cidr_visitor &visit, size_t limit)
+    {
+        for (; offset < 32; offset++, position = 0)
+        {
+            for (; position < keys[offset].size(); position++)
+            {
+                if (limit-- == 0)
+                    return true;
+
+                visit(db::addr_bits_to_ip(keys[offset][position] << offset)
+                      + "/" + std::to_string(32 - offset));
+            }
+        }
+
+        return false;
+    }
+
+    /**
+     * Method to append the next piece of the db::snapshot() image of the
+     * copy, carrying on where the previous call stopped.
+     *
+     * @param std::string to append the binary image to
+     * @param size_t most CIDRs to encode in this call
+     * @return bool whether any of the image is left for another call
+     */
+    bool db_copy::snapshot(std::string &image, size_t limit)
+    {
+        if (!begun)
+        {
+            image.append(snapshot_magic, sizeof snapshot_magic);
+            begun = true;
+        }
+
+        for (; offset < 32; offset++, position = 0)
+        {
+            const std::vector<in_addr_t> &entries = keys[offset];
+
+            for (; position < entries.size(); position++)
+            {
+                if (limit-- == 0)
+                    return true;
+
+                if (position == 0)
+                {
+                    image.push_back(static_cast<char>(offset));
+                    put_varint(image, entries.size());
+                }
+
+                put_varint(image, entries[position]
+                           - (position == 0 ? 0 : entries[position - 1]));
+            }
+        }
+
+        if (!ended)
+        {
+            image.push_back(static_cast<char>(snapshot_end));
+            put_varint(image, total);
+            ended = true;
+        }
+
+        return false;
+    }
+
     /**
      * Method to read a CIDR database file to initialize the in-memory database.
      *
@@ -197,8 +767,6 @@ namespace cidr
      */
     void db::read(const fs::path &db_filename)
     {
-        const char* DEBUG = std::getenv("DEBUG");
-
         std::ifstream infile(db_filename.c_str());
 
         size_t offset;
@@ -211,18 +779,9 @@ namespace cidr
 
             if (shifted_bits == 0) continue;
 
-            if (32 < offset || offset < 1) continue;
+            if (31 < offset) continue;
 
-            if (DEBUG)
-            {
-                std::cerr
-                    << "  read: "
-                    << shifted_bits
-                    << "/"
-                    << offset
-                    << " [" << std::bitset<32>(shifted_bits) << "]"
-                    << std::endl;
-            }
+            CIDR_TRACE(trace::verbose, "read", shifted_bits, offset);
 
             if (cidrs[offset] == 0)
                 cidrs[offset] = std::shared_ptr<std::set<in_addr_t>>(
@@ -230,6 +789,7 @@ namespace cidr
                 );
 
             cidrs[offset].get()->insert(shifted_bits);
+            populated |= 1u << offset;
 
             offset = 0;
             shifted_bits = 0;
@@ -239,21 +799,18 @@ namespace cidr
     }
 
     /**
-     * Static fuction to create a compiled CIDR database file.
+     * Static fuction to create a compiled CIDR database file. Records are
+     * sorted by (offset, bits) and de-duplicated, the same order commit()
+     * writes, so built files can be merged sequentially.
      *
      * @param boost::filesystem::path indicating path to raw CIDR datafile
      * @param boost::filesystem::path indicates path to compiled CIDR datafile
      */
     void db::build(const fs::path &infilename, const fs::path &db_filename)
     {
-        const char* DEBUG = std::getenv("DEBUG");
-
-        if (DEBUG)
-            std::cerr << "Opening: " << infilename << std::endl;
-
         std::ifstream infile(infilename.c_str());
-        std::ofstream dbfile(db_filename.c_str(), std::ios::out|std::ios::binary);
 
+        std::vector<std::pair<size_t, in_addr_t>> records;
         std::string cidr;
         in_addr_t shifted_bits;
         in_addr_t addr_bits;
@@ -267,45 +824,31 @@ namespace cidr
             addr_bits = ip_to_addr_bits(parts[0]);
             offset = 32 - boost::lexical_cast<size_t>(parts[1].c_str());
 
-            if (DEBUG)
-            {
-                std::cerr
-                    << parts[0]
-                    << " -> "
-                    << "["
-                    << std::bitset<32>(addr_bits)
-                    << "]"
-                    << std::endl;
-            }
-
             if (addr_bits == 0) continue;
 
-            if (32 < offset || offset < 1) continue;
+            if (31 < offset) continue;
 
             shifted_bits = addr_bits >> offset;
 
-            if (DEBUG)
-            {
-                std::cerr
-                    << cidr
-                    << " " << parts[1] << " => "
-                    << offset
-                    << ")"
-                    << std::endl
-                    << "["
-                    << std::bitset<32>(addr_bits)
-                    << "] => ["
-                    << std::bitset<32>(shifted_bits)
-                    << "]"
-                    << std::endl;
-            }
+            CIDR_TRACE(trace::verbose, "build", shifted_bits, offset);
 
-            dbfile.write(reinterpret_cast<char*>( &offset ), sizeof offset);
-            dbfile.write(reinterpret_cast<char*>( &shifted_bits ), sizeof shifted_bits);
+            records.emplace_back(offset, shifted_bits);
         }
 
-        dbfile.close();
         infile.close();
+
+        std::sort(records.begin(), records.end());
+        records.erase(std::unique(records.begin(), records.end()), records.end());
+
+        std::ofstream dbfile(db_filename.c_str(), std::ios::out|std::ios::binary);
+
+        for (auto &record : records)
+        {
+            dbfile.write(reinterpret_cast<char*>( &record.first ), sizeof record.first);
+            dbfile.write(reinterpret_cast<char*>( &record.second ), sizeof record.second);
+        }
+
+        dbfile.close();
     }
 
     /**
@@ -332,7 +875,7 @@ namespace cidr
         std::vector<std::string> parts;
         ba::split(parts, cidr, boost::is_any_of("/"));
 
-        if (!valid_ip(parts[0]))
+        if (parts.size() != 2 || !valid_ip(parts[0]))
             return false;
 
         size_t range = -1;
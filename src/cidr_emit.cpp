@@ -0,0 +1,238 @@
+#include <cctype>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <stdexcept>
+#include <vector>
+#include "cidr_emit.hpp"
+#include "cidr_merge.hpp"
+#include "cidr_mph.hpp"
+
+
+namespace cidr
+{
+    namespace emit
+    {
+        namespace
+        {
+            /**
+             * Lengths with at most this many CIDRs are emitted as a sorted
+             * array scanned in order; larger ones get a perfect hash.
+             */
+            const size_t max_scanned = 16;
+
+            template <typename T>
+            void write_array(std::ostream &out, const char *type,
+                             const std::string &name, const std::vector<T> &values,
+                             bool hex)
+            {
+                out << "    constexpr " << type << " " << name << "[] =\n    {";
+
+                for (size_t i = 0; i < values.size(); i++)
+                {
+                    out << (i % 8 == 0 ? "\n        " : " ");
+
+                    if (hex)
+                        out << "0x" << std::hex << std::setw(8) << std::setfill('0')
+                            << values[i] << std::dec;
+                    else
+                        out << values[i];
+
+                    out << ",";
+                }
+
+                out << "\n    };\n";
+            }
+
+            std::string guard_for(const fs::path &header_filename)
+            {
+                std::string name(header_filename.filename().string());
+                std::string guard;
+
+                for (char c : name)
+                    guard.push_back(std::isalnum((unsigned char)c) ? std::toupper((unsigned char)c) : '_');
+
+                return guard;
+            }
+        }
+
+        /**
+         * Turn a compiled CIDR datafile into a C++ header and source that
+         * answer lookups with no loading and no allocation. Each populated
+         * prefix length becomes a constexpr table: a sorted array when it
+         * holds only a few CIDRs, otherwise a perfect hash. The lookup
+         * function tests exactly the populated lengths, longest first.
+         *
+         * @param boost::filesystem::path compiled CIDR datafile
+         * @param boost::filesystem::path header to write
+         * @param boost::filesystem::path source to write
+         * @param std::string namespace for the generated code
+         * @return size_t number of CIDRs emitted
+         */
+        size_t cpp(const fs::path &db_filename,
+                   const fs::path &header_filename,
+                   const fs::path &source_filename,
+                   const std::string &name_space)
+        {
+            // prefix length -> shifted addresses, in ascending order
+            std::map<size_t, std::vector<in_addr_t>, std::greater<size_t>> lengths;
+            size_t count = 0;
+
+            merge::record_reader reader(db_filename);
+            merge::record r;
+
+            while (reader.next(r))
+            {
+                lengths[32 - r.offset].push_back(r.shifted_bits);
+                count++;
+            }
+
+            std::ofstream header(header_filename.c_str());
+            std::string guard(guard_for(header_filename));
+
+            if (!header)
+                throw std::runtime_error("Can't write " + header_filename.string());
+
+            header << "// Generated by cidrdb_cli --emit-cpp from "
+                   << db_filename.filename().string() << ". Do not edit.\n"
+                   << "\n"
+                   << "#ifndef " << guard << "\n"
+                   << "#define " << guard << "\n"
+                   << "\n"
+                   << "#include <cstddef>\n"
+                   << "#include <cstdint>\n"
+                   << "\n"
+                   << "namespace " << name_space << "\n"
+                   << "{\n"
+                   << "    /// Number of CIDRs in the frozen database.\n"
+                   << "    constexpr std::size_t cidr_count = " << count << ";\n"
+                   << "\n"
+                   << "    /// Number of populated prefix lengths; lookup() writes at most this many.\n"
+                   << "    constexpr std::size_t length_count = " << lengths.size() << ";\n"
+                   << "\n"
+                   << "    /// Write the prefix lengths of the CIDRs containing a host byte\n"
+                   << "    /// order address to out, longest first, and return how many.\n"
+                   << "    std::size_t lookup(std::uint32_t addr, std::uint8_t *out);\n"
+                   << "\n"
+                   << "    /// True if any CIDR contains the host byte order address.\n"
+                   << "    bool contains(std::uint32_t addr);\n"
+                   << "\n"
+                   << "    /// True if the CIDR addr/length is present.\n"
+                   << "    bool has(std::uint32_t addr, unsigned length);\n"
+                   << "}\n"
+                   << "\n"
+                   << "#endif // " << guard << "\n";
+
+            std::ofstream source(source_filename.c_str());
+
+            if (!source)
+                throw std::runtime_error("Can't write " + source_filename.string());
+
+            source << "// Generated by cidrdb_cli --emit-cpp from "
+                   << db_filename.filename().string() << ". Do not edit.\n"
+                   << "\n"
+                   << "#include \"" << header_filename.filename().string() << "\"\n"
+                   << "\n"
+                   << "namespace " << name_space << "\n"
+                   << "{\n"
+                   << "namespace\n"
+                   << "{\n"
+                   << "    constexpr std::uint64_t mix(std::uint64_t x)\n"
+                   << "    {\n"
+                   << "        x ^= x >> 33;\n"
+                   << "        x *= 0xff51afd7ed558ccdULL;\n"
+                   << "        x ^= x >> 33;\n"
+                   << "        x *= 0xc4ceb9fe1a85ec53ULL;\n"
+                   << "        x ^= x >> 33;\n"
+                   << "        return x;\n"
+                   << "    }\n";
+
+            for (auto &length : lengths)
+            {
+                size_t len = length.first;
+                size_t offset = 32 - len;
+                const std::vector<in_addr_t> &keys = length.second;
+                std::string suffix(std::to_string(len));
+
+                source << "\n";
+
+                if (keys.size() <= max_scanned)
+                {
+                    source << "    // /" << len << ": " << keys.size() << " CIDRs, sorted\n";
+                    write_array(source, "std::uint32_t", "keys_" + suffix, keys, true);
+                    source << "\n"
+                           << "    inline bool has_" << suffix << "(std::uint32_t addr)\n"
+                           << "    {\n"
+                           << "        const std::uint32_t key = addr >> " << offset << ";\n"
+                           << "        for (std::uint32_t k : keys_" << suffix << ")\n"
+                           << "            if (k >= key) return k == key;\n"
+                           << "        return false;\n"
+                           << "    }\n";
+                    continue;
+                }
+
+                mph::table t(mph::build(keys));
+
+                source << "    // /" << len << ": " << keys.size() << " CIDRs, perfect hash\n"
+                       << "    constexpr std::uint64_t seed_" << suffix << " = 0x"
+                       << std::hex << t.seed << std::dec << "ULL;\n";
+                write_array(source, "std::uint16_t", "pilots_" + suffix, t.pilots, false);
+                write_array(source, "std::uint32_t", "slots_" + suffix, t.slots, true);
+                source << "\n"
+                       << "    inline bool has_" << suffix << "(std::uint32_t addr)\n"
+                       << "    {\n"
+                       << "        const std::uint32_t key = addr >> " << offset << ";\n"
+                       << "        const std::uint64_t h = mix(key ^ seed_" << suffix << ");\n"
+                       << "        const std::uint16_t pilot = pilots_" << suffix
+                       << "[(h >> 32) % " << t.pilots.size() << "];\n"
+                       << "        return slots_" << suffix << "[(h ^ mix(pilot)) % "
+                       << t.slots.size() << "] == key;\n"
+                       << "    }\n";
+            }
+
+            source << "}\n"
+                   << "\n"
+                   << "std::size_t lookup(std::uint32_t addr, std::uint8_t *out)\n"
+                   << "{\n"
+                   << "    std::size_t n = 0;\n";
+
+            for (auto &length : lengths)
+                source << "    if (has_" << length.first << "(addr)) out[n++] = "
+                       << length.first << ";\n";
+
+            source << "    (void)addr;\n"
+                   << "    (void)out;\n"
+                   << "    return n;\n"
+                   << "}\n"
+                   << "\n"
+                   << "bool contains(std::uint32_t addr)\n"
+                   << "{\n"
+                   << "    (void)addr;\n"
+                   << "    return false";
+
+            for (auto &length : lengths)
+                source << "\n        || has_" << length.first << "(addr)";
+
+            source << ";\n"
+                   << "}\n"
+                   << "\n"
+                   << "bool has(std::uint32_t addr, unsigned length)\n"
+                   << "{\n"
+                   << "    (void)addr;\n"
+                   << "    switch (length)\n"
+                   << "    {\n";
+
+            for (auto &length : lengths)
+                source << "    case " << length.first << ": return has_"
+                       << length.first << "(addr);\n";
+
+            source << "    default: return false;\n"
+                   << "    }\n"
+                   << "}\n"
+                   << "}\n";
+
+            return count;
+        }
+    }
+}
@@ -0,0 +1,139 @@
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string.hpp>
+#include "cidr_frozen_db.hpp"
+#include "trace.hpp"
+
+namespace ba = boost::algorithm;
+
+
+namespace cidr
+{
+    /**
+     * Constructor for cidr::frozen_db from a loaded database.
+     *
+     * @param cidr::db database to copy
+     */
+    frozen_db::frozen_db(const db &source)
+    {
+        std::vector<in_addr_t> keys[32];
+
+        for (size_t offset = 0; offset < 32; offset++)
+        {
+            if (source.cidrs[offset] != 0)
+                keys[offset].assign(source.cidrs[offset]->begin(), source.cidrs[offset]->end());
+        }
+
+        freeze(keys);
+    }
+
+    /**
+     * Constructor for cidr::frozen_db from a compiled CIDR datafile, read
+     * straight into the hash tables without building a cidr::db first.
+     *
+     * @param boost::filesystem::path indicates path to compiled CIDR datafile
+     */
+    frozen_db::frozen_db(const fs::path &db_filename)
+    {
+        std::vector<in_addr_t> keys[32];
+        std::ifstream infile(db_filename.c_str(), std::ios::in|std::ios::binary);
+
+        size_t offset;
+        in_addr_t shifted_bits;
+
+        while (infile.read( (char*)&offset, sizeof(size_t) )
+               && infile.read( (char*)&shifted_bits, sizeof(in_addr_t) ))
+        {
+            if (shifted_bits == 0) continue;
+
+            if (31 < offset) continue;
+
+            keys[offset].push_back(shifted_bits);
+        }
+
+        // files written before commit() sorted may repeat records
+        for (auto &k : keys)
+        {
+            std::sort(k.begin(), k.end());
+            k.erase(std::unique(k.begin(), k.end()), k.end());
+        }
+
+        freeze(keys);
+    }
+
+    /**
+     * Method to lookup CIDR entries for a given IP address, longest prefix
+     * first as with cidr::db.
+     *
+     * @param std::string IP address
+     * @param vector<string> to store CIDR results
+     */
+    void frozen_db::lookup(const std::string &ip_address, std::vector<std::string> &results) const
+    {
+        in_addr_t ip_bits = db::ip_to_addr_bits(ip_address);
+
+        for (uint32_t lengths = populated; lengths != 0; lengths &= lengths - 1)
+        {
+            size_t offset = __builtin_ctz(lengths);
+
+            in_addr_t shifted_bits = ip_bits >> offset;
+
+            if (!tables[offset].contains(shifted_bits))
+                continue;
+
+            CIDR_TRACE(trace::debug, "found", shifted_bits, offset);
+
+            std::stringstream cidr;
+
+            cidr << db::addr_bits_to_ip(shifted_bits << offset) << "/" << (32 - offset);
+
+            results.push_back(cidr.str());
+        }
+    }
+
+    /**
+     * Method to verify a CIDR exists.
+     *
+     * @param std::string CIDR
+     */
+    bool frozen_db::has(const std::string &cidr) const
+    {
+        std::vector<std::string> parts;
+        ba::split(parts, cidr, boost::is_any_of("/"));
+
+        in_addr_t addr_bits = db::ip_to_addr_bits(parts[0]);
+        size_t offset = 32 - boost::lexical_cast<size_t>(parts[1].c_str());
+
+        return tables[offset].contains(addr_bits >> offset);
+    }
+
+    /**
+     * Memory held by the hash tables, excluding the object itself.
+     */
+    size_t frozen_db::bytes() const
+    {
+        size_t total = 0;
+
+        for (auto &t : tables)
+            total += t.bytes();
+
+        return total;
+    }
+
+    void frozen_db::freeze(std::vector<in_addr_t> (&keys)[32])
+    {
+        for (size_t offset = 0; offset < 32; offset++)
+        {
+            if (keys[offset].empty())
+                continue;
+
+            tables[offset] = mph::build(keys[offset]);
+            populated |= 1u << offset;
+            count += keys[offset].size();
+
+            CIDR_TRACE(trace::debug, "frozen", keys[offset].size(), offset);
+        }
+    }
+}
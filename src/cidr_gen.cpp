@@ -0,0 +1,270 @@
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+#include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string.hpp>
+#include "cidr_gen.hpp"
+
+namespace ba = boost::algorithm;
+
+
+namespace cidr
+{
+    namespace gen
+    {
+        namespace
+        {
+            /**
+             * Generated prefixes stay below 224.0.0.0 so that 240.0.0.0/4
+             * can supply queries that are guaranteed to miss.
+             */
+            const in_addr_t lowest_addr = 0x01000000;
+            const in_addr_t highest_addr = 0xdfffffff;
+            const in_addr_t miss_network = 0xf0000000;
+
+            in_addr_t netmask(size_t length)
+            {
+                return length == 0 ? 0 : ~((in_addr_t)0) << (32 - length);
+            }
+
+            double helper1(double x)
+            {
+                return std::abs(x) > 1e-8 ? std::log1p(x) / x : 1 - x / 2;
+            }
+
+            double helper2(double x)
+            {
+                return std::abs(x) > 1e-8 ? std::expm1(x) / x : 1 + x / 2;
+            }
+        }
+
+        zipf_distribution::zipf_distribution(size_t n, double s)
+            : n(n), s(s)
+        {
+            h_integral_x1 = h_integral(1.5) - 1;
+            h_integral_n = h_integral(n + 0.5);
+            threshold = 2 - h_integral_inverse(h_integral(2.5) - h(2));
+        }
+
+        /**
+         * One rejection-inversion step.
+         *
+         * @param double uniform variate in [0, 1)
+         * @return size_t rank, or 0 if the variate was rejected
+         */
+        size_t zipf_distribution::sample(double u01) const
+        {
+            double u = h_integral_n + u01 * (h_integral_x1 - h_integral_n);
+            double x = h_integral_inverse(u);
+            size_t k = (size_t)(x + 0.5);
+
+            if (k < 1) k = 1;
+            if (k > n) k = n;
+
+            if (k - x <= threshold || u >= h_integral(k + 0.5) - h(k))
+                return k;
+
+            return 0;
+        }
+
+        double zipf_distribution::h(double x) const
+        {
+            return std::exp(-s * std::log(x));
+        }
+
+        double zipf_distribution::h_integral(double x) const
+        {
+            double log_x = std::log(x);
+            return helper2((1 - s) * log_x) * log_x;
+        }
+
+        double zipf_distribution::h_integral_inverse(double x) const
+        {
+            double t = x * (1 - s);
+            if (t < -1) t = -1;
+            return std::exp(helper1(t) * x);
+        }
+
+        /**
+         * Named prefix length histograms.
+         *
+         *   bgp       -- full Internet routing table, dominated by /24
+         *   blocklist -- threat feed, dominated by single hosts
+         *
+         * @param std::string profile name
+         * @return length_histogram of (prefix length, weight)
+         */
+        length_histogram profile(const std::string &name)
+        {
+            if (name == "bgp")
+            {
+                return {
+                    {  8, 0.001 }, { 12, 0.003 }, { 14, 0.006 }, { 15, 0.008 },
+                    { 16, 0.015 }, { 17, 0.010 }, { 18, 0.018 }, { 19, 0.033 },
+                    { 20, 0.050 }, { 21, 0.055 }, { 22, 0.110 }, { 23, 0.100 },
+                    { 24, 0.580 }, { 28, 0.006 }, { 32, 0.005 },
+                };
+            }
+
+            if (name == "blocklist")
+            {
+                return {
+                    { 16, 0.005 }, { 19, 0.005 }, { 20, 0.010 }, { 21, 0.010 },
+                    { 22, 0.020 }, { 23, 0.020 }, { 24, 0.200 }, { 25, 0.010 },
+                    { 26, 0.010 }, { 27, 0.010 }, { 28, 0.020 }, { 29, 0.020 },
+                    { 30, 0.020 }, { 31, 0.010 }, { 32, 0.630 },
+                };
+            }
+
+            throw std::invalid_argument("unknown length profile: " + name);
+        }
+
+        /**
+         * Parse a histogram of the form "24:58,22:11,32:5".
+         *
+         * @param std::string histogram specification
+         * @return length_histogram of (prefix length, weight)
+         */
+        length_histogram parse_histogram(const std::string &spec)
+        {
+            length_histogram lengths;
+            std::vector<std::string> entries;
+            ba::split(entries, spec, boost::is_any_of(","));
+
+            for (auto &entry : entries)
+            {
+                std::vector<std::string> parts;
+                ba::split(parts, entry, boost::is_any_of(":"));
+
+                if (parts.size() != 2)
+                    throw std::invalid_argument("bad histogram entry: " + entry);
+
+                size_t length = boost::lexical_cast<size_t>(parts[0]);
+                double weight = boost::lexical_cast<double>(parts[1]);
+
+                if (length < 1 || length > 32)
+                    throw std::invalid_argument("bad prefix length: " + entry);
+
+                lengths.emplace_back(length, weight);
+            }
+
+            return lengths;
+        }
+
+        /**
+         * Generate a list of prefixes. A fraction of them is placed inside a
+         * shorter, previously generated prefix so the list has realistic
+         * nesting, and a fraction repeats an earlier entry as a dirty feed
+         * would.
+         *
+         * @param options count, length histogram, nesting and seed
+         * @return vector of prefixes in generation order
+         */
+        std::vector<prefix> prefixes(const options &opts)
+        {
+            std::mt19937 rng(opts.seed);
+            std::vector<double> weights;
+
+            for (auto &l : opts.lengths)
+                weights.push_back(l.second);
+
+            std::discrete_distribution<size_t> pick_length(weights.begin(), weights.end());
+            std::uniform_int_distribution<in_addr_t> pick_addr(lowest_addr, highest_addr);
+            std::uniform_real_distribution<double> coin(0.0, 1.0);
+
+            std::vector<prefix> result;
+            result.reserve(opts.count);
+
+            while (result.size() < opts.count)
+            {
+                if (!result.empty() && coin(rng) < opts.duplicates)
+                {
+                    result.push_back(result[rng() % result.size()]);
+                    continue;
+                }
+
+                size_t length = opts.lengths[pick_length(rng)].first;
+                in_addr_t addr = pick_addr(rng);
+
+                if (!result.empty() && coin(rng) < opts.nested)
+                {
+                    for (int attempt = 0; attempt < 8; attempt++)
+                    {
+                        const prefix &parent = result[rng() % result.size()];
+
+                        if (parent.length < length)
+                        {
+                            addr = parent.addr | (addr & ~netmask(parent.length));
+                            break;
+                        }
+                    }
+                }
+
+                result.push_back(prefix{ addr & netmask(length), length });
+            }
+
+            return result;
+        }
+
+        /**
+         * Generate a query trace against a prefix list. Hits pick a prefix by
+         * Zipf-distributed rank, so a few prefixes are very hot, and then a
+         * random host inside it; misses come from 240.0.0.0/4.
+         *
+         * @param vector<prefix> prefixes the trace should hit
+         * @param query_options count, hit rate, Zipf exponent and seed
+         * @return vector of host byte order addresses
+         */
+        std::vector<in_addr_t> queries(const std::vector<prefix> &stored,
+                                       const query_options &opts)
+        {
+            std::mt19937 rng(opts.seed);
+            std::uniform_real_distribution<double> coin(0.0, 1.0);
+            std::vector<in_addr_t> result;
+            result.reserve(opts.count);
+
+            // rank order independent of generation order
+            std::vector<size_t> ranked(stored.size());
+            for (size_t i = 0; i < ranked.size(); i++) ranked[i] = i;
+            std::shuffle(ranked.begin(), ranked.end(), rng);
+
+            zipf_distribution pick_rank(std::max<size_t>(stored.size(), 1), opts.zipf);
+
+            while (result.size() < opts.count)
+            {
+                if (stored.empty() || coin(rng) >= opts.hit_rate)
+                {
+                    result.push_back(miss_network | (rng() & ~netmask(4)));
+                    continue;
+                }
+
+                const prefix &p = stored[ranked[pick_rank(rng) - 1]];
+                result.push_back(p.addr | (rng() & ~netmask(p.length)));
+            }
+
+            return result;
+        }
+
+        /**
+         * @param prefix
+         * @return std::string CIDR notation
+         */
+        std::string to_cidr(const prefix &p)
+        {
+            return to_ip(p.addr) + "/" + std::to_string(p.length);
+        }
+
+        /**
+         * @param in_addr_t host byte order address
+         * @return std::string dotted quad
+         */
+        std::string to_ip(in_addr_t addr)
+        {
+            std::ostringstream ip;
+            ip << (addr >> 24) << "." << ((addr >> 16) & 0xff) << "."
+               << ((addr >> 8) & 0xff) << "." << (addr & 0xff);
+            return ip.str();
+        }
+    }
+}
@@ -0,0 +1,415 @@
+#include <cstring>
+#include <stdexcept>
+#include "cidr_db.hpp"
+#include "cidr_merge.hpp"
+#include "trace.hpp"
+
+
+namespace cidr
+{
+    namespace merge
+    {
+        namespace
+        {
+            const size_t record_size = sizeof(size_t) + sizeof(in_addr_t);
+            const size_t buffer_records = 1 << 16;
+
+            /**
+             * Walk two sorted record streams in lockstep, calling exactly one
+             * of the three handlers for every distinct record.
+             */
+            template <typename OnlyA, typename OnlyB, typename Both>
+            void merge_records(const fs::path &a, const fs::path &b,
+                               OnlyA only_a, OnlyB only_b, Both both)
+            {
+                record_reader left(a);
+                record_reader right(b);
+                record l, r;
+
+                bool have_l = left.next(l);
+                bool have_r = right.next(r);
+
+                while (have_l && have_r)
+                {
+                    if (l < r)
+                    {
+                        only_a(l);
+                        have_l = left.next(l);
+                    }
+                    else if (r < l)
+                    {
+                        only_b(r);
+                        have_r = right.next(r);
+                    }
+                    else
+                    {
+                        both(l);
+                        have_l = left.next(l);
+                        have_r = right.next(r);
+                    }
+                }
+
+                for (; have_l; have_l = left.next(l))
+                    only_a(l);
+
+                for (; have_r; have_r = right.next(r))
+                    only_b(r);
+            }
+        }
+
+        /**
+         * Constructor for a buffered reader over a compiled CIDR datafile.
+         *
+         * @param boost::filesystem::path indicates path to compiled CIDR datafile
+         */
+        record_reader::record_reader(const fs::path &db_filename)
+            : filename(db_filename),
+              infile(db_filename.c_str(), std::ios::in|std::ios::binary),
+              buffer(buffer_records * record_size),
+              position(0),
+              available(0),
+              have_last(false)
+        {
+            if (!infile)
+                throw std::runtime_error("Can't open " + db_filename.string());
+        }
+
+        /**
+         * Read the next valid record. Files must be in commit() order; a
+         * record out of order throws, and repeated records are skipped.
+         *
+         * @param record to fill
+         * @return bool false at end of file
+         */
+        bool record_reader::next(record &out)
+        {
+            for (;;)
+            {
+                if (available - position < record_size && !fill())
+                    return false;
+
+                std::memcpy(&out.offset, &buffer[position], sizeof out.offset);
+                std::memcpy(&out.shifted_bits, &buffer[position + sizeof out.offset],
+                            sizeof out.shifted_bits);
+                position += record_size;
+
+                if (out.shifted_bits == 0 || 31 < out.offset)
+                    continue;
+
+                if (have_last)
+                {
+                    if (out == last)
+                        continue;
+
+                    if (out < last)
+                        throw std::runtime_error(filename.string()
+                            + " is not sorted; rewrite it with cidrdb_cli or db::commit");
+                }
+
+                CIDR_TRACE(trace::verbose, "merge read", out.shifted_bits, out.offset);
+
+                last = out;
+                have_last = true;
+                return true;
+            }
+        }
+
+        bool record_reader::fill()
+        {
+            size_t remaining = available - position;
+            std::memmove(&buffer[0], &buffer[position], remaining);
+            position = 0;
+            available = remaining;
+
+            infile.read(&buffer[available], buffer.size() - available);
+            available += infile.gcount();
+
+            return available >= record_size;
+        }
+
+        /**
+         * Constructor for a buffered writer of a compiled CIDR datafile.
+         *
+         * @param boost::filesystem::path indicates path to compiled CIDR datafile
+         */
+        record_writer::record_writer(const fs::path &db_filename)
+            : outfile(db_filename.c_str(), std::ios::out|std::ios::binary),
+              buffer(buffer_records * record_size),
+              position(0)
+        {
+            if (!outfile)
+                throw std::runtime_error("Can't write " + db_filename.string());
+        }
+
+        record_writer::~record_writer()
+        {
+            close();
+        }
+
+        void record_writer::write(const record &r)
+        {
+            if (buffer.size() - position < record_size)
+            {
+                outfile.write(&buffer[0], position);
+                position = 0;
+            }
+
+            std::memcpy(&buffer[position], &r.offset, sizeof r.offset);
+            std::memcpy(&buffer[position + sizeof r.offset], &r.shifted_bits,
+                        sizeof r.shifted_bits);
+            position += record_size;
+        }
+
+        void record_writer::close()
+        {
+            if (!outfile.is_open())
+                return;
+
+            outfile.write(&buffer[0], position);
+            position = 0;
+            outfile.close();
+        }
+
+        /**
+         * @param std::string one of diff, union, intersect
+         * @return operation
+         */
+        operation parse_operation(const std::string &name)
+        {
+            if (name == "diff") return difference;
+            if (name == "union") return union_of;
+            if (name == "intersect") return intersection;
+
+            throw std::invalid_argument("unknown merge operation: " + name);
+        }
+
+        /**
+         * @param record
+         * @return std::string CIDR notation
+         */
+        std::string to_cidr(const record &r)
+        {
+            in_addr_t addr_stib = htonl(r.shifted_bits << r.offset);
+            char ip_address[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &addr_stib, ip_address, sizeof ip_address);
+            return std::string(ip_address) + "/" + std::to_string(32 - r.offset);
+        }
+
+        /**
+         * Merge two compiled CIDR datafiles into a new one with constant
+         * memory: A \ B, A | B or A & B.
+         *
+         * @param boost::filesystem::path first database (A)
+         * @param boost::filesystem::path second database (B)
+         * @param operation to apply
+         * @param boost::filesystem::path output database
+         * @return size_t number of records written
+         */
+        size_t to_db(const fs::path &a, const fs::path &b,
+                     operation op, const fs::path &out)
+        {
+            record_writer writer(out);
+            size_t written = 0;
+
+            auto keep = [&writer, &written](const record &r)
+            {
+                writer.write(r);
+                written++;
+            };
+            auto drop = [](const record &) { };
+
+            if (op == difference)
+                merge_records(a, b, keep, drop, drop);
+            else if (op == union_of)
+                merge_records(a, b, keep, keep, keep);
+            else
+                merge_records(a, b, drop, drop, keep);
+
+            writer.close();
+            return written;
+        }
+
+        /**
+         * Merge two compiled CIDR datafiles into a mutation stream of
+         * "+<cidr>" and "-<cidr>" lines that turns A into the result:
+         *
+         *   diff      -- turns A into B (-A\B, +B\A)
+         *   union     -- turns A into A | B (+B\A)
+         *   intersect -- turns A into A & B (-A\B)
+         *
+         * @param boost::filesystem::path first database (A)
+         * @param boost::filesystem::path second database (B)
+         * @param operation to apply
+         * @param std::ostream for the mutation lines
+         * @return size_t number of mutations written
+         */
+        size_t to_stream(const fs::path &a, const fs::path &b,
+                         operation op, std::ostream &out)
+        {
+            size_t written = 0;
+
+            auto add = [&out, &written](const record &r)
+            {
+                out << '+' << to_cidr(r) << '\n';
+                written++;
+            };
+            auto remove = [&out, &written](const record &r)
+            {
+                out << '-' << to_cidr(r) << '\n';
+                written++;
+            };
+            auto ignore = [](const record &) { };
+
+            if (op == difference)
+                merge_records(a, b, remove, add, ignore);
+            else if (op == union_of)
+                merge_records(a, b, ignore, add, ignore);
+            else
+                merge_records(a, b, remove, ignore, ignore);
+
+            return written;
+        }
+
+        /**
+         * Compute the mutations that turn one raw CIDR list into another.
+         * Both lists are compiled to sorted datafiles first, so the result
+         * does not depend on the order or duplicates within either list.
+         *
+         * @param boost::filesystem::path previous CIDR list
+         * @param boost::filesystem::path current CIDR list
+         * @param std::ostream for the "+<cidr>" / "-<cidr>" lines
+         * @return size_t number of mutations written
+         */
+        size_t delta(const fs::path &old_list, const fs::path &new_list,
+                     std::ostream &out)
+        {
+            fs::path old_db(fs::temp_directory_path() / fs::unique_path("cidrdb-%%%%-%%%%.cdb"));
+            fs::path new_db(fs::temp_directory_path() / fs::unique_path("cidrdb-%%%%-%%%%.cdb"));
+
+            try
+            {
+                db::build(old_list, old_db);
+                db::build(new_list, new_db);
+
+                size_t written = to_stream(old_db, new_db, difference, out);
+
+                fs::remove(old_db);
+                fs::remove(new_db);
+                return written;
+            }
+            catch (...)
+            {
+                boost::system::error_code ignored;
+                fs::remove(old_db, ignored);
+                fs::remove(new_db, ignored);
+                throw;
+            }
+        }
+
+        /**
+         * Apply the changes between two raw CIDR lists to an existing
+         * compiled datafile in one sequential pass, without loading it:
+         * records of the datafile and of new \ old are merged into a file
+         * next to it, skipping those of old \ new, which then replaces it.
+         * Memory stays constant however large the datafile is.
+         *
+         * @param boost::filesystem::path previous CIDR list
+         * @param boost::filesystem::path current CIDR list
+         * @param boost::filesystem::path compiled CIDR datafile to update
+         * @return size_t number of changes between the lists
+         * @throw std::runtime_error if the datafile can't be read
+         */
+        size_t apply_delta(const fs::path &old_list, const fs::path &new_list,
+                           const fs::path &db_filename)
+        {
+            if (!fs::is_regular_file(db_filename))
+                throw std::runtime_error("No such database: " + db_filename.string());
+
+            fs::path old_db(fs::temp_directory_path() / fs::unique_path("cidrdb-%%%%-%%%%.cdb"));
+            fs::path new_db(fs::temp_directory_path() / fs::unique_path("cidrdb-%%%%-%%%%.cdb"));
+            fs::path added(fs::temp_directory_path() / fs::unique_path("cidrdb-%%%%-%%%%.cdb"));
+            fs::path removed(fs::temp_directory_path() / fs::unique_path("cidrdb-%%%%-%%%%.cdb"));
+            fs::path updated(db_filename.string() + fs::unique_path(".%%%%-%%%%").string());
+
+            try
+            {
+                db::build(old_list, old_db);
+                db::build(new_list, new_db);
+
+                size_t changes = to_db(new_db, old_db, difference, added)
+                    + to_db(old_db, new_db, difference, removed);
+
+                {
+                    record_writer writer(updated);
+                    record_reader removals(removed);
+                    record removal;
+                    bool have_removal = removals.next(removal);
+
+                    // both inputs of the merge are sorted, so is its output
+                    auto keep = [&](const record &r)
+                    {
+                        while (have_removal && removal < r)
+                            have_removal = removals.next(removal);
+
+                        if (!have_removal || !(removal == r))
+                            writer.write(r);
+                    };
+
+                    merge_records(db_filename, added, keep, keep, keep);
+                    writer.close();
+                }
+
+                fs::rename(updated, db_filename);
+
+                for (auto &path : { old_db, new_db, added, removed })
+                    fs::remove(path);
+
+                return changes;
+            }
+            catch (...)
+            {
+                boost::system::error_code ignored;
+                for (auto &path : { old_db, new_db, added, removed, updated })
+                    fs::remove(path, ignored);
+                throw;
+            }
+        }
+
+        /**
+         * Parse a mutation stream. Blank lines are skipped; anything else
+         * must be "+<cidr>" or "-<cidr>". Nothing is returned for a stream
+         * with a bad line, so callers can apply all or nothing.
+         *
+         * @param std::istream of mutation lines
+         * @param vector<mutation> to store the mutations
+         * @throw std::invalid_argument naming the first bad line
+         */
+        void parse_mutations(std::istream &in, std::vector<mutation> &mutations)
+        {
+            std::vector<mutation> parsed;
+            std::string line;
+            size_t line_number = 0;
+
+            while (std::getline(in, line))
+            {
+                line_number++;
+
+                if (!line.empty() && line.back() == '\r')
+                    line.pop_back();
+
+                if (line.empty())
+                    continue;
+
+                std::string cidr(line.substr(1));
+
+                if ((line[0] != '+' && line[0] != '-') || !db::valid_cidr(cidr))
+                    throw std::invalid_argument("bad mutation on line "
+                        + std::to_string(line_number) + ": " + line);
+
+                parsed.push_back(mutation{ line[0] == '+', cidr });
+            }
+
+            mutations.insert(mutations.end(), parsed.begin(), parsed.end());
+        }
+    }
+}
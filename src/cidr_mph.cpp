@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <stdexcept>
+#include "cidr_mph.hpp"
+#include "trace.hpp"
+
+
+namespace cidr
+{
+    namespace mph
+    {
+        namespace
+        {
+            const size_t keys_per_bucket = 3;
+            const size_t max_seeds = 64;
+
+            /**
+             * One attempt at placing every bucket with the given seed.
+             *
+             * @return bool false if some bucket found no pilot
+             */
+            bool place(const std::vector<in_addr_t> &keys, table &t)
+            {
+                size_t bucket_count = t.pilots.size();
+                size_t slot_count = t.slots.size();
+
+                // counting sort of keys into buckets
+                std::vector<uint32_t> starts(bucket_count + 1, 0);
+                std::vector<uint64_t> hashes(keys.size());
+
+                for (size_t i = 0; i < keys.size(); i++)
+                {
+                    hashes[i] = mix(keys[i] ^ t.seed);
+                    starts[(hashes[i] >> 32) % bucket_count + 1]++;
+                }
+
+                for (size_t b = 0; b < bucket_count; b++)
+                    starts[b + 1] += starts[b];
+
+                std::vector<uint64_t> grouped(keys.size());
+                std::vector<uint32_t> fill(starts.begin(), starts.end() - 1);
+
+                for (size_t i = 0; i < keys.size(); i++)
+                    grouped[fill[(hashes[i] >> 32) % bucket_count]++] = i;
+
+                // largest buckets first, while the table is still empty
+                std::vector<uint32_t> order(bucket_count);
+                for (size_t b = 0; b < bucket_count; b++) order[b] = b;
+
+                std::stable_sort(order.begin(), order.end(),
+                    [&starts](uint32_t a, uint32_t b)
+                    {
+                        return starts[a + 1] - starts[a] > starts[b + 1] - starts[b];
+                    });
+
+                std::vector<bool> taken(slot_count, false);
+                std::vector<size_t> positions;
+
+                for (uint32_t b : order)
+                {
+                    size_t size = starts[b + 1] - starts[b];
+
+                    if (size == 0)
+                        break;
+
+                    bool placed = false;
+
+                    for (uint32_t pilot = 0; pilot <= 0xffff && !placed; pilot++)
+                    {
+                        uint64_t pilot_hash = mix(pilot);
+                        positions.clear();
+
+                        for (size_t j = starts[b]; j < starts[b + 1]; j++)
+                        {
+                            size_t p = (hashes[grouped[j]] ^ pilot_hash) % slot_count;
+
+                            if (taken[p] || std::find(positions.begin(), positions.end(), p)
+                                            != positions.end())
+                                break;
+
+                            positions.push_back(p);
+                        }
+
+                        if (positions.size() != size)
+                            continue;
+
+                        for (size_t j = 0; j < size; j++)
+                        {
+                            taken[positions[j]] = true;
+                            t.slots[positions[j]] = keys[grouped[starts[b] + j]];
+                        }
+
+                        t.pilots[b] = pilot;
+                        placed = true;
+                    }
+
+                    if (!placed)
+                        return false;
+                }
+
+                // An empty slot holds a key that hashes elsewhere, so it can
+                // never match a probe.
+                for (size_t p = 0; p < slot_count; p++)
+                {
+                    if (!taken[p])
+                        t.slots[p] = keys[0];
+                }
+
+                return true;
+            }
+        }
+
+        /**
+         * Build a perfect hash table over a set of distinct keys.
+         *
+         * @param vector<in_addr_t> distinct keys
+         * @return table
+         * @throw std::runtime_error if no seed works (duplicate keys)
+         */
+        table build(const std::vector<in_addr_t> &keys)
+        {
+            table t;
+
+            if (keys.empty())
+                return t;
+
+            for (size_t attempt = 0; attempt < max_seeds; attempt++)
+            {
+                t.seed = mix(attempt + 1);
+                t.pilots.assign(keys.size() / keys_per_bucket + 1, 0);
+                t.slots.assign(keys.size() + keys.size() / 50 + 1, 0);
+
+                if (place(keys, t))
+                {
+                    CIDR_TRACE(trace::debug, "mph built", keys.size(), attempt);
+                    return t;
+                }
+            }
+
+            throw std::runtime_error("perfect hash construction failed; duplicate keys?");
+        }
+    }
+}
@@ -0,0 +1,320 @@
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/thread/shared_lock_guard.hpp>
+#include "cidr_sharded_db.hpp"
+#include "trace.hpp"
+
+namespace ba = boost::algorithm;
+
+
+namespace cidr
+{
+    namespace
+    {
+        typedef boost::shared_lock_guard<boost::shared_mutex> read_lock;
+        typedef std::lock_guard<boost::shared_mutex> write_lock;
+
+        void parse(const std::string &cidr, in_addr_t &addr_bits, size_t &length)
+        {
+            std::vector<std::string> parts;
+            ba::split(parts, cidr, boost::is_any_of("/"));
+
+            addr_bits = inet_network(parts[0].c_str());
+            length = boost::lexical_cast<size_t>(parts[1].c_str());
+        }
+    }
+
+    /**
+     * Constructor for an empty cidr::sharded_db.
+     *
+     * @param size_t number of leading address bits that select a shard (1-16)
+     */
+    sharded_db::sharded_db(size_t shard_bits)
+        : shard_bits(shard_bits)
+    {
+        if (shard_bits < 1 || shard_bits > 16)
+            throw std::invalid_argument("shard bits must be between 1 and 16");
+
+        for (size_t i = 0; i < (1u << shard_bits); i++)
+            shards.emplace_back(new shard);
+    }
+
+    /**
+     * Constructor for cidr::sharded_db.
+     *
+     * @param boost::filesystem::path indicates path to compiled CIDR datafile
+     * @param size_t number of leading address bits that select a shard (1-16)
+     */
+    sharded_db::sharded_db(const fs::path &db_filename, size_t shard_bits)
+        : sharded_db(shard_bits)
+    {
+        this->db_filename = db_filename;
+
+        if (fs::exists(db_filename) && fs::file_size(db_filename) > 0)
+            read(db_filename);
+    }
+
+    /**
+     * Method to lookup CIDR entries for a given IP address, longest prefix
+     * first as with cidr::db.
+     *
+     * @param std::string IP address
+     * @param vector<string> to store CIDR results
+     */
+    void sharded_db::lookup(const std::string &ip_address, std::vector<std::string> &results) const
+    {
+        in_addr_t ip_bits = inet_network(ip_address.c_str());
+
+        {
+            const shard &s = *shards[ip_bits >> (32 - shard_bits)];
+            read_lock lock(s.mutex);
+            s.data.lookup(ip_address, results);
+        }
+
+        {
+            read_lock lock(top.mutex);
+            top.data.lookup(ip_address, results);
+        }
+    }
+
+    /**
+     * Method to add a new CIDR, locking only the shard it belongs to.
+     *
+     * @param std::string CIDR
+     */
+    void sharded_db::put(const std::string &cidr)
+    {
+        shard &s = route(cidr);
+        write_lock lock(s.mutex);
+        s.data.put(cidr);
+    }
+
+    /**
+     * Method to remove a CIDR, locking only the shard it belongs to.
+     *
+     * @param std::string CIDR
+     */
+    void sharded_db::del(const std::string &cidr)
+    {
+        shard &s = route(cidr);
+        write_lock lock(s.mutex);
+        s.data.del(cidr);
+    }
+
+    /**
+     * Method to verify a CIDR exists.
+     *
+     * @param std::string CIDR
+     */
+    bool sharded_db::has(const std::string &cidr) const
+    {
+        const shard &s = route(cidr);
+        read_lock lock(s.mutex);
+        return s.data.has(cidr);
+    }
+
+    /**
+     * Method to find every stored CIDR contained in a supernet.
+     *
+     * @param std::string CIDR of the supernet
+     * @param vector<string> to store CIDR results
+     */
+    void sharded_db::within(const std::string &cidr, std::vector<std::string> &results) const
+    {
+        within(cidr, [&results](const std::string &match)
+        {
+            results.push_back(match);
+        });
+    }
+
+    /**
+     * Method to stream every stored CIDR contained in a supernet to a
+     * visitor, in address order with shorter prefixes first. A supernet
+     * shorter than the shard width spans a run of shards; the top-level
+     * prefixes inside it are interleaved at the first shard they cover.
+     *
+     * @param std::string CIDR of the supernet
+     * @param cidr_visitor called once per contained CIDR
+     */
+    void sharded_db::within(const std::string &cidr, const cidr_visitor &visit) const
+    {
+        in_addr_t addr_bits;
+        size_t length;
+        parse(cidr, addr_bits, length);
+
+        if (length >= shard_bits)
+        {
+            const shard &s = *shards[addr_bits >> (32 - shard_bits)];
+            read_lock lock(s.mutex);
+            s.data.within(cidr, visit);
+            return;
+        }
+
+        std::vector<std::pair<size_t, std::string>> upper;
+        {
+            read_lock lock(top.mutex);
+            top.data.within(cidr, [this, &upper](const std::string &match)
+            {
+                in_addr_t match_bits;
+                size_t match_length;
+                parse(match, match_bits, match_length);
+                upper.emplace_back(match_bits >> (32 - shard_bits), match);
+            });
+        }
+
+        size_t first = (addr_bits >> (32 - length)) << (shard_bits - length);
+        size_t last = first + (1u << (shard_bits - length)) - 1;
+        auto next = upper.begin();
+
+        for (size_t i = first; i <= last; i++)
+        {
+            for (; next != upper.end() && next->first <= i; ++next)
+                visit(next->second);
+
+            const shard &s = *shards[i];
+            read_lock lock(s.mutex);
+            s.data.within(cidr, visit);
+        }
+
+        for (; next != upper.end(); ++next)
+            visit(next->second);
+    }
+
+    /**
+     * Method to find every stored CIDR that covers a CIDR, shortest prefix
+     * first.
+     *
+     * @param std::string CIDR
+     * @param vector<string> to store CIDR results
+     */
+    void sharded_db::covering(const std::string &cidr, std::vector<std::string> &results) const
+    {
+        covering(cidr, [&results](const std::string &match)
+        {
+            results.push_back(match);
+        });
+    }
+
+    /**
+     * Method to stream every stored CIDR that covers a CIDR to a visitor.
+     *
+     * @param std::string CIDR
+     * @param cidr_visitor called once per covering CIDR
+     */
+    void sharded_db::covering(const std::string &cidr, const cidr_visitor &visit) const
+    {
+        {
+            read_lock lock(top.mutex);
+            top.data.covering(cidr, visit);
+        }
+
+        in_addr_t addr_bits;
+        size_t length;
+        parse(cidr, addr_bits, length);
+
+        if (length >= shard_bits)
+        {
+            const shard &s = *shards[addr_bits >> (32 - shard_bits)];
+            read_lock lock(s.mutex);
+            s.data.covering(cidr, visit);
+        }
+    }
+
+    /**
+     * Method to commit the database to disk in the same sorted format as
+     * cidr::db::commit(). Every shard is read-locked for the duration so the
+     * file is a consistent image.
+     */
+    void sharded_db::commit() const
+    {
+        std::vector<std::unique_ptr<read_lock>> locks;
+        locks.emplace_back(new read_lock(top.mutex));
+        for (auto &s : shards)
+            locks.emplace_back(new read_lock(s->mutex));
+
+        std::ofstream dbfile(db_filename.c_str(), std::ios::out|std::ios::binary);
+
+        auto write = [&dbfile](const db &data, size_t offset)
+        {
+            if (data.cidrs[offset] == 0)
+                return;
+
+            for (in_addr_t shifted_bits : *data.cidrs[offset])
+            {
+                dbfile.write(reinterpret_cast<char*>( &offset ), sizeof offset);
+                dbfile.write(reinterpret_cast<char*>( &shifted_bits ), sizeof shifted_bits);
+            }
+        };
+
+        for (size_t offset = 0; offset < 32; offset++)
+        {
+            // shards hold prefixes of shard_bits or longer, in address order
+            if (32 - offset >= shard_bits)
+            {
+                for (auto &s : shards)
+                    write(s->data, offset);
+            }
+            else
+            {
+                write(top.data, offset);
+            }
+        }
+
+        dbfile.close();
+    }
+
+    const sharded_db::shard& sharded_db::route(const std::string &cidr) const
+    {
+        in_addr_t addr_bits;
+        size_t length;
+        parse(cidr, addr_bits, length);
+
+        if (length < shard_bits)
+            return top;
+
+        return *shards[addr_bits >> (32 - shard_bits)];
+    }
+
+    sharded_db::shard& sharded_db::route(const std::string &cidr)
+    {
+        return const_cast<shard&>(static_cast<const sharded_db*>(this)->route(cidr));
+    }
+
+    /**
+     * Method to read a CIDR database file, distributing records to shards
+     * without formatting and re-parsing them.
+     *
+     * @param boost::filesystem::path indicates path to compiled CIDR datafile
+     */
+    void sharded_db::read(const fs::path &db_filename)
+    {
+        std::ifstream infile(db_filename.c_str(), std::ios::in|std::ios::binary);
+
+        size_t offset;
+        in_addr_t shifted_bits;
+
+        while (infile.read( (char*)&offset, sizeof(size_t) )
+               && infile.read( (char*)&shifted_bits, sizeof(in_addr_t) ))
+        {
+            if (shifted_bits == 0) continue;
+
+            if (31 < offset) continue;
+
+            CIDR_TRACE(trace::verbose, "sharded read", shifted_bits, offset);
+
+            db &data = 32 - offset >= shard_bits
+                ? shards[(shifted_bits << offset) >> (32 - shard_bits)]->data
+                : top.data;
+
+            if (data.cidrs[offset] == 0)
+                data.cidrs[offset] = std::make_shared<std::set<in_addr_t>>();
+
+            // commit() order is ascending, so appending is the common case
+            data.cidrs[offset]->emplace_hint(data.cidrs[offset]->end(), shifted_bits);
+            data.populated |= 1u << offset;
+        }
+    }
+}
@@ -0,0 +1,254 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cidr_db.hpp"
+#include "cidr_shm.hpp"
+#include "trace.hpp"
+
+
+namespace cidr
+{
+    namespace shm
+    {
+        namespace
+        {
+            std::runtime_error system_error(const std::string &what)
+            {
+                return std::runtime_error(what + ": " + std::strerror(errno));
+            }
+
+            size_t align(size_t n, size_t to)
+            {
+                return (n + to - 1) / to * to;
+            }
+        }
+
+        /**
+         * Constructor for cidr::shm::publisher. An existing control segment
+         * is taken over, so generations keep increasing across restarts.
+         *
+         * @param std::string segment name, without the leading slash
+         * @throw std::runtime_error if the control segment can't be mapped
+         */
+        publisher::publisher(const std::string &name)
+            : name(name)
+        {
+            int fd = shm_open(segment_name(name).c_str(), O_CREAT | O_RDWR, 0644);
+            if (fd < 0)
+                throw system_error("shm_open " + segment_name(name));
+
+            struct stat st;
+            if (fstat(fd, &st) < 0
+                || (st.st_size < (off_t)sizeof(control) && ftruncate(fd, sizeof(control)) < 0))
+            {
+                close(fd);
+                throw system_error("resize " + segment_name(name));
+            }
+
+            void *p = mmap(nullptr, sizeof(control), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            close(fd);
+
+            if (p == MAP_FAILED)
+                throw system_error("mmap " + segment_name(name));
+
+            ctl = static_cast<control*>(p);
+
+            if (std::memcmp(ctl->magic, control_magic, sizeof control_magic) == 0)
+            {
+                current = ctl->generation.load(std::memory_order_relaxed);
+            }
+            else
+            {
+                ctl->sequence.store(0, std::memory_order_relaxed);
+                ctl->generation.store(0, std::memory_order_relaxed);
+                ctl->size.store(0, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+                std::memcpy(ctl->magic, control_magic, sizeof control_magic);
+            }
+        }
+
+        publisher::~publisher()
+        {
+            munmap(ctl, sizeof(control));
+        }
+
+        /**
+         * Method to copy out the keys at the prefix lengths that changed
+         * since the last published snapshot. Must not run concurrently with
+         * changes to the source.
+         *
+         * @param cidr::db database to publish
+         * @return snapshot for publish(); changed is false if there is
+         *         nothing new to publish
+         */
+        snapshot publisher::capture(const db &source)
+        {
+            snapshot changes;
+            changes.changed = &source != last_source;
+
+            for (size_t offset = 0; offset < 32; offset++)
+            {
+                const std::set<in_addr_t> *keys = source.cidrs[offset].get();
+
+                if (&source != last_source || source.versions[offset] != versions[offset])
+                {
+                    if (keys != nullptr)
+                        changes.keys[offset].assign(keys->begin(), keys->end());
+                    changes.rebuild |= 1u << offset;
+                    changes.changed = true;
+                }
+
+                if (keys != nullptr && !keys->empty())
+                {
+                    changes.populated |= 1u << offset;
+                    changes.count += keys->size();
+                }
+            }
+
+            std::copy(std::begin(source.versions), std::end(source.versions),
+                      std::begin(changes.versions));
+            changes.source = &source;
+            return changes;
+        }
+
+        /**
+         * Method to build the tables of a captured snapshot and write them
+         * as the next generation. Doesn't touch the source database.
+         *
+         * @param snapshot changes from capture()
+         * @return bool whether a new generation was written
+         * @throw std::runtime_error if the snapshot segment can't be written
+         */
+        bool publisher::publish(const snapshot &changes)
+        {
+            if (!changes.changed)
+                return false;
+
+            for (size_t offset = 0; offset < 32; offset++)
+            {
+                if (changes.rebuild & (1u << offset))
+                {
+                    tables[offset] = changes.keys[offset].empty()
+                        ? mph::table()
+                        : mph::build(changes.keys[offset]);
+                }
+            }
+
+            write(changes.populated, changes.count);
+
+            // only now are these keys in shared memory; had the write
+            // thrown, the next capture would still see them as changed
+            std::copy(std::begin(changes.versions), std::end(changes.versions),
+                      std::begin(versions));
+            last_source = changes.source;
+            return true;
+        }
+
+        /**
+         * Method to publish a snapshot of a database if it changed since the
+         * last call: capture() and publish() in one go. Must not run
+         * concurrently with changes to the source.
+         *
+         * @param cidr::db database to publish
+         * @return bool whether a new generation was written
+         * @throw std::runtime_error if the snapshot segment can't be written
+         */
+        bool publisher::publish(const db &source)
+        {
+            return publish(capture(source));
+        }
+
+        /**
+         * Write the tables as the next generation, point the control segment
+         * at it and unlink the previous one.
+         */
+        void publisher::write(uint32_t populated, uint64_t count)
+        {
+            image header;
+            std::memset(&header, 0, sizeof header);
+            std::memcpy(header.magic, image_magic, sizeof image_magic);
+            header.populated = populated;
+            header.count = count;
+
+            size_t size = sizeof(image);
+
+            for (size_t offset = 0; offset < 32; offset++)
+            {
+                if (!(populated & (1u << offset)))
+                    continue;
+
+                length_table &t = header.tables[offset];
+                t.seed = tables[offset].seed;
+                t.pilot_count = tables[offset].pilots.size();
+                t.slot_count = tables[offset].slots.size();
+                t.pilots = size;
+                size = align(size + t.pilot_count * sizeof(uint16_t), sizeof(in_addr_t));
+                t.slots = size;
+                size = align(size + t.slot_count * sizeof(in_addr_t), 8);
+            }
+
+            uint64_t next = current + 1;
+            std::string segment = segment_name(name, next);
+
+            // a crashed publisher may have left this generation half written
+            shm_unlink(segment.c_str());
+
+            int fd = shm_open(segment.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+            if (fd < 0)
+                throw system_error("shm_open " + segment);
+
+            if (ftruncate(fd, size) < 0)
+            {
+                close(fd);
+                shm_unlink(segment.c_str());
+                throw system_error("resize " + segment);
+            }
+
+            void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            close(fd);
+
+            if (p == MAP_FAILED)
+            {
+                shm_unlink(segment.c_str());
+                throw system_error("mmap " + segment);
+            }
+
+            char *base = static_cast<char*>(p);
+            std::memcpy(base, &header, sizeof header);
+
+            for (size_t offset = 0; offset < 32; offset++)
+            {
+                if (!(populated & (1u << offset)))
+                    continue;
+
+                const length_table &t = header.tables[offset];
+                std::memcpy(base + t.pilots, tables[offset].pilots.data(),
+                            t.pilot_count * sizeof(uint16_t));
+                std::memcpy(base + t.slots, tables[offset].slots.data(),
+                            t.slot_count * sizeof(in_addr_t));
+            }
+
+            munmap(p, size);
+
+            uint32_t sequence = ctl->sequence.load(std::memory_order_relaxed);
+            ctl->sequence.store(sequence + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            ctl->generation.store(next, std::memory_order_relaxed);
+            ctl->size.store(size, std::memory_order_relaxed);
+            ctl->sequence.store(sequence + 2, std::memory_order_release);
+
+            if (current > 0)
+                shm_unlink(segment_name(name, current).c_str());
+
+            current = next;
+
+            CIDR_TRACE(trace::info, "shm published", next, count);
+        }
+    }
+}
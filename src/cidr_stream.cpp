@@ -0,0 +1,439 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <boost/algorithm/string.hpp>
+#include "cidr_stream.hpp"
+#include "trace.hpp"
+
+
+namespace cidr
+{
+    namespace stream
+    {
+        namespace
+        {
+            const size_t jobs_per_thread = 4;
+
+            typedef std::function<void(const char *begin, const char *end,
+                                       std::string &out)> block_function;
+
+            /**
+             * Call a function for each line of a block, without the line
+             * break (and without a trailing carriage return).
+             */
+            template <typename F>
+            void each_line(const char *begin, const char *end, F f)
+            {
+                while (begin < end)
+                {
+                    const char *eol = static_cast<const char*>(std::memchr(begin, '\n', end - begin));
+                    if (eol == nullptr)
+                        eol = end;
+
+                    const char *last = eol;
+                    if (last > begin && last[-1] == '\r')
+                        last--;
+
+                    f(begin, last);
+                    begin = eol + 1;
+                }
+            }
+
+            /**
+             * Append "<cidr><separator><cidr>..." for an address, longest
+             * prefix first; nothing if there is no match or no address.
+             */
+            void append_matches(const db &cidr_db, const std::string &ip, char separator,
+                                std::vector<std::string> &results, std::string &out)
+            {
+                if (!db::valid_ip(ip))
+                    return;
+
+                results.clear();
+                cidr_db.lookup(ip, results);
+
+                for (size_t i = 0; i < results.size(); i++)
+                {
+                    if (i > 0) out.push_back(separator);
+                    out.append(results[i]);
+                }
+            }
+
+            /**
+             * Look up every line of a block of input and append
+             * "<ip>\t<cidr>,<cidr>..." lines; an address with no match, or
+             * that isn't one, gets an empty second column.
+             */
+            void lookup_block(const db &cidr_db, const char *begin, const char *end, std::string &out)
+            {
+                std::vector<std::string> results;
+                std::string ip;
+
+                out.reserve((end - begin) * 2);
+
+                each_line(begin, end, [&](const char *line, const char *line_end)
+                {
+                    if (line == line_end)
+                        return;
+
+                    ip.assign(line, line_end);
+                    out.append(ip);
+                    out.push_back('\t');
+                    append_matches(cidr_db, ip, ',', results, out);
+                    out.push_back('\n');
+                });
+            }
+
+            /**
+             * Copy every line of a block of delimited text through and
+             * append one column with the CIDRs matching the address in the
+             * chosen field, separated by spaces. Only that field is
+             * parsed; quoting is not interpreted.
+             */
+            void join_block(const db &cidr_db, const join_options &join,
+                            const char *begin, const char *end, std::string &out)
+            {
+                std::vector<std::string> results;
+                std::string ip;
+
+                out.reserve((end - begin) + (end - begin) / 2);
+
+                each_line(begin, end, [&](const char *line, const char *line_end)
+                {
+                    if (line == line_end)
+                    {
+                        out.push_back('\n');
+                        return;
+                    }
+
+                    const char *field = line;
+
+                    for (size_t i = 1; i < join.field && field != nullptr; i++)
+                    {
+                        field = static_cast<const char*>(std::memchr(field, join.delimiter, line_end - field));
+                        if (field != nullptr) field++;
+                    }
+
+                    out.append(line, line_end);
+                    out.push_back(join.delimiter);
+
+                    if (field != nullptr)
+                    {
+                        const char *field_end = static_cast<const char*>(
+                            std::memchr(field, join.delimiter, line_end - field));
+
+                        ip.assign(field, field_end ? field_end : line_end);
+                        boost::algorithm::trim_if(ip, boost::algorithm::is_any_of(" \""));
+                        append_matches(cidr_db, ip, ' ', results, out);
+                    }
+
+                    out.push_back('\n');
+                });
+            }
+
+            /**
+             * Read a stream in large blocks cut at line boundaries and
+             * submit each block to a pool.
+             *
+             * @return size_t number of bytes read
+             */
+            size_t read_blocks(std::istream &in, size_t block_bytes,
+                               ordered_pool &pool, const block_function &f)
+            {
+                std::string carry;
+                size_t total = 0;
+
+                for (;;)
+                {
+                    std::shared_ptr<std::string> block(new std::string);
+                    block->swap(carry);
+
+                    size_t have = block->size();
+                    block->resize(have + block_bytes);
+                    in.read(&(*block)[have], block_bytes);
+
+                    size_t got = in.gcount();
+                    block->resize(have + got);
+                    total += got;
+
+                    bool done = got == 0 || !in;
+
+                    // hand over whole lines; the tail waits for the next read
+                    if (!done)
+                    {
+                        size_t last = block->rfind('\n');
+
+                        if (last == std::string::npos)
+                        {
+                            carry.swap(*block);
+                            continue;
+                        }
+
+                        carry.assign(*block, last + 1, std::string::npos);
+                        block->resize(last + 1);
+                    }
+
+                    if (!block->empty())
+                    {
+                        pool.submit([&f, block](std::string &result)
+                        {
+                            f(block->data(), block->data() + block->size(), result);
+                        });
+                    }
+
+                    if (done)
+                        break;
+                }
+
+                pool.finish();
+
+                return total;
+            }
+        }
+
+        /**
+         * Constructor for cidr::stream::ordered_pool.
+         *
+         * @param size_t number of worker threads (0 = hardware threads)
+         * @param std::ostream to write job output to
+         */
+        ordered_pool::ordered_pool(size_t threads, std::ostream &out)
+            : out(out)
+        {
+            if (threads == 0)
+                threads = std::max(1u, std::thread::hardware_concurrency());
+
+            for (size_t i = 0; i < threads; i++)
+                workers.emplace_back(&ordered_pool::work, this);
+        }
+
+        ordered_pool::~ordered_pool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+                queue.clear();
+            }
+
+            ready.notify_all();
+
+            for (auto &t : workers)
+                t.join();
+        }
+
+        /**
+         * Method to queue a job, first writing out the oldest result if the
+         * window of jobs in flight is full.
+         *
+         * @param job fills a string with output
+         */
+        void ordered_pool::submit(job j)
+        {
+            while (pending.size() >= workers.size() * jobs_per_thread)
+                write_oldest();
+
+            std::packaged_task<std::string()> task([j]()
+            {
+                std::string result;
+                j(result);
+                return result;
+            });
+
+            pending.push_back(task.get_future());
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                queue.push_back(std::move(task));
+            }
+
+            ready.notify_one();
+        }
+
+        /**
+         * Method to wait for every submitted job and write its output.
+         */
+        void ordered_pool::finish()
+        {
+            while (!pending.empty())
+                write_oldest();
+
+            out.flush();
+        }
+
+        void ordered_pool::write_oldest()
+        {
+            std::future<std::string> result(std::move(pending.front()));
+            pending.pop_front();
+
+            std::string data(result.get());
+            out.write(data.data(), data.size());
+        }
+
+        void ordered_pool::work()
+        {
+            for (;;)
+            {
+                std::packaged_task<std::string()> task;
+
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    ready.wait(lock, [this] { return stopping || !queue.empty(); });
+
+                    if (stopping)
+                        return;
+
+                    task = std::move(queue.front());
+                    queue.pop_front();
+                }
+
+                task();
+            }
+        }
+
+        /**
+         * Look up one IP address per input line and write each with its
+         * matching CIDRs, in input order. Input is read in large blocks cut
+         * at line boundaries, and blocks are looked up in parallel.
+         *
+         * @param cidr::db database to search
+         * @param std::istream one IP address per line
+         * @param std::ostream "<ip>\t<cidr>,..." lines
+         * @param options thread count and block size
+         * @return size_t number of bytes read
+         */
+        size_t lookup(const db &cidr_db, std::istream &in, std::ostream &out,
+                      const options &opts)
+        {
+            ordered_pool pool(opts.threads, out);
+
+            size_t total = read_blocks(in, opts.block_bytes, pool,
+                [&cidr_db](const char *begin, const char *end, std::string &result)
+                {
+                    lookup_block(cidr_db, begin, end, result);
+                });
+
+            CIDR_TRACE(trace::info, "stream lookup", total, pool.size());
+
+            return total;
+        }
+
+        /**
+         * Copy delimited text through with an extra column holding the
+         * CIDRs that match the IP address in one field, in input order.
+         *
+         * @param cidr::db database to search
+         * @param std::istream delimited text, one record per line
+         * @param std::ostream input lines with the extra column
+         * @param join_options field number and delimiter
+         * @param options thread count and block size
+         * @return size_t number of bytes read
+         */
+        size_t join(const db &cidr_db, std::istream &in, std::ostream &out,
+                    const join_options &join, const options &opts)
+        {
+            ordered_pool pool(opts.threads, out);
+
+            size_t total = read_blocks(in, opts.block_bytes, pool,
+                [&cidr_db, &join](const char *begin, const char *end, std::string &result)
+                {
+                    join_block(cidr_db, join, begin, end, result);
+                });
+
+            CIDR_TRACE(trace::info, "stream join", total, pool.size());
+
+            return total;
+        }
+
+        /**
+         * As join() over a stream, but the file is mapped into memory and
+         * split into blocks in place, so input is never copied before the
+         * workers read it.
+         *
+         * @param cidr::db database to search
+         * @param boost::filesystem::path delimited text, one record per line
+         * @param std::ostream input lines with the extra column
+         * @param join_options field number and delimiter
+         * @param options thread count and block size
+         * @return size_t number of bytes read
+         * @throw std::runtime_error if the file can't be mapped
+         */
+        size_t join(const db &cidr_db, const fs::path &input, std::ostream &out,
+                    const join_options &join, const options &opts)
+        {
+            int fd = ::open(input.c_str(), O_RDONLY);
+
+            if (fd < 0)
+                throw std::runtime_error("Failed to read: " + input.string());
+
+            struct stat st;
+
+            if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+            {
+                ::close(fd);
+                throw std::runtime_error("Not a regular file: " + input.string());
+            }
+
+            size_t size = st.st_size;
+
+            if (size == 0)
+            {
+                ::close(fd);
+                return 0;
+            }
+
+            void *mapped = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+
+            if (mapped == MAP_FAILED)
+                throw std::runtime_error("Failed to map: " + input.string());
+
+            ::madvise(mapped, size, MADV_SEQUENTIAL);
+
+            const char *data = static_cast<const char*>(mapped);
+
+            try
+            {
+                ordered_pool pool(opts.threads, out);
+
+                for (size_t start = 0; start < size; )
+                {
+                    size_t end = std::min(size, start + opts.block_bytes);
+
+                    if (end < size)
+                    {
+                        const char *eol = static_cast<const char*>(
+                            std::memchr(data + end, '\n', size - end));
+                        end = eol ? eol - data + 1 : size;
+                    }
+
+                    const char *begin = data + start;
+                    const char *finish = data + end;
+
+                    pool.submit([&cidr_db, &join, begin, finish](std::string &result)
+                    {
+                        join_block(cidr_db, join, begin, finish, result);
+                    });
+
+                    start = end;
+                }
+
+                pool.finish();
+
+                CIDR_TRACE(trace::info, "stream join", size, pool.size());
+            }
+            catch (...)
+            {
+                ::munmap(mapped, size);
+                throw;
+            }
+
+            ::munmap(mapped, size);
+
+            return size;
+        }
+    }
+}
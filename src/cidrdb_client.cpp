@@ -0,0 +1,173 @@
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "cidrdb_client.hpp"
+
+
+namespace cidr
+{
+    namespace shm
+    {
+        namespace
+        {
+            // enough for a publisher that unlinks each generation as we
+            // reach for it many times over
+            const int max_attempts = 100;
+
+            std::runtime_error system_error(const std::string &what)
+            {
+                return std::runtime_error(what + ": " + std::strerror(errno));
+            }
+        }
+
+        /**
+         * Constructor for cidr::shm::client.
+         *
+         * @param std::string segment name given to cidrdb_rest --shm
+         * @throw std::runtime_error if nothing has been published under it
+         */
+        client::client(const std::string &name)
+            : name(name)
+        {
+            int fd = shm_open(segment_name(name).c_str(), O_RDONLY, 0);
+            if (fd < 0)
+                throw system_error("shm_open " + segment_name(name));
+
+            void *p = mmap(nullptr, sizeof(control), PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+
+            if (p == MAP_FAILED)
+                throw system_error("mmap " + segment_name(name));
+
+            ctl = static_cast<const control*>(p);
+
+            if (std::memcmp(ctl->magic, control_magic, sizeof control_magic) != 0)
+            {
+                munmap(p, sizeof(control));
+                throw std::runtime_error(segment_name(name) + " is not a cidrdb segment");
+            }
+
+            try
+            {
+                refresh();
+            }
+            catch (...)
+            {
+                munmap(p, sizeof(control));
+                throw;
+            }
+        }
+
+        client::~client()
+        {
+            if (base != nullptr)
+                munmap(const_cast<char*>(base), mapped_size);
+
+            munmap(const_cast<control*>(ctl), sizeof(control));
+        }
+
+        /**
+         * Method to lookup the CIDRs containing an address, longest prefix
+         * first as with cidr::db.
+         *
+         * @param in_addr_t IP address bits in host byte order
+         * @param uint8_t* receives up to 32 prefix lengths
+         * @return size_t number of matches
+         */
+        size_t client::lookup(in_addr_t ip_bits, uint8_t *lengths)
+        {
+            if (ctl->generation.load(std::memory_order_acquire) != mapped_generation)
+                refresh();
+
+            size_t count = 0;
+
+            for (uint32_t populated = snapshot->populated; populated != 0;
+                 populated &= populated - 1)
+            {
+                size_t offset = __builtin_ctz(populated);
+                const length_table &t = snapshot->tables[offset];
+
+                in_addr_t key = ip_bits >> offset;
+                const uint16_t *pilots = reinterpret_cast<const uint16_t*>(base + t.pilots);
+                const in_addr_t *slots = reinterpret_cast<const in_addr_t*>(base + t.slots);
+
+                // same probe as mph::table::position()
+                uint64_t h = mph::mix(key ^ t.seed);
+                uint16_t pilot = pilots[(h >> 32) % t.pilot_count];
+
+                if (slots[(h ^ mph::mix(pilot)) % t.slot_count] == key)
+                    lengths[count++] = 32 - offset;
+            }
+
+            return count;
+        }
+
+        /**
+         * Map the generation the control segment currently names, read
+         * under its seqlock. A generation unlinked before we open it has
+         * already been replaced, so try again.
+         */
+        void client::refresh()
+        {
+            for (int attempt = 0; attempt < max_attempts; attempt++)
+            {
+                uint32_t sequence = ctl->sequence.load(std::memory_order_acquire);
+
+                if (sequence & 1)
+                {
+                    sched_yield();
+                    continue;
+                }
+
+                uint64_t generation = ctl->generation.load(std::memory_order_relaxed);
+                uint64_t size = ctl->size.load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+
+                if (ctl->sequence.load(std::memory_order_relaxed) != sequence)
+                    continue;
+
+                if (generation == 0)
+                    throw std::runtime_error(segment_name(name) + " has no snapshot yet");
+
+                int fd = shm_open(segment_name(name, generation).c_str(), O_RDONLY, 0);
+                if (fd < 0)
+                {
+                    if (errno == ENOENT)
+                        continue;
+
+                    throw system_error("shm_open " + segment_name(name, generation));
+                }
+
+                void *p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+                close(fd);
+
+                if (p == MAP_FAILED)
+                    throw system_error("mmap " + segment_name(name, generation));
+
+                const image *next = static_cast<const image*>(p);
+
+                if (size < sizeof(image)
+                    || std::memcmp(next->magic, image_magic, sizeof image_magic) != 0)
+                {
+                    munmap(p, size);
+                    throw std::runtime_error(segment_name(name, generation) + " is not a cidrdb snapshot");
+                }
+
+                if (base != nullptr)
+                    munmap(const_cast<char*>(base), mapped_size);
+
+                base = static_cast<const char*>(p);
+                snapshot = next;
+                mapped_size = size;
+                mapped_generation = generation;
+                return;
+            }
+
+            throw std::runtime_error("no stable snapshot in " + segment_name(name));
+        }
+    }
+}
@@ -0,0 +1,76 @@
+#include <iostream>
+#include <fstream>
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+#include "cidr_db.hpp"
+#include "cidr_gen.hpp"
+
+namespace fs = boost::filesystem;
+namespace po = boost::program_options;
+
+int main(int ac, char** av)
+{
+    cidr::gen::options opts;
+    cidr::gen::query_options query_opts;
+    std::string length_profile;
+
+    po::options_description desc("Parameters:");
+    desc.add_options()
+        ("count", po::value<size_t>(&opts.count)->default_value(100000), "number of CIDRs to generate")
+        ("profile", po::value<std::string>(&length_profile)->default_value("bgp"), "prefix length profile: bgp, blocklist")
+        ("histogram", po::value<std::string>(), "prefix length weights, e.g. 24:60,22:10,32:5 (overrides --profile)")
+        ("nested", po::value<double>(&opts.nested)->default_value(0.1), "fraction of CIDRs placed inside a shorter one")
+        ("duplicates", po::value<double>(&opts.duplicates)->default_value(0.0), "fraction of repeated CIDRs")
+        ("seed", po::value<unsigned>(&opts.seed)->default_value(1), "random seed")
+        ("out", po::value<std::string>(), "CIDR list output filename")
+        ("db", po::value<std::string>(), "also build this CIDR database from the list")
+        ("queries", po::value<size_t>(&query_opts.count)->default_value(0), "number of query IPs to generate")
+        ("trace", po::value<std::string>(), "query trace output filename")
+        ("hit-rate", po::value<double>(&query_opts.hit_rate)->default_value(0.9), "fraction of queries that match")
+        ("zipf", po::value<double>(&query_opts.zipf)->default_value(1.0), "Zipf exponent of prefix popularity");
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(ac, av, desc), vm);
+    po::notify(vm);
+
+    if (!vm.count("out") || (query_opts.count > 0 && !vm.count("trace")))
+    {
+        std::cerr << desc << std::endl;
+        return 1;
+    }
+
+    try
+    {
+        opts.lengths = vm.count("histogram")
+            ? cidr::gen::parse_histogram(vm["histogram"].as<std::string>())
+            : cidr::gen::profile(length_profile);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    query_opts.seed = opts.seed + 1;
+
+    std::vector<cidr::gen::prefix> prefixes(cidr::gen::prefixes(opts));
+
+    fs::path outfilename(vm["out"].as<std::string>());
+    {
+        std::ofstream outfile(outfilename.c_str());
+        for (auto &p : prefixes)
+            outfile << cidr::gen::to_cidr(p) << "\n";
+    }
+
+    if (vm.count("db"))
+        cidr::db::build(outfilename, fs::path(vm["db"].as<std::string>()));
+
+    if (query_opts.count > 0)
+    {
+        std::ofstream tracefile(vm["trace"].as<std::string>());
+        for (auto addr : cidr::gen::queries(prefixes, query_opts))
+            tracefile << cidr::gen::to_ip(addr) << "\n";
+    }
+
+    return 0;
+}
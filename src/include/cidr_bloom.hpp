@@ -0,0 +1,74 @@
+#ifndef CIDR_BLOOM_H
+#define CIDR_BLOOM_H
+
+#include <arpa/inet.h>
+#include <cstdint>
+#include <vector>
+#include "cidr_mph.hpp"
+
+namespace cidr
+{
+    /**
+     * Blocked Bloom filter over 32-bit keys. Every key maps to one 64-byte
+     * block and sets a few bits inside it, so a probe touches a single
+     * cache line. Sized at about 10 bits per key, so a filter for a
+     * typical prefix length stays in L2, with a false positive rate
+     * around 1%. Keys can't be removed; the owner tracks removals and
+     * rebuilds the filter once enough of its bits are stale.
+     */
+    class bloom
+    {
+    public:
+        explicit bloom(size_t capacity);
+
+        void insert(in_addr_t key);
+
+        bool maybe_contains(in_addr_t key) const
+        {
+            uint64_t h = mph::mix(key);
+            const uint64_t *block = &words[block_of(h) * words_per_block];
+            uint64_t bits = mph::mix(h);
+
+            for (size_t i = 0; i < hashes; i++, bits >>= 9)
+            {
+                if ((block[(bits >> 6) & 7] & (1ULL << (bits & 63))) == 0)
+                    return false;
+            }
+
+            return true;
+        }
+
+        void removed() { removed_count++; }
+
+        /**
+         * True once the filter is over capacity or a quarter of the keys
+         * inserted since the last rebuild have been removed again.
+         */
+        bool stale() const
+        {
+            return inserted_count > capacity_count
+                || removed_count * 4 > inserted_count;
+        }
+
+        size_t capacity() const { return capacity_count; }
+        size_t bytes() const { return words.size() * sizeof(uint64_t); }
+
+    private:
+        static const size_t words_per_block = 8;
+        static const size_t hashes = 6;
+        static const size_t bits_per_key = 10;
+
+        size_t block_of(uint64_t h) const
+        {
+            return ((h >> 32) * block_count) >> 32;
+        }
+
+        std::vector<uint64_t> words;
+        size_t block_count;
+        size_t capacity_count;
+        size_t inserted_count = 0;
+        size_t removed_count = 0;
+    };
+}
+
+#endif // CIDR_BLOOM_H
@@ -4,15 +4,31 @@
 #include <arpa/inet.h>
 #include <set>
 #include <map>
+#include <functional>
+#include <memory>
+#include <vector>
 #include <boost/filesystem.hpp>
+#include "cidr_bloom.hpp"
 
 namespace fs = boost::filesystem;
 
 namespace cidr
 {
+    class db_copy;
+    class frozen_db;
+    class sharded_db;
+
+    namespace shm
+    {
+        class publisher;
+    }
+
     class db
     {
     public:
+        typedef std::function<void(const std::string &cidr)> cidr_visitor;
+        typedef std::function<void(in_addr_t network, uint8_t length)> prefix_visitor;
+
         db(const db&) = delete;
         db& operator=(const db&) = delete;
 
@@ -20,23 +36,89 @@ namespace cidr
         explicit db(const fs::path &dbfilename);
 
         void lookup(const std::string &ip_address, std::vector<std::string> &results) const;
+        size_t lookup(in_addr_t ip_bits, uint8_t *lengths) const;
 
         void put(const std::string &cidr);
         void del(const std::string &cidr);
         bool has(const std::string &cidr) const;
+        void within(const std::string &cidr, std::vector<std::string> &results) const;
+        void within(const std::string &cidr, const cidr_visitor &visit) const;
+        void within(in_addr_t addr_bits, uint8_t length, const prefix_visitor &visit) const;
+        void covering(const std::string &cidr, std::vector<std::string> &results) const;
+        void covering(const std::string &cidr, const cidr_visitor &visit) const;
+        void covering(in_addr_t addr_bits, uint8_t length, const prefix_visitor &visit) const;
+        void covered_by(const std::string &cidr, std::vector<std::string> &results) const;
+        void covered_by(const std::string &cidr, const cidr_visitor &visit) const;
+        void overlaps(const std::string &cidr,
+                      std::vector<std::string> &covering_results,
+                      std::vector<std::string> &covered_results) const;
+        void each(const cidr_visitor &visit) const;
+        void swap(db &other);
+        void snapshot(std::string &image) const;
+        size_t restore(const std::string &image);
         void commit() const;
 
+        void prefilter(bool enable);
+        bool prefiltered() const { return filtering; }
+
         static void build(const fs::path &infilename, const fs::path &dbfilename);
         static bool valid_ip(const std::string &ip_address);
         static bool valid_cidr(const std::string &cidr);
 
     private:
+        friend class db_copy;
+        friend class frozen_db;
+        friend class sharded_db;
+        friend class shm::publisher;
+
         fs::path db_filename;
         void read(const fs::path &dbfilename);
         static in_addr_t ip_to_addr_bits(const std::string &dotted_quad);
         static std::string addr_bits_to_ip(const in_addr_t addr_bits);
+        void walk(const std::string &cidr,
+                  const cidr_visitor *covering_visit,
+                  const cidr_visitor *covered_visit) const;
+        void walk(in_addr_t addr_bits, size_t cidr_offset,
+                  const prefix_visitor *covering_visit,
+                  const prefix_visitor *covered_visit) const;
+
+        void refilter(size_t offset);
 
         std::shared_ptr<std::set<in_addr_t>> cidrs[32];
+        uint32_t populated = 0;  // bit per offset with a non-empty set
+
+        // optional Bloom filter per populated offset, see prefilter()
+        std::unique_ptr<bloom> filters[32];
+        bool filtering = false;
+
+        // bumped by every change at an offset, so shm::publisher can tell
+        // which lengths to rebuild
+        uint64_t versions[32] = {};
+    };
+
+    /**
+     * A point-in-time copy of the CIDRs of a cidr::db, four bytes per CIDR,
+     * that can be read out a piece at a time while the database carries on
+     * changing.
+     */
+    class db_copy
+    {
+    public:
+        explicit db_copy(const db &source);
+
+        bool each(const db::cidr_visitor &visit, size_t limit);
+        bool snapshot(std::string &image, size_t limit);
+        size_t size() const { return total; }
+
+    private:
+        std::vector<in_addr_t> keys[32];
+        size_t total = 0;
+
+        // where the next piece starts; a copy is read out one way only
+        size_t offset = 0;
+        size_t position = 0;
+        bool begun = false;
+        bool ended = false;
     };
 }
 
@@ -0,0 +1,20 @@
+#ifndef CIDR_EMIT_H
+#define CIDR_EMIT_H
+
+#include <string>
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+
+namespace cidr
+{
+    namespace emit
+    {
+        size_t cpp(const fs::path &db_filename,
+                   const fs::path &header_filename,
+                   const fs::path &source_filename,
+                   const std::string &name_space);
+    }
+}
+
+#endif // CIDR_EMIT_H
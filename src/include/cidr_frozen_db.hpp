@@ -0,0 +1,38 @@
+#ifndef CIDR_FROZEN_DB_H
+#define CIDR_FROZEN_DB_H
+
+#include <vector>
+#include "cidr_db.hpp"
+#include "cidr_mph.hpp"
+
+namespace cidr
+{
+    /**
+     * An immutable cidr::db for read-only deployments. Each populated
+     * prefix length is a perfect hash table (cidr::mph) instead of a
+     * std::set, so a probe is two hashes and one slot compare rather than a
+     * tree walk, and a CIDR costs about 5 bytes instead of a tree node.
+     * Lookups return the same results in the same order as cidr::db.
+     */
+    class frozen_db
+    {
+    public:
+        explicit frozen_db(const db &source);
+        explicit frozen_db(const fs::path &dbfilename);
+
+        void lookup(const std::string &ip_address, std::vector<std::string> &results) const;
+        bool has(const std::string &cidr) const;
+
+        size_t size() const { return count; }
+        size_t bytes() const;
+
+    private:
+        void freeze(std::vector<in_addr_t> (&keys)[32]);
+
+        mph::table tables[32];
+        uint32_t populated = 0;  // bit per offset with a non-empty table
+        size_t count = 0;
+    };
+}
+
+#endif // CIDR_FROZEN_DB_H
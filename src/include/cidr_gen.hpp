@@ -0,0 +1,81 @@
+#ifndef CIDR_GEN_H
+#define CIDR_GEN_H
+
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+#include <random>
+
+namespace cidr
+{
+    namespace gen
+    {
+        typedef std::vector<std::pair<size_t, double>> length_histogram;
+
+        struct prefix
+        {
+            in_addr_t addr;
+            size_t length;
+        };
+
+        struct options
+        {
+            size_t count = 1000;
+            length_histogram lengths;
+            double nested = 0.0;
+            double duplicates = 0.0;
+            unsigned seed = 1;
+        };
+
+        struct query_options
+        {
+            size_t count = 1000;
+            double hit_rate = 0.9;
+            double zipf = 1.0;
+            unsigned seed = 2;
+        };
+
+        /**
+         * Zipf(s) distributed ranks in [1, n], drawn by rejection-inversion
+         * so no per-rank table is needed.
+         */
+        class zipf_distribution
+        {
+        public:
+            zipf_distribution(size_t n, double s);
+
+            template <typename Engine>
+            size_t operator()(Engine &rng)
+            {
+                std::uniform_real_distribution<double> uniform(0.0, 1.0);
+                size_t k = 0;
+                while (k == 0) k = sample(uniform(rng));
+                return k;
+            }
+
+        private:
+            size_t n;
+            double s;
+            double h_integral_x1;
+            double h_integral_n;
+            double threshold;
+
+            size_t sample(double u01) const;
+            double h(double x) const;
+            double h_integral(double x) const;
+            double h_integral_inverse(double x) const;
+        };
+
+        length_histogram profile(const std::string &name);
+        length_histogram parse_histogram(const std::string &spec);
+
+        std::vector<prefix> prefixes(const options &opts);
+        std::vector<in_addr_t> queries(const std::vector<prefix> &stored,
+                                       const query_options &opts);
+
+        std::string to_cidr(const prefix &p);
+        std::string to_ip(in_addr_t addr);
+    }
+}
+
+#endif // CIDR_GEN_H
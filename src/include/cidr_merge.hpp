@@ -0,0 +1,102 @@
+#ifndef CIDR_MERGE_H
+#define CIDR_MERGE_H
+
+#include <arpa/inet.h>
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+
+namespace cidr
+{
+    namespace merge
+    {
+        enum operation
+        {
+            difference,
+            union_of,
+            intersection
+        };
+
+        struct record
+        {
+            size_t offset;
+            in_addr_t shifted_bits;
+
+            bool operator<(const record &other) const
+            {
+                return offset != other.offset
+                    ? offset < other.offset
+                    : shifted_bits < other.shifted_bits;
+            }
+
+            bool operator==(const record &other) const
+            {
+                return offset == other.offset && shifted_bits == other.shifted_bits;
+            }
+        };
+
+        /**
+         * One line of a mutation stream: "+<cidr>" or "-<cidr>".
+         */
+        struct mutation
+        {
+            bool add;
+            std::string cidr;
+        };
+
+        class record_reader
+        {
+        public:
+            explicit record_reader(const fs::path &db_filename);
+
+            bool next(record &out);
+
+        private:
+            fs::path filename;
+            std::ifstream infile;
+            std::vector<char> buffer;
+            size_t position;
+            size_t available;
+            bool have_last;
+            record last;
+
+            bool fill();
+        };
+
+        class record_writer
+        {
+        public:
+            explicit record_writer(const fs::path &db_filename);
+            ~record_writer();
+
+            void write(const record &r);
+            void close();
+
+        private:
+            std::ofstream outfile;
+            std::vector<char> buffer;
+            size_t position;
+        };
+
+        operation parse_operation(const std::string &name);
+        std::string to_cidr(const record &r);
+
+        size_t to_db(const fs::path &a, const fs::path &b,
+                     operation op, const fs::path &out);
+        size_t to_stream(const fs::path &a, const fs::path &b,
+                         operation op, std::ostream &out);
+
+        size_t delta(const fs::path &old_list, const fs::path &new_list,
+                     std::ostream &out);
+        size_t apply_delta(const fs::path &old_list, const fs::path &new_list,
+                           const fs::path &db_filename);
+        void parse_mutations(std::istream &in, std::vector<mutation> &mutations);
+    }
+}
+
+#endif // CIDR_MERGE_H
@@ -0,0 +1,63 @@
+#ifndef CIDR_MPH_H
+#define CIDR_MPH_H
+
+#include <arpa/inet.h>
+#include <cstdint>
+#include <vector>
+
+namespace cidr
+{
+    namespace mph
+    {
+        /**
+         * 64-bit finalizer used for both key and pilot hashing. Generated
+         * code carries its own copy, so the two must stay identical.
+         */
+        inline uint64_t mix(uint64_t x)
+        {
+            x ^= x >> 33;
+            x *= 0xff51afd7ed558ccdULL;
+            x ^= x >> 33;
+            x *= 0xc4ceb9fe1a85ec53ULL;
+            x ^= x >> 33;
+            return x;
+        }
+
+        /**
+         * Perfect hash table over a fixed set of 32-bit keys, built by hash
+         * and displace: keys are grouped into buckets, and each bucket gets a
+         * 16-bit pilot that moves all of its keys to free slots. A lookup is
+         * two hashes and one probe; the slot holds the key itself, so misses
+         * are exact. With about three keys per bucket and 98% load the table
+         * costs under 5 bytes per key.
+         */
+        struct table
+        {
+            uint64_t seed = 0;
+            std::vector<uint16_t> pilots;
+            std::vector<in_addr_t> slots;
+
+            size_t position(in_addr_t key) const
+            {
+                uint64_t h = mix(key ^ seed);
+                uint16_t pilot = pilots[(h >> 32) % pilots.size()];
+                return (h ^ mix(pilot)) % slots.size();
+            }
+
+            bool contains(in_addr_t key) const
+            {
+                return !slots.empty() && slots[position(key)] == key;
+            }
+
+            size_t bytes() const
+            {
+                return pilots.size() * sizeof(uint16_t)
+                     + slots.size() * sizeof(in_addr_t);
+            }
+        };
+
+        table build(const std::vector<in_addr_t> &keys);
+    }
+}
+
+#endif // CIDR_MPH_H
@@ -0,0 +1,65 @@
+#ifndef CIDR_SHARDED_DB_H
+#define CIDR_SHARDED_DB_H
+
+#include <memory>
+#include <vector>
+#include <boost/thread/shared_mutex.hpp>
+#include "cidr_db.hpp"
+
+namespace cidr
+{
+    /**
+     * A cidr::db partitioned by the top bits of the address into
+     * independently locked shards, so writers to different shards and
+     * readers of any shard proceed in parallel. Prefixes shorter than the
+     * shard width span several shards and live in one shared top-level db
+     * instead.
+     *
+     * Each call locks the structures it touches one at a time, so a lookup
+     * racing a write sees the write in one shard or the other, never a
+     * torn entry. Visitors run under a shared lock and must not write to
+     * the same sharded_db.
+     */
+    class sharded_db
+    {
+    public:
+        typedef db::cidr_visitor cidr_visitor;
+
+        sharded_db(const sharded_db&) = delete;
+        sharded_db& operator=(const sharded_db&) = delete;
+
+        explicit sharded_db(size_t shard_bits = 8);
+        explicit sharded_db(const fs::path &dbfilename, size_t shard_bits = 8);
+
+        void lookup(const std::string &ip_address, std::vector<std::string> &results) const;
+
+        void put(const std::string &cidr);
+        void del(const std::string &cidr);
+        bool has(const std::string &cidr) const;
+        void within(const std::string &cidr, std::vector<std::string> &results) const;
+        void within(const std::string &cidr, const cidr_visitor &visit) const;
+        void covering(const std::string &cidr, std::vector<std::string> &results) const;
+        void covering(const std::string &cidr, const cidr_visitor &visit) const;
+        void commit() const;
+
+        size_t shard_count() const { return shards.size(); }
+
+    private:
+        struct shard
+        {
+            mutable boost::shared_mutex mutex;
+            db data;
+        };
+
+        const shard& route(const std::string &cidr) const;
+        shard& route(const std::string &cidr);
+        void read(const fs::path &dbfilename);
+
+        size_t shard_bits;
+        fs::path db_filename;
+        shard top;
+        std::vector<std::unique_ptr<shard>> shards;
+    };
+}
+
+#endif // CIDR_SHARDED_DB_H
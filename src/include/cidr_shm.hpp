@@ -0,0 +1,142 @@
+#ifndef CIDR_SHM_H
+#define CIDR_SHM_H
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "cidr_mph.hpp"
+
+namespace cidr
+{
+    class db;
+
+    /**
+     * Lookup structure shared with other processes through POSIX shared
+     * memory, so local callers can query without any IPC.
+     *
+     * The publisher writes each snapshot of the database into its own
+     * segment, /<name>.<generation>, and never touches it again: one perfect
+     * hash table per prefix length, as in cidr::frozen_db. A small control
+     * segment, /<name>, names the current generation behind a seqlock.
+     * Readers check the generation before each lookup and map the new
+     * segment when it moves on. A snapshot stays mapped, and consistent,
+     * for as long as a reader holds it, even after the publisher unlinks it.
+     *
+     * Both segments outlive the publisher on purpose: readers keep
+     * answering from the last snapshot and pick up a restarted server,
+     * which carries on the same control segment and generation count.
+     */
+    namespace shm
+    {
+        const char control_magic[8] = { 'C', 'I', 'D', 'R', 'C', 'T', 'L', '1' };
+        const char image_magic[8] = { 'C', 'I', 'D', 'R', 'S', 'H', 'M', '1' };
+
+        /**
+         * Layout of the control segment. sequence is odd while the
+         * publisher is changing generation and size.
+         */
+        struct control
+        {
+            char magic[8];
+            std::atomic<uint32_t> sequence;
+            uint32_t reserved;
+            std::atomic<uint64_t> generation;
+            std::atomic<uint64_t> size;
+        };
+
+        /**
+         * One prefix length's perfect hash table (see cidr::mph::table);
+         * pilots and slots are byte offsets from the start of the segment.
+         */
+        struct length_table
+        {
+            uint64_t seed;
+            uint32_t pilot_count;
+            uint32_t slot_count;
+            uint64_t pilots;
+            uint64_t slots;
+        };
+
+        /**
+         * Layout of the start of a snapshot segment, indexed by offset
+         * (32 - prefix length) as in cidr::db.
+         */
+        struct image
+        {
+            char magic[8];
+            uint32_t populated;
+            uint32_t reserved;
+            uint64_t count;
+            length_table tables[32];
+        };
+
+        /**
+         * shm_open() name of the control segment, or of a snapshot
+         * segment when generation is non-zero.
+         */
+        inline std::string segment_name(const std::string &name, uint64_t generation = 0)
+        {
+            if (generation == 0)
+                return "/" + name;
+
+            return "/" + name + "." + std::to_string(generation);
+        }
+
+        /**
+         * The keys at the prefix lengths that changed since the last
+         * capture, copied out of a cidr::db so that the tables can be built
+         * while the database carries on changing.
+         */
+        struct snapshot
+        {
+            std::vector<in_addr_t> keys[32];
+            uint32_t rebuild = 0;    // bit per offset whose keys were copied
+            uint32_t populated = 0;  // bit per offset with a non-empty set
+            uint64_t count = 0;
+            bool changed = false;
+            uint64_t versions[32] = {};  // of the source, at capture
+            const db *source = nullptr;
+        };
+
+        /**
+         * Writes snapshots of a cidr::db into shared memory. Tables are
+         * only rebuilt for the prefix lengths that changed since the last
+         * snapshot that was published.
+         *
+         * capture() only copies keys; publish() does the expensive part,
+         * building the tables and writing the segment, and may run on
+         * another thread as long as the two calls are not concurrent. A
+         * snapshot that fails to publish is captured again next time.
+         */
+        class publisher
+        {
+        public:
+            publisher(const publisher&) = delete;
+            publisher& operator=(const publisher&) = delete;
+
+            explicit publisher(const std::string &name);
+            ~publisher();
+
+            snapshot capture(const db &source);
+            bool publish(const snapshot &changes);
+            bool publish(const db &source);
+
+            uint64_t generation() const { return current; }
+
+        private:
+            void write(uint32_t populated, uint64_t count);
+
+            std::string name;
+            control *ctl = nullptr;
+
+            mph::table tables[32];
+            uint64_t versions[32] = {};
+            const db *last_source = nullptr;
+            uint64_t current = 0;
+        };
+    }
+}
+
+#endif // CIDR_SHM_H
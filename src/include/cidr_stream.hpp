@@ -0,0 +1,77 @@
+#ifndef CIDR_STREAM_H
+#define CIDR_STREAM_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "cidr_db.hpp"
+
+namespace cidr
+{
+    namespace stream
+    {
+        struct options
+        {
+            size_t threads = 0;              // 0 = one per hardware thread
+            size_t block_bytes = 1 << 20;    // input handed to a worker at once
+        };
+
+        struct join_options
+        {
+            size_t field = 1;                // 1-based field holding the IP
+            char delimiter = ',';
+        };
+
+        /**
+         * Runs jobs on a fixed set of worker threads and writes what each
+         * one produces to a stream in submission order. At most a few jobs
+         * per thread are in flight; submit() blocks on the oldest one
+         * beyond that, so memory stays bounded however long the input is.
+         * An exception thrown by a job is rethrown by submit() or finish().
+         */
+        class ordered_pool
+        {
+        public:
+            typedef std::function<void(std::string &out)> job;
+
+            ordered_pool(size_t threads, std::ostream &out);
+            ~ordered_pool();
+
+            ordered_pool(const ordered_pool&) = delete;
+            ordered_pool& operator=(const ordered_pool&) = delete;
+
+            void submit(job j);
+            void finish();
+
+            size_t size() const { return workers.size(); }
+
+        private:
+            void work();
+            void write_oldest();
+
+            std::ostream &out;
+            std::vector<std::thread> workers;
+            std::mutex mutex;
+            std::condition_variable ready;
+            std::deque<std::packaged_task<std::string()>> queue;
+            std::deque<std::future<std::string>> pending;
+            bool stopping = false;
+        };
+
+        size_t lookup(const db &cidr_db, std::istream &in, std::ostream &out,
+                      const options &opts = options());
+
+        size_t join(const db &cidr_db, std::istream &in, std::ostream &out,
+                    const join_options &join, const options &opts = options());
+        size_t join(const db &cidr_db, const fs::path &input, std::ostream &out,
+                    const join_options &join, const options &opts = options());
+    }
+}
+
+#endif // CIDR_STREAM_H
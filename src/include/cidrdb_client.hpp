@@ -0,0 +1,49 @@
+#ifndef CIDRDB_CLIENT_H
+#define CIDRDB_CLIENT_H
+
+#include <arpa/inet.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "cidr_shm.hpp"
+
+namespace cidr
+{
+    namespace shm
+    {
+        /**
+         * Read-only view of a database published by cidrdb_rest --shm. A
+         * lookup is one atomic load of the generation plus a perfect hash
+         * probe per populated prefix length, all in this process; there is
+         * no system call unless the server has published a new snapshot,
+         * which is mapped on the next lookup. One client per thread.
+         */
+        class client
+        {
+        public:
+            client(const client&) = delete;
+            client& operator=(const client&) = delete;
+
+            explicit client(const std::string &name = "cidrdb");
+            ~client();
+
+            size_t lookup(in_addr_t ip_bits, uint8_t *lengths);
+
+            uint64_t generation() const { return mapped_generation; }
+            uint64_t size() const { return snapshot->count; }
+
+        private:
+            void refresh();
+
+            std::string name;
+            const control *ctl = nullptr;
+
+            const char *base = nullptr;
+            const image *snapshot = nullptr;
+            size_t mapped_size = 0;
+            uint64_t mapped_generation = 0;
+        };
+    }
+}
+
+#endif // CIDRDB_CLIENT_H
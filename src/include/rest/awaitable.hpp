@@ -0,0 +1,21 @@
+///
+/// \file awaitable.hpp
+///
+/// Boost.Asio with C++20 coroutines.
+///
+/// Include this instead of <boost/asio.hpp>. Under C++20 Asio pulls in
+/// awaitable.hpp, which in Boost 1.74 calls std::exchange without including
+/// <utility> and so fails to compile on its own.
+///
+
+#ifndef HTTP_AWAITABLE_HPP
+#define HTTP_AWAITABLE_HPP
+
+#include <utility>
+#include <boost/asio.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+#endif // HTTP_AWAITABLE_HPP
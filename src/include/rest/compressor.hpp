@@ -0,0 +1,95 @@
+///
+/// \file compressor.hpp
+///
+/// Content-Encoding of reply bodies, negotiated from Accept-Encoding.
+///
+/// A reply is fed to the compressor while it is being built: once enough
+/// uncompressed text has piled up it is compressed and dropped, so a large
+/// Batch-Lookup never holds more than a chunk of its plain text at a time.
+/// Replies that stay small are sent as they are. A streamed reply is
+/// compressed piece by piece instead, each flushed so the client can
+/// decode it as soon as it arrives.
+///
+/// gzip and deflate come from zlib; zstd is offered when cidrdb_rest was
+/// built with libzstd. CPU time spent compressing is recorded in metrics.
+///
+
+#ifndef HTTP_COMPRESSOR_HPP
+#define HTTP_COMPRESSOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <boost/noncopyable.hpp>
+#include <zlib.h>
+#include "metrics.hpp"
+
+namespace http {
+namespace server {
+
+class compressor
+  : private boost::noncopyable
+{
+public:
+  /// Highest compression level accepted by set_compression_level().
+  static const int max_level = 9;
+
+  /// Plain text gathered before it is compressed.
+  static const std::size_t chunk_size = 64 * 1024;
+
+  /// Replies shorter than this are not worth compressing.
+  static const std::size_t min_size = 1024;
+
+  /// Pick the coding the client prefers among those supported, honouring
+  /// q-values and "*". Returns null if it only accepts identity.
+  static std::unique_ptr<compressor> negotiate(
+      const std::string& accept_encoding, int level);
+
+  /// Content-Encoding token of a coding.
+  static const char* name(metrics::encoding coding);
+
+  compressor(metrics::encoding coding, int level);
+  ~compressor();
+
+  /// Compress and clear pending once it holds at least chunk_size bytes.
+  void consume(std::string& pending);
+
+  /// Compress what is left and replace content with the whole compressed
+  /// body. Returns false, leaving content alone, if nothing was compressed
+  /// yet and content is shorter than min_size.
+  bool finish(std::string& content);
+
+  /// Replace piece with its compressed form, flushed so that everything
+  /// passed in so far can be decoded; last ends the stream.
+  void sync(std::string& piece, bool last);
+
+  /// The coding in use.
+  metrics::encoding coding() const { return coding_; }
+
+private:
+  enum flush_mode
+  {
+    no_flush,
+    sync_flush,
+    finish_stream
+  };
+
+  void compress(const char* data, std::size_t size, flush_mode mode);
+
+  metrics::encoding coding_;
+  int level_;
+  bool started_;
+  std::string out_;
+  std::uint64_t bytes_in_;
+  std::uint64_t bytes_out_;
+  double cpu_seconds_;
+
+  z_stream zlib_;
+  void* zstd_;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_COMPRESSOR_HPP
@@ -12,11 +12,14 @@
 #ifndef HTTP_CONNECTION_HPP
 #define HTTP_CONNECTION_HPP
 
-#include <boost/asio.hpp>
+#include <vector>
 #include <boost/array.hpp>
+#include <boost/logic/tribool.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/enable_shared_from_this.hpp>
+#include "awaitable.hpp"
+#include "handler_allocator.hpp"
 #include "reply.hpp"
 #include "request.hpp"
 #include "request_handler.hpp"
@@ -26,8 +29,15 @@ namespace http {
 namespace server {
 
 class connection_manager;
+class connection;
 
-/// Represents a single connection from a client.
+typedef boost::shared_ptr<connection> connection_ptr;
+
+/// Represents a single connection from a client. The request/reply cycle
+/// is one C++20 coroutine spawned on the socket's executor. A client that
+/// sends "Connection: keep-alive"
+/// gets the same connection back for its next request, and a request that
+/// isn't complete within request_timeout closes the connection.
 class connection
   : public boost::enable_shared_from_this<connection>,
     private boost::noncopyable
@@ -37,8 +47,11 @@ public:
   explicit connection(boost::asio::io_service& io_service,
       connection_manager& manager, request_handler& handler);
 
+  /// Stream socket type shared by the TCP and Unix domain listeners.
+  typedef boost::asio::generic::stream_protocol::socket socket_type;
+
   /// Get the socket associated with the connection.
-  boost::asio::ip::tcp::socket& socket();
+  socket_type& socket();
 
   /// Start the first asynchronous operation for the connection.
   void start();
@@ -47,15 +60,32 @@ public:
   void stop();
 
 private:
-  /// Handle completion of a read operation.
-  void handle_read(const boost::system::error_code& e,
-      std::size_t bytes_transferred);
+  /// The request/reply cycle; self keeps the connection alive until the
+  /// coroutine returns.
+  boost::asio::awaitable<void> run(connection_ptr self);
 
-  /// Handle completion of a write operation.
-  void handle_write(const boost::system::error_code& e);
+  /// Parse what is left in the buffer into the current request.
+  boost::tribool parse_buffered();
+
+  /// Close the connection once the current request is overdue.
+  void start_deadline();
+  void handle_deadline(const boost::system::error_code& e);
 
   /// Socket for the connection.
-  boost::asio::ip::tcp::socket socket_;
+  socket_type socket_;
+
+  /// Checks request_deadline_; armed once and re-armed from its handler.
+  boost::asio::deadline_timer deadline_;
+
+  /// When the request being read must be complete; pos_infin otherwise.
+  boost::posix_time::ptime request_deadline_;
+
+  /// Handler memory for the timer.
+  handler_memory timer_memory_;
+
+  /// Unparsed bytes in buffer_ are [buffer_begin_, buffer_end_).
+  std::size_t buffer_begin_;
+  std::size_t buffer_end_;
 
   /// The manager for this connection.
   connection_manager& connection_manager_;
@@ -74,9 +104,10 @@ private:
 
   /// The reply to be sent back to the client.
   reply reply_;
-};
 
-typedef boost::shared_ptr<connection> connection_ptr;
+  /// reply_ as buffers, while it is being written.
+  std::vector<boost::asio::const_buffer> buffers_;
+};
 
 } // namespace server
 } // namespace http
@@ -0,0 +1,142 @@
+///
+/// \file handler_allocator.hpp
+///
+/// Recycled memory for the completion handlers of one connection.
+///
+/// Every asynchronous operation Asio starts allocates room for its handler.
+/// Reads and writes resume the connection's coroutine (see awaitable.hpp);
+/// its deadline timer has a plain callback, and only ever one wait in
+/// flight, so that gets a small fixed block owned by the connection and
+/// reused for every wait. Anything that doesn't fit falls back to the heap.
+///
+
+#ifndef HTTP_HANDLER_ALLOCATOR_HPP
+#define HTTP_HANDLER_ALLOCATOR_HPP
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <boost/noncopyable.hpp>
+
+namespace http {
+namespace server {
+
+/// One reusable block of handler memory.
+class handler_memory
+  : private boost::noncopyable
+{
+public:
+  handler_memory()
+    : in_use_(false)
+  {
+  }
+
+  void* allocate(std::size_t size)
+  {
+    if (!in_use_ && size <= sizeof(storage_))
+    {
+      in_use_ = true;
+      return &storage_;
+    }
+
+    return ::operator new(size);
+  }
+
+  void deallocate(void* pointer)
+  {
+    if (pointer == &storage_)
+      in_use_ = false;
+    else
+      ::operator delete(pointer);
+  }
+
+private:
+  typename std::aligned_storage<1024>::type storage_;
+  bool in_use_;
+};
+
+/// Standard allocator handing out a handler_memory block.
+template <typename T>
+class handler_allocator
+{
+public:
+  typedef T value_type;
+
+  explicit handler_allocator(handler_memory& memory)
+    : memory_(memory)
+  {
+  }
+
+  template <typename U>
+  handler_allocator(const handler_allocator<U>& other)
+    : memory_(other.memory_)
+  {
+  }
+
+  T* allocate(std::size_t n) const
+  {
+    return static_cast<T*>(memory_.allocate(sizeof(T) * n));
+  }
+
+  void deallocate(T* p, std::size_t /*n*/) const
+  {
+    memory_.deallocate(p);
+  }
+
+  bool operator==(const handler_allocator& other) const
+  {
+    return &memory_ == &other.memory_;
+  }
+
+  bool operator!=(const handler_allocator& other) const
+  {
+    return &memory_ != &other.memory_;
+  }
+
+private:
+  template <typename> friend class handler_allocator;
+
+  handler_memory& memory_;
+};
+
+/// Wraps a handler so Asio allocates it from a handler_memory block.
+template <typename Handler>
+class custom_alloc_handler
+{
+public:
+  typedef handler_allocator<Handler> allocator_type;
+
+  custom_alloc_handler(handler_memory& memory, Handler h)
+    : memory_(memory),
+      handler_(std::move(h))
+  {
+  }
+
+  allocator_type get_allocator() const
+  {
+    return allocator_type(memory_);
+  }
+
+  template <typename... Args>
+  void operator()(Args&&... args)
+  {
+    handler_(std::forward<Args>(args)...);
+  }
+
+private:
+  handler_memory& memory_;
+  Handler handler_;
+};
+
+template <typename Handler>
+inline custom_alloc_handler<Handler> make_custom_alloc_handler(
+    handler_memory& memory, Handler h)
+{
+  return custom_alloc_handler<Handler>(memory, std::move(h));
+}
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_HANDLER_ALLOCATOR_HPP
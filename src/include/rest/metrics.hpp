@@ -0,0 +1,103 @@
+///
+/// \file metrics.hpp
+///
+/// Prometheus-style counters and histograms for the CIDR-DB REST service.
+///
+/// Every thread records into its own shard of plain relaxed atomics, so the
+/// request path never takes a lock or contends on a cache line. A scrape
+/// walks all shards and sums them.
+///
+
+#ifndef HTTP_METRICS_HPP
+#define HTTP_METRICS_HPP
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+namespace http {
+namespace server {
+namespace metrics {
+
+/// Operations tracked by the registry, one per determine_op() result.
+enum operation
+{
+  op_status,
+  op_batch_lookup,
+  op_single_lookup,
+  op_verify,
+  op_add,
+  op_delete,
+  op_patch,
+  op_within,
+  op_covering,
+  op_overlaps,
+  op_snapshot_export,
+  op_snapshot_import,
+  op_metrics,
+  op_invalid,
+  operation_count
+};
+
+/// Content codings a reply can be compressed with, see compressor.
+enum encoding
+{
+  encoding_gzip,
+  encoding_deflate,
+  encoding_zstd,
+  encoding_count
+};
+
+/// Map a determine_op() result onto an operation.
+operation operation_from_name(const std::string& op_type);
+
+/// Content-Encoding token of a coding, also used as its metrics label.
+const char* encoding_name(encoding coding);
+
+/// Record the handling time of one request.
+void observe_request(operation op, double seconds);
+
+/// Record the number of IP addresses carried by one Batch-Lookup.
+void observe_batch(std::size_t ip_count);
+
+/// Record the time spent writing the database to disk.
+void observe_commit(double seconds);
+
+/// Record one compressed reply: its size before and after compression and
+/// the thread CPU time spent compressing it.
+void observe_compression(encoding coding, std::size_t bytes_in,
+    std::size_t bytes_out, double cpu_seconds);
+
+/// Account for bytes read from and written to client sockets.
+void add_bytes_in(std::size_t bytes);
+void add_bytes_out(std::size_t bytes);
+
+/// Track the number of open client connections.
+void connection_opened();
+void connection_closed(std::size_t count = 1);
+
+/// Report replication progress: the last sequence number applied locally,
+/// the newest one known on the leader and the number of connected followers.
+/// Replication gauges are only exported once this has been called.
+void set_replication(std::uint64_t applied, std::uint64_t leader_sequence,
+    std::size_t followers);
+
+/// Count one io_uring_enter call by the io_uring backend; the counter is
+/// only exported once this has been called.
+void add_io_uring_enter();
+
+/// Count datagrams and the addresses they carried on the UDP lookup
+/// listener; the counters are only exported once this has been called.
+void add_udp(std::size_t datagrams, std::size_t addresses);
+
+/// Aggregate all shards into the Prometheus text exposition format.
+std::string scrape();
+
+/// Content type of the scrape() output.
+extern const char content_type[];
+
+} // namespace metrics
+} // namespace server
+} // namespace http
+
+#endif // HTTP_METRICS_HPP
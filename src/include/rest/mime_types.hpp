@@ -18,8 +18,9 @@ namespace http {
 namespace server {
 namespace mime_types {
 
-/// Convert a file extension into a MIME type.
-std::string extension_to_type(const std::string& extension);
+/// Convert a file extension into a MIME type. The result points into a
+/// static table, so asking costs no allocation.
+const char* extension_to_type(const std::string& extension);
 
 } // namespace mime_types
 } // namespace server
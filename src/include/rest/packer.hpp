@@ -0,0 +1,60 @@
+///
+/// \file packer.hpp
+///
+/// MessagePack and CBOR encoding of reply bodies.
+///
+/// Both formats carry the same data model for what we send: maps and
+/// arrays whose sizes are given up front, unsigned integers, booleans and
+/// strings. Addresses go out as 32-bit unsigned integers and a CIDR as a
+/// two-element array of its network address and prefix length, so neither
+/// side formats or parses dotted quads.
+///
+
+#ifndef HTTP_PACKER_HPP
+#define HTTP_PACKER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace http {
+namespace server {
+
+class packer
+{
+public:
+  enum format
+  {
+    msgpack,
+    cbor
+  };
+
+  /// Append values in the given format to out.
+  packer(format f, std::string& out);
+
+  /// Start a map of size key/value pairs, or an array of size values.
+  void map(std::size_t size);
+  void array(std::size_t size);
+
+  void uint(std::uint64_t value);
+  void boolean(bool value);
+  void str(const std::string& value);
+
+  /// A CIDR as [network, prefix length].
+  void cidr(std::uint32_t network, unsigned length);
+
+private:
+  /// Type byte(s) and big-endian argument of a CBOR data item.
+  void cbor_head(unsigned major, std::uint64_t value);
+
+  /// A type byte followed by value as a big-endian integer of bytes length.
+  void put_head(unsigned char type, std::uint64_t value, std::size_t bytes);
+
+  format format_;
+  std::string& out_;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_PACKER_HPP
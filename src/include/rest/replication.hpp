@@ -0,0 +1,173 @@
+///
+/// \file replication.hpp
+///
+/// Leader/follower replication of CIDR-DB mutations over TCP.
+///
+/// The leader numbers every PUT and DELETE it applies and keeps the most
+/// recent ones in a bounded log. Followers connect with the epoch and
+/// sequence number they last applied; the leader either resumes the log from
+/// there or, if it no longer holds that far back (or restarted, changing its
+/// epoch), sends a full snapshot followed by the live log. The protocol is
+/// line based:
+///
+///   follower -> leader   FOLLOW <epoch> <sequence>
+///   leader -> follower   RESUME <epoch> <sequence>
+///                        SNAPSHOT <epoch> <sequence>, +<cidr> ..., END
+///                        <sequence> +<cidr> | <sequence> -<cidr>
+///                        HEARTBEAT <sequence>
+///
+/// Both ends run on the HTTP server's io_service thread, so they touch the
+/// database without any locking.
+///
+
+#ifndef HTTP_REPLICATION_HPP
+#define HTTP_REPLICATION_HPP
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <set>
+#include <string>
+#include <boost/noncopyable.hpp>
+#include "awaitable.hpp"
+#include "cidr_db.hpp"
+
+namespace http {
+namespace server {
+namespace replication {
+
+/// Bounded, ordered log of "+cidr" / "-cidr" mutations.
+class mutation_log
+{
+public:
+  explicit mutation_log(std::size_t capacity);
+
+  /// Append a mutation and return its sequence number (the first is 1).
+  std::uint64_t append(const std::string& mutation);
+
+  /// Sequence number of the newest mutation, 0 if none.
+  std::uint64_t sequence() const { return base_ + entries_.size() - 1; }
+
+  /// True if every mutation after the given sequence number is retained.
+  bool can_resume(std::uint64_t after) const;
+
+  /// Forget every mutation; numbering continues.
+  void clear();
+
+  /// The mutation with the given sequence number; see can_resume().
+  const std::string& at(std::uint64_t seq) const { return entries_[seq - base_]; }
+
+private:
+  std::size_t capacity_;
+
+  /// Sequence number of entries_.front().
+  std::uint64_t base_;
+
+  std::deque<std::string> entries_;
+};
+
+/// Accepts followers and streams the mutation log to them.
+class leader
+  : private boost::noncopyable
+{
+public:
+  leader(boost::asio::io_service& io_service,
+      const std::string& address, const std::string& port,
+      std::shared_ptr<cidr::db>& cidr_db, std::size_t log_capacity);
+
+  /// Log a mutation and send it to every live follower.
+  void publish(const std::string& mutation);
+
+  /// Start a new epoch after the database was replaced wholesale, so that
+  /// every follower reconnects and loads a snapshot.
+  void reset();
+
+  /// Close the listener and all follower sessions.
+  void stop();
+
+private:
+  class session;
+  typedef std::shared_ptr<session> session_ptr;
+
+  void start_accept();
+  void handle_accept(session_ptr s, const boost::system::error_code& e);
+  void handle_follow(session_ptr s, const boost::system::error_code& e);
+  void send(session_ptr s, std::string data);
+  void start_write(session_ptr s);
+  void handle_write(session_ptr s, const boost::system::error_code& e,
+      std::size_t bytes_transferred);
+  void handle_snapshot_write(session_ptr s, const boost::system::error_code& e);
+  void start_heartbeat();
+  void handle_heartbeat(const boost::system::error_code& e);
+  void drop(session_ptr s);
+  void update_metrics();
+
+  boost::asio::io_service& io_service_;
+  boost::asio::ip::tcp::acceptor acceptor_;
+  boost::asio::deadline_timer heartbeat_timer_;
+  std::shared_ptr<cidr::db>& cidr_db_;
+  std::string epoch_;
+  mutation_log log_;
+  std::set<session_ptr> sessions_;
+};
+
+/// Connects to a leader and applies its mutations to the local database.
+class follower
+  : private boost::noncopyable
+{
+public:
+  follower(boost::asio::io_service& io_service,
+      const std::string& host, const std::string& port,
+      std::shared_ptr<cidr::db>& cidr_db);
+
+  /// Disconnect and stop reconnecting.
+  void stop();
+
+private:
+  void connect();
+  void handle_resolve(const boost::system::error_code& e,
+      boost::asio::ip::tcp::resolver::results_type endpoints);
+  void handle_connect(const boost::system::error_code& e);
+  void handle_follow(const boost::system::error_code& e);
+  void start_read();
+  void handle_read(const boost::system::error_code& e);
+  bool apply(const std::string& line);
+  void reconnect();
+  void handle_deadline(const boost::system::error_code& e);
+  void update_metrics();
+
+  boost::asio::io_service& io_service_;
+  boost::asio::ip::tcp::resolver resolver_;
+  boost::asio::ip::tcp::socket socket_;
+  boost::asio::deadline_timer deadline_;
+  boost::asio::deadline_timer retry_timer_;
+  boost::asio::streambuf buffer_;
+
+  /// The FOLLOW request being written.
+  std::string request_;
+
+  std::string host_;
+  std::string port_;
+  std::shared_ptr<cidr::db>& cidr_db_;
+
+  /// Leader epoch and last sequence number applied locally.
+  std::string epoch_;
+  std::uint64_t applied_;
+
+  /// Newest sequence number the leader has announced.
+  std::uint64_t leader_sequence_;
+
+  /// Snapshot being received; swapped in once complete.
+  std::unique_ptr<cidr::db> staging_;
+  std::uint64_t staging_sequence_;
+
+  /// Mutations applied since the database was last written to disk.
+  bool dirty_;
+  bool stopped_;
+};
+
+} // namespace replication
+} // namespace server
+} // namespace http
+
+#endif // HTTP_REPLICATION_HPP
@@ -13,9 +13,10 @@
 #ifndef HTTP_REPLY_HPP
 #define HTTP_REPLY_HPP
 
+#include <functional>
 #include <string>
 #include <vector>
-#include <boost/asio.hpp>
+#include "awaitable.hpp"
 #include "header.hpp"
 
 namespace http {
@@ -51,11 +52,27 @@ struct reply
   /// The content to be sent in the reply.
   std::string content;
 
+  /// For a reply sent while it is being computed: produces the rest of the
+  /// body after content. Each call replaces its argument with the next
+  /// piece and returns false with the last one. Such a reply carries no
+  /// Content-Length; the connection is closed once it has been sent.
+  std::function<bool (std::string& piece)> stream;
+
   /// Convert the reply into a vector of buffers. The buffers do not own the
   /// underlying memory blocks, therefore the reply object must remain valid and
   /// not be changed until the write operation has completed.
   std::vector<boost::asio::const_buffer> to_buffers();
 
+  /// As above, into a vector the caller keeps from one reply to the next.
+  void to_buffers(std::vector<boost::asio::const_buffer>& buffers);
+
+  /// Empty the reply for the next request on a kept-alive connection,
+  /// keeping the memory already allocated unless the body was large.
+  void clear();
+
+  /// Largest body whose memory clear() keeps for the next reply.
+  static const std::size_t max_retained_size = 64 * 1024;
+
   /// Get a stock reply.
   static void stock_reply(status_type status, reply& rep);
   /// Get a redirect reply.
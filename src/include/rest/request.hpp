@@ -13,6 +13,7 @@
 #define HTTP_REQUEST_HPP
 
 #include <string>
+#include <boost/algorithm/string/predicate.hpp>
 #include "header.hpp"
 
 namespace http {
@@ -32,8 +33,41 @@ struct request
   headers_list headers;
   size_t      content_length;
   std::string content;
+
+  /// Empty the request for the next one on a kept-alive connection,
+  /// keeping the memory already allocated unless the body was large.
+  void clear()
+  {
+    method.clear();
+    uri.clear();
+    query.clear();
+    http_version_major = 0;
+    http_version_minor = 0;
+    headers.clear();
+    content_length = 0;
+
+    if (content.capacity() > max_retained_size)
+      std::string().swap(content);
+    else
+      content.clear();
+  }
+
+  /// Largest body whose memory clear() keeps for the next request.
+  static const std::size_t max_retained_size = 64 * 1024;
 };
 
+/// True if the client asked to keep the connection open for another request.
+inline bool wants_keep_alive(const request& req)
+{
+  for (const header& h : req.headers)
+  {
+    if (boost::algorithm::iequals(h.name, "Connection"))
+      return boost::algorithm::iequals(h.value, "keep-alive");
+  }
+
+  return false;
+}
+
 } // namespace server
 } // namespace http
 
@@ -15,6 +15,7 @@
 
 #include <string>
 #include <map>
+#include <functional>
 #include <boost/noncopyable.hpp>
 #include <boost/function.hpp>
 #include "cidr_db.hpp"
@@ -31,6 +32,12 @@ typedef std::map<std::string, std::string> params_map;
 /// Prototype of a function able to generate a reply for the provided client request
 typedef boost::function<void (const request& req, const params_map& params, reply& rep)>  resource_function;
 
+/// Called with "+<cidr>" or "-<cidr>" after a PUT or DELETE is applied
+typedef std::function<void (const std::string& mutation)>  mutation_function;
+
+/// Called after the whole database has been replaced
+typedef std::function<void ()>  reset_function;
+
 /// The common handler for all incoming requests.
 class request_handler
   : private boost::noncopyable
@@ -46,10 +53,38 @@ public:
   void register_resource(const std::string& resource_name, resource_function&& function);
   void unregister_resource(const std::string& resource_name);
 
+  /// Report every applied PUT and DELETE, e.g. to replicate it.
+  void observe_mutations(mutation_function&& function);
+
+  /// Report every wholesale replacement of the database.
+  void observe_resets(reset_function&& function);
+
+  /// Refuse PUT and DELETE, e.g. on a replication follower.
+  void set_read_only(bool read_only);
+
+  /// Compress replies for clients that accept gzip, deflate or zstd, at
+  /// level 1 (fastest) to 9 (smallest); 0 never compresses.
+  void set_compression_level(int level);
+
 private:
   /// The CIDR scanner 
   std::shared_ptr<cidr::db> &cidr_db_;
 
+  /// Receives every applied mutation, if set
+  mutation_function mutation_observer_;
+
+  /// Receives every database replacement, if set
+  reset_function reset_observer_;
+
+  /// True if PUT and DELETE are refused
+  bool read_only_;
+
+  /// Compression level for replies, 0 if off
+  int compression_level_;
+
+  /// Write the CIDR-DB to disk and record how long it took.
+  void commit();
+
   /// Perform URL-decoding on a string. Returns false if the encoding was
   /// invalid.
   static bool url_decode(const std::string& in, std::string& out);
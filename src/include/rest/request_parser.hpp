@@ -13,6 +13,8 @@
 #ifndef HTTP_REQUEST_PARSER_HPP
 #define HTTP_REQUEST_PARSER_HPP
 
+#include <algorithm>
+#include <iterator>
 #include <boost/logic/tribool.hpp>
 #include <boost/tuple/tuple.hpp>
 
@@ -41,6 +43,18 @@ public:
   {
     while (begin != end)
     {
+      if (state_ == content)
+      {
+        // Copy the body in bulk rather than one character at a time.
+        std::size_t count = std::min<std::size_t>(
+            content_remaining(req), std::distance(begin, end));
+        boost::tribool result = consume_content(req, &*begin, count);
+        std::advance(begin, count);
+        if (result)
+          return boost::make_tuple(result, begin);
+        continue;
+      }
+
       boost::tribool result = consume(req, *begin++);
       if (result || !result)
         return boost::make_tuple(result, begin);
@@ -53,6 +67,12 @@ private:
   /// Handle the next character of input.
   boost::tribool consume(request& req, char input);
 
+  /// Number of body bytes still expected.
+  static std::size_t content_remaining(const request& req);
+
+  /// Append part of the body; true once it is complete.
+  boost::tribool consume_content(request& req, const char* data, std::size_t count);
+
   /// Check if a byte is an HTTP character.
   static bool is_char(int c);
 
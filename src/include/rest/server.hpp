@@ -11,13 +11,20 @@
 #ifndef HTTP_SERVER_HPP
 #define HTTP_SERVER_HPP
 
+#include <memory>
+#include <set>
 #include <string>
-#include <boost/asio.hpp>
+#include <thread>
+#include <sys/types.h>
 #include <boost/noncopyable.hpp>
+#include "awaitable.hpp"
 #include "connection.hpp"
 #include "connection_manager.hpp"
 #include "request_handler.hpp"
+#include "replication.hpp"
+#include "udp_lookup.hpp"
 #include "cidr_db.hpp"
+#include "cidr_shm.hpp"
 
 namespace http {
 namespace server {
@@ -38,12 +45,45 @@ public:
     std::shared_ptr<cidr::db> &cidr_db
   );
 
+  /// Wait for a shared memory snapshot still being built.
+  ~server();
+
   /// Run the server's io_service loop.
   void run();
 
   /// Stop the server.
   void stop();
 
+  /// Act as replication leader: stream mutations to followers connecting on
+  /// the given address and port, keeping the last log_capacity of them for
+  /// followers that reconnect.
+  void lead(const std::string& address, const std::string& port,
+      std::size_t log_capacity);
+
+  /// Act as replication follower of the leader at host and port. Local PUT
+  /// and DELETE requests are refused.
+  void follow(const std::string& host, const std::string& port);
+
+  /// Also answer binary lookups over UDP on the given address and port.
+  void serve_udp(const std::string& address, const std::string& port);
+
+  /// Also accept HTTP connections on a Unix domain socket at path, from
+  /// peers whose SO_PEERCRED uid is in allowed_uids; others get a 403. A
+  /// stale socket file at path is replaced, and removed again on stop().
+  void listen_local(const std::string& path, const std::set<uid_t>& allowed_uids);
+
+  /// Publish the database to shared memory under name for
+  /// libcidrdb_client readers, republishing whenever it changes. Snapshots
+  /// after the first are built on a thread of their own.
+  void publish_shm(const std::string& name);
+
+  /// Compress replies for clients that accept it, see
+  /// request_handler::set_compression_level().
+  inline void set_compression_level(int level)
+  {
+    request_handler_.set_compression_level(level);
+  }
+
   /// Register a dynamic resource (a code generated web page)
   inline void register_resource(const std::string&& resource_name, resource_function&& function)
   {
@@ -58,6 +98,15 @@ private:
   /// Handle completion of an asynchronous accept operation.
   void handle_accept(const boost::system::error_code& e);
 
+  /// Handle completion of an accept on the Unix domain socket.
+  void handle_local_accept(const boost::system::error_code& e);
+
+  /// Wait for the next shared memory republish, unless stopping.
+  void start_shm_timer();
+
+  /// Capture the changes to the database and hand them to the shm thread.
+  void handle_shm_timer(const boost::system::error_code& e);
+
   /// Handle a request to stop the server.
   void handle_stop();
 
@@ -73,8 +122,34 @@ private:
   /// The next connection to be accepted.
   connection_ptr new_connection_;
 
+  /// Unix domain socket listener, if any, and who may connect to it.
+  std::unique_ptr<boost::asio::local::stream_protocol::acceptor> local_acceptor_;
+  connection_ptr new_local_connection_;
+  std::string local_path_;
+  std::set<uid_t> allowed_uids_;
+
   /// The handler for all incoming requests.
   request_handler request_handler_;
+
+  /// The CIDR-DB shared with the request handler.
+  std::shared_ptr<cidr::db>& cidr_db_;
+
+  /// Replication endpoint, if any.
+  std::unique_ptr<replication::leader> leader_;
+  std::unique_ptr<replication::follower> follower_;
+
+  /// UDP lookup listener, if any.
+  std::unique_ptr<udp_lookup> udp_lookup_;
+
+  /// Shared memory publisher, if any, and the timer that drives it.
+  std::unique_ptr<cidr::shm::publisher> shm_publisher_;
+  boost::asio::deadline_timer shm_timer_;
+
+  /// The thread that builds and writes snapshots, and its queue; shm_work_
+  /// is reset on stop.
+  boost::asio::io_service shm_service_;
+  std::unique_ptr<boost::asio::io_service::work> shm_work_;
+  std::thread shm_thread_;
 };
 
 } // namespace server
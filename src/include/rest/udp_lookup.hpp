@@ -0,0 +1,81 @@
+///
+/// \file udp_lookup.hpp
+///
+/// Binary lookup protocol over UDP for in-path callers that can't afford
+/// HTTP parsing and a connection per query.
+///
+/// A request datagram is a 4-byte request ID followed by up to
+/// max_addresses IPv4 addresses, all in network byte order:
+///
+///   request   <id:4> <address:4> ...
+///   reply     <id:4> { <count:1> <length:1> ... } per address
+///
+/// The reply echoes the ID and lists, for each address in request order,
+/// the prefix lengths of the CIDRs containing it, longest first; the
+/// network is the address masked to that length. A request with no
+/// addresses is answered with just its ID. Malformed or oversized
+/// datagrams are dropped without a reply.
+///
+/// Datagrams are read and answered in batches with recvmmsg and sendmmsg on
+/// the HTTP server's io_service thread, so lookups go straight to the
+/// database without any locking.
+///
+
+#ifndef HTTP_UDP_LOOKUP_HPP
+#define HTTP_UDP_LOOKUP_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <sys/socket.h>
+#include "awaitable.hpp"
+#include "cidr_db.hpp"
+
+namespace http {
+namespace server {
+
+class udp_lookup
+  : private boost::noncopyable
+{
+public:
+  /// Addresses accepted in one request datagram.
+  static const std::size_t max_addresses = 256;
+  static const std::size_t max_request_size = 4 + 4 * max_addresses;
+  static const std::size_t max_reply_size = 4 + 33 * max_addresses;
+
+  udp_lookup(boost::asio::io_service& io_service,
+      const std::string& address, const std::string& port,
+      std::shared_ptr<cidr::db>& cidr_db);
+
+  /// Close the socket.
+  void stop();
+
+  /// Answer one request into reply, which must hold max_reply_size bytes.
+  /// Returns the reply size, or 0 if the request is malformed.
+  static std::size_t answer(const cidr::db& db, const char* request,
+      std::size_t size, char* reply);
+
+private:
+  void start_wait();
+  void handle_readable(const boost::system::error_code& e);
+
+  boost::asio::ip::udp::socket socket_;
+  std::shared_ptr<cidr::db>& cidr_db_;
+
+  /// One slot per datagram in a recvmmsg batch; replies reuse the index of
+  /// their request.
+  std::vector<char> requests_;
+  std::vector<char> replies_;
+  std::vector<sockaddr_storage> peers_;
+  std::vector<iovec> request_iov_;
+  std::vector<iovec> reply_iov_;
+  std::vector<mmsghdr> received_;
+  std::vector<mmsghdr> outgoing_;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_UDP_LOOKUP_HPP
@@ -0,0 +1,91 @@
+///
+/// \file uring_server.hpp
+///
+/// HTTP server backend driven by io_uring instead of Asio's epoll reactor.
+///
+/// One thread runs one ring. The listening socket has a single multishot
+/// accept outstanding, every connection a single multishot recv that draws
+/// from a ring of provided buffers registered with the kernel, and replies
+/// go out as sendmsg requests. Everything queued while handling a batch of
+/// completions is submitted with the next wait, so a busy server makes one
+/// io_uring_enter call per batch rather than one syscall per read or write.
+///
+/// Requests go through the same request_parser and request_handler as the
+/// Asio server, with the same one-request-per-connection and keep-alive
+/// behaviour and the same request deadline, checked by one timeout
+/// operation per connection. Replication is only available on the Asio
+/// backend.
+///
+
+#ifndef HTTP_URING_SERVER_HPP
+#define HTTP_URING_SERVER_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <boost/noncopyable.hpp>
+#include "request_handler.hpp"
+#include "cidr_db.hpp"
+
+namespace http {
+namespace server {
+
+class uring_server
+  : private boost::noncopyable
+{
+public:
+  /// Set up the ring and listen on the specified TCP address and port.
+  /// Throws std::runtime_error if the kernel doesn't support io_uring with
+  /// provided buffer rings (Linux 5.19 or later).
+  uring_server(const std::string& address, const std::string& port,
+      std::shared_ptr<cidr::db>& cidr_db);
+
+  ~uring_server();
+
+  /// Serve until stop() is called.
+  void run();
+
+  /// Make run() return. Safe to call from any thread.
+  void stop();
+
+  /// Compress replies for clients that accept it, see
+  /// request_handler::set_compression_level().
+  void set_compression_level(int level)
+  {
+    request_handler_.set_compression_level(level);
+  }
+
+private:
+  class ring;
+  struct connection;
+
+  void handle_completion(std::uint64_t user_data, int res, unsigned flags);
+  void start_accept();
+  void start_wake();
+  void start_recv(connection* c);
+  void handle_recv(connection* c, int res, unsigned flags);
+  void process(connection* c);
+  void start_write(connection* c);
+  void handle_write(connection* c, int res);
+  void start_close(connection* c);
+  void start_timer(connection* c);
+  void handle_timer(connection* c);
+  void maybe_release(connection* c);
+
+  std::unique_ptr<ring> ring_;
+
+  /// Connections accepted and not yet closed.
+  std::unordered_set<connection*> connections_;
+
+  request_handler request_handler_;
+  int listen_fd_;
+  int wake_fd_;
+  std::uint64_t wake_value_;
+  bool stopping_;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_URING_SERVER_HPP
@@ -0,0 +1,67 @@
+#ifndef CIDR_TRACE_H
+#define CIDR_TRACE_H
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * Highest trace level compiled into the binary. Trace points above it
+ * expand to nothing. Release builds keep the per-query debug points so they
+ * can be switched on at runtime, and drop the per-record verbose points.
+ */
+#ifndef CIDR_TRACE_LEVEL
+#  ifdef NDEBUG
+#    define CIDR_TRACE_LEVEL 3
+#  else
+#    define CIDR_TRACE_LEVEL 4
+#  endif
+#endif
+
+/**
+ * Record a trace event. The event name must be a string literal; the two
+ * values are copied into a lock-free ring buffer and formatted later by a
+ * background thread, so the calling thread never blocks or allocates.
+ */
+#define CIDR_TRACE(lvl, event, a, b)                                        \
+    do {                                                                    \
+        if ((lvl) <= CIDR_TRACE_LEVEL && ::cidr::trace::enabled(lvl))       \
+            ::cidr::trace::emit((lvl), (event),                             \
+                                static_cast<std::uint64_t>(a),              \
+                                static_cast<std::uint64_t>(b));             \
+    } while (0)
+
+namespace cidr
+{
+    namespace trace
+    {
+        enum level
+        {
+            off = 0,
+            error = 1,
+            info = 2,
+            debug = 3,
+            verbose = 4
+        };
+
+        extern std::atomic<int> current_level;
+
+        /**
+         * Cheap check made at every trace point: one relaxed load.
+         */
+        inline bool enabled(int lvl)
+        {
+            return lvl <= current_level.load(std::memory_order_relaxed);
+        }
+
+        void emit(int lvl, const char *event, std::uint64_t a, std::uint64_t b);
+
+        void configure(int lvl, std::uint32_t sample_every = 1);
+        void configure_from_env();
+        int raise_level();
+        void flush();
+
+        std::uint64_t dropped();
+    }
+}
+
+#endif // CIDR_TRACE_H
@@ -0,0 +1,829 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+#include <boost/algorithm/string.hpp>
+#include "awaitable.hpp"
+
+namespace asio = boost::asio;
+namespace ba = boost::algorithm;
+namespace fs = boost::filesystem;
+namespace po = boost::program_options;
+
+using tcp = asio::ip::tcp;
+using udp = asio::ip::udp;
+using stream = asio::generic::stream_protocol;
+using steady = std::chrono::steady_clock;
+
+
+/**
+ * Load generator for cidrdb_rest.
+ *
+ * Closed loop keeps a fixed number of requests in flight and issues the next
+ * one as soon as one completes. Open loop issues requests on a fixed
+ * schedule and measures latency from the scheduled start, so a stalled
+ * server shows up in the tail instead of silently lowering the offered load.
+ *
+ * Requests ask for keep-alive and connections are reused, one request at a
+ * time each, so the numbers are about requests rather than connection
+ * setup; --no-keep-alive opens a connection per request instead.
+ */
+
+enum op_kind { single_lookup, batch_lookup, mutation, op_kinds };
+
+static const char *op_names[op_kinds] = { "Single-Lookup", "Batch-Lookup", "Mutation" };
+
+struct options
+{
+    std::string host;
+    std::string port;
+    std::string mode;
+    std::string accept;
+    std::string udp_port;
+    std::string unix_socket;
+    size_t connections;
+    double rate;
+    double duration;
+    size_t batch_size;
+    bool keep_alive;
+    double mix[op_kinds];
+};
+
+/**
+ * Latency samples for one operation type, in nanoseconds.
+ */
+struct samples
+{
+    std::vector<uint64_t> latencies;
+    size_t errors = 0;
+
+    uint64_t percentile(double p)
+    {
+        if (latencies.empty()) return 0;
+        size_t i = std::min(latencies.size() - 1, (size_t)(p * latencies.size()));
+        std::nth_element(latencies.begin(), latencies.begin() + i, latencies.end());
+        return latencies[i];
+    }
+};
+
+/**
+ * Source of request paths and bodies.
+ */
+class workload
+{
+public:
+    workload(const options &opts, const std::vector<std::string> &ips)
+        : opts_(opts), ips_(ips), rng_(42), next_ip_(0), mutations_(0)
+    {
+        std::discrete_distribution<int> d(opts.mix, opts.mix + op_kinds);
+        pick_op_ = d;
+    }
+
+    op_kind next(std::string &request)
+    {
+        op_kind kind = static_cast<op_kind>(pick_op_(rng_));
+        std::ostringstream out;
+        const char *connection = opts_.keep_alive ? "Connection: keep-alive\r\n" : "";
+
+        if (kind == single_lookup)
+        {
+            out << "GET /" << ip() << " HTTP/1.0\r\n"
+                << connection
+                << "Accept: " << opts_.accept << "\r\n\r\n";
+        }
+        else if (kind == batch_lookup)
+        {
+            std::string body;
+            for (size_t i = 0; i < opts_.batch_size; i++)
+                body += ip() + "\n";
+
+            out << "POST / HTTP/1.0\r\n"
+                << connection
+                << "Accept: " << opts_.accept << "\r\n"
+                << "Content-Length: " << body.size() << "\r\n\r\n"
+                << body;
+        }
+        else
+        {
+            // Alternate adding and removing /24s inside the 198.18.0.0/15
+            // benchmarking range so the database does not drift in size.
+            size_t n = mutations_++;
+            uint32_t net = 0xc6120000 | (((n / 2) % 512) << 8);
+
+            out << (n % 2 == 0 ? "PUT /" : "DELETE /")
+                << (net >> 24) << "." << ((net >> 16) & 0xff) << "."
+                << ((net >> 8) & 0xff) << ".0/24 HTTP/1.0\r\n"
+                << connection
+                << "Accept: " << opts_.accept << "\r\n\r\n";
+        }
+
+        request = out.str();
+        return kind;
+    }
+
+    /**
+     * Binary lookup datagram for the UDP listener, see udp_lookup.hpp.
+     * Mutations have no UDP form; main() rejects mixes that ask for them.
+     */
+    op_kind next_datagram(std::string &datagram, uint32_t id)
+    {
+        op_kind kind = static_cast<op_kind>(pick_op_(rng_));
+        size_t count = kind == single_lookup ? 1 : std::min<size_t>(opts_.batch_size, 256);
+
+        datagram.resize(4 + 4 * count);
+        uint32_t be = htonl(id);
+        memcpy(&datagram[0], &be, 4);
+
+        for (size_t i = 0; i < count; i++)
+        {
+            in_addr_t addr = inet_addr(ip().c_str());
+            memcpy(&datagram[4 + 4 * i], &addr, 4);
+        }
+
+        return kind;
+    }
+
+private:
+    const options &opts_;
+    const std::vector<std::string> &ips_;
+    std::mt19937 rng_;
+    std::discrete_distribution<int> pick_op_;
+    size_t next_ip_;
+    size_t mutations_;
+
+    std::string ip()
+    {
+        if (!ips_.empty())
+            return ips_[next_ip_++ % ips_.size()];
+
+        uint32_t addr = std::uniform_int_distribution<uint32_t>(0x01000000, 0xdfffffff)(rng_);
+        std::ostringstream out;
+        out << (addr >> 24) << "." << ((addr >> 16) & 0xff) << "."
+            << ((addr >> 8) & 0xff) << "." << (addr & 0xff);
+        return out.str();
+    }
+};
+
+/**
+ * Drives requests against the server on a single io_service thread.
+ */
+class loadgen
+{
+public:
+    loadgen(asio::io_service &io, const options &opts, workload &work,
+            const tcp::endpoint &endpoint)
+        : io_(io), opts_(opts), work_(work),
+          endpoint_(opts.unix_socket.empty() ? stream::endpoint(endpoint)
+                    : stream::endpoint(asio::local::stream_protocol::endpoint(opts.unix_socket))),
+          udp_endpoint_(endpoint.address(), opts.udp_port.empty() ? 0 : std::stoi(opts.udp_port)),
+          timer_(io), in_flight_(0), scheduled_(0), next_id_(0), stopping_(false)
+        { }
+
+    void start()
+    {
+        start_ = steady::now();
+        deadline_ = start_ + to_duration(opts_.duration);
+
+        if (opts_.mode == "open")
+        {
+            schedule();
+        }
+        else
+        {
+            for (size_t i = 0; i < opts_.connections; i++)
+                issue(steady::now());
+        }
+    }
+
+    void report(std::ostream &out)
+    {
+        double elapsed = std::chrono::duration<double>(finish_ - start_).count();
+        samples all;
+        size_t total = 0;
+
+        for (auto &s : stats_)
+        {
+            all.latencies.insert(all.latencies.end(),
+                                 s.latencies.begin(), s.latencies.end());
+            all.errors += s.errors;
+            total += s.latencies.size() + s.errors;
+        }
+
+        out << "mode:        " << opts_.mode;
+        if (opts_.mode == "open") out << " @ " << opts_.rate << " req/s";
+        out << "\n"
+            << "duration:    " << elapsed << " s\n"
+            << "requests:    " << total << " (" << all.errors << " errors)\n"
+            << "throughput:  " << all.latencies.size() / elapsed << " req/s\n\n";
+
+        out << "operation          count       p50 us       p99 us      p999 us       max us\n";
+
+        for (int k = 0; k <= op_kinds; k++)
+        {
+            samples &s = k < op_kinds ? stats_[k] : all;
+            if (s.latencies.empty()) continue;
+
+            char line[160];
+            snprintf(line, sizeof line, "%-14s %9zu %12.1f %12.1f %12.1f %12.1f\n",
+                     k < op_kinds ? op_names[k] : "all",
+                     s.latencies.size(),
+                     s.percentile(0.50) / 1e3,
+                     s.percentile(0.99) / 1e3,
+                     s.percentile(0.999) / 1e3,
+                     s.percentile(1.0) / 1e3);
+            out << line;
+        }
+    }
+
+    size_t requests() const
+    {
+        size_t total = 0;
+        for (auto &s : stats_)
+            total += s.latencies.size() + s.errors;
+        return total;
+    }
+
+private:
+    struct request_state
+    {
+        std::shared_ptr<stream::socket> socket;
+        std::string request;
+        asio::streambuf response;
+        op_kind kind;
+        steady::time_point start;
+        int status = 0;
+        bool reusable = false;
+
+        // UDP mode
+        udp::socket datagram_socket;
+        asio::steady_timer timeout;
+        std::vector<char> reply;
+
+        explicit request_state(asio::io_service &io)
+            : datagram_socket(io), timeout(io) { }
+    };
+
+    asio::io_service &io_;
+    const options &opts_;
+    workload &work_;
+    stream::endpoint endpoint_;
+    udp::endpoint udp_endpoint_;
+    asio::steady_timer timer_;
+    size_t in_flight_;
+    size_t scheduled_;
+    uint32_t next_id_;
+    bool stopping_;
+    std::deque<steady::time_point> backlog_;
+    std::vector<std::shared_ptr<stream::socket>> idle_;
+    samples stats_[op_kinds];
+    steady::time_point start_;
+    steady::time_point deadline_;
+    steady::time_point finish_;
+
+    static steady::duration to_duration(double seconds)
+    {
+        return std::chrono::duration_cast<steady::duration>(
+            std::chrono::duration<double>(seconds));
+    }
+
+    /**
+     * Open loop: fire the next request at its scheduled time, queueing it
+     * if the in-flight cap has been reached.
+     */
+    void schedule()
+    {
+        steady::time_point when = start_ + to_duration(scheduled_ / opts_.rate);
+
+        if (when >= deadline_)
+        {
+            stopping_ = true;
+            maybe_finish();
+            return;
+        }
+
+        timer_.expires_at(when);
+        timer_.async_wait([this, when](const boost::system::error_code &e)
+        {
+            if (e) return;
+
+            scheduled_++;
+
+            if (in_flight_ < opts_.connections)
+                issue(when);
+            else
+                backlog_.push_back(when);
+
+            schedule();
+        });
+    }
+
+    void issue(steady::time_point start)
+    {
+        auto state = std::make_shared<request_state>(io_);
+        state->start = start;
+        in_flight_++;
+
+        if (!opts_.udp_port.empty())
+        {
+            state->kind = work_.next_datagram(state->request, next_id_++);
+            return issue_datagram(state);
+        }
+
+        state->kind = work_.next(state->request);
+
+        if (!idle_.empty())
+        {
+            state->socket = idle_.back();
+            idle_.pop_back();
+            return send(state);
+        }
+
+        state->socket = std::make_shared<stream::socket>(io_);
+        state->socket->async_connect(endpoint_,
+            [this, state](const boost::system::error_code &e)
+            {
+                if (e) return complete(state, false);
+
+                // a request on a reused connection mustn't wait for the
+                // delayed ACK of the previous reply; fails harmlessly on a
+                // Unix domain socket
+                boost::system::error_code ignored;
+                state->socket->set_option(tcp::no_delay(true), ignored);
+
+                send(state);
+            });
+    }
+
+    void send(std::shared_ptr<request_state> state)
+    {
+        asio::async_write(*state->socket, asio::buffer(state->request),
+            [this, state](const boost::system::error_code &e, size_t)
+            {
+                if (e) return complete(state, false);
+
+                asio::async_read_until(*state->socket, state->response, "\r\n\r\n",
+                    [this, state](const boost::system::error_code &e, size_t)
+                    {
+                        if (e) return complete(state, false);
+                        read_body(state);
+                    });
+            });
+    }
+
+    /**
+     * After the headers: exactly Content-Length more bytes if the server
+     * keeps the connection, so it can carry the next request, or
+     * everything up to the close otherwise.
+     */
+    void read_body(std::shared_ptr<request_state> state)
+    {
+        std::istream response(&state->response);
+        std::string version, line;
+        response >> version >> state->status;
+        std::getline(response, line);
+
+        size_t content_length = 0;
+        bool length_known = false;
+        bool keep_alive = false;
+
+        while (std::getline(response, line) && line != "\r")
+        {
+            size_t colon = line.find(':');
+            if (colon == std::string::npos)
+                continue;
+
+            std::string name(line.substr(0, colon));
+            std::string value(ba::trim_copy(line.substr(colon + 1)));
+
+            if (ba::iequals(name, "Content-Length"))
+            {
+                content_length = std::stoul(value);
+                length_known = true;
+            }
+            else if (ba::iequals(name, "Connection"))
+            {
+                keep_alive = ba::iequals(value, "keep-alive");
+            }
+        }
+
+        state->reusable = keep_alive && length_known;
+
+        if (!state->reusable)
+        {
+            asio::async_read(*state->socket, state->response,
+                [this, state](const boost::system::error_code &e, size_t)
+                {
+                    complete(state, !e || e == asio::error::eof);
+                });
+            return;
+        }
+
+        if (state->response.size() >= content_length)
+            return complete(state, true);
+
+        asio::async_read(*state->socket, state->response,
+            asio::transfer_exactly(content_length - state->response.size()),
+            [this, state](const boost::system::error_code &e, size_t)
+            {
+                complete(state, !e);
+            });
+    }
+
+    /**
+     * One datagram out, one back with the same request ID. A datagram
+     * lost on the way counts as an error after a second.
+     */
+    void issue_datagram(std::shared_ptr<request_state> state)
+    {
+        boost::system::error_code e;
+        state->datagram_socket.open(udp_endpoint_.protocol(), e);
+        if (!e) state->datagram_socket.connect(udp_endpoint_, e);
+        if (e) return complete(state, false);
+
+        state->timeout.expires_after(std::chrono::seconds(1));
+        state->timeout.async_wait([state](const boost::system::error_code &e)
+        {
+            boost::system::error_code ignored;
+            if (!e) state->datagram_socket.close(ignored);
+        });
+
+        state->datagram_socket.async_send(asio::buffer(state->request),
+            [this, state](const boost::system::error_code &e, size_t)
+            {
+                if (e) return complete(state, false);
+
+                state->reply.resize(65536);
+                state->datagram_socket.async_receive(asio::buffer(state->reply),
+                    [this, state](const boost::system::error_code &e, size_t n)
+                    {
+                        state->timeout.cancel();
+                        complete(state, !e && n >= 4
+                                 && memcmp(state->reply.data(), state->request.data(), 4) == 0);
+                    });
+            });
+    }
+
+    void complete(std::shared_ptr<request_state> state, bool ok)
+    {
+        steady::time_point now = steady::now();
+        in_flight_--;
+
+        if (opts_.udp_port.empty())
+        {
+            ok = ok && state->status == 200;
+
+            if (ok && state->reusable)
+                idle_.push_back(state->socket);
+        }
+
+        if (ok)
+            stats_[state->kind].latencies.push_back(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    now - state->start).count());
+        else
+            stats_[state->kind].errors++;
+
+        if (opts_.mode == "open")
+        {
+            if (!backlog_.empty())
+            {
+                issue(backlog_.front());
+                backlog_.pop_front();
+            }
+        }
+        else if (now < deadline_)
+        {
+            issue(now);
+        }
+        else
+        {
+            stopping_ = true;
+        }
+
+        maybe_finish();
+    }
+
+    void maybe_finish()
+    {
+        if (stopping_ && in_flight_ == 0 && backlog_.empty())
+        {
+            finish_ = steady::now();
+            timer_.cancel();
+            idle_.clear();
+        }
+    }
+};
+
+/**
+ * CPU time and context switches of a process, summed over its threads.
+ */
+struct process_usage
+{
+    double cpu_seconds = 0;
+    uint64_t context_switches = 0;
+};
+
+static process_usage read_usage(pid_t pid)
+{
+    process_usage usage;
+    fs::path proc("/proc/" + std::to_string(pid));
+
+    // utime and stime are fields 14 and 15; the command name in field 2
+    // may contain spaces, so count from the closing parenthesis.
+    std::ifstream stat((proc / "stat").string());
+    std::string line;
+    std::getline(stat, line);
+    size_t paren = line.rfind(')');
+
+    if (paren != std::string::npos)
+    {
+        std::istringstream fields(line.substr(paren + 2));
+        std::string field;
+        unsigned long utime = 0, stime = 0;
+
+        for (int i = 3; i <= 13 && fields >> field; i++) { }
+        fields >> utime >> stime;
+        usage.cpu_seconds = double(utime + stime) / sysconf(_SC_CLK_TCK);
+    }
+
+    boost::system::error_code e;
+    for (fs::directory_iterator task(proc / "task", e), end; !e && task != end; ++task)
+    {
+        std::ifstream status((task->path() / "status").string());
+
+        while (std::getline(status, line))
+        {
+            if (ba::ends_with(line.substr(0, line.find(':')), "ctxt_switches"))
+                usage.context_switches += std::stoull(line.substr(line.find(':') + 1));
+        }
+    }
+
+    return usage;
+}
+
+/**
+ * Counts the system calls a process makes, over all of its threads, by
+ * tracing it with ptrace. procfs has no such counter, and the read/write
+ * counts in /proc/<pid>/io miss recvmsg, sendmsg, epoll_wait and
+ * io_uring_enter, which are most of what a server does. Every call stops
+ * the server twice, so it runs slower while it is counted.
+ *
+ * The tracer is a thread of its own, as ptrace requests must come from
+ * the thread that attached. It runs until the process exits, and reaps it.
+ */
+class syscall_counter
+{
+public:
+    explicit syscall_counter(pid_t pid)
+        : pid_(pid), stops_(0), thread_([this] { run(); }) { }
+
+    ~syscall_counter()
+    {
+        thread_.join();
+    }
+
+    /** System calls made since tracing started. */
+    uint64_t count() const
+    {
+        return stops_.load() / 2;
+    }
+
+private:
+    pid_t pid_;
+    std::atomic<uint64_t> stops_;
+    std::thread thread_;
+
+    void run()
+    {
+        // threads started later are traced from their first instruction
+        long options = PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE;
+        boost::system::error_code e;
+        fs::path tasks("/proc/" + std::to_string(pid_) + "/task");
+
+        for (fs::directory_iterator task(tasks, e), end; !e && task != end; ++task)
+        {
+            pid_t tid = std::stoi(task->path().filename().string());
+            if (ptrace(PTRACE_SEIZE, tid, nullptr, options) == 0)
+                ptrace(PTRACE_INTERRUPT, tid, nullptr, nullptr);
+        }
+
+        int status;
+        pid_t tid;
+
+        while ((tid = waitpid(-1, &status, __WALL)) > 0)
+        {
+            if (!WIFSTOPPED(status))
+            {
+                if (tid == pid_)
+                    break;
+                continue;
+            }
+
+            int signal = 0;
+            if (WSTOPSIG(status) == (SIGTRAP | 0x80))
+                stops_++;
+            else if (status >> 16 == 0)
+                signal = WSTOPSIG(status);  // deliver the server's own signals
+
+            ptrace(PTRACE_SYSCALL, tid, nullptr, signal);
+        }
+    }
+};
+
+/**
+ * Start cidrdb_rest on loopback and wait until it accepts connections.
+ */
+static pid_t spawn_server(const std::string &binary, const std::vector<std::string> &args,
+                          const tcp::endpoint &endpoint)
+{
+    pid_t pid = fork();
+
+    if (pid == 0)
+    {
+        std::vector<char*> argv;
+        argv.push_back(const_cast<char*>(binary.c_str()));
+        for (const std::string &arg : args)
+            argv.push_back(const_cast<char*>(arg.c_str()));
+        argv.push_back(nullptr);
+
+        execv(binary.c_str(), argv.data());
+        _exit(127);
+    }
+
+    for (int attempt = 0; attempt < 100; attempt++)
+    {
+        asio::io_service io;
+        tcp::socket probe(io);
+        boost::system::error_code e;
+        probe.connect(endpoint, e);
+        if (!e) return pid;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+
+    kill(pid, SIGTERM);
+    waitpid(pid, nullptr, 0);
+    return -1;
+}
+
+int main(int ac, char** av)
+{
+    options opts;
+    std::string mix;
+
+    po::options_description desc("Parameters:");
+    desc.add_options()
+        ("host", po::value<std::string>(&opts.host)->default_value("127.0.0.1"), "server address")
+        ("port", po::value<std::string>(&opts.port)->default_value("8080"), "server port")
+        ("mode", po::value<std::string>(&opts.mode)->default_value("closed"), "closed or open loop")
+        ("connections", po::value<size_t>(&opts.connections)->default_value(16), "requests in flight (closed) or in-flight cap (open)")
+        ("rate", po::value<double>(&opts.rate)->default_value(1000), "open loop request rate, req/s")
+        ("duration", po::value<double>(&opts.duration)->default_value(10), "test length in seconds")
+        ("mix", po::value<std::string>(&mix)->default_value("90:9:1"), "single:batch:mutation ratio")
+        ("batch-size", po::value<size_t>(&opts.batch_size)->default_value(100), "IPs per Batch-Lookup")
+        ("accept", po::value<std::string>(&opts.accept)->default_value("application/json"), "Accept header")
+        ("no-keep-alive", "open a new connection for every request")
+        ("unix-socket", po::value<std::string>(&opts.unix_socket), "send HTTP requests over this Unix domain socket instead of TCP")
+        ("udp-port", po::value<std::string>(&opts.udp_port), "send lookups as binary UDP datagrams to this port instead of HTTP")
+        ("ips", po::value<std::string>(), "file of IPs to query, one per line (default random)")
+        ("spawn", po::value<std::string>(), "path to a cidrdb_rest binary to start on loopback")
+        ("db", po::value<std::string>(), "CIDR database for --spawn")
+        ("backend", po::value<std::string>()->default_value("asio"), "network backend for --spawn: asio or uring")
+        ("count-syscalls", "trace the --spawn server to count its system calls per request; slows it down")
+        ("help", "show this help");
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(ac, av, desc), vm);
+    po::notify(vm);
+
+    std::vector<std::string> ratios;
+    ba::split(ratios, mix, boost::is_any_of(":"));
+
+    if (vm.count("help") || ratios.size() != op_kinds
+        || (opts.mode != "open" && opts.mode != "closed")
+        || (vm.count("spawn") && !vm.count("db"))
+        || (vm.count("count-syscalls") && !vm.count("spawn")))
+    {
+        std::cerr << desc << std::endl;
+        return 1;
+    }
+
+    for (int k = 0; k < op_kinds; k++)
+        opts.mix[k] = std::stod(ratios[k]);
+
+    opts.keep_alive = !vm.count("no-keep-alive");
+
+    if (!opts.udp_port.empty() && opts.mix[mutation] > 0)
+    {
+        std::cerr << "--udp-port takes lookups only; use a mix like --mix 90:10:0" << std::endl;
+        return 1;
+    }
+
+    std::vector<std::string> ips;
+
+    if (vm.count("ips"))
+    {
+        std::ifstream infile(vm["ips"].as<std::string>());
+        std::string ip;
+        while (infile >> ip) ips.push_back(ip);
+    }
+
+    asio::io_service io;
+    tcp::resolver resolver(io);
+    tcp::endpoint endpoint = *resolver.resolve(tcp::resolver::query(opts.host, opts.port));
+
+    pid_t server = 0;
+    fs::path scratch_db;
+
+    if (vm.count("spawn"))
+    {
+        fs::path db(vm["db"].as<std::string>());
+        if (!fs::exists(db))
+        {
+            std::cerr << "No such file: " << db << std::endl;
+            return 1;
+        }
+
+        // The server commits every PUT and DELETE of the mix to its file,
+        // so it gets a copy and the user's database is left as it was.
+        scratch_db = fs::temp_directory_path()
+            / fs::unique_path("cidrdb_loadgen-%%%%-%%%%-%%%%.cdb");
+        fs::copy_file(db, scratch_db);
+
+        std::vector<std::string> args = { "127.0.0.1", opts.port, scratch_db.string(),
+                                          "--backend", vm["backend"].as<std::string>() };
+        if (!opts.udp_port.empty())
+            args.insert(args.end(), { "--udp-port", opts.udp_port });
+        if (!opts.unix_socket.empty())
+            args.insert(args.end(), { "--unix-socket", opts.unix_socket });
+
+        server = spawn_server(vm["spawn"].as<std::string>(), args, endpoint);
+        if (server < 0)
+        {
+            std::cerr << "Failed to start " << vm["spawn"].as<std::string>() << std::endl;
+            fs::remove(scratch_db);
+            return 1;
+        }
+    }
+
+    std::unique_ptr<syscall_counter> syscalls;
+    if (server > 0 && vm.count("count-syscalls"))
+        syscalls.reset(new syscall_counter(server));
+
+    workload work(opts, ips);
+    loadgen gen(io, opts, work, endpoint);
+
+    process_usage before;
+    uint64_t syscalls_before = 0;
+    if (server > 0) before = read_usage(server);
+    if (syscalls) syscalls_before = syscalls->count();
+
+    gen.start();
+    io.run();
+    gen.report(std::cout);
+
+    if (server > 0 && gen.requests() > 0)
+    {
+        process_usage after = read_usage(server);
+        double requests = gen.requests();
+
+        char line[160];
+        snprintf(line, sizeof line, "\nserver (%s): %.1f us cpu/req, %.2f context switches/req\n",
+                 vm["backend"].as<std::string>().c_str(),
+                 (after.cpu_seconds - before.cpu_seconds) * 1e6 / requests,
+                 (after.context_switches - before.context_switches) / requests);
+        std::cout << line;
+
+        if (syscalls)
+        {
+            snprintf(line, sizeof line, "server (%s): %.2f syscalls/req (traced)\n",
+                     vm["backend"].as<std::string>().c_str(),
+                     (syscalls->count() - syscalls_before) / requests);
+            std::cout << line;
+        }
+    }
+
+    if (server > 0)
+    {
+        kill(server, SIGTERM);
+        syscalls.reset();  // the tracer reaps the server when it exits
+        waitpid(server, nullptr, 0);
+        fs::remove(scratch_db);
+    }
+
+    return 0;
+}
@@ -1,7 +1,13 @@
 #include <iostream>
+#include <fstream>
+#include <stdexcept>
 #include <boost/filesystem.hpp>
 #include <boost/program_options.hpp>
 #include "cidr_db.hpp"
+#include "cidr_emit.hpp"
+#include "cidr_merge.hpp"
+#include "cidr_stream.hpp"
+#include "trace.hpp"
 
 namespace fs = boost::filesystem;
 namespace po = boost::program_options;
@@ -12,12 +18,201 @@ int main(int ac, char** av)
     desc.add_options()
         ("in", po::value<std::string>(), "input source data filename")
         ("db", po::value<std::string>(), "CIDR database filename")
-        ("ip", po::value<std::string>(), "IP address to scan");
+        ("ip", po::value<std::string>(), "IP address to scan")
+        ("merge", po::value<std::string>(), "diff, union or intersect --db with --with")
+        ("with", po::value<std::string>(), "second CIDR database filename for --merge")
+        ("out", po::value<std::string>(), "merged CIDR database or delta filename (default: stdout)")
+        ("delta", po::value<std::vector<std::string>>()->multitoken(),
+            "<old.list> <new.list>: apply the changes to --db, or write them as +/- lines")
+        ("emit-cpp", po::value<std::string>(), "write --db as <prefix>.hpp and <prefix>.cpp lookup code")
+        ("namespace", po::value<std::string>()->default_value("cidr_frozen"), "namespace for --emit-cpp")
+        ("stdin", "look up one IP address per line of stdin")
+        ("input", po::value<std::string>(), "look up one IP address per line of this file")
+        ("threads", po::value<size_t>()->default_value(0), "lookup threads for --stdin/--input (0 = all cores)")
+        ("join", "append a column of matching CIDRs to delimited --input (or stdin)")
+        ("field", po::value<size_t>()->default_value(1), "1-based field holding the IP address for --join")
+        ("delimiter", po::value<std::string>()->default_value(","), "field delimiter for --join (a single character, or \\t)");
 
     po::variables_map vm;
     po::store(po::parse_command_line(ac, av, desc), vm);
     po::notify(vm);
 
+    cidr::trace::configure_from_env();
+
+    if (vm.count("merge"))
+    {
+        if (!vm.count("db") || !vm.count("with"))
+        {
+            std::cerr << desc << std::endl;
+            return 1;
+        }
+
+        try
+        {
+            cidr::merge::operation op(cidr::merge::parse_operation(vm["merge"].as<std::string>()));
+            fs::path a(vm["db"].as<std::string>());
+            fs::path b(vm["with"].as<std::string>());
+
+            if (vm.count("out"))
+            {
+                cidr::merge::to_db(a, b, op, fs::path(vm["out"].as<std::string>()));
+            }
+            else
+            {
+                std::ios::sync_with_stdio(false);
+                cidr::merge::to_stream(a, b, op, std::cout);
+                std::cout.flush();
+            }
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+
+        return 0;
+    }
+
+    if (vm.count("delta"))
+    {
+        std::vector<std::string> lists(vm["delta"].as<std::vector<std::string>>());
+
+        if (lists.size() != 2)
+        {
+            std::cerr << desc << std::endl;
+            return 1;
+        }
+
+        try
+        {
+            size_t count;
+
+            if (vm.count("db"))
+            {
+                count = cidr::merge::apply_delta(fs::path(lists[0]), fs::path(lists[1]),
+                                                 fs::path(vm["db"].as<std::string>()));
+            }
+            else if (vm.count("out"))
+            {
+                std::string out(vm["out"].as<std::string>());
+                std::ofstream outfile(out.c_str());
+                if (!outfile)
+                    throw std::runtime_error("Can't write " + out);
+
+                count = cidr::merge::delta(fs::path(lists[0]), fs::path(lists[1]), outfile);
+
+                outfile.close();
+                if (!outfile)
+                    throw std::runtime_error("Can't write " + out);
+            }
+            else
+            {
+                std::ios::sync_with_stdio(false);
+                count = cidr::merge::delta(fs::path(lists[0]), fs::path(lists[1]), std::cout);
+                std::cout.flush();
+            }
+
+            std::cerr << count << " changes" << std::endl;
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+
+        return 0;
+    }
+
+    if (vm.count("emit-cpp"))
+    {
+        if (!vm.count("db"))
+        {
+            std::cerr << desc << std::endl;
+            return 1;
+        }
+
+        try
+        {
+            std::string prefix(vm["emit-cpp"].as<std::string>());
+            size_t count = cidr::emit::cpp(fs::path(vm["db"].as<std::string>()),
+                                           fs::path(prefix + ".hpp"),
+                                           fs::path(prefix + ".cpp"),
+                                           vm["namespace"].as<std::string>());
+
+            std::cerr << count << " CIDRs emitted" << std::endl;
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+
+        return 0;
+    }
+
+    if (vm.count("stdin") || vm.count("input") || vm.count("join"))
+    {
+        if (!vm.count("db") || !fs::exists(vm["db"].as<std::string>()))
+        {
+            std::cerr << desc << std::endl;
+            return 1;
+        }
+
+        try
+        {
+            cidr::db db(fs::path(vm["db"].as<std::string>()));
+            db.prefilter(true);
+
+            cidr::stream::options opts;
+            opts.threads = vm["threads"].as<size_t>();
+
+            std::ios::sync_with_stdio(false);
+
+            if (vm.count("join"))
+            {
+                std::string delimiter(vm["delimiter"].as<std::string>());
+                cidr::stream::join_options join;
+                join.field = vm["field"].as<size_t>();
+
+                if (join.field == 0 || delimiter.empty() || (delimiter.size() > 1 && delimiter != "\\t"))
+                {
+                    std::cerr << desc << std::endl;
+                    return 1;
+                }
+
+                join.delimiter = delimiter == "\\t" ? '\t' : delimiter[0];
+
+                if (vm.count("input"))
+                    cidr::stream::join(db, fs::path(vm["input"].as<std::string>()), std::cout, join, opts);
+                else
+                    cidr::stream::join(db, std::cin, std::cout, join, opts);
+            }
+            else if (vm.count("input"))
+            {
+                std::ifstream infile(vm["input"].as<std::string>().c_str(), std::ios::in|std::ios::binary);
+
+                if (!infile)
+                {
+                    std::cerr << "Failed to read: " << vm["input"].as<std::string>() << std::endl;
+                    return 1;
+                }
+
+                cidr::stream::lookup(db, infile, std::cout, opts);
+            }
+            else
+            {
+                cidr::stream::lookup(db, std::cin, std::cout, opts);
+            }
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+
+        return 0;
+    }
+
     if ( !vm.count("db") || !vm.count("ip") )
     {
         std::cerr << desc << std::endl;
@@ -0,0 +1,254 @@
+///
+/// \file compressor.cpp
+///
+/// Content-Encoding of reply bodies.
+///
+
+#include "compressor.hpp"
+#include <cstdlib>
+#include <ctime>
+#include <new>
+#include <stdexcept>
+#include <vector>
+#include <boost/algorithm/string.hpp>
+#ifdef CIDRDB_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace ba = boost::algorithm;
+
+namespace http {
+namespace server {
+
+namespace {
+
+/// Codings in order of preference when the client likes them equally.
+const metrics::encoding preference[] =
+{
+#ifdef CIDRDB_HAVE_ZSTD
+  metrics::encoding_zstd,
+#endif
+  metrics::encoding_gzip,
+  metrics::encoding_deflate
+};
+
+/// Output space added per deflate() or ZSTD_compressStream2() call.
+const std::size_t out_step = 16 * 1024;
+
+double thread_cpu_seconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+} // namespace
+
+std::unique_ptr<compressor> compressor::negotiate(
+    const std::string& accept_encoding, int level)
+{
+  double quality[metrics::encoding_count] = {};
+  bool listed[metrics::encoding_count] = {};
+  double wildcard = 0;
+
+  std::vector<std::string> elements;
+  ba::split(elements, accept_encoding, ba::is_any_of(","));
+
+  for (auto& element : elements)
+  {
+    std::vector<std::string> params;
+    ba::split(params, element, ba::is_any_of(";"));
+
+    std::string coding(ba::to_lower_copy(ba::trim_copy(params[0])));
+    double q = 1;
+
+    for (std::size_t i = 1; i < params.size(); ++i)
+    {
+      std::string param(ba::trim_copy(params[i]));
+      if (param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=')
+        q = std::strtod(param.c_str() + 2, nullptr);
+    }
+
+    if (coding == "x-gzip")
+      coding = "gzip";
+
+    if (coding == "*")
+      wildcard = q;
+
+    for (std::size_t e = 0; e < metrics::encoding_count; ++e)
+    {
+      if (coding == metrics::encoding_name(static_cast<metrics::encoding>(e)))
+      {
+        quality[e] = q;
+        listed[e] = true;
+      }
+    }
+  }
+
+  std::unique_ptr<compressor> chosen;
+  double best = 0;
+
+  for (metrics::encoding e : preference)
+  {
+    double q = listed[e] ? quality[e] : wildcard;
+    if (q > best)
+    {
+      best = q;
+      chosen.reset(new compressor(e, level));
+    }
+  }
+
+  return chosen;
+}
+
+const char* compressor::name(metrics::encoding coding)
+{
+  return metrics::encoding_name(coding);
+}
+
+compressor::compressor(metrics::encoding coding, int level)
+  : coding_(coding),
+    level_(level < 1 ? 1 : level > max_level ? max_level : level),
+    started_(false),
+    bytes_in_(0),
+    bytes_out_(0),
+    cpu_seconds_(0),
+    zlib_(),
+    zstd_(nullptr)
+{
+}
+
+compressor::~compressor()
+{
+  if (!started_)
+    return;
+
+#ifdef CIDRDB_HAVE_ZSTD
+  if (coding_ == metrics::encoding_zstd)
+  {
+    ZSTD_freeCCtx(static_cast<ZSTD_CCtx*>(zstd_));
+    return;
+  }
+#endif
+
+  deflateEnd(&zlib_);
+}
+
+void compressor::consume(std::string& pending)
+{
+  if (pending.size() < chunk_size)
+    return;
+
+  compress(pending.data(), pending.size(), no_flush);
+  pending.clear();
+}
+
+bool compressor::finish(std::string& content)
+{
+  if (!started_ && content.size() < min_size)
+    return false;
+
+  compress(content.data(), content.size(), finish_stream);
+  content.swap(out_);
+  out_.clear();
+
+  metrics::observe_compression(coding_, bytes_in_, content.size(), cpu_seconds_);
+  return true;
+}
+
+void compressor::sync(std::string& piece, bool last)
+{
+  compress(piece.data(), piece.size(), last ? finish_stream : sync_flush);
+  piece.swap(out_);
+  out_.clear();
+  bytes_out_ += piece.size();
+
+  if (last)
+    metrics::observe_compression(coding_, bytes_in_, bytes_out_, cpu_seconds_);
+}
+
+void compressor::compress(const char* data, std::size_t size, flush_mode mode)
+{
+  double start = thread_cpu_seconds();
+
+  if (!started_)
+  {
+#ifdef CIDRDB_HAVE_ZSTD
+    if (coding_ == metrics::encoding_zstd)
+    {
+      zstd_ = ZSTD_createCCtx();
+      if (zstd_ == nullptr)
+        throw std::bad_alloc();
+      ZSTD_CCtx_setParameter(static_cast<ZSTD_CCtx*>(zstd_),
+          ZSTD_c_compressionLevel, level_);
+    }
+    else
+#endif
+    {
+      // 15 window bits is the zlib format HTTP calls deflate; 16 more
+      // asks for a gzip header and trailer instead
+      int window_bits = coding_ == metrics::encoding_gzip ? 15 + 16 : 15;
+      if (deflateInit2(&zlib_, level_, Z_DEFLATED, window_bits, 8,
+            Z_DEFAULT_STRATEGY) != Z_OK)
+        throw std::bad_alloc();
+    }
+
+    started_ = true;
+  }
+
+  bytes_in_ += size;
+
+#ifdef CIDRDB_HAVE_ZSTD
+  if (coding_ == metrics::encoding_zstd)
+  {
+    ZSTD_inBuffer in = { data, size, 0 };
+    ZSTD_EndDirective directive = mode == finish_stream ? ZSTD_e_end
+        : mode == sync_flush ? ZSTD_e_flush : ZSTD_e_continue;
+    size_t remaining;
+
+    do
+    {
+      std::size_t used = out_.size();
+      out_.resize(used + out_step);
+      ZSTD_outBuffer out = { &out_[used], out_step, 0 };
+
+      remaining = ZSTD_compressStream2(static_cast<ZSTD_CCtx*>(zstd_),
+          &out, &in, directive);
+      out_.resize(used + out.pos);
+
+      if (ZSTD_isError(remaining))
+        throw std::runtime_error(ZSTD_getErrorName(remaining));
+    }
+    while (mode == no_flush ? in.pos < in.size : remaining != 0);
+
+    cpu_seconds_ += thread_cpu_seconds() - start;
+    return;
+  }
+#endif
+
+  zlib_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+  zlib_.avail_in = size;
+  int flush = mode == finish_stream ? Z_FINISH
+      : mode == sync_flush ? Z_SYNC_FLUSH : Z_NO_FLUSH;
+  int result;
+
+  do
+  {
+    std::size_t used = out_.size();
+    out_.resize(used + out_step);
+    zlib_.next_out = reinterpret_cast<Bytef*>(&out_[used]);
+    zlib_.avail_out = out_step;
+
+    result = deflate(&zlib_, flush);
+    out_.resize(used + out_step - zlib_.avail_out);
+
+    if (result == Z_STREAM_ERROR)
+      throw std::runtime_error("deflate failed");
+  }
+  while (mode == finish_stream ? result != Z_STREAM_END : zlib_.avail_out == 0);
+
+  cpu_seconds_ += thread_cpu_seconds() - start;
+}
+
+} // namespace server
+} // namespace http
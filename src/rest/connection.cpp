@@ -10,95 +10,172 @@
 ///
 
 #include "connection.hpp"
+#include <span>
 #include <vector>
+#include <boost/asio/redirect_error.hpp>
 #include <boost/bind.hpp>
 #include "connection_manager.hpp"
+#include "metrics.hpp"
 #include "request_handler.hpp"
 
 namespace http {
 namespace server {
 
+namespace {
+
+/// How long a client has to send a complete request, including the idle
+/// time before the next request on a kept-alive connection.
+const boost::posix_time::seconds request_timeout(30);
+
+} // namespace
+
 connection::connection(boost::asio::io_service& io_service,
     connection_manager& manager, request_handler& handler)
   : socket_(io_service),
+    deadline_(io_service),
+    request_deadline_(boost::posix_time::pos_infin),
+    buffer_begin_(0),
+    buffer_end_(0),
     connection_manager_(manager),
     request_handler_(handler),
     buffer_()
 {
 }
 
-boost::asio::ip::tcp::socket& connection::socket()
+connection::socket_type& connection::socket()
 {
   return socket_;
 }
 
 void connection::start()
 {
-  // ask to read asynchronously the client request
-  socket_.async_read_some(boost::asio::buffer(buffer_),
-      boost::bind(&connection::handle_read, shared_from_this(),
-        boost::asio::placeholders::error,
-        boost::asio::placeholders::bytes_transferred));
+  start_deadline();
+  boost::asio::co_spawn(socket_.get_executor(), run(shared_from_this()),
+      boost::asio::detached);
 }
 
 void connection::stop()
 {
   socket_.close();
+  deadline_.cancel();
 }
 
-void connection::handle_read(const boost::system::error_code& e,
-    std::size_t bytes_transferred)
+boost::asio::awaitable<void> connection::run(connection_ptr self)
 {
-  if (!e)
+  // errors come back as codes rather than exceptions, so that the usual
+  // end of a connection doesn't throw
+  boost::system::error_code e;
+  auto io = boost::asio::redirect_error(boost::asio::use_awaitable, e);
+
+  for (;;)
   {
-    boost::tribool result;
-    boost::tie(result, boost::tuples::ignore) = request_parser_.parse(
-        request_, buffer_.data(), buffer_.data() + bytes_transferred);
+    request_.clear();
+    reply_.clear();
+    request_parser_.reset();
+    request_deadline_ = boost::posix_time::microsec_clock::universal_time()
+      + request_timeout;
 
-    if (result)
+    // a kept-alive client may already have sent (part of) this request
+    boost::tribool parse_result;
+    while (boost::indeterminate(parse_result = parse_buffered()))
+    {
+      std::size_t bytes_transferred = co_await socket_.async_read_some(
+          boost::asio::buffer(buffer_), io);
+      if (e)
+        break;
+
+      metrics::add_bytes_in(bytes_transferred);
+      buffer_begin_ = 0;
+      buffer_end_ = bytes_transferred;
+    }
+
+    if (e)
+      break;
+
+    request_deadline_ = boost::posix_time::pos_infin;
+
+    bool keep_alive;
+    if (parse_result)
     {
       // parse done successfully, handle the request
       request_handler_.handle_request(request_, reply_);
-      boost::asio::async_write(socket_, reply_.to_buffers(),
-          boost::bind(&connection::handle_write, shared_from_this(),
-            boost::asio::placeholders::error));
+      keep_alive = wants_keep_alive(request_) && !reply_.stream;
     }
-    else if (!result)
+    else
     {
       // error interrupted the parse of the request
       reply::stock_reply(reply::bad_request, reply_);
-      boost::asio::async_write(socket_, reply_.to_buffers(),
-          boost::bind(&connection::handle_write, shared_from_this(),
-            boost::asio::placeholders::error));
+      keep_alive = false;
     }
-    else
+
+    if (keep_alive)
+      reply_.headers.push_back(header{"Connection", "keep-alive"});
+
+    // a span is cheap to copy into the operation, unlike the vector itself
+    reply_.to_buffers(buffers_);
+    metrics::add_bytes_out(co_await boost::asio::async_write(socket_,
+        std::span<const boost::asio::const_buffer>(buffers_), io));
+
+    // a streamed body follows, each piece sent as soon as it is produced
+    while (!e && reply_.stream)
     {
-      // request not complete, ask to keep reading asynchronously
-      socket_.async_read_some(boost::asio::buffer(buffer_),
-          boost::bind(&connection::handle_read, shared_from_this(),
-            boost::asio::placeholders::error,
-            boost::asio::placeholders::bytes_transferred));
+      if (!reply_.stream(reply_.content))
+        reply_.stream = nullptr;
+
+      if (!reply_.content.empty())
+        metrics::add_bytes_out(co_await boost::asio::async_write(socket_,
+            boost::asio::buffer(reply_.content), io));
     }
+
+    if (e || !keep_alive)
+      break;
   }
-  else if (e != boost::asio::error::operation_aborted)
-  {
-    connection_manager_.stop(shared_from_this());
-  }
+
+  if (e == boost::asio::error::operation_aborted)
+    co_return;
+
+  // Initiate graceful connection closure.
+  boost::system::error_code ignored_ec;
+  socket_.shutdown(boost::asio::socket_base::shutdown_both, ignored_ec);
+  connection_manager_.stop(self);
 }
 
-void connection::handle_write(const boost::system::error_code& e)
+boost::tribool connection::parse_buffered()
 {
-  if (!e)
-  {
-    // Initiate graceful connection closure.
-    boost::system::error_code ignored_ec;
-    socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored_ec);
-  }
+  if (buffer_begin_ == buffer_end_)
+    return boost::indeterminate;
+
+  boost::tribool result;
+  char* next;
+  boost::tie(result, next) = request_parser_.parse(request_,
+      buffer_.data() + buffer_begin_, buffer_.data() + buffer_end_);
 
-  if (e != boost::asio::error::operation_aborted)
+  buffer_begin_ = next - buffer_.data();
+  return result;
+}
+
+void connection::start_deadline()
+{
+  boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+  deadline_.expires_at(request_deadline_ < now + request_timeout
+      ? request_deadline_ : now + request_timeout);
+  deadline_.async_wait(make_custom_alloc_handler(timer_memory_,
+      boost::bind(&connection::handle_deadline, shared_from_this(),
+        boost::asio::placeholders::error)));
+}
+
+void connection::handle_deadline(const boost::system::error_code& e)
+{
+  if (e == boost::asio::error::operation_aborted)
+    return;
+
+  if (request_deadline_ <= boost::posix_time::microsec_clock::universal_time())
   {
     connection_manager_.stop(shared_from_this());
+    return;
   }
+
+  start_deadline();
 }
 
 } // namespace server
@@ -12,19 +12,22 @@
 #include "connection_manager.hpp"
 #include <algorithm>
 #include <boost/bind.hpp>
+#include "metrics.hpp"
 
 namespace http {
 namespace server {
 
 void connection_manager::start(connection_ptr c)
 {
-  connections_.insert(c);
+  if (connections_.insert(c).second)
+    metrics::connection_opened();
   c->start();
 }
 
 void connection_manager::stop(connection_ptr c)
 {
-  connections_.erase(c);
+  if (connections_.erase(c) > 0)
+    metrics::connection_closed();
   c->stop();
 }
 
@@ -32,6 +35,7 @@ void connection_manager::stop_all()
 {
   std::for_each(connections_.begin(), connections_.end(),
       boost::bind(&connection::stop, _1));
+  metrics::connection_closed(connections_.size());
   connections_.clear();
 }
 
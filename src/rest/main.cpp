@@ -11,28 +11,177 @@
 
 #include <iostream>
 #include <string>
-#include <boost/asio.hpp>
 #include <boost/thread.hpp>
 #include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+#include "awaitable.hpp"
+#include "compressor.hpp"
 #include "server.hpp"
+#ifdef CIDRDB_HAVE_IO_URING
+#include "uring_server.hpp"
+#endif
 #include "cidr_db.hpp"
+#include "trace.hpp"
 
 #include <pthread.h>
+#include <unistd.h>
 #include <signal.h>
 
 namespace fs = boost::filesystem;
+namespace po = boost::program_options;
+
+/// Wait for a signal indicating time to shut down. SIGUSR1 steps the trace
+/// level up (wrapping to off) and SIGUSR2 turns tracing off.
+static void wait_for_shutdown()
+{
+  sigset_t wait_mask;
+  sigemptyset(&wait_mask);
+  sigaddset(&wait_mask, SIGINT);
+  sigaddset(&wait_mask, SIGQUIT);
+  sigaddset(&wait_mask, SIGTERM);
+  sigaddset(&wait_mask, SIGUSR1);
+  sigaddset(&wait_mask, SIGUSR2);
+  pthread_sigmask(SIG_BLOCK, &wait_mask, 0);
+  int sig = 0;
+
+  for (;;)
+  {
+    sigwait(&wait_mask, &sig);
+
+    if (sig == SIGUSR1)
+    {
+      std::cerr << "trace level " << cidr::trace::raise_level() << std::endl;
+      continue;
+    }
+
+    if (sig == SIGUSR2)
+    {
+      cidr::trace::configure(cidr::trace::off);
+      std::cerr << "trace off" << std::endl;
+      continue;
+    }
+
+    break;
+  }
+}
 
 int main(int argc, char* argv[])
 {
   try
   {
+    po::options_description desc("Options");
+    desc.add_options()
+      ("address", po::value<std::string>(), "address to listen on")
+      ("port", po::value<std::string>(), "port to listen on")
+      ("db", po::value<std::string>(), "CIDR database filename")
+      ("replicate-port", po::value<std::string>(),
+          "act as replication leader, accepting followers on this port")
+      ("replication-log", po::value<std::size_t>()->default_value(1000000),
+          "mutations the leader keeps for followers that reconnect")
+      ("follow", po::value<std::string>(),
+          "act as replication follower of the leader at <host>:<port>")
+      ("unix-socket", po::value<std::string>(),
+          "also accept HTTP connections on a Unix domain socket at this path")
+      ("unix-allow-uid", po::value<std::vector<uid_t>>()->composing(),
+          "uid allowed on --unix-socket, repeatable (default: our own and root)")
+      ("shm", po::value<std::string>(),
+          "publish the database to shared memory under this name for libcidrdb_client")
+      ("udp-port", po::value<std::string>(),
+          "also answer binary lookups over UDP on this port")
+      ("udp-address", po::value<std::string>()->default_value("127.0.0.1"),
+          "address for --udp-port, apart from the HTTP one since replies can amplify spoofed requests")
+      ("compression-level", po::value<int>()->default_value(6),
+          "gzip/deflate/zstd level for clients sending Accept-Encoding, 1-9, or 0 for none")
+      ("prefilter", "check a Bloom filter per prefix length before each lookup")
+      ("backend", po::value<std::string>()->default_value("asio"),
+          "network backend: asio, or uring for an io_uring event loop");
+
+    po::positional_options_description positional;
+    positional.add("address", 1).add("port", 1).add("db", 1);
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv)
+        .options(desc).positional(positional).run(), vm);
+    po::notify(vm);
+
     // Check command line arguments.
-    if (argc != 4)
+    if (!vm.count("address") || !vm.count("port") || !vm.count("db")
+        || (vm.count("replicate-port") && vm.count("follow")))
     {
       std::cerr << "Usage: "
                 << "cidrdb_rest <address> <port> <cidr-db-filename>"
-                << std::endl;
+                << " [--replicate-port <port> | --follow <host>:<port>]"
+                << std::endl
+                << desc;
+      return 1;
+    }
+
+    std::string leader_host;
+    std::string leader_port;
+
+    if (vm.count("follow"))
+    {
+      const std::string leader(vm["follow"].as<std::string>());
+      std::size_t colon = leader.rfind(':');
+
+      if (colon == std::string::npos)
+      {
+        std::cerr << "--follow expects <host>:<port>" << std::endl;
+        return 1;
+      }
+
+      leader_host = leader.substr(0, colon);
+      leader_port = leader.substr(colon + 1);
+    }
+
+    const std::string backend(vm["backend"].as<std::string>());
+
+    if (backend != "asio" && backend != "uring")
+    {
+      std::cerr << "--backend expects asio or uring" << std::endl;
+      return 1;
+    }
+
+#ifndef CIDRDB_HAVE_IO_URING
+    if (backend == "uring")
+    {
+      std::cerr << "cidrdb_rest was built without io_uring support" << std::endl;
+      return 1;
+    }
+#endif
+
+    const int compression_level(vm["compression-level"].as<int>());
+
+    if (compression_level < 0 || compression_level > http::server::compressor::max_level)
+    {
+      std::cerr << "--compression-level expects 0 to "
+                << http::server::compressor::max_level << std::endl;
+      return 1;
+    }
+
+    // Replication and the UDP listener ride on the asio io_service.
+    if (backend == "uring" && (vm.count("replicate-port") || vm.count("follow")))
+    {
+      std::cerr << "replication requires --backend asio" << std::endl;
+      return 1;
+    }
+
+    if (backend == "uring" && vm.count("udp-port"))
+    {
+      std::cerr << "--udp-port requires --backend asio" << std::endl;
+      return 1;
+    }
+
+    if (backend == "uring" && vm.count("unix-socket"))
+    {
+      std::cerr << "--unix-socket requires --backend asio" << std::endl;
+      return 1;
+    }
+
+    if (backend == "uring" && vm.count("shm"))
+    {
+      std::cerr << "--shm requires --backend asio" << std::endl;
       return 1;
     }
 
@@ -42,11 +191,12 @@ int main(int argc, char* argv[])
     sigset_t old_mask;
     pthread_sigmask(SIG_BLOCK, &new_mask, &old_mask);
 
-    const std::string address(argv[1]);
-    const std::string port(argv[2]);
-    const fs::path cidr_dbfilename(argv[3]);
+    const std::string address(vm["address"].as<std::string>());
+    const std::string port(vm["port"].as<std::string>());
+    const fs::path cidr_dbfilename(vm["db"].as<std::string>());
 
-    if (!fs::exists(cidr_dbfilename))
+    // A follower starts empty if need be; the leader sends it a snapshot.
+    if (!fs::exists(cidr_dbfilename) && leader_host.empty())
     {
         std::cerr
             << "Can't open "
@@ -56,26 +206,73 @@ int main(int argc, char* argv[])
         return 1;
     }
 
+    cidr::trace::configure_from_env();
+
     std::cerr << "loading cidr::db ... ";
     auto cidr_db = std::make_shared<cidr::db>(cidr_dbfilename);
+    cidr_db->prefilter(vm.count("prefilter") > 0);
     std::cerr << "OK" << std::endl;
 
+#ifdef CIDRDB_HAVE_IO_URING
+    if (backend == "uring")
+    {
+      // Run server in background thread.
+      http::server::uring_server s(address, port, cidr_db);
+      s.set_compression_level(compression_level);
+      boost::thread t(boost::bind(&http::server::uring_server::run, &s));
+
+      // Restore previous signals.
+      pthread_sigmask(SIG_SETMASK, &old_mask, 0);
+
+      wait_for_shutdown();
+
+      // Stop the server.
+      s.stop();
+      t.join();
+      return 0;
+    }
+#endif
+
     // Run server in background thread.
     http::server::server s(address, port, cidr_db);
+    s.set_compression_level(compression_level);
+
+    if (vm.count("replicate-port"))
+      s.lead(address, vm["replicate-port"].as<std::string>(),
+          vm["replication-log"].as<std::size_t>());
+    else if (!leader_host.empty())
+      s.follow(leader_host, leader_port);
+
+    if (vm.count("udp-port"))
+      s.serve_udp(vm["udp-address"].as<std::string>(), vm["udp-port"].as<std::string>());
+
+    if (vm.count("shm"))
+      s.publish_shm(vm["shm"].as<std::string>());
+
+    if (vm.count("unix-socket"))
+    {
+      std::set<uid_t> allowed_uids;
+
+      if (vm.count("unix-allow-uid"))
+      {
+        const std::vector<uid_t>& uids = vm["unix-allow-uid"].as<std::vector<uid_t>>();
+        allowed_uids.insert(uids.begin(), uids.end());
+      }
+      else
+      {
+        allowed_uids.insert(geteuid());
+        allowed_uids.insert(0);
+      }
+
+      s.listen_local(vm["unix-socket"].as<std::string>(), allowed_uids);
+    }
+
     boost::thread t(boost::bind(&http::server::server::run, &s));
 
     // Restore previous signals.
     pthread_sigmask(SIG_SETMASK, &old_mask, 0);
 
-    // Wait for signal indicating time to shut down.
-    sigset_t wait_mask;
-    sigemptyset(&wait_mask);
-    sigaddset(&wait_mask, SIGINT);
-    sigaddset(&wait_mask, SIGQUIT);
-    sigaddset(&wait_mask, SIGTERM);
-    pthread_sigmask(SIG_BLOCK, &wait_mask, 0);
-    int sig = 0;
-    sigwait(&wait_mask, &sig);
+    wait_for_shutdown();
 
     // Stop the server.
     s.stop();
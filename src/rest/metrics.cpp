@@ -0,0 +1,463 @@
+///
+/// \file metrics.cpp
+///
+/// Prometheus-style counters and histograms for the CIDR-DB REST service.
+///
+
+#include "metrics.hpp"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+namespace http {
+namespace server {
+namespace metrics {
+
+const char content_type[] = "text/plain; version=0.0.4";
+
+namespace {
+
+const char* const operation_names[operation_count] =
+{
+  "Status",
+  "Batch-Lookup",
+  "Single-Lookup",
+  "Verify",
+  "Add",
+  "Delete",
+  "Patch",
+  "Within",
+  "Covering",
+  "Overlaps",
+  "Snapshot-Export",
+  "Snapshot-Import",
+  "Metrics",
+  "Invalid"
+};
+
+const char* const encoding_names[encoding_count] =
+{
+  "gzip",
+  "deflate",
+  "zstd"
+};
+
+/// Upper bounds of the latency buckets, in nanoseconds.
+const std::uint64_t latency_bounds[] =
+{
+  1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+  1000000, 2500000, 5000000, 10000000, 25000000, 50000000, 100000000,
+  250000000, 500000000, 1000000000, 2500000000, 5000000000, 10000000000
+};
+
+/// Upper bounds of the IPs-per-batch buckets.
+const std::uint64_t batch_bounds[] =
+{
+  1, 2, 5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000,
+  50000, 100000
+};
+
+const std::size_t max_buckets = sizeof(latency_bounds) / sizeof(latency_bounds[0]);
+
+/// Add to a counter that only the owning thread writes. A relaxed load and
+/// store avoids the locked read-modify-write of fetch_add.
+inline void bump(std::atomic<std::uint64_t>& counter, std::uint64_t value)
+{
+  counter.store(counter.load(std::memory_order_relaxed) + value,
+      std::memory_order_relaxed);
+}
+
+/// Non-cumulative histogram; buckets are summed up at scrape time.
+struct histogram
+{
+  std::atomic<std::uint64_t> buckets[max_buckets + 1];
+  std::atomic<std::uint64_t> count;
+  std::atomic<std::uint64_t> sum;
+
+  histogram() : count(0), sum(0)
+  {
+    for (auto& b : buckets) b.store(0, std::memory_order_relaxed);
+  }
+
+  void observe(const std::uint64_t* bounds, std::size_t n, std::uint64_t value)
+  {
+    std::size_t i = 0;
+    while (i < n && value > bounds[i]) ++i;
+    bump(buckets[i], 1);
+    bump(count, 1);
+    bump(sum, value);
+  }
+};
+
+/// Compression totals for one content coding.
+struct compression_counters
+{
+  std::atomic<std::uint64_t> replies{0};
+  std::atomic<std::uint64_t> bytes_in{0};
+  std::atomic<std::uint64_t> bytes_out{0};
+  std::atomic<std::uint64_t> cpu_nanoseconds{0};
+};
+
+/// Counters owned by a single thread.
+struct shard
+{
+  histogram requests[operation_count];
+  histogram batch_ips;
+  histogram commits;
+  std::atomic<std::uint64_t> bytes_in{0};
+  std::atomic<std::uint64_t> bytes_out{0};
+  std::atomic<std::uint64_t> connections_opened{0};
+  std::atomic<std::uint64_t> connections_closed{0};
+  compression_counters compression[encoding_count];
+};
+
+/// All shards ever created. Shards outlive their threads so that totals
+/// never go backwards.
+struct registry
+{
+  std::mutex mutex;
+  std::vector<std::unique_ptr<shard>> shards;
+};
+
+registry& global_registry()
+{
+  static registry r;
+  return r;
+}
+
+shard& local_shard()
+{
+  static thread_local shard* local = nullptr;
+
+  if (local == nullptr)
+  {
+    registry& r = global_registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.shards.emplace_back(new shard);
+    local = r.shards.back().get();
+  }
+
+  return *local;
+}
+
+/// Histogram totals summed across shards.
+struct histogram_totals
+{
+  std::uint64_t buckets[max_buckets + 1] = {};
+  std::uint64_t count = 0;
+  std::uint64_t sum = 0;
+
+  void add(const histogram& h)
+  {
+    for (std::size_t i = 0; i <= max_buckets; ++i)
+      buckets[i] += h.buckets[i].load(std::memory_order_relaxed);
+    count += h.count.load(std::memory_order_relaxed);
+    sum += h.sum.load(std::memory_order_relaxed);
+  }
+};
+
+/// Compression totals summed across shards.
+struct compression_totals
+{
+  std::uint64_t replies = 0;
+  std::uint64_t bytes_in = 0;
+  std::uint64_t bytes_out = 0;
+  std::uint64_t cpu_nanoseconds = 0;
+
+  void add(const compression_counters& c)
+  {
+    replies += c.replies.load(std::memory_order_relaxed);
+    bytes_in += c.bytes_in.load(std::memory_order_relaxed);
+    bytes_out += c.bytes_out.load(std::memory_order_relaxed);
+    cpu_nanoseconds += c.cpu_nanoseconds.load(std::memory_order_relaxed);
+  }
+};
+
+void write_histogram(std::ostream& out, const std::string& name,
+    const std::string& labels, const histogram_totals& h,
+    const std::uint64_t* bounds, std::size_t n, double scale)
+{
+  std::string prefix(labels.empty() ? "{" : "{" + labels + ",");
+  std::uint64_t cumulative = 0;
+
+  for (std::size_t i = 0; i < n; ++i)
+  {
+    cumulative += h.buckets[i];
+    out << name << "_bucket" << prefix << "le=\"" << bounds[i] * scale
+        << "\"} " << cumulative << "\n";
+  }
+
+  out << name << "_bucket" << prefix << "le=\"+Inf\"} " << h.count << "\n";
+  out << name << "_sum" << (labels.empty() ? "" : "{" + labels + "}")
+      << " " << h.sum * scale << "\n";
+  out << name << "_count" << (labels.empty() ? "" : "{" + labels + "}")
+      << " " << h.count << "\n";
+}
+
+/// Replication state is written by the io_service thread only, so plain
+/// globals suffice instead of per-thread shards.
+std::atomic<bool> replication_enabled(false);
+std::atomic<std::uint64_t> replication_applied(0);
+std::atomic<std::uint64_t> replication_leader_sequence(0);
+std::atomic<std::uint64_t> replication_followers(0);
+
+/// Written by the io_uring backend's single thread.
+std::atomic<std::uint64_t> io_uring_enters(0);
+
+/// Written by the io_service thread that runs the UDP listener.
+std::atomic<bool> udp_enabled(false);
+std::atomic<std::uint64_t> udp_datagrams(0);
+std::atomic<std::uint64_t> udp_addresses(0);
+
+std::uint64_t to_nanoseconds(double seconds)
+{
+  return seconds > 0 ? static_cast<std::uint64_t>(seconds * 1e9) : 0;
+}
+
+} // namespace
+
+operation operation_from_name(const std::string& op_type)
+{
+  for (std::size_t op = 0; op < operation_count; ++op)
+  {
+    if (op_type == operation_names[op])
+      return static_cast<operation>(op);
+  }
+
+  return op_invalid;
+}
+
+const char* encoding_name(encoding coding)
+{
+  return encoding_names[coding];
+}
+
+void observe_request(operation op, double seconds)
+{
+  local_shard().requests[op].observe(latency_bounds, max_buckets,
+      to_nanoseconds(seconds));
+}
+
+void observe_batch(std::size_t ip_count)
+{
+  local_shard().batch_ips.observe(batch_bounds,
+      sizeof(batch_bounds) / sizeof(batch_bounds[0]), ip_count);
+}
+
+void observe_commit(double seconds)
+{
+  local_shard().commits.observe(latency_bounds, max_buckets,
+      to_nanoseconds(seconds));
+}
+
+void observe_compression(encoding coding, std::size_t bytes_in,
+    std::size_t bytes_out, double cpu_seconds)
+{
+  compression_counters& c = local_shard().compression[coding];
+  bump(c.replies, 1);
+  bump(c.bytes_in, bytes_in);
+  bump(c.bytes_out, bytes_out);
+  bump(c.cpu_nanoseconds, to_nanoseconds(cpu_seconds));
+}
+
+void add_bytes_in(std::size_t bytes)
+{
+  bump(local_shard().bytes_in, bytes);
+}
+
+void add_bytes_out(std::size_t bytes)
+{
+  bump(local_shard().bytes_out, bytes);
+}
+
+void connection_opened()
+{
+  bump(local_shard().connections_opened, 1);
+}
+
+void connection_closed(std::size_t count)
+{
+  bump(local_shard().connections_closed, count);
+}
+
+void set_replication(std::uint64_t applied, std::uint64_t leader_sequence,
+    std::size_t followers)
+{
+  replication_applied.store(applied, std::memory_order_relaxed);
+  replication_leader_sequence.store(leader_sequence, std::memory_order_relaxed);
+  replication_followers.store(followers, std::memory_order_relaxed);
+  replication_enabled.store(true, std::memory_order_relaxed);
+}
+
+void add_io_uring_enter()
+{
+  io_uring_enters.fetch_add(1, std::memory_order_relaxed);
+}
+
+void add_udp(std::size_t datagrams, std::size_t addresses)
+{
+  udp_datagrams.fetch_add(datagrams, std::memory_order_relaxed);
+  udp_addresses.fetch_add(addresses, std::memory_order_relaxed);
+  udp_enabled.store(true, std::memory_order_relaxed);
+}
+
+std::string scrape()
+{
+  histogram_totals requests[operation_count];
+  histogram_totals batch_ips;
+  histogram_totals commits;
+  std::uint64_t bytes_in = 0;
+  std::uint64_t bytes_out = 0;
+  std::uint64_t opened = 0;
+  std::uint64_t closed = 0;
+  compression_totals compression[encoding_count];
+
+  {
+    registry& r = global_registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+
+    for (auto& s : r.shards)
+    {
+      for (std::size_t op = 0; op < operation_count; ++op)
+        requests[op].add(s->requests[op]);
+      batch_ips.add(s->batch_ips);
+      commits.add(s->commits);
+      bytes_in += s->bytes_in.load(std::memory_order_relaxed);
+      bytes_out += s->bytes_out.load(std::memory_order_relaxed);
+      opened += s->connections_opened.load(std::memory_order_relaxed);
+      closed += s->connections_closed.load(std::memory_order_relaxed);
+
+      for (std::size_t e = 0; e < encoding_count; ++e)
+      {
+        compression[e].add(s->compression[e]);
+      }
+    }
+  }
+
+  std::ostringstream out;
+  out.precision(9);
+
+  out << "# HELP cidrdb_requests_total Requests handled, by operation.\n"
+      << "# TYPE cidrdb_requests_total counter\n";
+  for (std::size_t op = 0; op < operation_count; ++op)
+  {
+    out << "cidrdb_requests_total{op=\"" << operation_names[op] << "\"} "
+        << requests[op].count << "\n";
+  }
+
+  out << "# HELP cidrdb_request_duration_seconds Request handling time, by operation.\n"
+      << "# TYPE cidrdb_request_duration_seconds histogram\n";
+  for (std::size_t op = 0; op < operation_count; ++op)
+  {
+    write_histogram(out, "cidrdb_request_duration_seconds",
+        std::string("op=\"") + operation_names[op] + "\"", requests[op],
+        latency_bounds, max_buckets, 1e-9);
+  }
+
+  out << "# HELP cidrdb_batch_ips IP addresses per Batch-Lookup request.\n"
+      << "# TYPE cidrdb_batch_ips histogram\n";
+  write_histogram(out, "cidrdb_batch_ips", "", batch_ips, batch_bounds,
+      sizeof(batch_bounds) / sizeof(batch_bounds[0]), 1);
+
+  out << "# HELP cidrdb_commit_duration_seconds Time spent writing the database to disk.\n"
+      << "# TYPE cidrdb_commit_duration_seconds histogram\n";
+  write_histogram(out, "cidrdb_commit_duration_seconds", "", commits,
+      latency_bounds, max_buckets, 1e-9);
+
+  out << "# HELP cidrdb_received_bytes_total Bytes read from client sockets.\n"
+      << "# TYPE cidrdb_received_bytes_total counter\n"
+      << "cidrdb_received_bytes_total " << bytes_in << "\n";
+
+  out << "# HELP cidrdb_sent_bytes_total Bytes written to client sockets.\n"
+      << "# TYPE cidrdb_sent_bytes_total counter\n"
+      << "cidrdb_sent_bytes_total " << bytes_out << "\n";
+
+  out << "# HELP cidrdb_active_connections Open client connections.\n"
+      << "# TYPE cidrdb_active_connections gauge\n"
+      << "cidrdb_active_connections "
+      << (opened > closed ? opened - closed : 0) << "\n";
+
+  out << "# HELP cidrdb_compressed_replies_total Replies sent with a Content-Encoding.\n"
+      << "# TYPE cidrdb_compressed_replies_total counter\n";
+  for (std::size_t e = 0; e < encoding_count; ++e)
+  {
+    out << "cidrdb_compressed_replies_total{encoding=\"" << encoding_names[e]
+        << "\"} " << compression[e].replies << "\n";
+  }
+
+  out << "# HELP cidrdb_compression_input_bytes_total Reply bytes before compression.\n"
+      << "# TYPE cidrdb_compression_input_bytes_total counter\n";
+  for (std::size_t e = 0; e < encoding_count; ++e)
+  {
+    out << "cidrdb_compression_input_bytes_total{encoding=\"" << encoding_names[e]
+        << "\"} " << compression[e].bytes_in << "\n";
+  }
+
+  out << "# HELP cidrdb_compression_output_bytes_total Reply bytes after compression.\n"
+      << "# TYPE cidrdb_compression_output_bytes_total counter\n";
+  for (std::size_t e = 0; e < encoding_count; ++e)
+  {
+    out << "cidrdb_compression_output_bytes_total{encoding=\"" << encoding_names[e]
+        << "\"} " << compression[e].bytes_out << "\n";
+  }
+
+  out << "# HELP cidrdb_compression_cpu_seconds_total Thread CPU time spent compressing replies.\n"
+      << "# TYPE cidrdb_compression_cpu_seconds_total counter\n";
+  for (std::size_t e = 0; e < encoding_count; ++e)
+  {
+    out << "cidrdb_compression_cpu_seconds_total{encoding=\"" << encoding_names[e]
+        << "\"} " << compression[e].cpu_nanoseconds * 1e-9 << "\n";
+  }
+
+  if (std::uint64_t enters = io_uring_enters.load(std::memory_order_relaxed))
+  {
+    out << "# HELP cidrdb_io_uring_enter_total io_uring_enter system calls made by the io_uring backend.\n"
+        << "# TYPE cidrdb_io_uring_enter_total counter\n"
+        << "cidrdb_io_uring_enter_total " << enters << "\n";
+  }
+
+  if (udp_enabled.load(std::memory_order_relaxed))
+  {
+    out << "# HELP cidrdb_udp_datagrams_total Request datagrams read by the UDP listener.\n"
+        << "# TYPE cidrdb_udp_datagrams_total counter\n"
+        << "cidrdb_udp_datagrams_total "
+        << udp_datagrams.load(std::memory_order_relaxed) << "\n";
+
+    out << "# HELP cidrdb_udp_lookups_total Addresses looked up over UDP.\n"
+        << "# TYPE cidrdb_udp_lookups_total counter\n"
+        << "cidrdb_udp_lookups_total "
+        << udp_addresses.load(std::memory_order_relaxed) << "\n";
+  }
+
+  if (replication_enabled.load(std::memory_order_relaxed))
+  {
+    std::uint64_t applied = replication_applied.load(std::memory_order_relaxed);
+    std::uint64_t leader = replication_leader_sequence.load(std::memory_order_relaxed);
+
+    out << "# HELP cidrdb_replication_applied_sequence Last mutation applied locally.\n"
+        << "# TYPE cidrdb_replication_applied_sequence gauge\n"
+        << "cidrdb_replication_applied_sequence " << applied << "\n";
+
+    out << "# HELP cidrdb_replication_leader_sequence Newest mutation known on the leader.\n"
+        << "# TYPE cidrdb_replication_leader_sequence gauge\n"
+        << "cidrdb_replication_leader_sequence " << leader << "\n";
+
+    out << "# HELP cidrdb_replication_lag Mutations the leader has that are not applied locally.\n"
+        << "# TYPE cidrdb_replication_lag gauge\n"
+        << "cidrdb_replication_lag " << (leader > applied ? leader - applied : 0) << "\n";
+
+    out << "# HELP cidrdb_replication_followers Connected followers.\n"
+        << "# TYPE cidrdb_replication_followers gauge\n"
+        << "cidrdb_replication_followers "
+        << replication_followers.load(std::memory_order_relaxed) << "\n";
+  }
+
+  return out.str();
+}
+
+} // namespace metrics
+} // namespace server
+} // namespace http
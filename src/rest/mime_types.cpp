@@ -38,6 +38,10 @@ struct mapping
   { "csv",  "text/csv"  },
   { "yaml",  "application/x-yaml"  },
   { "json",  "application/json"  },
+  { "ndjson", "application/x-ndjson"  },
+  { "bin",   "application/octet-stream"  },
+  { "msgpack", "application/msgpack"  },
+  { "cbor",    "application/cbor"  },
   // common image mime types
   { "jpeg","image/jpeg" },
   { "jpg", "image/jpeg" },
@@ -109,7 +113,7 @@ struct mapping
 };
 
 // TODO SRombauts : optimize with a hash_map ?
-std::string extension_to_type(const std::string& extension)
+const char* extension_to_type(const std::string& extension)
 {
   for (mapping* m = mappings; m->extension; ++m)
   {
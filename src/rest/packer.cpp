@@ -0,0 +1,124 @@
+///
+/// \file packer.cpp
+///
+/// MessagePack and CBOR encoding of reply bodies.
+///
+
+#include "packer.hpp"
+
+namespace http {
+namespace server {
+
+namespace {
+
+/// CBOR major types (RFC 8949 section 3.1).
+const unsigned cbor_uint = 0;
+const unsigned cbor_text = 3;
+const unsigned cbor_array = 4;
+const unsigned cbor_map = 5;
+
+} // namespace
+
+packer::packer(format f, std::string& out)
+  : format_(f),
+    out_(out)
+{
+}
+
+void packer::map(std::size_t size)
+{
+  if (format_ == cbor)
+    cbor_head(cbor_map, size);
+  else if (size <= 15)
+    out_.push_back(static_cast<char>(0x80 | size));
+  else if (size <= 0xffff)
+    put_head(0xde, size, 2);
+  else
+    put_head(0xdf, size, 4);
+}
+
+void packer::array(std::size_t size)
+{
+  if (format_ == cbor)
+    cbor_head(cbor_array, size);
+  else if (size <= 15)
+    out_.push_back(static_cast<char>(0x90 | size));
+  else if (size <= 0xffff)
+    put_head(0xdc, size, 2);
+  else
+    put_head(0xdd, size, 4);
+}
+
+void packer::uint(std::uint64_t value)
+{
+  if (format_ == cbor)
+    cbor_head(cbor_uint, value);
+  else if (value <= 0x7f)
+    out_.push_back(static_cast<char>(value));
+  else if (value <= 0xff)
+    put_head(0xcc, value, 1);
+  else if (value <= 0xffff)
+    put_head(0xcd, value, 2);
+  else if (value <= 0xffffffff)
+    put_head(0xce, value, 4);
+  else
+    put_head(0xcf, value, 8);
+}
+
+void packer::boolean(bool value)
+{
+  if (format_ == cbor)
+    out_.push_back(static_cast<char>(value ? 0xf5 : 0xf4));
+  else
+    out_.push_back(static_cast<char>(value ? 0xc3 : 0xc2));
+}
+
+void packer::str(const std::string& value)
+{
+  if (format_ == cbor)
+    cbor_head(cbor_text, value.size());
+  else if (value.size() <= 31)
+    out_.push_back(static_cast<char>(0xa0 | value.size()));
+  else if (value.size() <= 0xff)
+    put_head(0xd9, value.size(), 1);
+  else if (value.size() <= 0xffff)
+    put_head(0xda, value.size(), 2);
+  else
+    put_head(0xdb, value.size(), 4);
+
+  out_.append(value);
+}
+
+void packer::cidr(std::uint32_t network, unsigned length)
+{
+  array(2);
+  uint(network);
+  uint(length);
+}
+
+void packer::cbor_head(unsigned major, std::uint64_t value)
+{
+  unsigned char type = static_cast<unsigned char>(major << 5);
+
+  if (value < 24)
+    out_.push_back(static_cast<char>(type | value));
+  else if (value <= 0xff)
+    put_head(type | 24, value, 1);
+  else if (value <= 0xffff)
+    put_head(type | 25, value, 2);
+  else if (value <= 0xffffffff)
+    put_head(type | 26, value, 4);
+  else
+    put_head(type | 27, value, 8);
+}
+
+void packer::put_head(unsigned char type, std::uint64_t value, std::size_t bytes)
+{
+  out_.push_back(static_cast<char>(type));
+
+  for (std::size_t shift = bytes * 8; shift > 0; shift -= 8)
+    out_.push_back(static_cast<char>(value >> (shift - 8)));
+}
+
+} // namespace server
+} // namespace http
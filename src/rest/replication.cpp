@@ -0,0 +1,658 @@
+///
+/// \file replication.cpp
+///
+/// Leader/follower replication of CIDR-DB mutations over TCP.
+///
+
+#include "replication.hpp"
+#include <algorithm>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <boost/bind.hpp>
+#include "metrics.hpp"
+#include "trace.hpp"
+
+namespace http {
+namespace server {
+namespace replication {
+
+namespace {
+
+/// How often the leader announces its sequence number to idle followers.
+const boost::posix_time::seconds heartbeat_interval(1);
+
+/// A follower that hears nothing for this long reconnects.
+const boost::posix_time::seconds follower_timeout(5);
+
+/// Delay before a follower retries a failed connection.
+const boost::posix_time::seconds retry_interval(1);
+
+/// A follower that falls this far behind is disconnected; it catches up
+/// again from the log or a snapshot when it reconnects.
+const std::size_t max_queued_bytes = 64 << 20;
+
+/// CIDRs per piece of a snapshot; the next piece is encoded once the
+/// previous one has been written.
+const std::size_t snapshot_piece_cidrs = 4096;
+
+std::string make_epoch()
+{
+  std::random_device rd;
+  std::ostringstream epoch;
+  epoch << std::hex << std::setfill('0')
+        << std::setw(8) << rd() << std::setw(8) << rd();
+  return epoch.str();
+}
+
+} // namespace
+
+mutation_log::mutation_log(std::size_t capacity)
+  : capacity_(capacity > 0 ? capacity : 1),
+    base_(1),
+    entries_()
+{
+}
+
+std::uint64_t mutation_log::append(const std::string& mutation)
+{
+  entries_.push_back(mutation);
+
+  if (entries_.size() > capacity_)
+  {
+    entries_.pop_front();
+    ++base_;
+  }
+
+  return sequence();
+}
+
+void mutation_log::clear()
+{
+  base_ += entries_.size();
+  entries_.clear();
+}
+
+bool mutation_log::can_resume(std::uint64_t after) const
+{
+  return after <= sequence() && after + 1 >= base_;
+}
+
+/// One connected follower.
+class leader::session
+{
+public:
+  explicit session(boost::asio::io_service& io_service)
+    : socket(io_service),
+      queued(0),
+      writing(false),
+      live(false)
+  {
+  }
+
+  boost::asio::ip::tcp::socket socket;
+
+  /// The FOLLOW request.
+  boost::asio::streambuf request;
+
+  /// Data waiting to be written; the front entry is being written.
+  std::deque<std::string> outbox;
+
+  /// The rest of a snapshot being sent, which goes out ahead of the
+  /// outbox, and the piece of it being written.
+  std::unique_ptr<cidr::db_copy> snapshot;
+  std::string piece;
+
+  /// Bytes of log entries in the outbox.
+  std::size_t queued;
+
+  bool writing;
+
+  /// Set once the follower is caught up to the point of receiving
+  /// every new mutation.
+  bool live;
+};
+
+leader::leader(boost::asio::io_service& io_service,
+    const std::string& address, const std::string& port,
+    std::shared_ptr<cidr::db>& cidr_db, std::size_t log_capacity)
+  : io_service_(io_service),
+    acceptor_(io_service),
+    heartbeat_timer_(io_service),
+    cidr_db_(cidr_db),
+    epoch_(make_epoch()),
+    log_(log_capacity),
+    sessions_()
+{
+  boost::asio::ip::tcp::resolver resolver(io_service);
+  boost::asio::ip::tcp::resolver::query query(address, port);
+  boost::asio::ip::tcp::endpoint endpoint = *resolver.resolve(query);
+  acceptor_.open(endpoint.protocol());
+  acceptor_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+  acceptor_.bind(endpoint);
+  acceptor_.listen();
+
+  start_accept();
+  start_heartbeat();
+  update_metrics();
+}
+
+void leader::publish(const std::string& mutation)
+{
+  std::uint64_t seq = log_.append(mutation);
+  std::string line(std::to_string(seq) + " " + mutation + "\n");
+
+  // Copy: send() may drop a session from the set.
+  std::set<session_ptr> sessions(sessions_);
+
+  for (auto& s : sessions)
+  {
+    if (!s->live)
+      continue;
+
+    if (s->queued + line.size() > max_queued_bytes)
+    {
+      CIDR_TRACE(cidr::trace::info, "replication follower too slow", seq, s->queued);
+      drop(s);
+      continue;
+    }
+
+    s->queued += line.size();
+    send(s, line);
+  }
+
+  update_metrics();
+}
+
+void leader::reset()
+{
+  epoch_ = make_epoch();
+  log_.clear();
+
+  // Copy: drop() erases from the set.
+  std::set<session_ptr> sessions(sessions_);
+
+  for (auto& s : sessions)
+    drop(s);
+
+  CIDR_TRACE(cidr::trace::info, "replication reset", log_.sequence(), sessions.size());
+}
+
+void leader::stop()
+{
+  boost::system::error_code ignored_ec;
+  acceptor_.close(ignored_ec);
+  heartbeat_timer_.cancel(ignored_ec);
+
+  for (auto& s : sessions_)
+    s->socket.close(ignored_ec);
+
+  sessions_.clear();
+}
+
+void leader::start_accept()
+{
+  session_ptr s(new session(io_service_));
+
+  acceptor_.async_accept(s->socket,
+      boost::bind(&leader::handle_accept, this, s,
+        boost::asio::placeholders::error));
+}
+
+void leader::handle_accept(session_ptr s, const boost::system::error_code& e)
+{
+  if (e)
+    return;
+
+  sessions_.insert(s);
+  update_metrics();
+
+  boost::asio::async_read_until(s->socket, s->request, '\n',
+      boost::bind(&leader::handle_follow, this, s,
+        boost::asio::placeholders::error));
+
+  start_accept();
+}
+
+void leader::handle_follow(session_ptr s, const boost::system::error_code& e)
+{
+  if (e)
+  {
+    drop(s);
+    return;
+  }
+
+  std::istream in(&s->request);
+  std::string command, epoch;
+  std::uint64_t after = 0;
+  in >> command >> epoch >> after;
+
+  if (command != "FOLLOW")
+  {
+    drop(s);
+    return;
+  }
+
+  std::uint64_t seq = log_.sequence();
+
+  if (epoch == epoch_ && log_.can_resume(after))
+  {
+    CIDR_TRACE(cidr::trace::info, "replication resume", after, seq);
+
+    std::string data("RESUME " + epoch_ + " " + std::to_string(after) + "\n");
+
+    for (std::uint64_t i = after + 1; i <= seq; ++i)
+      data += std::to_string(i) + " " + log_.at(i) + "\n";
+
+    send(s, std::move(data));
+  }
+  else
+  {
+    CIDR_TRACE(cidr::trace::info, "replication snapshot", after, seq);
+
+    // Only the copy is taken now; the text is encoded a piece at a time as
+    // the follower takes it, while mutations after seq queue up behind it
+    // in the outbox against max_queued_bytes.
+    s->snapshot.reset(new cidr::db_copy(*cidr_db_.get()));
+    s->piece = "SNAPSHOT " + epoch_ + " " + std::to_string(seq) + "\n";
+    start_write(s);
+  }
+
+  s->live = true;
+}
+
+void leader::send(session_ptr s, std::string data)
+{
+  s->outbox.push_back(std::move(data));
+
+  if (!s->writing)
+    start_write(s);
+}
+
+void leader::start_write(session_ptr s)
+{
+  s->writing = true;
+
+  if (s->snapshot)
+  {
+    std::string& piece = s->piece;
+
+    bool more = s->snapshot->each([&piece](const std::string& cidr)
+    {
+      piece += "+";
+      piece += cidr;
+      piece += "\n";
+    }, snapshot_piece_cidrs);
+
+    if (!more)
+    {
+      piece += "END\n";
+      s->snapshot.reset();
+    }
+
+    boost::asio::async_write(s->socket, boost::asio::buffer(piece),
+        boost::bind(&leader::handle_snapshot_write, this, s,
+          boost::asio::placeholders::error));
+    return;
+  }
+
+  boost::asio::async_write(s->socket, boost::asio::buffer(s->outbox.front()),
+      boost::bind(&leader::handle_write, this, s,
+        boost::asio::placeholders::error,
+        boost::asio::placeholders::bytes_transferred));
+}
+
+void leader::handle_write(session_ptr s, const boost::system::error_code& e,
+    std::size_t bytes_transferred)
+{
+  s->writing = false;
+
+  if (e)
+  {
+    drop(s);
+    return;
+  }
+
+  s->queued -= std::min(s->queued, bytes_transferred);
+  s->outbox.pop_front();
+
+  if (!s->outbox.empty())
+    start_write(s);
+}
+
+void leader::handle_snapshot_write(session_ptr s,
+    const boost::system::error_code& e)
+{
+  s->writing = false;
+  s->piece.clear();
+
+  if (e)
+  {
+    drop(s);
+    return;
+  }
+
+  if (s->snapshot || !s->outbox.empty())
+    start_write(s);
+}
+
+void leader::start_heartbeat()
+{
+  heartbeat_timer_.expires_from_now(heartbeat_interval);
+  heartbeat_timer_.async_wait(
+      boost::bind(&leader::handle_heartbeat, this,
+        boost::asio::placeholders::error));
+}
+
+void leader::handle_heartbeat(const boost::system::error_code& e)
+{
+  if (e)
+    return;
+
+  std::string line("HEARTBEAT " + std::to_string(log_.sequence()) + "\n");
+
+  for (auto& s : sessions_)
+  {
+    if (s->live && !s->writing)
+      send(s, line);
+  }
+
+  start_heartbeat();
+}
+
+void leader::drop(session_ptr s)
+{
+  boost::system::error_code ignored_ec;
+  s->socket.close(ignored_ec);
+
+  if (sessions_.erase(s))
+    update_metrics();
+}
+
+void leader::update_metrics()
+{
+  metrics::set_replication(log_.sequence(), log_.sequence(), sessions_.size());
+}
+
+follower::follower(boost::asio::io_service& io_service,
+    const std::string& host, const std::string& port,
+    std::shared_ptr<cidr::db>& cidr_db)
+  : io_service_(io_service),
+    resolver_(io_service),
+    socket_(io_service),
+    deadline_(io_service),
+    retry_timer_(io_service),
+    buffer_(),
+    request_(),
+    host_(host),
+    port_(port),
+    cidr_db_(cidr_db),
+    epoch_(),
+    applied_(0),
+    leader_sequence_(0),
+    staging_(),
+    staging_sequence_(0),
+    dirty_(false),
+    stopped_(false)
+{
+  update_metrics();
+  connect();
+}
+
+void follower::stop()
+{
+  stopped_ = true;
+
+  boost::system::error_code ignored_ec;
+  resolver_.cancel();
+  socket_.close(ignored_ec);
+  deadline_.cancel(ignored_ec);
+  retry_timer_.cancel(ignored_ec);
+}
+
+void follower::connect()
+{
+  // a slow name server must not hold up the io_service thread, which
+  // serves HTTP too
+  resolver_.async_resolve(host_, port_,
+      boost::bind(&follower::handle_resolve, this,
+        boost::asio::placeholders::error,
+        boost::asio::placeholders::results));
+}
+
+void follower::handle_resolve(const boost::system::error_code& e,
+    boost::asio::ip::tcp::resolver::results_type endpoints)
+{
+  if (e)
+  {
+    reconnect();
+    return;
+  }
+
+  boost::asio::async_connect(socket_, endpoints,
+      boost::bind(&follower::handle_connect, this,
+        boost::asio::placeholders::error));
+}
+
+void follower::handle_connect(const boost::system::error_code& e)
+{
+  if (e)
+  {
+    reconnect();
+    return;
+  }
+
+  request_ = "FOLLOW " + (epoch_.empty() ? "-" : epoch_)
+      + " " + std::to_string(applied_) + "\n";
+
+  boost::asio::async_write(socket_, boost::asio::buffer(request_),
+      boost::bind(&follower::handle_follow, this,
+        boost::asio::placeholders::error));
+}
+
+void follower::handle_follow(const boost::system::error_code& e)
+{
+  if (e)
+  {
+    reconnect();
+    return;
+  }
+
+  CIDR_TRACE(cidr::trace::info, "replication connected", applied_, 0);
+
+  start_read();
+}
+
+void follower::start_read()
+{
+  deadline_.expires_from_now(follower_timeout);
+  deadline_.async_wait(
+      boost::bind(&follower::handle_deadline, this,
+        boost::asio::placeholders::error));
+
+  boost::asio::async_read_until(socket_, buffer_, '\n',
+      boost::bind(&follower::handle_read, this,
+        boost::asio::placeholders::error));
+}
+
+void follower::handle_read(const boost::system::error_code& e)
+{
+  if (e)
+  {
+    if (e != boost::asio::error::operation_aborted)
+      reconnect();
+    return;
+  }
+
+  std::istream in(&buffer_);
+  std::string line;
+
+  // Apply every complete line already received before writing to disk.
+  for (;;)
+  {
+    auto data = buffer_.data();
+    auto end = boost::asio::buffers_end(data);
+
+    if (std::find(boost::asio::buffers_begin(data), end, '\n') == end)
+      break;
+
+    std::getline(in, line);
+
+    if (!apply(line))
+    {
+      CIDR_TRACE(cidr::trace::error, "replication protocol error", applied_, 0);
+      reconnect();
+      return;
+    }
+  }
+
+  if (dirty_ && !staging_)
+  {
+    cidr_db_.get()->commit();
+    dirty_ = false;
+  }
+
+  update_metrics();
+  start_read();
+}
+
+bool follower::apply(const std::string& line)
+{
+  if (line.empty())
+    return true;
+
+  if (staging_ && (line[0] == '+' || line[0] == '-'))
+  {
+    std::string cidr(line.substr(1));
+
+    if (line[0] != '+' || !cidr::db::valid_cidr(cidr))
+      return false;
+
+    staging_->put(cidr);
+    return true;
+  }
+
+  std::istringstream in(line);
+  std::string command;
+  in >> command;
+
+  if (command == "HEARTBEAT")
+  {
+    in >> leader_sequence_;
+    return !in.fail();
+  }
+
+  if (command == "RESUME")
+  {
+    std::string epoch;
+    std::uint64_t after = 0;
+    in >> epoch >> after;
+    return epoch == epoch_ && after == applied_;
+  }
+
+  if (command == "SNAPSHOT")
+  {
+    std::string epoch;
+    std::uint64_t seq = 0;
+    in >> epoch >> seq;
+
+    if (in.fail())
+      return false;
+
+    staging_.reset(new cidr::db());
+    staging_sequence_ = seq;
+    epoch_ = epoch;
+    leader_sequence_ = seq;
+    return true;
+  }
+
+  if (command == "END")
+  {
+    if (!staging_)
+      return false;
+
+    cidr_db_.get()->swap(*staging_);
+    staging_.reset();
+    applied_ = staging_sequence_;
+    dirty_ = true;
+
+    CIDR_TRACE(cidr::trace::info, "replication snapshot applied", applied_, 0);
+    return true;
+  }
+
+  // <sequence> +<cidr> | <sequence> -<cidr>
+  std::uint64_t seq = 0;
+  std::string mutation;
+  std::istringstream entry(line);
+  entry >> seq >> mutation;
+
+  if (staging_ || entry.fail() || seq != applied_ + 1 || mutation.size() < 2)
+    return false;
+
+  std::string cidr(mutation.substr(1));
+
+  if (!cidr::db::valid_cidr(cidr))
+    return false;
+
+  if (mutation[0] == '+')
+    cidr_db_.get()->put(cidr);
+  else if (mutation[0] == '-')
+    cidr_db_.get()->del(cidr);
+  else
+    return false;
+
+  applied_ = seq;
+  leader_sequence_ = std::max(leader_sequence_, seq);
+  dirty_ = true;
+
+  CIDR_TRACE(cidr::trace::debug, "replication applied", seq, 0);
+  return true;
+}
+
+void follower::reconnect()
+{
+  boost::system::error_code ignored_ec;
+  socket_.close(ignored_ec);
+  deadline_.cancel(ignored_ec);
+  buffer_.consume(buffer_.size());
+  staging_.reset();
+
+  if (dirty_)
+  {
+    cidr_db_.get()->commit();
+    dirty_ = false;
+  }
+
+  update_metrics();
+
+  if (stopped_)
+    return;
+
+  retry_timer_.expires_from_now(retry_interval);
+  retry_timer_.async_wait(
+      [this](const boost::system::error_code& e)
+      {
+        if (!e && !stopped_)
+          connect();
+      });
+}
+
+void follower::handle_deadline(const boost::system::error_code& e)
+{
+  if (e || deadline_.expires_at() > boost::asio::deadline_timer::traits_type::now())
+    return;
+
+  // Nothing heard from the leader, not even a heartbeat.
+  CIDR_TRACE(cidr::trace::info, "replication timeout", applied_, leader_sequence_);
+
+  reconnect();
+}
+
+void follower::update_metrics()
+{
+  metrics::set_replication(applied_, leader_sequence_, 0);
+}
+
+} // namespace replication
+} // namespace server
+} // namespace http
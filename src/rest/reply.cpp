@@ -107,6 +107,13 @@ const char crlf[] = { '\r', '\n' };
 std::vector<boost::asio::const_buffer> reply::to_buffers()
 {
   std::vector<boost::asio::const_buffer> buffers;
+  to_buffers(buffers);
+  return buffers;
+}
+
+void reply::to_buffers(std::vector<boost::asio::const_buffer>& buffers)
+{
+  buffers.clear();
   buffers.push_back(status_strings::to_buffer(status));
   for (std::size_t i = 0; i < headers.size(); ++i)
   {
@@ -118,7 +125,18 @@ std::vector<boost::asio::const_buffer> reply::to_buffers()
   }
   buffers.push_back(boost::asio::buffer(misc_strings::crlf));
   buffers.push_back(boost::asio::buffer(content));
-  return buffers;
+}
+
+void reply::clear()
+{
+  status = ok;
+  headers.clear();
+  stream = nullptr;
+
+  if (content.capacity() > max_retained_size)
+    std::string().swap(content);
+  else
+    content.clear();
 }
 
 /// Various HTML page for standard status replies
@@ -18,12 +18,19 @@
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <chrono>
+#include <memory>
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string.hpp>
+#include "compressor.hpp"
 #include "mime_types.hpp"
+#include "metrics.hpp"
+#include "packer.hpp"
 #include "reply.hpp"
 #include "request.hpp"
 #include "cidr_db.hpp"
+#include "cidr_merge.hpp"
 
 namespace b = boost;
 namespace ba = boost::algorithm;
@@ -36,13 +43,276 @@ namespace server {
  *
  *     GET     /           -- status
  *     POST    /           -- batch lookup
+ *     PATCH   /           -- apply +<cidr> / -<cidr> lines
+ *     GET     /metrics    -- Prometheus metrics
+ *     GET     /snapshot   -- binary image of the CIDR-DB
+ *     PUT     /snapshot   -- replace the CIDR-DB with a binary image
  *     GET     /<ip>       -- single lookup
  *     GET     /<ip>/<int> -- has (verify)
+ *     GET     /<ip>/<int>?within=1   -- CIDRs inside the supernet
+ *                         ?covered_by=1   (same as within)
+ *     GET     /<ip>/<int>?covering=1 -- CIDRs covering the CIDR
+ *     GET     /<ip>/<int>?overlaps=1 -- both of the above
  *     PUT     /<ip>/<int> -- add/update
  *     DELETE  /<ip>/<int> -- delete
  */
+/**
+ * True if the query string carries the option with any value but "0".
+ */
+bool has_option(const params_map &params, const std::string &name)
+{
+    auto option = params.find(name);
+    return option != params.end() && option->second != "0";
+}
+
+/**
+ * Compresses the reply body while it is built if the client sent an
+ * Accept-Encoding we support, and fixes up the headers when the handler
+ * returns. Declare it after the request_timer so compressing counts
+ * towards the handling time.
+ */
+class reply_encoder
+{
+public:
+    reply_encoder(const request &req, reply &rep, int level)
+        : rep_(rep),
+          enabled_(level > 0)
+    {
+        if (!enabled_)
+            return;
+
+        auto accept_encoding = std::find_if(req.headers.begin(), req.headers.end(),
+            [](auto &header) { return header.name == "Accept-Encoding"; });
+
+        if (accept_encoding != req.headers.end())
+            compressor_ = compressor::negotiate(accept_encoding->value, level);
+    }
+
+    ~reply_encoder()
+    {
+        if (!enabled_)
+            return;
+
+        rep_.headers.push_back(header{"Vary", "Accept-Encoding"});
+
+        if (!compressor_)
+            return;
+
+        try
+        {
+            if (rep_.stream)
+            {
+                wrap_stream();
+                return;
+            }
+
+            if (!compressor_->finish(rep_.content))
+                return;
+        }
+        catch (const std::exception &)
+        {
+            reply::stock_reply(reply::internal_server_error, rep_);
+            return;
+        }
+
+        for (auto &header : rep_.headers)
+        {
+            if (header.name == "Content-Length")
+                header.value = std::to_string(rep_.content.size());
+        }
+
+        rep_.headers.push_back(header{"Content-Encoding",
+            compressor::name(compressor_->coding())});
+    }
+
+    /**
+     * Compress the body built so far once there is a chunk of it, so
+     * large replies never sit in memory uncompressed.
+     */
+    void flush()
+    {
+        if (compressor_)
+            compressor_->consume(rep_.content);
+    }
+
+private:
+    /**
+     * Hand the compressor over to a streamed reply, which outlives the
+     * handler, and compress each piece as the stream produces it.
+     */
+    void wrap_stream()
+    {
+        std::shared_ptr<compressor> encoder(std::move(compressor_));
+        encoder->sync(rep_.content, false);
+
+        rep_.stream = [produce = std::move(rep_.stream), encoder](std::string &piece)
+        {
+            bool more = produce(piece);
+            encoder->sync(piece, !more);
+            return more;
+        };
+
+        rep_.headers.push_back(header{"Content-Encoding",
+            compressor::name(encoder->coding())});
+    }
+
+    reply &rep_;
+    bool enabled_;
+    std::unique_ptr<compressor> compressor_;
+};
+
+/// Bytes of lines gathered into each piece of a streamed reply.
+const size_t stream_piece_size = 16 * 1024;
+
+/// CIDRs encoded into each piece of a snapshot image, at a byte or two
+/// each.
+const size_t snapshot_piece_cidrs = 8192;
+
+/**
+ * Append the lookup of one address as a self-contained NDJSON or CSV
+ * line. Blank input lines produce nothing.
+ */
+void append_lookup_line(std::string &out, const cidr::db &db,
+    const std::string &ip, bool csv)
+{
+    if (ip.empty())
+        return;
+
+    bool valid = cidr::db::valid_ip(ip);
+    std::vector<std::string> results;
+
+    if (valid)
+        db.lookup(ip, results);
+
+    if (csv)
+    {
+        if (ip.find_first_of(",\"") == std::string::npos)
+        {
+            out.append(ip);
+        }
+        else
+        {
+            out.append("\"");
+            out.append(ba::replace_all_copy(ip, "\"", "\"\""));
+            out.append("\"");
+        }
+
+        out.append(valid ? ",true," : ",false,");
+
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            if (i > 0)
+                out.append(" ");
+            out.append(results[i]);
+        }
+
+        out.append("\n");
+        return;
+    }
+
+    out.append("{\"ip\":\"");
+
+    // escape quotes and drop control characters, so every line parses
+    // on its own whatever was sent
+    for (char c : ip)
+    {
+        if (c == '"' || c == '\\')
+            out.push_back('\\');
+
+        if (static_cast<unsigned char>(c) < 0x20)
+            continue;
+
+        out.push_back(c);
+    }
+
+    out.append("\",\"valid\":");
+    out.append(valid ? "true" : "false");
+    out.append(",\"cidrs\":[");
+
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        if (i > 0)
+            out.append(",");
+        out.append("\"");
+        out.append(results[i]);
+        out.append("\"");
+    }
+
+    out.append("]}\n");
+}
+
+/**
+ * Append a named list of CIDRs to a JSON object or YAML mapping. The
+ * producer feeds CIDRs to the visitor it is given, so results stream
+ * straight into the reply body.
+ */
+void append_cidr_list(reply &rep, reply_encoder &encoder, bool json,
+    const std::string &name,
+    const std::function<void(const cidr::db::cidr_visitor &)> &produce)
+{
+    if (json)
+    {
+        rep.content.append(",\"");
+        rep.content.append(name);
+        rep.content.append("\":[");
+
+        std::string comma("");
+        produce([&comma, &rep, &encoder](const std::string &cidr)
+        {
+            rep.content.append(comma);
+            rep.content.append("\"");
+            rep.content.append(cidr);
+            rep.content.append("\"");
+            comma = ",";
+            encoder.flush();
+        });
+
+        rep.content.append("]");
+    }
+    else
+    {
+        rep.content.append(name);
+        rep.content.append(":\n");
+
+        produce([&rep, &encoder](const std::string &cidr)
+        {
+            rep.content.append("- ");
+            rep.content.append(cidr);
+            rep.content.append("\n");
+            encoder.flush();
+        });
+    }
+}
+
+/**
+ * Append a named list of CIDRs to a MessagePack or CBOR map. The producer
+ * feeds network bits and prefix lengths to the visitor it is given; they
+ * are collected first, as the array length is written up front.
+ */
+void append_prefix_list(packer &pack, reply_encoder &encoder,
+    const std::string &name,
+    const std::function<void(const cidr::db::prefix_visitor &)> &produce)
+{
+    std::vector<std::pair<in_addr_t, uint8_t>> prefixes;
+
+    produce([&prefixes](in_addr_t network, uint8_t length)
+    {
+        prefixes.emplace_back(network, length);
+    });
+
+    pack.str(name);
+    pack.array(prefixes.size());
+
+    for (auto &prefix : prefixes)
+    {
+        pack.cidr(prefix.first, prefix.second);
+        encoder.flush();
+    }
+}
+
 std::string determine_op(const std::vector<std::string> &path_tokens,
-                       const std::string &method)
+                       const std::string &method,
+                       const params_map &params)
 {
     size_t token_count = std::count_if(path_tokens.begin(), path_tokens.end(),
         [](auto token) { return token != ""; });
@@ -55,16 +325,38 @@ std::string determine_op(const std::vector<std::string> &path_tokens,
 
         if (method == "POST")
             return "Batch-Lookup";  // lookup CIDRs for multiple IPs
+
+        if (method == "PATCH")
+            return "Patch";  // apply a delta
     }
     // path: /<ip>
     else if (token_count == 1)
     {
+        if (method == "GET" && path_tokens[0] == "metrics")
+            return "Metrics";  // scrape the service metrics
+
+        if (method == "GET" && path_tokens[0] == "snapshot")
+            return "Snapshot-Export";  // binary image of the CIDR-DB
+
+        if (method == "PUT" && path_tokens[0] == "snapshot")
+            return "Snapshot-Import";  // replace the CIDR-DB
+
         if (method == "GET")
             return "Single-Lookup";  // lookup CIDRs for an IP
     }
     // path: /<ip>/<int>
     else if (token_count == 2)
     {
+        if (method == "GET" && (has_option(params, "within")
+                                || has_option(params, "covered_by")))
+            return "Within";  // list CIDRs inside a supernet
+
+        if (method == "GET" && has_option(params, "covering"))
+            return "Covering";  // list CIDRs covering a CIDR
+
+        if (method == "GET" && has_option(params, "overlaps"))
+            return "Overlaps";  // list CIDRs covering or inside a CIDR
+
         if (method == "GET")
             return "Verify";  // verify CIDR present
 
@@ -78,14 +370,83 @@ std::string determine_op(const std::vector<std::string> &path_tokens,
     return "Invalid";
 }
 
+/**
+ * Records the handling time of a request against whatever operation it
+ * resolved to by the time the handler returns. A streamed reply is mostly
+ * produced after that, so its pieces are timed as the stream makes them,
+ * not counting the waits to send them, and the total is recorded once the
+ * stream is done with.
+ */
+class request_timer
+{
+public:
+    request_timer(const std::string &op_type, reply &rep)
+        : op_type_(op_type),
+          rep_(rep),
+          start_(std::chrono::steady_clock::now())
+        { }
+
+    ~request_timer()
+    {
+        metrics::operation op = metrics::operation_from_name(op_type_);
+
+        if (!rep_.stream)
+        {
+            std::chrono::duration<double> elapsed
+                = std::chrono::steady_clock::now() - start_;
+            metrics::observe_request(op, elapsed.count());
+            return;
+        }
+
+        auto total = std::make_shared<streamed_time>(op, start_);
+
+        rep_.stream = [produce = std::move(rep_.stream), total](std::string &piece)
+        {
+            auto start = std::chrono::steady_clock::now();
+            bool more = produce(piece);
+            total->elapsed += std::chrono::steady_clock::now() - start;
+            return more;
+        };
+    }
+
+private:
+    /** Recorded when the last reference goes. */
+    struct streamed_time
+    {
+        streamed_time(metrics::operation op, std::chrono::steady_clock::time_point start)
+            : op(op),
+              elapsed(std::chrono::steady_clock::now() - start)
+            { }
+
+        ~streamed_time()
+        {
+            metrics::observe_request(op, elapsed.count());
+        }
+
+        metrics::operation op;
+        std::chrono::duration<double> elapsed;
+    };
+
+    const std::string &op_type_;
+    reply &rep_;
+    std::chrono::steady_clock::time_point start_;
+};
+
 request_handler::request_handler(std::shared_ptr<cidr::db> &cidr_db)
-    : cidr_db_(cidr_db)
+    : cidr_db_(cidr_db),
+      read_only_(false),
+      compression_level_(0)
     { }
 
 void request_handler::handle_request(const request &req, reply &rep)
 {
+    std::string op_type("Invalid");
+    request_timer timer(op_type, rep);
+    reply_encoder encoder(req, rep, compression_level_);
+
     std::string request_path;
-    std::string accept_type(mime_types::extension_to_type("json"));
+    // points into the request, which outlives the handler
+    std::string_view accept_type(mime_types::extension_to_type("json"));
 
     if (!url_decode(req.uri, request_path))
     {
@@ -93,6 +454,64 @@ void request_handler::handle_request(const request &req, reply &rep)
         return;
     }
 
+    // the non-empty segments of the path; at most two are ever used
+    std::vector<std::string> path_tokens;
+    path_tokens.reserve(2);
+
+    for (size_t begin = 0; begin < request_path.size(); )
+    {
+        size_t end = request_path.find('/', begin);
+        if (end == std::string::npos)
+            end = request_path.size();
+
+        if (end > begin)
+            path_tokens.emplace_back(request_path, begin, end - begin);
+
+        begin = end + 1;
+    }
+
+    params_map params;
+    query_tokenize(req.query, params);
+
+    op_type = determine_op(path_tokens, req.method, params);
+
+    if (op_type == "Metrics")
+    {
+        rep.content = metrics::scrape();
+        rep.headers.resize(3);
+        rep.headers[0].name = "X-Operation";
+        rep.headers[0].value = op_type;
+        rep.headers[1].name = "Content-Length";
+        rep.headers[1].value = std::to_string(rep.content.size());
+        rep.headers[2].name = "Content-Type";
+        rep.headers[2].value = metrics::content_type;
+        rep.status = reply::ok;
+        return;
+    }
+
+    if (op_type == "Snapshot-Export")
+    {
+        // Only the copy of the keys is taken here, which keeps the image
+        // consistent; it is encoded a piece at a time as it is sent, with
+        // other requests (and changes) served in between. The image ends
+        // with its record count, so a cut-off download fails to import.
+        auto copy = std::make_shared<cidr::db_copy>(*cidr_db_.get());
+        rep.headers.resize(2);
+        rep.headers[0].name = "X-Operation";
+        rep.headers[0].value = op_type;
+        rep.headers[1].name = "Content-Type";
+        rep.headers[1].value = mime_types::extension_to_type("bin");
+        rep.status = reply::ok;
+
+        rep.stream = [copy](std::string &piece)
+        {
+            piece.clear();
+            return copy->snapshot(piece, snapshot_piece_cidrs);
+        };
+
+        return;
+    }
+
     auto accept_header = std::find_if(req.headers.begin(), req.headers.end(),
         [](auto &header) { return header.name == "Accept"; });
 
@@ -100,7 +519,11 @@ void request_handler::handle_request(const request &req, reply &rep)
         accept_type = accept_header[0].value;
 
     if (   accept_type != mime_types::extension_to_type("json")
-        && accept_type != mime_types::extension_to_type("yaml"))
+        && accept_type != mime_types::extension_to_type("yaml")
+        && accept_type != mime_types::extension_to_type("msgpack")
+        && accept_type != mime_types::extension_to_type("cbor")
+        && accept_type != mime_types::extension_to_type("ndjson")
+        && accept_type != mime_types::extension_to_type("csv"))
     {
         rep.status = reply::bad_request;
         rep.content.append("Unsupported content type: ");
@@ -111,6 +534,16 @@ void request_handler::handle_request(const request &req, reply &rep)
         rep.content.append(mime_types::extension_to_type("json"));
         rep.content.append("\n  - ");
         rep.content.append(mime_types::extension_to_type("yaml"));
+        rep.content.append("\n  - ");
+        rep.content.append(mime_types::extension_to_type("msgpack"));
+        rep.content.append("\n  - ");
+        rep.content.append(mime_types::extension_to_type("cbor"));
+        rep.content.append("\n  - ");
+        rep.content.append(mime_types::extension_to_type("ndjson"));
+        rep.content.append(" (lookups only)");
+        rep.content.append("\n  - ");
+        rep.content.append(mime_types::extension_to_type("csv"));
+        rep.content.append(" (lookups only)");
         rep.content.append("\n");
         rep.headers.resize(2);
         rep.headers[0].name = "Content-Length";
@@ -120,12 +553,30 @@ void request_handler::handle_request(const request &req, reply &rep)
         return;
     }
 
-    std::vector<std::string> path_tokens;
-    ba::split(path_tokens, request_path, b::is_any_of("/"));
-    std::remove_if(path_tokens.begin(), path_tokens.end(),
-        [](auto token) { return token == ""; });
+    // MessagePack and CBOR carry addresses as integers, see packer.hpp
+    bool packed = accept_type == mime_types::extension_to_type("msgpack")
+               || accept_type == mime_types::extension_to_type("cbor");
+    packer pack(accept_type == mime_types::extension_to_type("cbor")
+                ? packer::cbor : packer::msgpack, rep.content);
 
-    std::string op_type(determine_op(path_tokens, req.method));
+    // NDJSON and CSV give each address a line of its own, so a batch is
+    // streamed to the client as it is looked up
+    bool line_per_ip = accept_type == mime_types::extension_to_type("ndjson")
+                    || accept_type == mime_types::extension_to_type("csv");
+
+    if (line_per_ip && op_type != "Batch-Lookup" && op_type != "Single-Lookup"
+        && op_type != "Invalid")
+    {
+        rep.status = reply::bad_request;
+        rep.content.append(accept_type);
+        rep.content.append(" is only offered for lookups\n");
+        rep.headers.resize(2);
+        rep.headers[0].name = "Content-Length";
+        rep.headers[0].value = std::to_string(rep.content.size());
+        rep.headers[1].name = "Content-Type";
+        rep.headers[1].value = mime_types::extension_to_type("txt");
+        return;
+    }
 
     if (op_type == "Invalid")
     {
@@ -143,8 +594,16 @@ void request_handler::handle_request(const request &req, reply &rep)
             rep.content.append("---\n");
             rep.content.append("status: OK\n");
         }
+        else if (packed)
+        {
+            pack.map(1);
+            pack.str("status");
+            pack.str("OK");
+        }
+
+        if (!packed)
+            rep.content.append("\n");
 
-        rep.content.append("\n");
         rep.headers.resize(3);
         rep.headers[0].name = "X-Operation";
         rep.headers[0].value = op_type;
@@ -169,10 +628,14 @@ void request_handler::handle_request(const request &req, reply &rep)
             }
 
             ba::split(lines, content, b::is_any_of("\r\n"));
+
+            metrics::observe_batch(std::count_if(lines.begin(), lines.end(),
+                [](const std::string &line) { return !line.empty(); }));
         }
         else if (op_type == "Single-Lookup")
         {
-            lines.push_back(path_tokens[0]);
+            // the address is the only path token
+            lines.swap(path_tokens);
         }
 
         if (lines.size() < 1)
@@ -181,13 +644,52 @@ void request_handler::handle_request(const request &req, reply &rep)
             return;
         }
 
+        if (line_per_ip)
+        {
+            bool csv = accept_type == mime_types::extension_to_type("csv");
+            std::shared_ptr<cidr::db> db(cidr_db_);
+
+            if (csv)
+                rep.content.append("ip,valid,cidrs\n");
+
+            rep.headers.resize(2);
+            rep.headers[0].name = "X-Operation";
+            rep.headers[0].value = op_type;
+            rep.headers[1].name = "Content-Type";
+            rep.headers[1].value = accept_type;
+            rep.status = reply::ok;
+
+            if (op_type == "Single-Lookup")
+            {
+                append_lookup_line(rep.content, *db, lines[0], csv);
+                rep.headers.push_back(header{"Content-Length",
+                    std::to_string(rep.content.size())});
+                return;
+            }
+
+            // Each call looks up the next piece's worth of addresses; other
+            // requests are served while the piece before is being sent.
+            rep.stream = [lines = std::move(lines), db, csv, next = size_t(0)]
+                (std::string &piece) mutable
+            {
+                piece.clear();
+
+                while (next < lines.size() && piece.size() < stream_piece_size)
+                    append_lookup_line(piece, *db, lines[next++], csv);
+
+                return next < lines.size();
+            };
+
+            return;
+        }
+
         if (accept_type == mime_types::extension_to_type("json"))
         {
             rep.content.append("[");
 
             std::string comma1("");
             std::for_each(lines.begin(), lines.end(),
-                [&comma1, &rep, this](std::string &ip)
+                [&comma1, &rep, &encoder, this](std::string &ip)
                 {
                     if (ip.empty()) return;
 
@@ -221,6 +723,7 @@ void request_handler::handle_request(const request &req, reply &rep)
 
                     rep.content.append("]}");
                     comma1 = ",";
+                    encoder.flush();
                 }
             );
 
@@ -231,7 +734,7 @@ void request_handler::handle_request(const request &req, reply &rep)
             rep.content.append("---\n");
 
             std::for_each(lines.begin(), lines.end(),
-                [&rep, this](std::string &ip)
+                [&rep, &encoder, this](std::string &ip)
                 {
                     if (ip.empty()) return;
 
@@ -260,11 +763,218 @@ void request_handler::handle_request(const request &req, reply &rep)
                             rep.content.append("\n");
                         }
                     );
+
+                    encoder.flush();
                 }
             );
         }
+        else if (packed)
+        {
+            pack.array(std::count_if(lines.begin(), lines.end(),
+                [](const std::string &line) { return !line.empty(); }));
+
+            for (const std::string &ip : lines)
+            {
+                if (ip.empty())
+                    continue;
+
+                struct in_addr addr;
+                bool valid = inet_pton(AF_INET, ip.c_str(), &addr) == 1;
+                in_addr_t ip_bits = ntohl(addr.s_addr);
+                uint8_t lengths[32];
+                size_t count = valid ? cidr_db_.get()->lookup(ip_bits, lengths) : 0;
+
+                pack.map(3);
+                pack.str("ip");
+
+                if (valid)
+                    pack.uint(ip_bits);
+                else
+                    pack.str(ip);
+
+                pack.str("valid");
+                pack.boolean(valid);
+                pack.str("cidrs");
+                pack.array(count);
+
+                for (size_t i = 0; i < count; i++)
+                {
+                    size_t offset = 32 - lengths[i];
+                    pack.cidr((ip_bits >> offset) << offset, lengths[i]);
+                }
+
+                encoder.flush();
+            }
+        }
+
+        if (!packed)
+            rep.content.append("\n");
+
+        rep.headers.resize(3);
+        rep.headers[0].name = "X-Operation";
+        rep.headers[0].value = op_type;
+        rep.headers[1].name = "Content-Length";
+        rep.headers[1].value = std::to_string(rep.content.size());
+        rep.headers[2].name = "Content-Type";
+        rep.headers[2].value = accept_type;
+        rep.status = reply::ok;
+
+        return;
+    }
+    else if (op_type == "Patch")
+    {
+        if (read_only_)
+        {
+            reply::stock_reply(reply::forbidden, rep);
+            return;
+        }
+
+        std::vector<cidr::merge::mutation> mutations;
+
+        try
+        {
+            std::istringstream delta(req.content);
+            cidr::merge::parse_mutations(delta, mutations);
+        }
+        catch (const std::exception &e)
+        {
+            rep.status = reply::bad_request;
+            rep.content.append(e.what());
+            rep.content.append("\n");
+            rep.headers.resize(2);
+            rep.headers[0].name = "Content-Length";
+            rep.headers[0].value = std::to_string(rep.content.size());
+            rep.headers[1].name = "Content-Type";
+            rep.headers[1].value = mime_types::extension_to_type("txt");
+            return;
+        }
+
+        size_t added = 0;
+        size_t removed = 0;
+
+        for (auto &m : mutations)
+        {
+            if (m.add)
+            {
+                cidr_db_.get()->put(m.cidr);
+                added++;
+            }
+            else
+            {
+                cidr_db_.get()->del(m.cidr);
+                removed++;
+            }
+
+            if (mutation_observer_)
+                mutation_observer_((m.add ? "+" : "-") + m.cidr);
+        }
+
+        commit();
+
+        if (accept_type == mime_types::extension_to_type("json"))
+        {
+            rep.content.append("{\"status\":\"OK\",\"added\":");
+            rep.content.append(std::to_string(added));
+            rep.content.append(",\"removed\":");
+            rep.content.append(std::to_string(removed));
+            rep.content.append("}");
+        }
+        else if (accept_type == mime_types::extension_to_type("yaml"))
+        {
+            rep.content.append("---\n");
+            rep.content.append("status: OK\n");
+            rep.content.append("added: ");
+            rep.content.append(std::to_string(added));
+            rep.content.append("\n");
+            rep.content.append("removed: ");
+            rep.content.append(std::to_string(removed));
+            rep.content.append("\n");
+        }
+        else if (packed)
+        {
+            pack.map(3);
+            pack.str("status");
+            pack.str("OK");
+            pack.str("added");
+            pack.uint(added);
+            pack.str("removed");
+            pack.uint(removed);
+        }
+
+        if (!packed)
+            rep.content.append("\n");
+
+        rep.headers.resize(3);
+        rep.headers[0].name = "X-Operation";
+        rep.headers[0].value = op_type;
+        rep.headers[1].name = "Content-Length";
+        rep.headers[1].value = std::to_string(rep.content.size());
+        rep.headers[2].name = "Content-Type";
+        rep.headers[2].value = accept_type;
+        rep.status = reply::ok;
+
+        return;
+    }
+    else if (op_type == "Snapshot-Import")
+    {
+        if (read_only_)
+        {
+            reply::stock_reply(reply::forbidden, rep);
+            return;
+        }
+
+        cidr::db restored;
+        size_t count = 0;
+
+        try
+        {
+            count = restored.restore(req.content);
+        }
+        catch (const std::exception &e)
+        {
+            rep.status = reply::bad_request;
+            rep.content.append(e.what());
+            rep.content.append("\n");
+            rep.headers.resize(2);
+            rep.headers[0].name = "Content-Length";
+            rep.headers[0].value = std::to_string(rep.content.size());
+            rep.headers[1].name = "Content-Type";
+            rep.headers[1].value = mime_types::extension_to_type("txt");
+            return;
+        }
+
+        cidr_db_.get()->swap(restored);
+        commit();
+
+        if (reset_observer_)
+            reset_observer_();
+
+        if (accept_type == mime_types::extension_to_type("json"))
+        {
+            rep.content.append("{\"status\":\"OK\",\"cidrs\":");
+            rep.content.append(std::to_string(count));
+            rep.content.append("}");
+        }
+        else if (accept_type == mime_types::extension_to_type("yaml"))
+        {
+            rep.content.append("---\n");
+            rep.content.append("status: OK\n");
+            rep.content.append("cidrs: ");
+            rep.content.append(std::to_string(count));
+            rep.content.append("\n");
+        }
+        else if (packed)
+        {
+            pack.map(2);
+            pack.str("status");
+            pack.str("OK");
+            pack.str("cidrs");
+            pack.uint(count);
+        }
+
+        if (!packed)
+            rep.content.append("\n");
 
-        rep.content.append("\n");
         rep.headers.resize(3);
         rep.headers[0].name = "X-Operation";
         rep.headers[0].value = op_type;
@@ -288,18 +998,31 @@ void request_handler::handle_request(const request &req, reply &rep)
             return;
         }
 
+        if (read_only_ && op_type != "Verify")
+        {
+            reply::stock_reply(reply::forbidden, rep);
+            return;
+        }
+
         if (op_type == "Add")
         {
             cidr_db_.get()->put(cidr);
-            cidr_db_.get()->commit();
+            commit();
+
+            if (mutation_observer_)
+                mutation_observer_("+" + cidr);
         }
         else if (op_type == "Delete")
         {
             cidr_db_.get()->del(cidr);
-            cidr_db_.get()->commit();
+            commit();
+
+            if (mutation_observer_)
+                mutation_observer_("-" + cidr);
         }
 
-        std::string present(cidr_db_.get()->has(cidr) ? "true" : "false");
+        bool is_present = cidr_db_.get()->has(cidr);
+        std::string present(is_present ? "true" : "false");
 
         if (accept_type == mime_types::extension_to_type("json"))
         {
@@ -322,8 +1045,146 @@ void request_handler::handle_request(const request &req, reply &rep)
             rep.content.append(present);
             rep.content.append("\n");
         }
+        else if (packed)
+        {
+            pack.map(3);
+            pack.str("cidr");
+            pack.cidr(inet_network(path_tokens[0].c_str()),
+                std::stoi(path_tokens[1]));
+            pack.str("valid");
+            pack.boolean(true);
+            pack.str("present");
+            pack.boolean(is_present);
+        }
+
+        if (!packed)
+            rep.content.append("\n");
+
+        rep.headers.resize(3);
+        rep.headers[0].name = "X-Operation";
+        rep.headers[0].value = op_type;
+        rep.headers[1].name = "Content-Length";
+        rep.headers[1].value = std::to_string(rep.content.size());
+        rep.headers[2].name = "Content-Type";
+        rep.headers[2].value = accept_type;
+        rep.status = reply::ok;
+
+        return;
+    }
+
+    else if (op_type == "Within" || op_type == "Covering" || op_type == "Overlaps")
+    {
+        std::string cidr(path_tokens[0]
+                       + "/"
+                       + path_tokens[1]);
+
+        if (!cidr::db::valid_cidr(cidr))
+        {
+            reply::stock_reply(reply::bad_request, rep);
+            return;
+        }
+
+        if (packed)
+        {
+            in_addr_t addr_bits = inet_network(path_tokens[0].c_str());
+            uint8_t length = std::stoi(path_tokens[1]);
+            const cidr::db &db = *cidr_db_;
+
+            pack.map(op_type == "Overlaps" ? 4 : 3);
+            pack.str("cidr");
+            pack.cidr(addr_bits, length);
+            pack.str("valid");
+            pack.boolean(true);
+
+            auto within = [&db, addr_bits, length](const cidr::db::prefix_visitor &visit)
+            {
+                db.within(addr_bits, length, visit);
+            };
+
+            auto covering = [&db, addr_bits, length](const cidr::db::prefix_visitor &visit)
+            {
+                db.covering(addr_bits, length, visit);
+            };
+
+            if (op_type == "Within")
+            {
+                append_prefix_list(pack, encoder, "within", within);
+            }
+            else if (op_type == "Covering")
+            {
+                append_prefix_list(pack, encoder, "covering", covering);
+            }
+            else if (op_type == "Overlaps")
+            {
+                append_prefix_list(pack, encoder, "covering", covering);
+                append_prefix_list(pack, encoder, "covered", within);
+            }
+        }
+        else
+        {
+            bool json = accept_type == mime_types::extension_to_type("json");
+
+            if (json)
+            {
+                rep.content.append("{\"cidr\":\"");
+                rep.content.append(cidr);
+                rep.content.append("\",\"valid\":true");
+            }
+            else
+            {
+                rep.content.append("---\n");
+                rep.content.append("cidr: ");
+                rep.content.append(cidr);
+                rep.content.append("\n");
+                rep.content.append("valid: true\n");
+            }
+
+            if (op_type == "Within")
+            {
+                append_cidr_list(rep, encoder, json, "within",
+                    [this, &cidr](const cidr::db::cidr_visitor &visit)
+                    {
+                        cidr_db_.get()->within(cidr, visit);
+                    }
+                );
+            }
+            else if (op_type == "Covering")
+            {
+                append_cidr_list(rep, encoder, json, "covering",
+                    [this, &cidr](const cidr::db::cidr_visitor &visit)
+                    {
+                        cidr_db_.get()->covering(cidr, visit);
+                    }
+                );
+            }
+            else if (op_type == "Overlaps")
+            {
+                std::vector<std::string> covering;
+                std::vector<std::string> covered;
+
+                cidr_db_.get()->overlaps(cidr, covering, covered);
+
+                append_cidr_list(rep, encoder, json, "covering",
+                    [&covering](const cidr::db::cidr_visitor &visit)
+                    {
+                        std::for_each(covering.begin(), covering.end(), visit);
+                    }
+                );
+                append_cidr_list(rep, encoder, json, "covered",
+                    [&covered](const cidr::db::cidr_visitor &visit)
+                    {
+                        std::for_each(covered.begin(), covered.end(), visit);
+                    }
+                );
+            }
+
+            if (json)
+                rep.content.append("}");
+        }
+
+        if (!packed)
+            rep.content.append("\n");
 
-        rep.content.append("\n");
         rep.headers.resize(3);
         rep.headers[0].name = "X-Operation";
         rep.headers[0].value = op_type;
@@ -340,6 +1201,18 @@ void request_handler::handle_request(const request &req, reply &rep)
     return;
 }
 
+void request_handler::commit()
+{
+    auto start = std::chrono::steady_clock::now();
+
+    cidr_db_.get()->commit();
+
+    std::chrono::duration<double> elapsed
+        = std::chrono::steady_clock::now() - start;
+
+    metrics::observe_commit(elapsed.count());
+}
+
 bool request_handler::url_decode(const std::string &in, std::string &out)
 {
   out.clear();
@@ -428,6 +1301,29 @@ void request_handler::query_tokenize(const std::string& in, params_map& out)
   }
 }
 
+/// Report every applied PUT and DELETE
+void request_handler::observe_mutations(mutation_function&& function)
+{
+  mutation_observer_ = std::move(function);
+}
+
+/// Report every wholesale replacement of the database
+void request_handler::observe_resets(reset_function&& function)
+{
+  reset_observer_ = std::move(function);
+}
+
+/// Refuse PUT and DELETE
+void request_handler::set_read_only(bool read_only)
+{
+  read_only_ = read_only;
+}
+
+void request_handler::set_compression_level(int level)
+{
+  compression_level_ = level;
+}
+
 /// Register a dynamic resource (a code generated web page)
 void request_handler::register_resource(const std::string& resource_name, resource_function&& function)
 {
@@ -313,16 +313,20 @@ boost::tribool request_parser::consume(request& req, char input)
   case expecting_newline_3:
     if (input == '\n')
     {
-      if (req.method == "POST")
+      if (req.method == "POST" || req.method == "PUT" || req.method == "PATCH")
       {
         if (set_content_length(req))
         {
+          if (req.content_length == 0)
+            return true;
+
           state_ = content;
           return boost::indeterminate;
         }
         else
         {
-          return false;
+          // PUT /<ip>/<int> carries no body
+          return req.method != "POST";
         }
       }
       else
@@ -349,6 +353,26 @@ boost::tribool request_parser::consume(request& req, char input)
   }
 }
 
+std::size_t request_parser::content_remaining(const request& req)
+{
+  return req.content_length - req.content.size();
+}
+
+boost::tribool request_parser::consume_content(request& req,
+    const char* data, std::size_t count)
+{
+  req.content.append(data, count);
+
+  if (req.content.length() == req.content_length)
+  {
+    return true;
+  }
+  else
+  {
+    return boost::indeterminate;
+  }
+}
+
 bool request_parser::is_char(int c)
 {
   return c >= 0 && c <= 127;
@@ -9,12 +9,29 @@
 /// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
 ///
 
+#include <iostream>
+#include <memory>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <boost/bind.hpp>
 #include "server.hpp"
+#include "trace.hpp"
 
 namespace http {
 namespace server {
 
+namespace {
+
+/// How often the shared memory snapshot is brought up to date; changes are
+/// batched up to this long after the previous snapshot was written, and only
+/// the prefix lengths they touched are rebuilt.
+const boost::posix_time::milliseconds shm_interval(100);
+
+} // namespace
+
 server::server(
     const std::string &address,
     const std::string &port,
@@ -23,7 +40,9 @@ server::server(
    acceptor_(io_service_),
    connection_manager_(),
    new_connection_(new connection(io_service_, connection_manager_, request_handler_)),
-   request_handler_(cidr_db)
+   request_handler_(cidr_db),
+   cidr_db_(cidr_db),
+   shm_timer_(io_service_)
 {
   // Open the acceptor with the option to reuse the address (i.e. SO_REUSEADDR).
   boost::asio::ip::tcp::resolver resolver(io_service_);
@@ -43,6 +62,72 @@ server::server(
   );
 }
 
+void server::lead(const std::string &address, const std::string &port,
+    std::size_t log_capacity)
+{
+  leader_.reset(new replication::leader(io_service_, address, port,
+      cidr_db_, log_capacity));
+
+  replication::leader* leader = leader_.get();
+  request_handler_.observe_mutations([leader](const std::string &mutation)
+  {
+    leader->publish(mutation);
+  });
+  request_handler_.observe_resets([leader]()
+  {
+    leader->reset();
+  });
+}
+
+void server::follow(const std::string &host, const std::string &port)
+{
+  request_handler_.set_read_only(true);
+  follower_.reset(new replication::follower(io_service_, host, port, cidr_db_));
+}
+
+void server::serve_udp(const std::string &address, const std::string &port)
+{
+  udp_lookup_.reset(new udp_lookup(io_service_, address, port, cidr_db_));
+}
+
+void server::listen_local(const std::string &path,
+    const std::set<uid_t> &allowed_uids)
+{
+  // Replace a socket left behind by an earlier run, but nothing else.
+  struct stat st;
+  if (::lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+    ::unlink(path.c_str());
+
+  local_acceptor_.reset(new boost::asio::local::stream_protocol::acceptor(
+      io_service_, boost::asio::local::stream_protocol::endpoint(path)));
+  local_path_ = path;
+  allowed_uids_ = allowed_uids;
+
+  new_local_connection_.reset(new connection(io_service_,
+        connection_manager_, request_handler_));
+  local_acceptor_->async_accept(new_local_connection_->socket(),
+      boost::bind(&server::handle_local_accept, this,
+        boost::asio::placeholders::error));
+}
+
+server::~server()
+{
+  shm_work_.reset();
+
+  if (shm_thread_.joinable())
+    shm_thread_.join();
+}
+
+void server::publish_shm(const std::string &name)
+{
+  shm_publisher_.reset(new cidr::shm::publisher(name));
+  shm_publisher_->publish(*cidr_db_);
+
+  shm_work_.reset(new boost::asio::io_service::work(shm_service_));
+  shm_thread_ = std::thread([this] { shm_service_.run(); });
+  start_shm_timer();
+}
+
 void server::run()
 {
   // The io_service::run() call will block until all asynchronous operations
@@ -63,6 +148,11 @@ void server::handle_accept(const boost::system::error_code &e)
 {
   if (!e)
   {
+    // a kept-alive reply must not wait on Nagle for the client's delayed ACK
+    boost::system::error_code ignored_ec;
+    new_connection_->socket().set_option(
+        boost::asio::detail::socket_option::boolean<IPPROTO_TCP, TCP_NODELAY>(true),
+        ignored_ec);
     connection_manager_.start(new_connection_);
     new_connection_.reset(new connection(io_service_,
           connection_manager_, request_handler_));
@@ -72,13 +162,115 @@ void server::handle_accept(const boost::system::error_code &e)
   }
 }
 
+void server::handle_local_accept(const boost::system::error_code &e)
+{
+  if (e)
+    return;
+
+  ucred peer = ucred();
+  socklen_t length = sizeof peer;
+  int fd = new_local_connection_->socket().native_handle();
+
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &length) == 0
+      && allowed_uids_.count(peer.uid))
+  {
+    connection_manager_.start(new_local_connection_);
+  }
+  else
+  {
+    CIDR_TRACE(cidr::trace::info, "unix socket peer refused", peer.uid, peer.pid);
+
+    // The refused connection and its reply live until the write completes.
+    connection_ptr refused(new_local_connection_);
+    std::shared_ptr<reply> rep(std::make_shared<reply>());
+    reply::stock_reply(reply::forbidden, *rep);
+    boost::asio::async_write(refused->socket(), rep->to_buffers(),
+        [refused, rep](const boost::system::error_code&, std::size_t)
+        {
+          boost::system::error_code ignored_ec;
+          refused->socket().close(ignored_ec);
+        });
+  }
+
+  new_local_connection_.reset(new connection(io_service_,
+        connection_manager_, request_handler_));
+  local_acceptor_->async_accept(new_local_connection_->socket(),
+      boost::bind(&server::handle_local_accept, this,
+        boost::asio::placeholders::error));
+}
+
+void server::start_shm_timer()
+{
+  if (!shm_work_)
+    return;
+
+  shm_timer_.expires_from_now(shm_interval);
+  shm_timer_.async_wait(boost::bind(&server::handle_shm_timer, this,
+        boost::asio::placeholders::error));
+}
+
+void server::handle_shm_timer(const boost::system::error_code &e)
+{
+  if (e || !shm_work_)
+    return;
+
+  // Only copying the changed keys happens here, where the database can't
+  // change underneath. Building the hash tables takes far longer on a large
+  // database, so the shm thread does that and the write, and only then
+  // re-arms the timer: one build at a time, and lookups never wait for it.
+  auto changes = std::make_shared<cidr::shm::snapshot>(
+      shm_publisher_->capture(*cidr_db_));
+
+  if (!changes->changed)
+  {
+    start_shm_timer();
+    return;
+  }
+
+  shm_service_.post([this, changes]
+  {
+    try
+    {
+      shm_publisher_->publish(*changes);
+    }
+    catch (std::exception &ex)
+    {
+      std::cerr << "shm publish: " << ex.what() << std::endl;
+    }
+
+    io_service_.post(boost::bind(&server::start_shm_timer, this));
+  });
+}
+
 void server::handle_stop()
 {
   // The server is stopped by cancelling all outstanding asynchronous
   // operations. Once all operations have finished the io_service::run() call
   // will exit.
   acceptor_.close();
+
+  if (local_acceptor_)
+  {
+    local_acceptor_->close();
+    ::unlink(local_path_.c_str());
+  }
+
   connection_manager_.stop_all();
+
+  if (leader_)
+    leader_->stop();
+
+  if (follower_)
+    follower_->stop();
+
+  if (udp_lookup_)
+    udp_lookup_->stop();
+
+  // The shm thread finishes a build in progress; ~server() waits for it.
+  shm_work_.reset();
+
+  boost::system::error_code ignored_ec;
+  shm_timer_.cancel(ignored_ec);
 }
 
 } // namespace server
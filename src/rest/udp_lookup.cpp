@@ -0,0 +1,177 @@
+///
+/// \file udp_lookup.cpp
+///
+/// Binary lookup protocol over UDP.
+///
+
+#include "udp_lookup.hpp"
+#include <cerrno>
+#include <cstring>
+#include <arpa/inet.h>
+#include <boost/bind.hpp>
+#include "metrics.hpp"
+
+namespace http {
+namespace server {
+
+namespace {
+
+/// Datagrams moved per recvmmsg / sendmmsg call.
+const std::size_t batch_size = 64;
+
+/// Batches handled before yielding to the rest of the io_service, so a
+/// flood of datagrams can't starve the HTTP connections.
+const int max_rounds = 16;
+
+} // namespace
+
+const std::size_t udp_lookup::max_addresses;
+const std::size_t udp_lookup::max_request_size;
+const std::size_t udp_lookup::max_reply_size;
+
+udp_lookup::udp_lookup(boost::asio::io_service& io_service,
+    const std::string& address, const std::string& port,
+    std::shared_ptr<cidr::db>& cidr_db)
+  : socket_(io_service),
+    cidr_db_(cidr_db),
+    // one spare byte per request slot so that an oversized datagram is
+    // flagged MSG_TRUNC rather than silently cut to a valid length
+    requests_(batch_size * (max_request_size + 1)),
+    replies_(batch_size * max_reply_size),
+    peers_(batch_size),
+    request_iov_(batch_size),
+    reply_iov_(batch_size),
+    received_(batch_size),
+    outgoing_(batch_size)
+{
+  boost::asio::ip::udp::resolver resolver(io_service);
+  boost::asio::ip::udp::resolver::query query(address, port);
+  boost::asio::ip::udp::endpoint endpoint = *resolver.resolve(query);
+  socket_.open(endpoint.protocol());
+  socket_.set_option(boost::asio::ip::udp::socket::reuse_address(true));
+  socket_.bind(endpoint);
+  socket_.non_blocking(true);
+
+  start_wait();
+}
+
+void udp_lookup::stop()
+{
+  boost::system::error_code ignored_ec;
+  socket_.close(ignored_ec);
+}
+
+std::size_t udp_lookup::answer(const cidr::db& db, const char* request,
+    std::size_t size, char* reply)
+{
+  if (size < 4 || (size - 4) % 4 != 0 || size > max_request_size)
+    return 0;
+
+  std::memcpy(reply, request, 4);
+  char* out = reply + 4;
+
+  for (const char* in = request + 4; in < request + size; in += 4)
+  {
+    std::uint32_t address;
+    std::memcpy(&address, in, 4);
+
+    std::uint8_t* lengths = reinterpret_cast<std::uint8_t*>(out + 1);
+    std::size_t count = db.lookup(ntohl(address), lengths);
+    *out = static_cast<char>(count);
+    out += 1 + count;
+  }
+
+  return out - reply;
+}
+
+void udp_lookup::start_wait()
+{
+  socket_.async_wait(boost::asio::ip::udp::socket::wait_read,
+      boost::bind(&udp_lookup::handle_readable, this,
+        boost::asio::placeholders::error));
+}
+
+void udp_lookup::handle_readable(const boost::system::error_code& e)
+{
+  if (e)
+    return;
+
+  int fd = socket_.native_handle();
+  std::size_t datagrams = 0;
+  std::size_t addresses = 0;
+
+  for (int round = 0; round < max_rounds; round++)
+  {
+    for (std::size_t i = 0; i < batch_size; i++)
+    {
+      request_iov_[i].iov_base = &requests_[i * (max_request_size + 1)];
+      request_iov_[i].iov_len = max_request_size + 1;
+
+      msghdr& h = received_[i].msg_hdr;
+      std::memset(&h, 0, sizeof h);
+      h.msg_name = &peers_[i];
+      h.msg_namelen = sizeof peers_[i];
+      h.msg_iov = &request_iov_[i];
+      h.msg_iovlen = 1;
+    }
+
+    int n = recvmmsg(fd, received_.data(), batch_size, MSG_DONTWAIT, nullptr);
+
+    if (n <= 0)
+      break;
+
+    std::size_t replies = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+      const msghdr& in = received_[i].msg_hdr;
+
+      if (in.msg_flags & MSG_TRUNC)
+        continue;
+
+      char* reply = &replies_[i * max_reply_size];
+      std::size_t size = answer(*cidr_db_,
+          static_cast<const char*>(request_iov_[i].iov_base),
+          received_[i].msg_len, reply);
+
+      if (size == 0)
+        continue;
+
+      addresses += (received_[i].msg_len - 4) / 4;
+
+      reply_iov_[replies].iov_base = reply;
+      reply_iov_[replies].iov_len = size;
+
+      msghdr& out = outgoing_[replies].msg_hdr;
+      std::memset(&out, 0, sizeof out);
+      out.msg_name = in.msg_name;
+      out.msg_namelen = in.msg_namelen;
+      out.msg_iov = &reply_iov_[replies];
+      out.msg_iovlen = 1;
+      replies++;
+    }
+
+    // A reply the socket buffer can't take is dropped, as the network
+    // would; the client retries. A reply that fails outright is skipped.
+    for (std::size_t sent = 0; sent < replies; )
+    {
+      int m = sendmmsg(fd, &outgoing_[sent], replies - sent, MSG_DONTWAIT);
+
+      if (m < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        break;
+
+      sent += m > 0 ? m : 1;
+    }
+
+    datagrams += n;
+
+    if (static_cast<std::size_t>(n) < batch_size)
+      break;
+  }
+
+  metrics::add_udp(datagrams, addresses);
+  start_wait();
+}
+
+} // namespace server
+} // namespace http
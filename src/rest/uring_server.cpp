@@ -0,0 +1,752 @@
+///
+/// \file uring_server.cpp
+///
+/// HTTP server backend driven by io_uring instead of Asio's epoll reactor.
+///
+
+#include "uring_server.hpp"
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include <linux/io_uring.h>
+#include <netdb.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <boost/logic/tribool.hpp>
+#include <boost/tuple/tuple.hpp>
+#include "metrics.hpp"
+#include "reply.hpp"
+#include "request.hpp"
+#include "request_parser.hpp"
+
+namespace http {
+namespace server {
+
+namespace {
+
+const unsigned ring_entries = 1024;
+
+/// Provided receive buffers; the count must be a power of two.
+const unsigned buffer_count = 1024;
+const unsigned buffer_size = 8192;
+
+typedef std::chrono::steady_clock clock_type;
+
+/// How long a client has to send a complete request, including the idle
+/// time before the next request on a kept-alive connection.
+const clock_type::duration request_timeout = std::chrono::seconds(30);
+
+/// Operation tag kept in the low bits of a completion's user_data; the
+/// rest is the connection pointer, if any.
+enum operation : std::uint64_t
+{
+  op_ignore = 0,
+  op_accept = 1,
+  op_wake = 2,
+  op_recv = 3,
+  op_send = 4,
+  op_shutdown = 5,
+  op_close = 6,
+  op_timeout = 7
+};
+
+const std::uint64_t op_mask = 7;
+
+std::runtime_error system_error(const std::string& what)
+{
+  return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+} // namespace
+
+/// A connection's parse and reply state, and which operations it has in
+/// flight. It is deleted once its close completes.
+struct uring_server::connection
+{
+  explicit connection(int fd)
+    : fd(fd),
+      input_begin(0),
+      iov_next(0),
+      request_deadline(clock_type::now() + request_timeout),
+      recv_armed(false),
+      sending(false),
+      timer_armed(false),
+      keep_alive(false),
+      peer_closed(false),
+      closing(false),
+      shutdown_pending(false),
+      close_submitted(false)
+  {
+    std::memset(&msg, 0, sizeof msg);
+    std::memset(&timeout, 0, sizeof timeout);
+  }
+
+  int fd;
+
+  request req;
+  request_parser parser;
+  reply rep;
+
+  /// Received bytes not yet parsed start at input_begin.
+  std::string input;
+  std::size_t input_begin;
+
+  /// Unsent part of the reply starts at iov[iov_next].
+  std::vector<iovec> iov;
+  std::size_t iov_next;
+  msghdr msg;
+
+  /// When the request being read must be complete; time_point::max()
+  /// while one is being handled and answered.
+  clock_type::time_point request_deadline;
+  __kernel_timespec timeout;
+
+  bool recv_armed;
+  bool sending;
+  bool timer_armed;
+  bool keep_alive;
+  bool peer_closed;
+  bool closing;
+  bool shutdown_pending;
+  bool close_submitted;
+};
+
+/// The submission and completion queues and the provided buffer ring,
+/// set up with the raw system calls.
+class uring_server::ring
+  : private boost::noncopyable
+{
+public:
+  ring()
+    : fd_(-1),
+      sq_ptr_(MAP_FAILED),
+      cq_ptr_(MAP_FAILED),
+      sqes_(static_cast<io_uring_sqe*>(MAP_FAILED)),
+      buf_ring_(static_cast<io_uring_buf_ring*>(MAP_FAILED)),
+      to_submit_(0),
+      buf_tail_(0),
+      buffers_(buffer_count * buffer_size)
+  {
+    std::memset(&params_, 0, sizeof params_);
+
+    fd_ = syscall(__NR_io_uring_setup, ring_entries, &params_);
+    if (fd_ < 0)
+      throw system_error("io_uring_setup");
+
+    if (!(params_.features & IORING_FEAT_SINGLE_MMAP))
+      throw std::runtime_error("io_uring: kernel too old (no single mmap)");
+
+    sq_size_ = params_.sq_off.array + params_.sq_entries * sizeof(unsigned);
+    cq_size_ = params_.cq_off.cqes + params_.cq_entries * sizeof(io_uring_cqe);
+    if (cq_size_ > sq_size_)
+      sq_size_ = cq_size_;
+
+    sq_ptr_ = mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+    if (sq_ptr_ == MAP_FAILED)
+      throw system_error("io_uring mmap");
+    cq_ptr_ = sq_ptr_;
+
+    sqes_size_ = params_.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = static_cast<io_uring_sqe*>(mmap(nullptr, sqes_size_,
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES));
+    if (sqes_ == MAP_FAILED)
+      throw system_error("io_uring mmap");
+
+    char* sq = static_cast<char*>(sq_ptr_);
+    sq_head_ = reinterpret_cast<unsigned*>(sq + params_.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + params_.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned*>(sq + params_.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + params_.sq_off.array);
+    sq_local_tail_ = *sq_tail_;
+
+    char* cq = static_cast<char*>(cq_ptr_);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + params_.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + params_.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(cq + params_.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params_.cq_off.cqes);
+
+    // Register the receive buffers as a provided buffer ring, so a recv
+    // picks a buffer only once data has arrived.
+    buf_ring_size_ = buffer_count * sizeof(io_uring_buf);
+    buf_ring_ = static_cast<io_uring_buf_ring*>(mmap(nullptr, buf_ring_size_,
+        PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0));
+    if (buf_ring_ == MAP_FAILED)
+      throw system_error("io_uring buffer ring mmap");
+
+    io_uring_buf_reg reg;
+    std::memset(&reg, 0, sizeof reg);
+    reg.ring_addr = reinterpret_cast<std::uint64_t>(buf_ring_);
+    reg.ring_entries = buffer_count;
+    reg.bgid = 0;
+
+    if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+      throw system_error("io_uring provided buffer ring");
+
+    for (unsigned id = 0; id < buffer_count; id++)
+      recycle(id);
+  }
+
+  ~ring()
+  {
+    if (buf_ring_ != MAP_FAILED)
+      munmap(buf_ring_, buf_ring_size_);
+    if (sqes_ != MAP_FAILED)
+      munmap(sqes_, sqes_size_);
+    if (sq_ptr_ != MAP_FAILED)
+      munmap(sq_ptr_, sq_size_);
+    if (fd_ >= 0)
+      close(fd_);
+  }
+
+  /// A zeroed submission queue entry, queued for the next submit.
+  io_uring_sqe* sqe()
+  {
+    // a slot can only be reused once the kernel has consumed its entry
+    while (sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == params_.sq_entries)
+      flush();
+
+    unsigned index = sq_local_tail_ & sq_mask_;
+    io_uring_sqe* entry = &sqes_[index];
+    std::memset(entry, 0, sizeof *entry);
+    sq_array_[index] = index;
+    sq_local_tail_++;
+    to_submit_++;
+    return entry;
+  }
+
+  /// Submit everything queued and wait for at least wait_for completions.
+  void submit(unsigned wait_for)
+  {
+    __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+
+    int submitted = syscall(__NR_io_uring_enter, fd_, to_submit_, wait_for,
+        wait_for > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+
+    metrics::add_io_uring_enter();
+
+    if (submitted < 0)
+    {
+      if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        throw system_error("io_uring_enter");
+      return;
+    }
+
+    to_submit_ -= submitted;
+  }
+
+  /// Hand the queued entries to the kernel because the queue is full.
+  /// Unlike submit() this can't give up: if the kernel takes none of them
+  /// (no memory, or the completion queue has overflowed) it throws.
+  void flush()
+  {
+    __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+
+    int submitted = syscall(__NR_io_uring_enter, fd_, to_submit_, 0, 0,
+        nullptr, 0);
+
+    metrics::add_io_uring_enter();
+
+    if (submitted < 0)
+    {
+      if (errno == EINTR)
+        return;
+      throw system_error("io_uring_enter with a full submission queue");
+    }
+
+    if (submitted == 0)
+      throw std::runtime_error("io_uring_enter took nothing from a full submission queue");
+
+    to_submit_ -= submitted;
+  }
+
+  /// Call f(user_data, res, flags) for every completion available.
+  template <typename F>
+  void drain(F f)
+  {
+    unsigned head = *cq_head_;
+
+    while (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE))
+    {
+      const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+      std::uint64_t user_data = cqe.user_data;
+      int res = cqe.res;
+      unsigned flags = cqe.flags;
+
+      head++;
+      __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+
+      f(user_data, res, flags);
+    }
+  }
+
+  const char* buffer(unsigned id) const
+  {
+    return &buffers_[id * buffer_size];
+  }
+
+  /// Hand a receive buffer back to the kernel.
+  void recycle(unsigned id)
+  {
+    // Index the ring as a plain array: in C++ the header's flexible array
+    // member sits after an empty struct and is shifted by 8 bytes.
+    io_uring_buf* bufs = reinterpret_cast<io_uring_buf*>(buf_ring_);
+    io_uring_buf* buf = &bufs[buf_tail_ & (buffer_count - 1)];
+    buf->addr = reinterpret_cast<std::uint64_t>(&buffers_[id * buffer_size]);
+    buf->len = buffer_size;
+    buf->bid = id;
+    buf_tail_++;
+    __atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+  }
+
+private:
+  int fd_;
+  io_uring_params params_;
+
+  void* sq_ptr_;
+  std::size_t sq_size_;
+  void* cq_ptr_;
+  std::size_t cq_size_;
+  io_uring_sqe* sqes_;
+  std::size_t sqes_size_;
+
+  unsigned* sq_head_;
+  unsigned* sq_tail_;
+  unsigned sq_mask_;
+  unsigned* sq_array_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned cq_mask_;
+  io_uring_cqe* cqes_;
+
+  io_uring_buf_ring* buf_ring_;
+  std::size_t buf_ring_size_;
+
+  unsigned sq_local_tail_;
+  unsigned to_submit_;
+  std::uint16_t buf_tail_;
+  std::vector<char> buffers_;
+};
+
+uring_server::uring_server(const std::string& address, const std::string& port,
+    std::shared_ptr<cidr::db>& cidr_db)
+  : ring_(new ring()),
+    request_handler_(cidr_db),
+    listen_fd_(-1),
+    wake_fd_(-1),
+    wake_value_(0),
+    stopping_(false)
+{
+  addrinfo hints;
+  std::memset(&hints, 0, sizeof hints);
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+
+  addrinfo* result = nullptr;
+  int e = getaddrinfo(address.c_str(), port.c_str(), &hints, &result);
+  if (e != 0)
+    throw std::runtime_error(std::string("resolve: ") + gai_strerror(e));
+
+  listen_fd_ = socket(result->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  int on = 1;
+
+  if (listen_fd_ < 0
+      || setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on) < 0
+      || bind(listen_fd_, result->ai_addr, result->ai_addrlen) < 0
+      || listen(listen_fd_, SOMAXCONN) < 0)
+  {
+    freeaddrinfo(result);
+    throw system_error("listen on " + address + ":" + port);
+  }
+
+  freeaddrinfo(result);
+
+  wake_fd_ = eventfd(0, EFD_CLOEXEC);
+  if (wake_fd_ < 0)
+    throw system_error("eventfd");
+}
+
+uring_server::~uring_server()
+{
+  // Tearing down the ring cancels everything still in flight.
+  ring_.reset();
+
+  for (connection* c : connections_)
+  {
+    close(c->fd);
+    delete c;
+  }
+
+  metrics::connection_closed(connections_.size());
+  connections_.clear();
+
+  if (wake_fd_ >= 0)
+    close(wake_fd_);
+  if (listen_fd_ >= 0)
+    close(listen_fd_);
+}
+
+void uring_server::run()
+{
+  start_accept();
+  start_wake();
+
+  while (!stopping_)
+  {
+    ring_->submit(1);
+    ring_->drain([this](std::uint64_t user_data, int res, unsigned flags)
+    {
+      handle_completion(user_data, res, flags);
+    });
+  }
+}
+
+void uring_server::stop()
+{
+  std::uint64_t one = 1;
+  if (write(wake_fd_, &one, sizeof one) < 0)
+    std::perror("uring_server::stop");
+}
+
+void uring_server::handle_completion(std::uint64_t user_data, int res,
+    unsigned flags)
+{
+  connection* c = reinterpret_cast<connection*>(user_data & ~op_mask);
+
+  switch (user_data & op_mask)
+  {
+  case op_accept:
+    if (res >= 0)
+    {
+      c = new connection(res);
+      connections_.insert(c);
+      metrics::connection_opened();
+      start_recv(c);
+      start_timer(c);
+    }
+    // the multishot accept ends on error; arm a new one
+    if (!(flags & IORING_CQE_F_MORE))
+      start_accept();
+    break;
+
+  case op_wake:
+    stopping_ = true;
+    break;
+
+  case op_recv:
+    handle_recv(c, res, flags);
+    break;
+
+  case op_send:
+    handle_write(c, res);
+    break;
+
+  case op_shutdown:
+    c->shutdown_pending = false;
+    maybe_release(c);
+    break;
+
+  case op_timeout:
+    handle_timer(c);
+    break;
+
+  case op_close:
+    connections_.erase(c);
+    metrics::connection_closed();
+    delete c;
+    break;
+  }
+}
+
+void uring_server::start_accept()
+{
+  io_uring_sqe* sqe = ring_->sqe();
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = listen_fd_;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_CLOEXEC;
+  sqe->user_data = op_accept;
+}
+
+void uring_server::start_wake()
+{
+  io_uring_sqe* sqe = ring_->sqe();
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = wake_fd_;
+  sqe->addr = reinterpret_cast<std::uint64_t>(&wake_value_);
+  sqe->len = sizeof wake_value_;
+  sqe->user_data = op_wake;
+}
+
+void uring_server::start_recv(connection* c)
+{
+  io_uring_sqe* sqe = ring_->sqe();
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = c->fd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = 0;
+  sqe->user_data = reinterpret_cast<std::uint64_t>(c) | op_recv;
+  c->recv_armed = true;
+}
+
+void uring_server::handle_recv(connection* c, int res, unsigned flags)
+{
+  if (!(flags & IORING_CQE_F_MORE))
+    c->recv_armed = false;
+
+  if (res > 0)
+  {
+    unsigned id = flags >> IORING_CQE_BUFFER_SHIFT;
+
+    metrics::add_bytes_in(res);
+
+    if (!c->closing)
+      c->input.append(ring_->buffer(id), res);
+
+    ring_->recycle(id);
+    process(c);
+
+    if (!c->recv_armed && !c->closing)
+      start_recv(c);
+  }
+  else if (res == -ENOBUFS)
+  {
+    // every buffer is in use; try again once some are recycled
+    if (!c->recv_armed && !c->closing)
+      start_recv(c);
+  }
+  else
+  {
+    // the peer is done sending (or the socket failed); a reply in flight
+    // still goes out
+    c->peer_closed = true;
+
+    if (!c->sending)
+      start_close(c);
+  }
+
+  maybe_release(c);
+}
+
+void uring_server::process(connection* c)
+{
+  while (!c->sending && !c->closing && c->input_begin < c->input.size())
+  {
+    boost::tribool result;
+    const char* next;
+    boost::tie(result, next) = c->parser.parse(c->req,
+        c->input.data() + c->input_begin, c->input.data() + c->input.size());
+    c->input_begin = next - c->input.data();
+
+    if (boost::indeterminate(result))
+      break;
+
+    c->request_deadline = clock_type::time_point::max();
+
+    if (result)
+    {
+      request_handler_.handle_request(c->req, c->rep);
+      c->keep_alive = wants_keep_alive(c->req) && !c->rep.stream;
+    }
+    else
+    {
+      reply::stock_reply(reply::bad_request, c->rep);
+      c->keep_alive = false;
+    }
+
+    if (c->keep_alive)
+      c->rep.headers.push_back(header{"Connection", "keep-alive"});
+
+    std::vector<boost::asio::const_buffer> buffers(c->rep.to_buffers());
+    c->iov.clear();
+    c->iov_next = 0;
+
+    for (const boost::asio::const_buffer& b : buffers)
+    {
+      iovec v;
+      v.iov_base = const_cast<void*>(b.data());
+      v.iov_len = b.size();
+      c->iov.push_back(v);
+    }
+
+    start_write(c);
+  }
+
+  if (c->input_begin == c->input.size())
+  {
+    c->input.clear();
+    c->input_begin = 0;
+  }
+}
+
+void uring_server::start_write(connection* c)
+{
+  c->msg.msg_iov = c->iov.data() + c->iov_next;
+  c->msg.msg_iovlen = c->iov.size() - c->iov_next;
+
+  io_uring_sqe* sqe = ring_->sqe();
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = c->fd;
+  sqe->addr = reinterpret_cast<std::uint64_t>(&c->msg);
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = reinterpret_cast<std::uint64_t>(c) | op_send;
+  c->sending = true;
+}
+
+void uring_server::handle_write(connection* c, int res)
+{
+  c->sending = false;
+
+  if (res < 0)
+  {
+    start_close(c);
+    maybe_release(c);
+    return;
+  }
+
+  metrics::add_bytes_out(res);
+
+  std::size_t sent = res;
+
+  while (sent > 0 && c->iov_next < c->iov.size())
+  {
+    iovec& v = c->iov[c->iov_next];
+
+    if (sent >= v.iov_len)
+    {
+      sent -= v.iov_len;
+      c->iov_next++;
+    }
+    else
+    {
+      v.iov_base = static_cast<char*>(v.iov_base) + sent;
+      v.iov_len -= sent;
+      sent = 0;
+    }
+  }
+
+  // an empty body, as a streamed reply starts with, leaves nothing to send
+  while (c->iov_next < c->iov.size() && c->iov[c->iov_next].iov_len == 0)
+    c->iov_next++;
+
+  if (c->iov_next < c->iov.size())
+  {
+    start_write(c);
+    return;
+  }
+
+  // a streamed body follows, each piece sent as soon as it is produced
+  while (c->rep.stream)
+  {
+    if (!c->rep.stream(c->rep.content))
+      c->rep.stream = nullptr;
+
+    if (!c->rep.content.empty())
+    {
+      iovec v;
+      v.iov_base = &c->rep.content[0];
+      v.iov_len = c->rep.content.size();
+      c->iov.assign(1, v);
+      c->iov_next = 0;
+      start_write(c);
+      return;
+    }
+  }
+
+  if (c->keep_alive && !c->peer_closed)
+  {
+    c->req.clear();
+    c->rep.clear();
+    c->parser.reset();
+    c->request_deadline = clock_type::now() + request_timeout;
+    process(c);
+  }
+  else
+  {
+    start_close(c);
+  }
+
+  maybe_release(c);
+}
+
+void uring_server::start_close(connection* c)
+{
+  if (c->closing)
+    return;
+
+  c->closing = true;
+
+  // Initiate graceful connection closure; this also ends the multishot recv.
+  io_uring_sqe* sqe = ring_->sqe();
+  sqe->opcode = IORING_OP_SHUTDOWN;
+  sqe->fd = c->fd;
+  sqe->len = SHUT_RDWR;
+  sqe->user_data = reinterpret_cast<std::uint64_t>(c) | op_shutdown;
+  c->shutdown_pending = true;
+
+  if (c->timer_armed)
+  {
+    sqe = ring_->sqe();
+    sqe->opcode = IORING_OP_TIMEOUT_REMOVE;
+    sqe->addr = reinterpret_cast<std::uint64_t>(c) | op_timeout;
+    sqe->user_data = op_ignore;
+  }
+}
+
+void uring_server::start_timer(connection* c)
+{
+  clock_type::time_point now = clock_type::now();
+  clock_type::duration wait = c->request_deadline - now < request_timeout
+    ? c->request_deadline - now : request_timeout;
+  std::chrono::nanoseconds ns(std::chrono::duration_cast<std::chrono::nanoseconds>(wait));
+
+  c->timeout.tv_sec = ns.count() / 1000000000;
+  c->timeout.tv_nsec = ns.count() % 1000000000;
+
+  io_uring_sqe* sqe = ring_->sqe();
+  sqe->opcode = IORING_OP_TIMEOUT;
+  sqe->addr = reinterpret_cast<std::uint64_t>(&c->timeout);
+  sqe->len = 1;
+  sqe->user_data = reinterpret_cast<std::uint64_t>(c) | op_timeout;
+  c->timer_armed = true;
+}
+
+void uring_server::handle_timer(connection* c)
+{
+  c->timer_armed = false;
+
+  if (!c->closing)
+  {
+    // the timer only checks the deadline, which moves with every request
+    if (c->request_deadline <= clock_type::now())
+      start_close(c);
+    else
+      start_timer(c);
+  }
+
+  maybe_release(c);
+}
+
+void uring_server::maybe_release(connection* c)
+{
+  if (!c->closing || c->recv_armed || c->sending || c->shutdown_pending
+      || c->timer_armed || c->close_submitted)
+    return;
+
+  io_uring_sqe* sqe = ring_->sqe();
+  sqe->opcode = IORING_OP_CLOSE;
+  sqe->fd = c->fd;
+  sqe->user_data = reinterpret_cast<std::uint64_t>(c) | op_close;
+  c->close_submitted = true;
+}
+
+} // namespace server
+} // namespace http
@@ -0,0 +1,269 @@
+#include <memory>
+#include <string>
+#include <vector>
+#include <zlib.h>
+#ifdef CIDRDB_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "gtest/gtest.h"
+#include "compressor.hpp"
+
+using http::server::compressor;
+namespace metrics = http::server::metrics;
+
+
+/**
+ * Decodes a compressed body as it arrives, the way a client would.
+ */
+class decoder
+{
+public:
+    explicit decoder(metrics::encoding coding)
+        : coding_(coding), zlib_(), zstd_(nullptr)
+    {
+#ifdef CIDRDB_HAVE_ZSTD
+        if (coding_ == metrics::encoding_zstd)
+        {
+            zstd_ = ZSTD_createDCtx();
+            return;
+        }
+#endif
+        inflateInit2(&zlib_, coding_ == metrics::encoding_gzip ? 15 + 16 : 15);
+    }
+
+    ~decoder()
+    {
+#ifdef CIDRDB_HAVE_ZSTD
+        if (coding_ == metrics::encoding_zstd)
+        {
+            ZSTD_freeDCtx(static_cast<ZSTD_DCtx*>(zstd_));
+            return;
+        }
+#endif
+        inflateEnd(&zlib_);
+    }
+
+    /** Everything the data received so far decodes to. */
+    const std::string& feed(const std::string &data)
+    {
+        char buffer[4096];
+
+#ifdef CIDRDB_HAVE_ZSTD
+        if (coding_ == metrics::encoding_zstd)
+        {
+            ZSTD_inBuffer in = { data.data(), data.size(), 0 };
+            ZSTD_outBuffer out;
+
+            do
+            {
+                out = { buffer, sizeof buffer, 0 };
+                size_t result = ZSTD_decompressStream(static_cast<ZSTD_DCtx*>(zstd_), &out, &in);
+                EXPECT_FALSE(ZSTD_isError(result));
+                if (ZSTD_isError(result))
+                    break;
+                plain_.append(buffer, out.pos);
+            }
+            while (in.pos < in.size || out.pos == out.size);
+
+            return plain_;
+        }
+#endif
+
+        zlib_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+        zlib_.avail_in = data.size();
+        int result;
+
+        do
+        {
+            zlib_.next_out = reinterpret_cast<Bytef*>(buffer);
+            zlib_.avail_out = sizeof buffer;
+            result = inflate(&zlib_, Z_SYNC_FLUSH);
+            EXPECT_TRUE(result == Z_OK || result == Z_STREAM_END || result == Z_BUF_ERROR)
+                << result;
+            plain_.append(buffer, sizeof buffer - zlib_.avail_out);
+            ended_ = result == Z_STREAM_END;
+        }
+        while (result == Z_OK && zlib_.avail_out == 0);
+
+        return plain_;
+    }
+
+    /** Whether the zlib stream was properly ended. */
+    bool ended() const { return coding_ == metrics::encoding_zstd || ended_; }
+
+private:
+    metrics::encoding coding_;
+    z_stream zlib_;
+    void *zstd_;
+    bool ended_ = false;
+    std::string plain_;
+};
+
+class CidrCompressorTest : public ::testing::Test
+{
+protected:
+    /** The coding a client gets when it accepts every one equally. */
+    static constexpr metrics::encoding preferred =
+#ifdef CIDRDB_HAVE_ZSTD
+        metrics::encoding_zstd;
+#else
+        metrics::encoding_gzip;
+#endif
+
+    std::vector<metrics::encoding> codings;
+
+    CidrCompressorTest()
+        : codings({ metrics::encoding_gzip, metrics::encoding_deflate })
+    {
+#ifdef CIDRDB_HAVE_ZSTD
+        codings.push_back(metrics::encoding_zstd);
+#endif
+    }
+
+    virtual ~CidrCompressorTest() { }
+
+    /** The coding negotiated for an Accept-Encoding, -1 for identity. */
+    static int negotiated(const std::string &accept_encoding)
+    {
+        std::unique_ptr<compressor> chosen(compressor::negotiate(accept_encoding, 6));
+        return chosen ? chosen->coding() : -1;
+    }
+
+    /** Lookup-result-like text, a line per address. */
+    static std::string line(size_t i)
+    {
+        return "{\"ip\":\"10.1." + std::to_string(i % 256) + "." + std::to_string(i % 199)
+            + "\",\"valid\":true,\"cidrs\":[\"10.0.0.0/8\"]}\n";
+    }
+};
+
+TEST_F(CidrCompressorTest, MethodNegotiateSingle)
+{
+    EXPECT_EQ(negotiated("gzip"), metrics::encoding_gzip);
+    EXPECT_EQ(negotiated("deflate"), metrics::encoding_deflate);
+    EXPECT_EQ(negotiated(" GZip "), metrics::encoding_gzip);
+    EXPECT_EQ(negotiated("gzip, deflate"), metrics::encoding_gzip);
+    EXPECT_EQ(negotiated("deflate, gzip"), metrics::encoding_gzip);
+}
+
+TEST_F(CidrCompressorTest, MethodNegotiateXGzip)
+{
+    EXPECT_EQ(negotiated("x-gzip"), metrics::encoding_gzip);
+    EXPECT_EQ(negotiated("X-GZIP;q=0.5, deflate;q=0.4"), metrics::encoding_gzip);
+}
+
+TEST_F(CidrCompressorTest, MethodNegotiateQValues)
+{
+    EXPECT_EQ(negotiated("gzip;q=0.5, deflate;q=0.8"), metrics::encoding_deflate);
+    EXPECT_EQ(negotiated("deflate;Q=0.1, gzip; q=0.2"), metrics::encoding_gzip);
+    EXPECT_EQ(negotiated("gzip;q=1.0, deflate;q=1"), metrics::encoding_gzip);
+    EXPECT_EQ(negotiated("deflate;level=1;q=0.9, gzip;q=0.3"), metrics::encoding_deflate);
+}
+
+TEST_F(CidrCompressorTest, MethodNegotiateZeroQ)
+{
+    // q=0 means "not acceptable", even next to codings the client does take
+    EXPECT_EQ(negotiated("gzip;q=0"), -1);
+    EXPECT_EQ(negotiated("gzip;q=0, deflate"), metrics::encoding_deflate);
+    EXPECT_EQ(negotiated("gzip;q=0, deflate;q=0.000"), -1);
+}
+
+TEST_F(CidrCompressorTest, MethodNegotiateWildcard)
+{
+    EXPECT_EQ(negotiated("*"), preferred);
+    EXPECT_EQ(negotiated("*;q=0.5, deflate"), metrics::encoding_deflate);
+    EXPECT_EQ(negotiated("deflate;q=0.5, *;q=0.9"), preferred);
+    EXPECT_EQ(negotiated("*;q=0"), -1);
+
+    // a listed coding keeps its own q-value; the wildcard covers the rest
+    EXPECT_EQ(negotiated("*, gzip;q=0, zstd;q=0"), metrics::encoding_deflate);
+}
+
+TEST_F(CidrCompressorTest, MethodNegotiateIdentityOnly)
+{
+    EXPECT_EQ(negotiated(""), -1);
+    EXPECT_EQ(negotiated("identity"), -1);
+    EXPECT_EQ(negotiated("identity, br"), -1);
+    EXPECT_EQ(negotiated("identity;q=1, *;q=0"), -1);
+}
+
+TEST_F(CidrCompressorTest, MethodFinishRoundTrip)
+{
+    for (metrics::encoding coding : codings)
+    {
+        compressor c(coding, 6);
+        std::string plain, pending;
+
+        // fed as request_handler does: consume() once a chunk piles up
+        for (size_t i = 0; i < 5000; i++)
+        {
+            plain += line(i);
+            pending += line(i);
+            c.consume(pending);
+        }
+
+        ASSERT_GT(plain.size(), 2 * compressor::chunk_size);
+        ASSERT_TRUE(c.finish(pending)) << compressor::name(coding);
+        EXPECT_LT(pending.size(), plain.size() / 4);
+
+        decoder d(coding);
+        EXPECT_EQ(d.feed(pending), plain) << compressor::name(coding);
+        EXPECT_TRUE(d.ended());
+    }
+}
+
+TEST_F(CidrCompressorTest, MethodFinishSmallReply)
+{
+    for (metrics::encoding coding : codings)
+    {
+        compressor c(coding, 6);
+        std::string content(line(1));
+
+        EXPECT_FALSE(c.finish(content));
+        EXPECT_EQ(content, line(1));
+    }
+}
+
+TEST_F(CidrCompressorTest, MethodSyncRoundTrip)
+{
+    for (metrics::encoding coding : codings)
+    {
+        compressor c(coding, 6);
+        decoder d(coding);
+        std::string plain;
+
+        // every piece decodes as soon as it arrives, before the stream ends
+        for (size_t piece = 0; piece < 20; piece++)
+        {
+            std::string text;
+            for (size_t i = 0; i < 300; i++)
+                text += line(piece * 300 + i);
+            plain += text;
+
+            bool last = piece == 19;
+            c.sync(text, last);
+            EXPECT_EQ(d.feed(text), plain) << compressor::name(coding) << " " << piece;
+        }
+
+        EXPECT_TRUE(d.ended());
+    }
+}
+
+TEST_F(CidrCompressorTest, MethodSyncEmptyPieces)
+{
+    for (metrics::encoding coding : codings)
+    {
+        compressor c(coding, 6);
+        decoder d(coding);
+
+        std::string first(line(1));
+        c.sync(first, false);
+        EXPECT_EQ(d.feed(first), line(1));
+
+        // a stream that has nothing left still ends properly
+        std::string empty;
+        c.sync(empty, true);
+        EXPECT_EQ(d.feed(empty), line(1));
+        EXPECT_TRUE(d.ended());
+    }
+}
@@ -76,6 +76,269 @@ TEST_F(CidrDbTest, MethodPutLookup)
     EXPECT_EQ(results[0], "85.143.160.0/21");
 }
 
+TEST_F(CidrDbTest, MethodPutWithin)
+{
+    cidr::db db(dbfilename);
+    db.put("10.0.0.0/8");
+    db.put("10.1.0.0/16");
+    db.put("10.1.2.0/24");
+    db.put("10.0.0.0/24");
+    db.put("10.255.255.255/32");
+    db.put("11.0.0.0/24");
+    db.put("9.255.255.0/24");
+    std::vector<std::string> results;
+    db.within("10.1.0.0/16", results);
+    ASSERT_EQ(results.size(), 2U);
+    EXPECT_EQ(results[0], "10.1.0.0/16");
+    EXPECT_EQ(results[1], "10.1.2.0/24");
+    results.clear();
+    db.within("10.0.0.0/8", results);
+    ASSERT_EQ(results.size(), 5U);
+    EXPECT_EQ(results[0], "10.0.0.0/8");
+    EXPECT_EQ(results[1], "10.0.0.0/24");
+    EXPECT_EQ(results[2], "10.1.0.0/16");
+    EXPECT_EQ(results[3], "10.1.2.0/24");
+    EXPECT_EQ(results[4], "10.255.255.255/32");
+    results.clear();
+    db.within("12.0.0.0/8", results);
+    EXPECT_TRUE(results.empty());
+}
+
+TEST_F(CidrDbTest, MethodPutCovering)
+{
+    cidr::db db(dbfilename);
+    db.put("10.0.0.0/8");
+    db.put("10.1.0.0/16");
+    db.put("10.1.2.0/24");
+    db.put("10.2.0.0/16");
+    std::vector<std::string> results;
+    db.covering("10.1.2.128/25", results);
+    ASSERT_EQ(results.size(), 3U);
+    EXPECT_EQ(results[0], "10.0.0.0/8");
+    EXPECT_EQ(results[1], "10.1.0.0/16");
+    EXPECT_EQ(results[2], "10.1.2.0/24");
+    results.clear();
+    db.covering("10.1.0.0/16", results);
+    ASSERT_EQ(results.size(), 2U);
+    EXPECT_EQ(results[1], "10.1.0.0/16");
+}
+
+TEST_F(CidrDbTest, MethodPutOverlaps)
+{
+    cidr::db db(dbfilename);
+    db.put("10.0.0.0/8");
+    db.put("10.1.0.0/16");
+    db.put("10.1.2.0/24");
+    db.put("10.2.0.0/16");
+    std::vector<std::string> covering;
+    std::vector<std::string> covered;
+    db.overlaps("10.1.0.0/16", covering, covered);
+    ASSERT_EQ(covering.size(), 2U);
+    EXPECT_EQ(covering[0], "10.0.0.0/8");
+    EXPECT_EQ(covering[1], "10.1.0.0/16");
+    ASSERT_EQ(covered.size(), 2U);
+    EXPECT_EQ(covered[0], "10.1.0.0/16");
+    EXPECT_EQ(covered[1], "10.1.2.0/24");
+    std::vector<std::string> covered_by;
+    db.covered_by("10.1.0.0/16", covered_by);
+    EXPECT_EQ(covered_by, covered);
+}
+
+TEST_F(CidrDbTest, MethodPutDelLookup)
+{
+    cidr::db db(dbfilename);
+    db.put("85.143.160.0/21");
+    db.put("85.143.0.0/16");
+    db.del("85.143.160.0/21");
+    std::vector<std::string> results;
+    db.lookup("85.143.160.10", results);
+    ASSERT_EQ(results.size(), 1U);
+    EXPECT_EQ(results[0], "85.143.0.0/16");
+}
+
+TEST_F(CidrDbTest, MethodSnapshotRestore)
+{
+    cidr::db db(dbfilename);
+    db.put("85.143.160.0/21");
+    db.put("192.0.2.1/32");
+    db.put("10.0.0.0/8");
+    std::string image;
+    db.snapshot(image);
+    cidr::db db2;
+    db2.put("198.51.100.0/24");
+    EXPECT_EQ(db2.restore(image), 3U);
+    EXPECT_TRUE(db2.has("85.143.160.0/21"));
+    EXPECT_TRUE(db2.has("192.0.2.1/32"));
+    EXPECT_TRUE(db2.has("10.0.0.0/8"));
+    EXPECT_FALSE(db2.has("198.51.100.0/24"));
+    std::vector<std::string> results;
+    db2.lookup("10.143.160.10", results);
+    ASSERT_EQ(results.size(), 1U);
+    EXPECT_EQ(results[0], "10.0.0.0/8");
+}
+
+TEST_F(CidrDbTest, MethodRestoreMalformed)
+{
+    cidr::db db;
+    db.put("85.143.160.0/21");
+    std::string image;
+    db.snapshot(image);
+    cidr::db db2;
+    db2.put("198.51.100.0/24");
+    EXPECT_THROW(db2.restore(image.substr(0, image.size() - 2)), std::runtime_error);
+    EXPECT_THROW(db2.restore("not a snapshot"), std::runtime_error);
+    EXPECT_TRUE(db2.has("198.51.100.0/24"));
+    EXPECT_FALSE(db2.has("85.143.160.0/21"));
+}
+
+TEST_F(CidrDbTest, MethodCopyEachInPieces)
+{
+    cidr::db db;
+    db.put("85.143.160.0/21");
+    db.put("192.0.2.1/32");
+    db.put("192.0.2.2/32");
+    db.put("10.0.0.0/8");
+    db.put("10.1.0.0/16");
+    std::vector<std::string> expected;
+    db.each([&expected](const std::string &cidr) { expected.push_back(cidr); });
+
+    cidr::db_copy copy(db);
+    EXPECT_EQ(copy.size(), 5U);
+
+    // later changes to the database don't reach the copy
+    db.del("10.0.0.0/8");
+    db.put("198.51.100.0/24");
+
+    std::vector<std::string> copied;
+    auto collect = [&copied](const std::string &cidr) { copied.push_back(cidr); };
+    EXPECT_TRUE(copy.each(collect, 2));
+    EXPECT_EQ(copied.size(), 2U);
+    EXPECT_TRUE(copy.each(collect, 2));
+    EXPECT_FALSE(copy.each(collect, 2));
+    EXPECT_FALSE(copy.each(collect, 2));
+    EXPECT_EQ(copied, expected);
+}
+
+TEST_F(CidrDbTest, MethodCopySnapshotInPieces)
+{
+    cidr::db db;
+    for (int i = 0; i < 100; i++)
+        db.put("10." + std::to_string(i) + ".0.0/16");
+    db.put("85.143.160.0/21");
+    std::string image;
+    db.snapshot(image);
+
+    cidr::db_copy copy(db);
+    db.put("198.51.100.0/24");
+
+    std::string pieces;
+    size_t calls = 1;
+    while (copy.snapshot(pieces, 7))
+        calls++;
+    EXPECT_EQ(calls, 15U);
+    EXPECT_FALSE(copy.snapshot(pieces, 7));
+    EXPECT_EQ(pieces, image);
+
+    cidr::db db2;
+    EXPECT_EQ(db2.restore(pieces), 101U);
+    EXPECT_FALSE(db2.has("198.51.100.0/24"));
+}
+
+TEST_F(CidrDbTest, MethodPrefilter)
+{
+    cidr::db plain;
+    cidr::db filtered;
+    filtered.prefilter(true);
+    EXPECT_TRUE(filtered.prefiltered());
+
+    // enough puts to outgrow the first filters, then enough dels to compact
+    for (uint32_t i = 1; i <= 3000; i++)
+    {
+        struct in_addr in;
+        in.s_addr = htonl(i << 12);
+        std::string cidr(std::string(inet_ntoa(in)) + "/" + std::to_string(20 + i % 5));
+        plain.put(cidr);
+        filtered.put(cidr);
+        if (i % 3 == 0)
+        {
+            plain.del(cidr);
+            filtered.del(cidr);
+        }
+    }
+
+    for (uint32_t i = 0; i < 20000; i++)
+    {
+        struct in_addr in;
+        in.s_addr = htonl(i * 2654435761u);
+        std::vector<std::string> expected, actual;
+        plain.lookup(inet_ntoa(in), expected);
+        filtered.lookup(inet_ntoa(in), actual);
+        EXPECT_EQ(expected, actual);
+    }
+
+    EXPECT_TRUE(filtered.has("0.0.16.0/21"));
+    EXPECT_FALSE(filtered.has("0.0.48.0/23"));
+
+    // swap exchanges contents; the filters follow each side's setting
+    cidr::db other;
+    other.put("10.0.0.0/8");
+    filtered.swap(other);
+    EXPECT_TRUE(filtered.prefiltered());
+    EXPECT_FALSE(other.prefiltered());
+    EXPECT_TRUE(filtered.has("10.0.0.0/8"));
+    EXPECT_TRUE(other.has("0.0.16.0/21"));
+    std::vector<std::string> results;
+    filtered.lookup("10.1.2.3", results);
+    ASSERT_EQ(results.size(), 1U);
+    EXPECT_EQ(results[0], "10.0.0.0/8");
+}
+
+TEST_F(CidrDbTest, MethodLookupLengths)
+{
+    cidr::db db;
+    db.put("10.0.0.0/8");
+    db.put("10.1.0.0/16");
+    db.put("10.1.2.0/24");
+    db.put("192.168.0.0/16");
+
+    uint8_t lengths[32];
+    ASSERT_EQ(db.lookup(inet_network("10.1.2.3"), lengths), 3U);
+    EXPECT_EQ(lengths[0], 24);
+    EXPECT_EQ(lengths[1], 16);
+    EXPECT_EQ(lengths[2], 8);
+    EXPECT_EQ(db.lookup(inet_network("10.2.0.1"), lengths), 1U);
+    EXPECT_EQ(db.lookup(inet_network("172.16.0.1"), lengths), 0U);
+}
+
+TEST_F(CidrDbTest, MethodWithinCoveringBits)
+{
+    cidr::db db;
+    db.put("10.0.0.0/8");
+    db.put("10.1.0.0/16");
+    db.put("10.1.2.0/24");
+    db.put("11.0.0.0/24");
+
+    std::vector<std::pair<in_addr_t, uint8_t>> results;
+    auto collect = [&results](in_addr_t network, uint8_t length)
+    {
+        results.emplace_back(network, length);
+    };
+
+    db.within(inet_network("10.1.0.0"), 16, collect);
+    ASSERT_EQ(results.size(), 2U);
+    EXPECT_EQ(results[0].first, inet_network("10.1.0.0"));
+    EXPECT_EQ(results[0].second, 16);
+    EXPECT_EQ(results[1].first, inet_network("10.1.2.0"));
+    EXPECT_EQ(results[1].second, 24);
+    results.clear();
+    db.covering(inet_network("10.1.2.3"), 32, collect);
+    ASSERT_EQ(results.size(), 3U);
+    EXPECT_EQ(results[0].first, inet_network("10.0.0.0"));
+    EXPECT_EQ(results[0].second, 8);
+    EXPECT_EQ(results[2].first, inet_network("10.1.2.0"));
+    EXPECT_EQ(results[2].second, 24);
+}
+
 
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,82 @@
+#include <random>
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+#include "gtest/gtest.h"
+#include "cidr_db.hpp"
+#include "frozen_cidrs.hpp"
+
+namespace ba = boost::algorithm;
+namespace fs = boost::filesystem;
+
+
+// CIDR_EMIT_DB is the database the frozen_cidrs sources were generated from
+class CidrEmitTest : public ::testing::Test
+{
+protected:
+    cidr::db db;
+
+    CidrEmitTest()
+        : db(fs::path(CIDR_EMIT_DB))
+    {
+    }
+
+    std::vector<uint8_t> expected(in_addr_t addr) const
+    {
+        struct in_addr in;
+        in.s_addr = htonl(addr);
+
+        std::vector<std::string> results;
+        db.lookup(inet_ntoa(in), results);
+
+        std::vector<uint8_t> lengths;
+        for (auto &cidr : results)
+            lengths.push_back(std::stoi(cidr.substr(cidr.find('/') + 1)));
+
+        return lengths;
+    }
+
+    std::vector<uint8_t> actual(in_addr_t addr) const
+    {
+        uint8_t out[frozen_cidrs::length_count + 1];
+        size_t n = frozen_cidrs::lookup(addr, out);
+
+        EXPECT_EQ(n > 0, frozen_cidrs::contains(addr));
+        return std::vector<uint8_t>(out, out + n);
+    }
+};
+
+TEST_F(CidrEmitTest, MethodHasEveryCidr)
+{
+    size_t count = 0;
+
+    db.each([&count](const std::string &cidr)
+    {
+        std::vector<std::string> parts;
+        ba::split(parts, cidr, boost::is_any_of("/"));
+
+        EXPECT_TRUE(frozen_cidrs::has(inet_network(parts[0].c_str()), std::stoi(parts[1]))) << cidr;
+        count++;
+    });
+
+    EXPECT_EQ(frozen_cidrs::cidr_count, count);
+    EXPECT_FALSE(frozen_cidrs::has(0, 0));
+}
+
+TEST_F(CidrEmitTest, MethodLookupMatchesDb)
+{
+    db.each([this](const std::string &cidr)
+    {
+        in_addr_t addr = inet_network(cidr.substr(0, cidr.find('/')).c_str());
+
+        EXPECT_EQ(expected(addr), actual(addr)) << cidr;
+        EXPECT_EQ(expected(addr - 1), actual(addr - 1)) << cidr;
+    });
+
+    std::mt19937 rng(1);
+
+    for (size_t i = 0; i < 100000; i++)
+    {
+        in_addr_t addr = rng();
+        EXPECT_EQ(expected(addr), actual(addr)) << addr;
+    }
+}
@@ -0,0 +1,102 @@
+#include <random>
+#include <boost/filesystem.hpp>
+#include "gtest/gtest.h"
+#include "cidr_db.hpp"
+#include "cidr_frozen_db.hpp"
+
+namespace fs = boost::filesystem;
+
+
+class CidrFrozenDbTest : public ::testing::Test
+{
+protected:
+    fs::path dbfilename;
+
+    CidrFrozenDbTest()
+    {
+        dbfilename = fs::path("/tmp/cidr_frozen.db");
+    }
+
+    virtual ~CidrFrozenDbTest() { }
+
+    virtual void TearDown()
+    {
+        if (fs::exists(dbfilename))
+        {
+            fs::remove(dbfilename);
+        }
+    }
+
+    static std::string random_cidr(std::mt19937 &rng)
+    {
+        size_t length = 8 + rng() % 25;
+        struct in_addr in;
+        // the file format has no record for a network of all zero bits
+        do
+            in.s_addr = htonl(rng() & ~(length == 32 ? 0 : 0xffffffffu >> length));
+        while (in.s_addr == 0);
+        return std::string(inet_ntoa(in)) + "/" + std::to_string(length);
+    }
+};
+
+TEST_F(CidrFrozenDbTest, MethodPutLookup)
+{
+    cidr::db db;
+    db.put("10.0.0.0/7");
+    db.put("11.0.0.0/8");
+    db.put("11.1.0.0/16");
+    cidr::frozen_db frozen(db);
+    EXPECT_EQ(frozen.size(), 3U);
+    std::vector<std::string> results;
+    frozen.lookup("11.1.2.3", results);
+    ASSERT_EQ(results.size(), 3U);
+    EXPECT_EQ(results[0], "11.1.0.0/16");
+    EXPECT_EQ(results[1], "11.0.0.0/8");
+    EXPECT_EQ(results[2], "10.0.0.0/7");
+    results.clear();
+    frozen.lookup("12.1.2.3", results);
+    EXPECT_TRUE(results.empty());
+    EXPECT_TRUE(frozen.has("11.1.0.0/16"));
+    EXPECT_FALSE(frozen.has("11.2.0.0/16"));
+    EXPECT_FALSE(frozen.has("11.1.0.0/24"));
+}
+
+TEST_F(CidrFrozenDbTest, MethodEmpty)
+{
+    cidr::db db;
+    cidr::frozen_db frozen(db);
+    std::vector<std::string> results;
+    frozen.lookup("11.1.2.3", results);
+    EXPECT_TRUE(results.empty());
+    EXPECT_FALSE(frozen.has("11.1.0.0/16"));
+    EXPECT_EQ(frozen.bytes(), 0U);
+}
+
+TEST_F(CidrFrozenDbTest, MethodCommitReadMatchesDb)
+{
+    std::mt19937 rng(7);
+    cidr::db db(dbfilename);
+    for (size_t i = 0; i < 20000; i++)
+        db.put(random_cidr(rng));
+    db.commit();
+
+    cidr::frozen_db frozen(dbfilename);
+    size_t count = 0;
+    db.each([&frozen, &count](const std::string &cidr)
+    {
+        EXPECT_TRUE(frozen.has(cidr)) << cidr;
+        count++;
+    });
+    EXPECT_EQ(frozen.size(), count);
+    EXPECT_LT(frozen.bytes(), count * 6);
+
+    for (size_t i = 0; i < 20000; i++)
+    {
+        struct in_addr in;
+        in.s_addr = rng();
+        std::vector<std::string> expected, actual;
+        db.lookup(inet_ntoa(in), expected);
+        frozen.lookup(inet_ntoa(in), actual);
+        EXPECT_EQ(expected, actual);
+    }
+}
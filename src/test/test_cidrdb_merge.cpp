@@ -0,0 +1,194 @@
+#include <fstream>
+#include <sstream>
+#include <boost/filesystem.hpp>
+#include "gtest/gtest.h"
+#include "cidr_db.hpp"
+#include "cidr_merge.hpp"
+
+namespace fs = boost::filesystem;
+
+
+class CidrMergeTest : public ::testing::Test
+{
+protected:
+    fs::path a_filename;
+    fs::path b_filename;
+    fs::path out_filename;
+
+    CidrMergeTest()
+    {
+        a_filename = fs::path("/tmp/cidr_merge_a.db");
+        b_filename = fs::path("/tmp/cidr_merge_b.db");
+        out_filename = fs::path("/tmp/cidr_merge_out.db");
+    }
+
+    virtual ~CidrMergeTest() { }
+
+    virtual void SetUp()
+    {
+        cidr::db a(a_filename);
+        a.put("10.0.0.0/8");
+        a.put("85.143.160.0/21");
+        a.put("192.0.2.1/32");
+        a.commit();
+
+        cidr::db b(b_filename);
+        b.put("85.143.160.0/21");
+        b.put("192.0.2.1/32");
+        b.put("198.51.100.0/24");
+        b.commit();
+    }
+
+    virtual void TearDown()
+    {
+        for (auto &filename : { a_filename, b_filename, out_filename })
+        {
+            if (fs::exists(filename))
+            {
+                fs::remove(filename);
+            }
+        }
+    }
+
+    std::string stream(cidr::merge::operation op)
+    {
+        std::ostringstream out;
+        cidr::merge::to_stream(a_filename, b_filename, op, out);
+        return out.str();
+    }
+};
+
+TEST_F(CidrMergeTest, MethodDifferenceToDb)
+{
+    EXPECT_EQ(cidr::merge::to_db(a_filename, b_filename,
+                                 cidr::merge::difference, out_filename), 1U);
+    cidr::db db(out_filename);
+    EXPECT_TRUE(db.has("10.0.0.0/8"));
+    EXPECT_FALSE(db.has("85.143.160.0/21"));
+    EXPECT_FALSE(db.has("192.0.2.1/32"));
+    EXPECT_FALSE(db.has("198.51.100.0/24"));
+}
+
+TEST_F(CidrMergeTest, MethodUnionToDb)
+{
+    EXPECT_EQ(cidr::merge::to_db(a_filename, b_filename,
+                                 cidr::merge::union_of, out_filename), 4U);
+    cidr::db db(out_filename);
+    EXPECT_TRUE(db.has("10.0.0.0/8"));
+    EXPECT_TRUE(db.has("85.143.160.0/21"));
+    EXPECT_TRUE(db.has("192.0.2.1/32"));
+    EXPECT_TRUE(db.has("198.51.100.0/24"));
+}
+
+TEST_F(CidrMergeTest, MethodIntersectionToDb)
+{
+    EXPECT_EQ(cidr::merge::to_db(a_filename, b_filename,
+                                 cidr::merge::intersection, out_filename), 2U);
+    cidr::db db(out_filename);
+    EXPECT_FALSE(db.has("10.0.0.0/8"));
+    EXPECT_TRUE(db.has("85.143.160.0/21"));
+    EXPECT_TRUE(db.has("192.0.2.1/32"));
+    EXPECT_FALSE(db.has("198.51.100.0/24"));
+}
+
+TEST_F(CidrMergeTest, MethodStreams)
+{
+    EXPECT_EQ(stream(cidr::merge::difference), "+198.51.100.0/24\n-10.0.0.0/8\n");
+    EXPECT_EQ(stream(cidr::merge::union_of), "+198.51.100.0/24\n");
+    EXPECT_EQ(stream(cidr::merge::intersection), "-10.0.0.0/8\n");
+}
+
+TEST_F(CidrMergeTest, MethodBuildIsMergeable)
+{
+    fs::path list_filename("/tmp/cidr_merge.list");
+    {
+        std::ofstream list(list_filename.c_str());
+        list << "198.51.100.0/24\n10.0.0.0/8\n198.51.100.0/24\n192.0.2.1/32\n";
+    }
+    cidr::db::build(list_filename, out_filename);
+    fs::remove(list_filename);
+
+    std::ostringstream out;
+    cidr::merge::to_stream(out_filename, b_filename, cidr::merge::difference, out);
+    EXPECT_EQ(out.str(), "+85.143.160.0/21\n-10.0.0.0/8\n");
+}
+
+TEST_F(CidrMergeTest, MethodUnsortedThrows)
+{
+    {
+        std::ofstream outfile(out_filename.c_str(), std::ios::out|std::ios::binary);
+        cidr::merge::record records[] = { { 8, 10 }, { 0, 1 } };
+        for (auto &r : records)
+        {
+            outfile.write((char*)&r.offset, sizeof r.offset);
+            outfile.write((char*)&r.shifted_bits, sizeof r.shifted_bits);
+        }
+    }
+    EXPECT_THROW(cidr::merge::to_db(out_filename, b_filename,
+                                    cidr::merge::union_of, out_filename.string() + ".2"),
+                 std::runtime_error);
+    fs::remove(out_filename.string() + ".2");
+}
+
+TEST_F(CidrMergeTest, MethodDelta)
+{
+    fs::path old_list("/tmp/cidr_merge_old.list");
+    fs::path new_list("/tmp/cidr_merge_new.list");
+    {
+        std::ofstream list(old_list.c_str());
+        list << "10.0.0.0/8\n85.143.160.0/21\n192.0.2.1/32\n";
+    }
+    {
+        std::ofstream list(new_list.c_str());
+        list << "192.0.2.1/32\n198.51.100.0/24\n85.143.160.0/21\n198.51.100.0/24\n";
+    }
+    std::ostringstream out;
+    EXPECT_EQ(cidr::merge::delta(old_list, new_list, out), 2U);
+    EXPECT_EQ(out.str(), "+198.51.100.0/24\n-10.0.0.0/8\n");
+    fs::remove(old_list);
+    fs::remove(new_list);
+}
+
+TEST_F(CidrMergeTest, MethodApplyDelta)
+{
+    fs::path old_list("/tmp/cidr_merge_old.list");
+    fs::path new_list("/tmp/cidr_merge_new.list");
+    {
+        std::ofstream list(old_list.c_str());
+        list << "10.0.0.0/8\n85.143.160.0/21\n";
+    }
+    {
+        std::ofstream list(new_list.c_str());
+        list << "85.143.160.0/21\n198.51.100.0/24\n11.0.0.0/8\n";
+    }
+    EXPECT_EQ(cidr::merge::apply_delta(old_list, new_list, a_filename), 3U);
+
+    cidr::db db(a_filename);
+    EXPECT_FALSE(db.has("10.0.0.0/8"));
+    EXPECT_TRUE(db.has("11.0.0.0/8"));
+    EXPECT_TRUE(db.has("85.143.160.0/21"));
+    EXPECT_TRUE(db.has("192.0.2.1/32"));
+    EXPECT_TRUE(db.has("198.51.100.0/24"));
+
+    EXPECT_THROW(cidr::merge::apply_delta(old_list, new_list, "/tmp/cidr_merge_missing.db"),
+                 std::runtime_error);
+    EXPECT_FALSE(fs::exists("/tmp/cidr_merge_missing.db"));
+    fs::remove(old_list);
+    fs::remove(new_list);
+}
+
+TEST_F(CidrMergeTest, MethodParseMutations)
+{
+    std::vector<cidr::merge::mutation> mutations;
+    std::istringstream good("+198.51.100.0/24\r\n\n-10.0.0.0/8\n");
+    cidr::merge::parse_mutations(good, mutations);
+    ASSERT_EQ(mutations.size(), 2U);
+    EXPECT_TRUE(mutations[0].add);
+    EXPECT_EQ(mutations[0].cidr, "198.51.100.0/24");
+    EXPECT_FALSE(mutations[1].add);
+    EXPECT_EQ(mutations[1].cidr, "10.0.0.0/8");
+
+    std::istringstream bad("+198.51.100.0/24\n10.0.0.0/8\n");
+    EXPECT_THROW(cidr::merge::parse_mutations(bad, mutations), std::invalid_argument);
+    EXPECT_EQ(mutations.size(), 2U);
+}
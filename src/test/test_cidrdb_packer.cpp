@@ -0,0 +1,141 @@
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <string>
+#include "gtest/gtest.h"
+#include "packer.hpp"
+
+using http::server::packer;
+
+
+class CidrPackerTest : public ::testing::Test
+{
+protected:
+    virtual ~CidrPackerTest() { }
+
+    /** What the calls made on a packer of the given format append. */
+    static std::string packed(packer::format f, const std::function<void (packer&)> &calls)
+    {
+        std::string out;
+        packer pack(f, out);
+        calls(pack);
+        return out;
+    }
+
+    static std::string bytes(std::initializer_list<int> values)
+    {
+        std::string out;
+        for (int value : values)
+            out.push_back(static_cast<char>(value));
+        return out;
+    }
+
+    static std::string uint(packer::format f, std::uint64_t value)
+    {
+        return packed(f, [value](packer &pack) { pack.uint(value); });
+    }
+
+    static std::string map(packer::format f, std::size_t size)
+    {
+        return packed(f, [size](packer &pack) { pack.map(size); });
+    }
+
+    static std::string array(packer::format f, std::size_t size)
+    {
+        return packed(f, [size](packer &pack) { pack.array(size); });
+    }
+
+    /** The head of a string of the given length, without the string. */
+    static std::string str_head(packer::format f, std::size_t size)
+    {
+        std::string value(size, 'x');
+        std::string out(packed(f, [&value](packer &pack) { pack.str(value); }));
+        EXPECT_EQ(out.substr(out.size() - size), value);
+        return out.substr(0, out.size() - size);
+    }
+};
+
+TEST_F(CidrPackerTest, MethodMsgpackMapBoundaries)
+{
+    EXPECT_EQ(map(packer::msgpack, 0), bytes({ 0x80 }));
+    EXPECT_EQ(map(packer::msgpack, 15), bytes({ 0x8f }));
+    EXPECT_EQ(map(packer::msgpack, 16), bytes({ 0xde, 0x00, 0x10 }));
+    EXPECT_EQ(map(packer::msgpack, 0xffff), bytes({ 0xde, 0xff, 0xff }));
+    EXPECT_EQ(map(packer::msgpack, 0x10000), bytes({ 0xdf, 0x00, 0x01, 0x00, 0x00 }));
+}
+
+TEST_F(CidrPackerTest, MethodMsgpackArrayBoundaries)
+{
+    EXPECT_EQ(array(packer::msgpack, 0), bytes({ 0x90 }));
+    EXPECT_EQ(array(packer::msgpack, 15), bytes({ 0x9f }));
+    EXPECT_EQ(array(packer::msgpack, 16), bytes({ 0xdc, 0x00, 0x10 }));
+    EXPECT_EQ(array(packer::msgpack, 0xffff), bytes({ 0xdc, 0xff, 0xff }));
+    EXPECT_EQ(array(packer::msgpack, 0x10000), bytes({ 0xdd, 0x00, 0x01, 0x00, 0x00 }));
+}
+
+TEST_F(CidrPackerTest, MethodMsgpackStrBoundaries)
+{
+    EXPECT_EQ(str_head(packer::msgpack, 0), bytes({ 0xa0 }));
+    EXPECT_EQ(str_head(packer::msgpack, 31), bytes({ 0xbf }));
+    EXPECT_EQ(str_head(packer::msgpack, 32), bytes({ 0xd9, 0x20 }));
+    EXPECT_EQ(str_head(packer::msgpack, 0xff), bytes({ 0xd9, 0xff }));
+    EXPECT_EQ(str_head(packer::msgpack, 0x100), bytes({ 0xda, 0x01, 0x00 }));
+    EXPECT_EQ(str_head(packer::msgpack, 0xffff), bytes({ 0xda, 0xff, 0xff }));
+    EXPECT_EQ(str_head(packer::msgpack, 0x10000), bytes({ 0xdb, 0x00, 0x01, 0x00, 0x00 }));
+}
+
+TEST_F(CidrPackerTest, MethodMsgpackUintBoundaries)
+{
+    EXPECT_EQ(uint(packer::msgpack, 0), bytes({ 0x00 }));
+    EXPECT_EQ(uint(packer::msgpack, 0x7f), bytes({ 0x7f }));
+    EXPECT_EQ(uint(packer::msgpack, 0x80), bytes({ 0xcc, 0x80 }));
+    EXPECT_EQ(uint(packer::msgpack, 0xff), bytes({ 0xcc, 0xff }));
+    EXPECT_EQ(uint(packer::msgpack, 0x100), bytes({ 0xcd, 0x01, 0x00 }));
+    EXPECT_EQ(uint(packer::msgpack, 0xffff), bytes({ 0xcd, 0xff, 0xff }));
+    EXPECT_EQ(uint(packer::msgpack, 0x10000), bytes({ 0xce, 0x00, 0x01, 0x00, 0x00 }));
+    EXPECT_EQ(uint(packer::msgpack, 0xffffffff), bytes({ 0xce, 0xff, 0xff, 0xff, 0xff }));
+    EXPECT_EQ(uint(packer::msgpack, 0x100000000),
+              bytes({ 0xcf, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00 }));
+}
+
+TEST_F(CidrPackerTest, MethodCborHeadBoundaries)
+{
+    // the same head rules for every major type; uint is major type 0
+    EXPECT_EQ(uint(packer::cbor, 0), bytes({ 0x00 }));
+    EXPECT_EQ(uint(packer::cbor, 23), bytes({ 0x17 }));
+    EXPECT_EQ(uint(packer::cbor, 24), bytes({ 0x18, 0x18 }));
+    EXPECT_EQ(uint(packer::cbor, 0xff), bytes({ 0x18, 0xff }));
+    EXPECT_EQ(uint(packer::cbor, 0x100), bytes({ 0x19, 0x01, 0x00 }));
+    EXPECT_EQ(uint(packer::cbor, 0xffff), bytes({ 0x19, 0xff, 0xff }));
+    EXPECT_EQ(uint(packer::cbor, 0x10000), bytes({ 0x1a, 0x00, 0x01, 0x00, 0x00 }));
+    EXPECT_EQ(uint(packer::cbor, 0xffffffff), bytes({ 0x1a, 0xff, 0xff, 0xff, 0xff }));
+    EXPECT_EQ(uint(packer::cbor, 0x100000000),
+              bytes({ 0x1b, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00 }));
+}
+
+TEST_F(CidrPackerTest, MethodCborMajorTypes)
+{
+    EXPECT_EQ(str_head(packer::cbor, 23), bytes({ 0x77 }));
+    EXPECT_EQ(str_head(packer::cbor, 24), bytes({ 0x78, 0x18 }));
+    EXPECT_EQ(str_head(packer::cbor, 0x100), bytes({ 0x79, 0x01, 0x00 }));
+    EXPECT_EQ(array(packer::cbor, 23), bytes({ 0x97 }));
+    EXPECT_EQ(array(packer::cbor, 24), bytes({ 0x98, 0x18 }));
+    EXPECT_EQ(array(packer::cbor, 0x10000), bytes({ 0x9a, 0x00, 0x01, 0x00, 0x00 }));
+    EXPECT_EQ(map(packer::cbor, 23), bytes({ 0xb7 }));
+    EXPECT_EQ(map(packer::cbor, 0xff), bytes({ 0xb8, 0xff }));
+    EXPECT_EQ(map(packer::cbor, 0xffff), bytes({ 0xb9, 0xff, 0xff }));
+}
+
+TEST_F(CidrPackerTest, MethodBooleanAndCidr)
+{
+    EXPECT_EQ(packed(packer::msgpack, [](packer &pack) { pack.boolean(true); pack.boolean(false); }),
+              bytes({ 0xc3, 0xc2 }));
+    EXPECT_EQ(packed(packer::cbor, [](packer &pack) { pack.boolean(true); pack.boolean(false); }),
+              bytes({ 0xf5, 0xf4 }));
+
+    // 85.143.160.0/21
+    EXPECT_EQ(packed(packer::msgpack, [](packer &pack) { pack.cidr(0x558fa000, 21); }),
+              bytes({ 0x92, 0xce, 0x55, 0x8f, 0xa0, 0x00, 0x15 }));
+    EXPECT_EQ(packed(packer::cbor, [](packer &pack) { pack.cidr(0x558fa000, 21); }),
+              bytes({ 0x82, 0x1a, 0x55, 0x8f, 0xa0, 0x00, 0x15 }));
+}
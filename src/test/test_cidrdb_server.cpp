@@ -0,0 +1,213 @@
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <thread>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "gtest/gtest.h"
+#include "cidr_db.hpp"
+#include "server.hpp"
+
+
+class CidrServerTest : public ::testing::Test
+{
+protected:
+    static const unsigned short port = 47321;
+
+    std::shared_ptr<cidr::db> db;
+    std::unique_ptr<http::server::server> server;
+    std::thread thread;
+
+    virtual ~CidrServerTest() { }
+
+    virtual void SetUp()
+    {
+        db = std::make_shared<cidr::db>();
+        db->put("10.0.0.0/8");
+        db->put("85.143.160.0/21");
+
+        server.reset(new http::server::server("127.0.0.1", std::to_string(port), db));
+    }
+
+    /** Start serving, once any listeners have been added. */
+    void start()
+    {
+        thread = std::thread([this] { server->run(); });
+    }
+
+    virtual void TearDown()
+    {
+        if (thread.joinable())
+        {
+            server->stop();
+            thread.join();
+        }
+
+        server.reset();
+    }
+
+    /** A Unix socket path of our own for listen_local(). */
+    static std::string local_path()
+    {
+        return "/tmp/cidrdb_test_server." + std::to_string(getpid()) + ".sock";
+    }
+
+    static int connect_local()
+    {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        local_path().copy(addr.sun_path, sizeof addr.sun_path - 1);
+        EXPECT_EQ(connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr), 0);
+        return fd;
+    }
+
+    static int connect_loopback()
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        EXPECT_EQ(connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr), 0);
+        return fd;
+    }
+
+    static void send_all(int fd, const std::string &data)
+    {
+        for (size_t sent = 0; sent < data.size(); )
+        {
+            ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            ASSERT_GT(n, 0);
+            sent += n;
+        }
+    }
+
+    /// Everything the server sends until it closes the connection.
+    static std::string read_all(int fd)
+    {
+        std::string in;
+        char buffer[65536];
+        ssize_t n;
+
+        while ((n = recv(fd, buffer, sizeof buffer, 0)) > 0)
+            in.append(buffer, n);
+
+        close(fd);
+        return in;
+    }
+
+    /// The body of a Batch-Lookup of the given lines, after checking it
+    /// was streamed.
+    static std::string batch_lookup(const std::string &accept, const std::string &lines)
+    {
+        int fd = connect_loopback();
+        send_all(fd, "POST / HTTP/1.0\r\nAccept: " + accept + "\r\nContent-Length: "
+                 + std::to_string(lines.size()) + "\r\n\r\n" + lines);
+        std::string reply(read_all(fd));
+
+        size_t body = reply.find("\r\n\r\n");
+        EXPECT_NE(body, std::string::npos);
+        EXPECT_EQ(reply.substr(0, body).find("Content-Length"), std::string::npos);
+        return reply.substr(body + 4);
+    }
+
+    static std::string get(const std::string &path)
+    {
+        int fd = connect_loopback();
+        send_all(fd, "GET " + path + " HTTP/1.0\r\nAccept: application/json\r\n\r\n");
+        return read_all(fd);
+    }
+
+    /// The value of a metric line in a /metrics scrape.
+    static double metric(const std::string &scrape, const std::string &name)
+    {
+        size_t at = scrape.find("\n" + name + " ");
+        return at == std::string::npos ? 0 : std::stod(scrape.substr(at + name.size() + 2));
+    }
+};
+
+TEST_F(CidrServerTest, MethodStreamedCsvQuoting)
+{
+    start();
+
+    std::string body(batch_lookup("text/csv",
+        "85.143.160.10\n"
+        "not,an\"ip\n"
+        "\n"
+        "a\"b\n"
+        "192.0.2.1\n"));
+
+    EXPECT_EQ(body,
+        "ip,valid,cidrs\n"
+        "85.143.160.10,true,85.143.160.0/21\n"
+        "\"not,an\"\"ip\",false,\n"
+        "\"a\"\"b\",false,\n"
+        "192.0.2.1,true,\n");
+}
+
+TEST_F(CidrServerTest, MethodStreamedNdjsonEscaping)
+{
+    start();
+
+    // a tab and other control characters are dropped, quotes and
+    // backslashes escaped, so each line parses on its own
+    std::string body(batch_lookup("application/x-ndjson",
+        "10.1.2.3\n"
+        "a\"b\\c\n"
+        "x\ty\x01z\x1f\n"));
+
+    EXPECT_EQ(body,
+        "{\"ip\":\"10.1.2.3\",\"valid\":true,\"cidrs\":[\"10.0.0.0/8\"]}\n"
+        "{\"ip\":\"a\\\"b\\\\c\",\"valid\":false,\"cidrs\":[]}\n"
+        "{\"ip\":\"xyz\",\"valid\":false,\"cidrs\":[]}\n");
+}
+
+TEST_F(CidrServerTest, MethodStreamedRequestTimed)
+{
+    start();
+
+    const std::string count("cidrdb_requests_total{op=\"Batch-Lookup\"}");
+    double before = metric(get("/metrics"), count);
+
+    // the request is recorded once the whole body has been produced
+    std::string lines;
+    for (int i = 0; i < 20000; i++)
+        lines += "85.143.160." + std::to_string(i % 256) + "\n";
+    std::string body(batch_lookup("application/x-ndjson", lines));
+    EXPECT_EQ(std::count(body.begin(), body.end(), '\n'), 20000);
+
+    EXPECT_EQ(metric(get("/metrics"), count), before + 1);
+}
+
+TEST_F(CidrServerTest, MethodLocalAllowedPeer)
+{
+    server->listen_local(local_path(), { getuid() });
+    start();
+
+    int fd = connect_local();
+    send_all(fd, "GET /85.143.160.10 HTTP/1.0\r\nAccept: application/json\r\n\r\n");
+    std::string reply(read_all(fd));
+
+    EXPECT_EQ(reply.compare(0, 17, "HTTP/1.0 200 OK\r\n"), 0) << reply;
+    EXPECT_NE(reply.find("85.143.160.0/21"), std::string::npos) << reply;
+}
+
+TEST_F(CidrServerTest, MethodLocalRefusedPeer)
+{
+    // SO_PEERCRED reports our own uid, which is not the one allowed
+    server->listen_local(local_path(), { getuid() + 12345 });
+    start();
+
+    for (int i = 0; i < 3; i++)
+    {
+        std::string reply(read_all(connect_local()));
+        EXPECT_EQ(reply.compare(0, 24, "HTTP/1.0 403 Forbidden\r\n"), 0) << reply;
+    }
+
+    // refusing a peer doesn't get in the way of the TCP listener
+    EXPECT_EQ(get("/metrics").compare(0, 17, "HTTP/1.0 200 OK\r\n"), 0);
+}
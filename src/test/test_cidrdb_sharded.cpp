@@ -0,0 +1,137 @@
+#include <thread>
+#include <boost/filesystem.hpp>
+#include "gtest/gtest.h"
+#include "cidr_db.hpp"
+#include "cidr_sharded_db.hpp"
+
+namespace fs = boost::filesystem;
+
+
+class CidrShardedDbTest : public ::testing::Test
+{
+protected:
+    fs::path dbfilename;
+
+    CidrShardedDbTest()
+    {
+        dbfilename = fs::path("/tmp/cidr_sharded.db");
+    }
+
+    virtual ~CidrShardedDbTest() { }
+
+    virtual void TearDown()
+    {
+        if (fs::exists(dbfilename))
+        {
+            fs::remove(dbfilename);
+        }
+    }
+};
+
+TEST_F(CidrShardedDbTest, MethodPutHasDelHas)
+{
+    cidr::sharded_db db(dbfilename);
+    EXPECT_EQ(db.shard_count(), 256U);
+    db.put("85.143.160.0/21");
+    db.put("10.0.0.0/7");
+    EXPECT_TRUE(db.has("85.143.160.0/21"));
+    EXPECT_TRUE(db.has("10.0.0.0/7"));
+    db.del("85.143.160.0/21");
+    db.del("10.0.0.0/7");
+    EXPECT_FALSE(db.has("85.143.160.0/21"));
+    EXPECT_FALSE(db.has("10.0.0.0/7"));
+}
+
+TEST_F(CidrShardedDbTest, MethodPutLookup)
+{
+    cidr::sharded_db db(dbfilename);
+    db.put("10.0.0.0/7");
+    db.put("11.0.0.0/8");
+    db.put("11.1.0.0/16");
+    std::vector<std::string> results;
+    db.lookup("11.1.2.3", results);
+    ASSERT_EQ(results.size(), 3U);
+    EXPECT_EQ(results[0], "11.1.0.0/16");
+    EXPECT_EQ(results[1], "11.0.0.0/8");
+    EXPECT_EQ(results[2], "10.0.0.0/7");
+}
+
+TEST_F(CidrShardedDbTest, MethodWithinAcrossShards)
+{
+    cidr::sharded_db db(dbfilename);
+    db.put("11.1.0.0/16");
+    db.put("10.0.0.0/7");
+    db.put("10.2.0.0/16");
+    db.put("8.0.0.0/6");
+    db.put("12.0.0.0/8");
+    std::vector<std::string> results;
+    db.within("8.0.0.0/6", results);
+    std::vector<std::string> expected = {
+        "8.0.0.0/6", "10.0.0.0/7", "10.2.0.0/16", "11.1.0.0/16"
+    };
+    EXPECT_EQ(results, expected);
+}
+
+TEST_F(CidrShardedDbTest, MethodCovering)
+{
+    cidr::sharded_db db(dbfilename);
+    db.put("10.0.0.0/7");
+    db.put("11.0.0.0/8");
+    db.put("11.1.0.0/16");
+    std::vector<std::string> results;
+    db.covering("11.1.2.0/24", results);
+    std::vector<std::string> expected = { "10.0.0.0/7", "11.0.0.0/8", "11.1.0.0/16" };
+    EXPECT_EQ(results, expected);
+}
+
+TEST_F(CidrShardedDbTest, MethodCommitMatchesDb)
+{
+    {
+        cidr::sharded_db db(dbfilename, 4);
+        db.put("85.143.160.0/21");
+        db.put("10.0.0.0/7");
+        db.put("192.0.2.1/32");
+        db.commit();
+    }
+
+    cidr::db plain(dbfilename);
+    EXPECT_TRUE(plain.has("85.143.160.0/21"));
+    EXPECT_TRUE(plain.has("10.0.0.0/7"));
+    EXPECT_TRUE(plain.has("192.0.2.1/32"));
+
+    cidr::sharded_db reread(dbfilename, 6);
+    EXPECT_TRUE(reread.has("85.143.160.0/21"));
+    EXPECT_TRUE(reread.has("10.0.0.0/7"));
+    EXPECT_TRUE(reread.has("192.0.2.1/32"));
+}
+
+TEST_F(CidrShardedDbTest, MethodConcurrentWriters)
+{
+    cidr::sharded_db db(dbfilename);
+    std::vector<std::thread> writers;
+
+    for (int t = 0; t < 4; t++)
+    {
+        writers.emplace_back([&db, t]()
+        {
+            for (int i = 0; i < 1000; i++)
+                db.put(std::to_string(t * 50 + 1) + "." + std::to_string(i % 256)
+                       + "." + std::to_string(i / 256) + ".0/24");
+        });
+    }
+
+    std::vector<std::string> results;
+    for (int i = 0; i < 1000; i++)
+    {
+        results.clear();
+        db.lookup("1.2.0.1", results);
+    }
+
+    for (auto &w : writers)
+        w.join();
+
+    for (int t = 0; t < 4; t++)
+        for (int i = 0; i < 1000; i++)
+            ASSERT_TRUE(db.has(std::to_string(t * 50 + 1) + "." + std::to_string(i % 256)
+                               + "." + std::to_string(i / 256) + ".0/24"));
+}
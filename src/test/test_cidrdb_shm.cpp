@@ -0,0 +1,164 @@
+#include <random>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "gtest/gtest.h"
+#include "cidr_db.hpp"
+#include "cidr_shm.hpp"
+#include "cidrdb_client.hpp"
+
+
+class CidrShmTest : public ::testing::Test
+{
+protected:
+    std::string name;
+
+    CidrShmTest()
+    {
+        name = "cidrdb_test_" + std::to_string(getpid());
+    }
+
+    virtual ~CidrShmTest() { }
+
+    virtual void TearDown()
+    {
+        // segments outlive the publisher by design
+        for (uint64_t generation = 0; generation < 8; generation++)
+            shm_unlink(cidr::shm::segment_name(name, generation).c_str());
+    }
+};
+
+TEST_F(CidrShmTest, MethodPublishLookup)
+{
+    cidr::db db;
+    std::mt19937 rng(7);
+
+    for (int i = 0; i < 5000; i++)
+    {
+        size_t length = 8 + rng() % 25;
+        struct in_addr in;
+        in.s_addr = htonl(rng() & ~(length == 32 ? 0 : 0xffffffffu >> length));
+        db.put(std::string(inet_ntoa(in)) + "/" + std::to_string(length));
+    }
+
+    cidr::shm::publisher publisher(name);
+    EXPECT_TRUE(publisher.publish(db));
+    EXPECT_FALSE(publisher.publish(db));
+
+    cidr::shm::client client(name);
+    EXPECT_EQ(client.generation(), publisher.generation());
+
+    for (uint32_t i = 0; i < 20000; i++)
+    {
+        in_addr_t ip_bits = i * 2654435761u;
+        uint8_t expected[32], actual[32];
+        size_t count = db.lookup(ip_bits, expected);
+        ASSERT_EQ(client.lookup(ip_bits, actual), count);
+        EXPECT_TRUE(std::equal(expected, expected + count, actual));
+    }
+}
+
+TEST_F(CidrShmTest, MethodRepublish)
+{
+    cidr::db db;
+    db.put("10.0.0.0/8");
+
+    cidr::shm::publisher publisher(name);
+    publisher.publish(db);
+
+    cidr::shm::client client(name);
+    uint8_t lengths[32];
+    EXPECT_EQ(client.lookup(inet_network("10.1.2.3"), lengths), 1U);
+
+    db.put("10.1.0.0/16");
+    db.del("10.0.0.0/8");
+    EXPECT_TRUE(publisher.publish(db));
+
+    ASSERT_EQ(client.lookup(inet_network("10.1.2.3"), lengths), 1U);
+    EXPECT_EQ(lengths[0], 16);
+    EXPECT_EQ(client.generation(), publisher.generation());
+    EXPECT_EQ(client.size(), 1U);
+
+    // a restarted publisher carries on the generation count
+    uint64_t before = publisher.generation();
+    {
+        cidr::shm::publisher restarted(name);
+        cidr::db replaced;
+        replaced.put("192.168.0.0/16");
+        restarted.publish(replaced);
+        EXPECT_EQ(restarted.generation(), before + 1);
+    }
+
+    EXPECT_EQ(client.lookup(inet_network("10.1.2.3"), lengths), 0U);
+    EXPECT_EQ(client.lookup(inet_network("192.168.1.1"), lengths), 1U);
+}
+
+TEST_F(CidrShmTest, MethodCaptureThenPublish)
+{
+    cidr::db db;
+    db.put("10.0.0.0/8");
+
+    cidr::shm::publisher publisher(name);
+    publisher.publish(db);
+
+    // changes made after a capture wait for the next one
+    db.put("10.1.0.0/16");
+    cidr::shm::snapshot changes(publisher.capture(db));
+    EXPECT_TRUE(changes.changed);
+    EXPECT_EQ(changes.rebuild, 1u << 16);
+    db.put("10.1.2.0/24");
+
+    EXPECT_TRUE(publisher.publish(changes));
+
+    cidr::shm::client client(name);
+    uint8_t lengths[32];
+    ASSERT_EQ(client.lookup(inet_network("10.1.2.3"), lengths), 2U);
+    EXPECT_EQ(lengths[0], 16);
+    EXPECT_EQ(client.size(), 2U);
+
+    EXPECT_TRUE(publisher.publish(publisher.capture(db)));
+    EXPECT_EQ(client.lookup(inet_network("10.1.2.3"), lengths), 3U);
+    EXPECT_FALSE(publisher.capture(db).changed);
+}
+
+TEST_F(CidrShmTest, MethodPublishFailure)
+{
+    cidr::db db;
+    db.put("10.0.0.0/8");
+
+    cidr::shm::publisher publisher(name);
+    publisher.publish(db);
+
+    // a file size limit makes the next segment fail to resize
+    db.put("10.1.0.0/16");
+    cidr::shm::snapshot changes(publisher.capture(db));
+
+    rlimit limit;
+    getrlimit(RLIMIT_FSIZE, &limit);
+    rlimit small = { 64, limit.rlim_max };
+    sighandler_t previous = signal(SIGXFSZ, SIG_IGN);
+    setrlimit(RLIMIT_FSIZE, &small);
+    EXPECT_THROW(publisher.publish(changes), std::runtime_error);
+    setrlimit(RLIMIT_FSIZE, &limit);
+    signal(SIGXFSZ, previous);
+
+    // the /16 was never published, so the next capture still has it
+    changes = publisher.capture(db);
+    EXPECT_TRUE(changes.changed);
+    EXPECT_EQ(changes.rebuild, 1u << 16);
+    EXPECT_TRUE(publisher.publish(changes));
+
+    cidr::shm::client client(name);
+    uint8_t lengths[32];
+    ASSERT_EQ(client.lookup(inet_network("10.1.2.3"), lengths), 2U);
+    EXPECT_EQ(lengths[0], 16);
+}
+
+TEST_F(CidrShmTest, MethodUnpublished)
+{
+    EXPECT_THROW(cidr::shm::client client(name), std::runtime_error);
+
+    cidr::shm::publisher publisher(name);
+    EXPECT_THROW(cidr::shm::client client(name), std::runtime_error);
+}
@@ -0,0 +1,83 @@
+#include <fstream>
+#include <sstream>
+#include <boost/filesystem.hpp>
+#include "gtest/gtest.h"
+#include "cidr_db.hpp"
+#include "cidr_stream.hpp"
+
+
+TEST(CidrStreamTest, MethodLookupKeepsOrder)
+{
+    cidr::db db;
+    db.put("10.0.0.0/8");
+    db.put("10.1.0.0/16");
+    db.put("192.0.2.0/24");
+
+    std::stringstream in, expected;
+    for (size_t i = 0; i < 5000; i++)
+    {
+        std::string ip("10." + std::to_string(i % 3) + ".0." + std::to_string(i % 250));
+        in << ip << "\n";
+        expected << ip << "\t" << (i % 3 == 1 ? "10.1.0.0/16,10.0.0.0/8" : "10.0.0.0/8") << "\n";
+    }
+    in << "192.0.2.7\r\n\nnot-an-ip\n198.51.100.1";
+    expected << "192.0.2.7\t192.0.2.0/24\nnot-an-ip\t\n198.51.100.1\t\n";
+
+    // small blocks so lines straddle reads and many jobs are in flight
+    cidr::stream::options opts;
+    opts.threads = 4;
+    opts.block_bytes = 100;
+
+    std::stringstream out;
+    EXPECT_EQ(cidr::stream::lookup(db, in, out, opts), in.str().size());
+    EXPECT_EQ(out.str(), expected.str());
+}
+
+TEST(CidrStreamTest, MethodOrderedPoolRethrows)
+{
+    std::stringstream out;
+    cidr::stream::ordered_pool pool(2, out);
+    pool.submit([](std::string &result) { result = "a"; });
+    pool.submit([](std::string &) { throw std::runtime_error("job failed"); });
+    pool.submit([](std::string &result) { result = "c"; });
+    EXPECT_THROW(pool.finish(), std::runtime_error);
+    EXPECT_EQ(out.str(), "a");
+}
+
+TEST(CidrStreamTest, MethodJoin)
+{
+    cidr::db db;
+    db.put("10.0.0.0/8");
+    db.put("10.1.0.0/16");
+
+    std::string input;
+    std::string expected;
+    for (size_t i = 0; i < 2000; i++)
+    {
+        std::string line("GET\t10." + std::to_string(i % 2) + ".2.3\t" + std::to_string(i));
+        input += line + "\n";
+        expected += line + (i % 2 ? "\t10.1.0.0/16 10.0.0.0/8\n" : "\t10.0.0.0/8\n");
+    }
+    input += "GET\t\"192.0.2.1\"\t1\r\nshort\n\n";
+    expected += "GET\t\"192.0.2.1\"\t1\t\nshort\t\n\n";
+
+    cidr::stream::join_options join;
+    join.field = 2;
+    join.delimiter = '\t';
+
+    cidr::stream::options opts;
+    opts.threads = 3;
+    opts.block_bytes = 64;
+
+    std::stringstream in(input), out;
+    EXPECT_EQ(cidr::stream::join(db, in, out, join, opts), input.size());
+    EXPECT_EQ(out.str(), expected);
+
+    boost::filesystem::path path("/tmp/cidr_stream_join.tsv");
+    std::ofstream(path.c_str()) << input;
+
+    std::stringstream mapped;
+    EXPECT_EQ(cidr::stream::join(db, path, mapped, join, opts), input.size());
+    EXPECT_EQ(mapped.str(), expected);
+    boost::filesystem::remove(path);
+}
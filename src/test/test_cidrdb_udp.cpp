@@ -0,0 +1,121 @@
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include "gtest/gtest.h"
+#include "cidr_db.hpp"
+#include "udp_lookup.hpp"
+
+using http::server::udp_lookup;
+
+
+class CidrUdpTest : public ::testing::Test
+{
+protected:
+    cidr::db db;
+    std::vector<char> reply;
+
+    CidrUdpTest()
+        : reply(udp_lookup::max_reply_size)
+    {
+        db.put("10.0.0.0/8");
+        db.put("10.1.0.0/16");
+        db.put("10.1.2.0/24");
+        db.put("85.143.160.0/21");
+    }
+
+    virtual ~CidrUdpTest() { }
+
+    /// A request datagram with the given ID and addresses.
+    static std::string request(std::uint32_t id, const std::vector<std::string> &addresses)
+    {
+        std::string out(4, '\0');
+        std::memcpy(&out[0], &id, 4);
+
+        for (const std::string &address : addresses)
+        {
+            in_addr_t bits = inet_addr(address.c_str());
+            out.append(reinterpret_cast<const char*>(&bits), 4);
+        }
+
+        return out;
+    }
+
+    size_t answer(const std::string &datagram)
+    {
+        return udp_lookup::answer(db, datagram.data(), datagram.size(), reply.data());
+    }
+
+    std::string answered(size_t size) const
+    {
+        return std::string(reply.data(), size);
+    }
+};
+
+TEST_F(CidrUdpTest, MethodAnswerEchoesId)
+{
+    std::string datagram(request(0xdeadbeef, { "10.1.2.3" }));
+
+    size_t size = answer(datagram);
+    ASSERT_GE(size, 4U);
+    EXPECT_EQ(std::memcmp(reply.data(), datagram.data(), 4), 0);
+}
+
+TEST_F(CidrUdpTest, MethodAnswerLayout)
+{
+    size_t size = answer(request(7, { "10.1.2.3", "192.0.2.1", "85.143.161.1", "10.200.0.1" }));
+
+    // per address, in request order: a count byte, then the prefix lengths
+    // of the matching networks, longest first
+    std::string expected(request(7, {}));
+    expected += std::string("\x03\x18\x10\x08", 4);
+    expected += std::string("\x00", 1);
+    expected += std::string("\x01\x15", 2);
+    expected += std::string("\x01\x08", 2);
+
+    EXPECT_EQ(answered(size), expected);
+}
+
+TEST_F(CidrUdpTest, MethodAnswerIdOnly)
+{
+    std::string datagram(request(42, {}));
+
+    EXPECT_EQ(answer(datagram), 4U);
+    EXPECT_EQ(answered(4), datagram);
+}
+
+TEST_F(CidrUdpTest, MethodAnswerRejectsPartialAddress)
+{
+    std::string datagram(request(1, { "10.1.2.3" }));
+
+    for (size_t size = 0; size < 4; size++)
+        EXPECT_EQ(udp_lookup::answer(db, datagram.data(), size, reply.data()), 0U) << size;
+
+    for (size_t size = 5; size < 8; size++)
+        EXPECT_EQ(udp_lookup::answer(db, datagram.data(), size, reply.data()), 0U) << size;
+
+    EXPECT_EQ(answer(datagram + "\x0a"), 0U);
+}
+
+TEST_F(CidrUdpTest, MethodAnswerRequestSizeLimit)
+{
+    // the worst case: every address is covered by a network of every length
+    for (int length = 1; length <= 32; length++)
+    {
+        in_addr network = { htonl(0x0a010203U & (0xffffffffU << (32 - length))) };
+        db.put(std::string(inet_ntoa(network)) + "/" + std::to_string(length));
+    }
+
+    std::vector<std::string> addresses(udp_lookup::max_addresses, "10.1.2.3");
+    std::string datagram(request(9, addresses));
+    ASSERT_EQ(datagram.size(), udp_lookup::max_request_size);
+
+    // 33 bytes per 4-byte address still fits max_reply_size
+    size_t size = answer(datagram);
+    EXPECT_EQ(size, udp_lookup::max_reply_size);
+    EXPECT_EQ(static_cast<uint8_t>(reply[4]), 32U);
+
+    addresses.push_back("10.1.2.3");
+    EXPECT_EQ(answer(request(9, addresses)), 0U);
+}
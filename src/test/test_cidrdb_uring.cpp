@@ -0,0 +1,187 @@
+#include <memory>
+#include <string>
+#include <thread>
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "gtest/gtest.h"
+#include "cidr_db.hpp"
+#include "uring_server.hpp"
+
+
+class CidrUringTest : public ::testing::Test
+{
+protected:
+    static const unsigned short port = 47311;
+
+    std::shared_ptr<cidr::db> db;
+    std::unique_ptr<http::server::uring_server> server;
+    std::thread thread;
+
+    virtual ~CidrUringTest() { }
+
+    virtual void SetUp()
+    {
+        db = std::make_shared<cidr::db>();
+        db->put("10.0.0.0/8");
+        db->put("85.143.160.0/21");
+
+        try
+        {
+            server.reset(new http::server::uring_server("127.0.0.1",
+                std::to_string(port), db));
+        }
+        catch (const std::runtime_error &e)
+        {
+            GTEST_SKIP() << e.what();
+        }
+
+        thread = std::thread([this] { server->run(); });
+    }
+
+    virtual void TearDown()
+    {
+        if (!server)
+            return;
+
+        server->stop();
+        thread.join();
+        server.reset();
+    }
+
+    static int connect_loopback()
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        EXPECT_EQ(connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr), 0);
+        return fd;
+    }
+
+    static void send_all(int fd, const std::string &data)
+    {
+        for (size_t sent = 0; sent < data.size(); )
+        {
+            ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            ASSERT_GT(n, 0);
+            sent += n;
+        }
+    }
+
+    /// Everything the server sends until it closes the connection.
+    static std::string read_all(int fd)
+    {
+        std::string in;
+        char buffer[65536];
+        ssize_t n;
+
+        while ((n = recv(fd, buffer, sizeof buffer, 0)) > 0)
+            in.append(buffer, n);
+
+        close(fd);
+        return in;
+    }
+
+    static size_t count(const std::string &haystack, const std::string &needle)
+    {
+        size_t found = 0;
+        for (size_t at = haystack.find(needle); at != std::string::npos;
+             at = haystack.find(needle, at + 1))
+            found++;
+        return found;
+    }
+
+    static size_t open_fds()
+    {
+        size_t fds = 0;
+        DIR *dir = opendir("/proc/self/fd");
+        while (readdir(dir) != nullptr)
+            fds++;
+        closedir(dir);
+        return fds;
+    }
+
+    static std::string batch_lookup(const std::string &accept, size_t addresses)
+    {
+        std::string body;
+        for (size_t i = 0; i < addresses; i++)
+            body += (i % 2 ? "85.143.160." : "192.0.2.") + std::to_string(i % 256) + "\n";
+
+        return "POST / HTTP/1.1\r\nAccept: " + accept
+            + "\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+    }
+};
+
+TEST_F(CidrUringTest, MethodPipelinedKeepAlive)
+{
+    std::string lookup("GET /85.143.160.10 HTTP/1.1\r\nAccept: application/json\r\n");
+    std::string requests;
+    for (int i = 0; i < 20; i++)
+        requests += lookup + "Connection: keep-alive\r\n\r\n";
+    requests += lookup + "\r\n";
+
+    // every request in one segment; the replies come back in order on the
+    // same connection, which closes after the last one
+    int fd = connect_loopback();
+    send_all(fd, requests);
+    std::string replies(read_all(fd));
+
+    EXPECT_EQ(count(replies, "HTTP/1.0 200 OK\r\n"), 21U);
+    EXPECT_EQ(count(replies, "Connection: keep-alive\r\n"), 20U);
+    EXPECT_EQ(count(replies, "\"85.143.160.0/21\""), 21U);
+}
+
+TEST_F(CidrUringTest, MethodStreamedNdjson)
+{
+    const size_t addresses = 20000;
+
+    int fd = connect_loopback();
+    send_all(fd, batch_lookup("application/x-ndjson", addresses));
+    std::string reply(read_all(fd));
+
+    size_t body = reply.find("\r\n\r\n");
+    ASSERT_NE(body, std::string::npos);
+    std::string headers(reply.substr(0, body));
+    EXPECT_EQ(headers.find("Content-Length"), std::string::npos);
+    EXPECT_NE(headers.find("Content-Type: application/x-ndjson"), std::string::npos);
+
+    std::string lines(reply.substr(body + 4));
+    EXPECT_EQ(count(lines, "\n"), addresses);
+    EXPECT_EQ(count(lines, "\"cidrs\":[\"85.143.160.0/21\"]"), addresses / 2);
+    EXPECT_EQ(lines.substr(0, lines.find('\n')),
+              "{\"ip\":\"192.0.2.0\",\"valid\":true,\"cidrs\":[]}");
+}
+
+TEST_F(CidrUringTest, MethodPeerCloseDuringSend)
+{
+    size_t fds = open_fds();
+
+    for (const char *accept : { "application/json", "application/x-ndjson" })
+    {
+        int fd = connect_loopback();
+        int small = 4096;
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &small, sizeof small);
+        send_all(fd, batch_lookup(accept, 200000));
+
+        // take the start of a reply far larger than the socket buffers,
+        // then reset the connection with the rest still being sent
+        char buffer[1024];
+        ASSERT_GT(recv(fd, buffer, sizeof buffer, 0), 0);
+        linger reset = { 1, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &reset, sizeof reset);
+        close(fd);
+    }
+
+    // the server releases both connections and carries on
+    for (int i = 0; i < 200 && open_fds() > fds; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_EQ(open_fds(), fds);
+
+    int fd = connect_loopback();
+    send_all(fd, "GET /10.1.2.3 HTTP/1.0\r\nAccept: application/json\r\n\r\n");
+    EXPECT_NE(read_all(fd).find("\"10.0.0.0/8\""), std::string::npos);
+}
@@ -0,0 +1,309 @@
+#include <iostream>
+#include <sstream>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "trace.hpp"
+
+
+namespace cidr
+{
+    namespace trace
+    {
+        std::atomic<int> current_level(off);
+
+        namespace
+        {
+            const size_t capacity = 1 << 14;
+
+            const char *level_names[] = { "off", "error", "info", "debug", "verbose" };
+
+            struct record
+            {
+                std::atomic<size_t> sequence;
+                int level;
+                const char *event;
+                std::uint64_t a;
+                std::uint64_t b;
+                std::uint64_t when;
+            };
+
+            /**
+             * Bounded multi-producer ring buffer. Each slot carries a
+             * sequence number telling producers and the consumer whose turn
+             * it is, so pushing is a single compare-and-swap on the head.
+             */
+            class ring
+            {
+            public:
+                ring() : head(0), tail(0)
+                {
+                    for (size_t i = 0; i < capacity; i++)
+                        slots[i].sequence.store(i, std::memory_order_relaxed);
+                }
+
+                bool push(int lvl, const char *event,
+                          std::uint64_t a, std::uint64_t b, std::uint64_t when)
+                {
+                    size_t pos = head.load(std::memory_order_relaxed);
+
+                    for (;;)
+                    {
+                        record &slot = slots[pos & (capacity - 1)];
+                        size_t seq = slot.sequence.load(std::memory_order_acquire);
+                        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+                        if (diff == 0)
+                        {
+                            if (head.compare_exchange_weak(pos, pos + 1,
+                                    std::memory_order_relaxed))
+                            {
+                                slot.level = lvl;
+                                slot.event = event;
+                                slot.a = a;
+                                slot.b = b;
+                                slot.when = when;
+                                slot.sequence.store(pos + 1, std::memory_order_release);
+                                return true;
+                            }
+                        }
+                        else if (diff < 0)
+                        {
+                            return false;  // full
+                        }
+                        else
+                        {
+                            pos = head.load(std::memory_order_relaxed);
+                        }
+                    }
+                }
+
+                /**
+                 * Pop one record; only ever called by a single consumer.
+                 */
+                bool pop(record &out)
+                {
+                    record &slot = slots[tail & (capacity - 1)];
+                    size_t seq = slot.sequence.load(std::memory_order_acquire);
+
+                    if (seq != tail + 1)
+                        return false;
+
+                    out.level = slot.level;
+                    out.event = slot.event;
+                    out.a = slot.a;
+                    out.b = slot.b;
+                    out.when = slot.when;
+
+                    slot.sequence.store(tail + capacity, std::memory_order_release);
+                    tail++;
+                    return true;
+                }
+
+            private:
+                record slots[capacity];
+                alignas(64) std::atomic<size_t> head;
+                alignas(64) size_t tail;
+            };
+
+            /**
+             * Owns the ring buffer and the background thread draining it.
+             */
+            class drainer
+            {
+            public:
+                ring buffer;
+                std::atomic<std::uint32_t> sample_every;
+                std::atomic<std::uint64_t> dropped;
+
+                drainer() : sample_every(1), dropped(0), stopping(false) { }
+
+                ~drainer()
+                {
+                    {
+                        std::lock_guard<std::mutex> lock(wake_mutex);
+                        stopping = true;
+                    }
+                    wake.notify_all();
+
+                    if (worker.joinable())
+                        worker.join();
+
+                    drain();
+                }
+
+                void start()
+                {
+                    std::call_once(started, [this]()
+                    {
+                        worker = std::thread(&drainer::run, this);
+                    });
+                }
+
+                void drain()
+                {
+                    std::lock_guard<std::mutex> lock(consumer_mutex);
+
+                    std::ostringstream out;
+                    record r;
+                    size_t count = 0;
+
+                    while (buffer.pop(r))
+                    {
+                        out << r.when / 1000000 << "."
+                            << std::to_string(1000000 + r.when % 1000000).substr(1)
+                            << " " << level_names[r.level]
+                            << " " << r.event << ": "
+                            << r.a << "/" << r.b
+                            << "\n";
+                        count++;
+                    }
+
+                    if (count > 0)
+                    {
+                        std::cerr << out.str();
+                        std::cerr.flush();
+                    }
+                }
+
+            private:
+                std::once_flag started;
+                std::thread worker;
+                std::mutex consumer_mutex;
+                std::mutex wake_mutex;
+                std::condition_variable wake;
+                bool stopping;
+
+                void run()
+                {
+                    std::unique_lock<std::mutex> lock(wake_mutex);
+
+                    while (!stopping)
+                    {
+                        wake.wait_for(lock, std::chrono::milliseconds(10));
+                        lock.unlock();
+                        drain();
+                        lock.lock();
+                    }
+                }
+            };
+
+            drainer &instance()
+            {
+                static drainer d;
+                return d;
+            }
+        }
+
+        /**
+         * Copy a trace event into the ring buffer, honouring the sampling
+         * rate. Events are dropped, and counted, when the buffer is full.
+         *
+         * @param int trace level of the event
+         * @param const char* static event name
+         * @param uint64_t first value
+         * @param uint64_t second value
+         */
+        void emit(int lvl, const char *event, std::uint64_t a, std::uint64_t b)
+        {
+            static thread_local std::uint32_t counter = 0;
+
+            drainer &d = instance();
+            std::uint32_t every = d.sample_every.load(std::memory_order_relaxed);
+
+            if (every > 1 && ++counter % every != 0)
+                return;
+
+            std::uint64_t when = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+
+            if (!d.buffer.push(lvl, event, a, b, when))
+                d.dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /**
+         * Set the runtime trace level and sampling rate, starting the
+         * background drain thread the first time tracing is switched on.
+         *
+         * @param int trace level, clamped to CIDR_TRACE_LEVEL
+         * @param uint32_t record one in every N events
+         */
+        void configure(int lvl, std::uint32_t sample_every)
+        {
+            if (lvl > CIDR_TRACE_LEVEL) lvl = CIDR_TRACE_LEVEL;
+            if (lvl < off) lvl = off;
+
+            drainer &d = instance();
+            d.sample_every.store(sample_every > 0 ? sample_every : 1);
+
+            if (lvl > off)
+                d.start();
+
+            current_level.store(lvl, std::memory_order_relaxed);
+        }
+
+        /**
+         * Configure tracing from CIDR_TRACE (level name or number) and
+         * CIDR_TRACE_SAMPLE. A set DEBUG variable still turns on verbose
+         * tracing for compatibility.
+         */
+        void configure_from_env()
+        {
+            int lvl = std::getenv("DEBUG") ? verbose : off;
+            std::uint32_t sample_every = 1;
+
+            if (const char *name = std::getenv("CIDR_TRACE"))
+            {
+                lvl = std::atoi(name);
+
+                for (int i = off; i <= verbose; i++)
+                {
+                    if (std::strcmp(name, level_names[i]) == 0)
+                        lvl = i;
+                }
+            }
+
+            if (const char *every = std::getenv("CIDR_TRACE_SAMPLE"))
+                sample_every = std::strtoul(every, nullptr, 10);
+
+            configure(lvl, sample_every);
+        }
+
+        /**
+         * Step the runtime trace level up by one, wrapping back to off.
+         *
+         * @return int the new trace level
+         */
+        int raise_level()
+        {
+            int lvl = current_level.load(std::memory_order_relaxed) + 1;
+
+            if (lvl > CIDR_TRACE_LEVEL)
+                lvl = off;
+
+            configure(lvl, instance().sample_every.load());
+
+            return lvl;
+        }
+
+        /**
+         * Synchronously write out everything buffered so far.
+         */
+        void flush()
+        {
+            instance().drain();
+        }
+
+        /**
+         * @return uint64_t number of events lost to a full ring buffer
+         */
+        std::uint64_t dropped()
+        {
+            return instance().dropped.load(std::memory_order_relaxed);
+        }
+    }
+}
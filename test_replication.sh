@@ -0,0 +1,139 @@
+#!/bin/bash
+#
+# This script demonstrates leader/follower replication on loopback: one
+# leader, two followers (one of which joins late and catches up from a
+# snapshot), and a follower that restarts after missing some mutations.
+#
+cd "$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+
+REST="${REST:-build/bin/cidrdb_rest}"
+CIDR_LIST="data/sample-cidrs.list"
+WORK_DIR="$(mktemp -d)"
+PIDS=()
+LAST_PID=
+
+
+function start()
+{
+    $REST "$@" >/dev/null 2>&1 &
+    LAST_PID=$!
+    PIDS+=($!)
+}
+
+function stop_all()
+{
+    for pid in "${PIDS[@]}"; do kill $pid 2>/dev/null; done
+    wait 2>/dev/null
+    rm -rf "$WORK_DIR"
+}
+
+function rest()
+{
+    local port="$1"
+    local method="$2"
+    local path="$3"
+
+    curl -s                                 \
+         -X $method                         \
+         -H 'Accept: application/json'      \
+         "http://127.0.0.1:${port}${path}"
+}
+
+function check()
+{
+    local description="$1"
+    shift
+
+    if "$@"
+    then
+        echo -en "\e[32;1mOK\e[0m "
+    else
+        echo -en "\e[31;1mFAIL\e[0m "
+    fi
+
+    echo "$description"
+}
+
+# wait until every CIDR in the list is (or is not) present on a port
+function converged()
+{
+    local port="$1"
+    local expect="$2"
+
+    for attempt in $(seq 50)
+    do
+        local ok=1
+
+        for cidr in $(cat $CIDR_LIST)
+        do
+            if [[ ! $(rest $port GET "/$cidr") =~ "\"present\":$expect" ]]
+            then
+                ok=0 && break
+            fi
+        done
+
+        [[ $ok -eq 1 ]] && return 0
+        sleep 0.1
+    done
+
+    return 1
+}
+
+function lag_zero()
+{
+    [[ $(rest $1 GET "/metrics") =~ "cidrdb_replication_lag 0" ]]
+}
+
+function run()
+{
+    for file in $REST $CIDR_LIST
+    do
+        if [[ ! -f $file ]]
+        then
+            echo "No such file: $file" >&2 && exit 1
+        fi
+    done
+
+    trap stop_all EXIT
+
+    >$WORK_DIR/leader.db
+
+    start 127.0.0.1 8180 $WORK_DIR/leader.db --replicate-port 8190
+    start 127.0.0.1 8181 $WORK_DIR/follower1.db --follow 127.0.0.1:8190
+    local follower1=$LAST_PID
+    sleep 0.5
+
+    for cidr in $(cat $CIDR_LIST)
+    do
+        rest 8180 PUT "/$cidr" >/dev/null
+    done
+
+    check "follower 1 received every PUT" converged 8181 true
+    check "follower 1 reports no lag" lag_zero 8181
+
+    check "follower 1 refuses PUT" \
+        test "$(curl -s -o /dev/null -w '%{http_code}' -X PUT \
+                -H 'Accept: application/json' \
+                http://127.0.0.1:8181/$(head -1 $CIDR_LIST))" = 403
+
+    start 127.0.0.1 8182 $WORK_DIR/follower2.db --follow 127.0.0.1:8190
+    check "follower 2 caught up from a snapshot" converged 8182 true
+
+    kill $follower1 && wait $follower1 2>/dev/null
+
+    for cidr in $(cat $CIDR_LIST)
+    do
+        rest 8180 DELETE "/$cidr" >/dev/null
+    done
+
+    check "follower 2 received every DELETE" converged 8182 false
+
+    start 127.0.0.1 8181 $WORK_DIR/follower1.db --follow 127.0.0.1:8190
+    check "restarted follower 1 caught up on the DELETEs" converged 8181 false
+
+    check "followers are counted on the leader" \
+        eval '[[ $(rest 8180 GET "/metrics") =~ "cidrdb_replication_followers 2" ]]'
+}
+
+
+if [[ $(caller | awk '{print $1}') -eq 0 ]]; then run "$@"; fi
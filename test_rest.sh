@@ -106,6 +106,17 @@ function run()
         printf "%14s \u2209 %15s\n" $ip $cidr
     done
 
+    local adds=$(grep -c . $CIDR_LIST)
+
+    if [[ $(rest GET "/metrics") =~ "cidrdb_requests_total{op=\"Add\"} ${adds}" ]]
+    then
+        echo -en "\e[32;1mOK\e[0m "
+    else
+        echo -en "\e[31;1mFAIL\e[0m "
+    fi
+
+    printf "%14s metrics counted %d adds\n" "" $adds
+
     stop_rest_service
 }
 